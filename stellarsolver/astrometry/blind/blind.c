@@ -209,6 +209,7 @@ static size_t n_indexes(blind_t* bp) {
 
 void blind_clear_verify_wcses(blind_t* bp) {
     bl_remove_all(bp->verify_wcs_list);
+    dl_remove_all(bp->verify_wcs_offsets); //# Added for the StellarSolver Internal Library
 }
 
 void blind_clear_solutions(blind_t* bp) {
@@ -293,7 +294,13 @@ void blind_add_loaded_index(blind_t* bp, index_t* ind) {
 }
 
 void blind_add_verify_wcs(blind_t* bp, sip_t* wcs) {
+    blind_add_verify_wcs_near(bp, wcs, 0.0); //# Modified for the StellarSolver Internal Library
+}
+
+//# Added for the StellarSolver Internal Library
+void blind_add_verify_wcs_near(blind_t* bp, sip_t* wcs, double offset) {
     bl_append(bp->verify_wcs_list, wcs);
+    dl_append(bp->verify_wcs_offsets, offset);
 }
 
 void blind_add_field(blind_t* bp, int field) {
@@ -307,9 +314,137 @@ void blind_add_field_range(blind_t* bp, int lo, int hi) {
     }
 }
 
+//# Added for the StellarSolver Internal Library
+// Sets "cancelled" once the cancel callback says the run was cancelled.
+static anbool is_cancelled(blind_t* bp) {
+    if (!bp->cancelled && bp->cancel_callback && bp->cancel_callback(bp->cancel_userdata))
+        bp->cancelled = TRUE;
+    return bp->cancelled;
+}
+
+//# Added for the StellarSolver Internal Library
+// The brightest field and index stars compared by shift_verify_wcs(), and how
+// many of them have to agree on the shift.
+#define SHIFT_FIELD_STARS 50
+#define SHIFT_INDEX_STARS 50
+#define SHIFT_MIN_MATCHES 6
+
+//# Added for the StellarSolver Internal Library
+// A WCS that may be off by up to "offset" pixels, like a field that has drifted
+// since it was last solved, is too far off to verify.  Every pair of a bright
+// field star and a bright index star votes for the shift between them, and the
+// shift with the most votes moves the WCS to "shifted".  Returns FALSE if too
+// few stars agree on it.
+static anbool shift_verify_wcs(blind_t* bp, index_t* index, const sip_t* wcs,
+                               double offset, sip_t* shifted) {
+    solver_t* sp = &(bp->solver);
+    sip_t grown;
+    double center[3];
+    double fieldr2;
+    double* indexpix = NULL;
+    int NI = 0, NF;
+    double bin;
+    int nbins, i, j, k;
+    int* votes;
+    int best = 0, bestbin = 0;
+    double sumx = 0.0, sumy = 0.0;
+    int nsum = 0;
+
+    if (!sp->fieldxy || !index->starkd)
+        return FALSE;
+    NF = MIN(starxy_n(sp->fieldxy), SHIFT_FIELD_STARS);
+
+    // The index stars that can be moved into the field are those up to "offset" outside of it.
+    memcpy(&grown, wcs, sizeof(sip_t));
+    grown.wcstan.imagew += 2.0 * offset;
+    grown.wcstan.imageh += 2.0 * offset;
+    grown.wcstan.crpix[0] += offset;
+    grown.wcstan.crpix[1] += offset;
+    sip_pixelxy2xyzarr(&grown, 0.5 * grown.wcstan.imagew, 0.5 * grown.wcstan.imageh, center);
+    fieldr2 = arcsec2distsq(sip_pixel_scale(&grown) * 0.5 *
+                            hypot(grown.wcstan.imagew, grown.wcstan.imageh));
+    // These are sorted brightest first.
+    verify_get_index_stars(center, fieldr2, index->starkd, &grown, NULL,
+                           grown.wcstan.imagew, grown.wcstan.imageh,
+                           NULL, &indexpix, NULL, &NI);
+    NI = MIN(NI, SHIFT_INDEX_STARS);
+    if (NI < SHIFT_MIN_MATCHES || NF < SHIFT_MIN_MATCHES) {
+        free(indexpix);
+        return FALSE;
+    }
+
+    // The votes are counted in bins about as wide as the verification
+    // tolerance, and the best shift is the one with the most votes in the
+    // bins around it, since a shift between two bins is split between them.
+    bin = MAX(2.0 * sp->verify_pix, 1.0);
+    nbins = (int)ceil(2.0 * offset / bin) + 1;
+    votes = calloc((size_t)nbins * nbins, sizeof(int));
+    if (!votes) {
+        free(indexpix);
+        return FALSE;
+    }
+    for (i=0; i<NF; i++) {
+        double fx = starxy_getx(sp->fieldxy, i);
+        double fy = starxy_gety(sp->fieldxy, i);
+        for (j=0; j<NI; j++) {
+            double dx = fx - (indexpix[2*j] - offset);
+            double dy = fy - (indexpix[2*j+1] - offset);
+            int bx = (int)floor((dx + offset) / bin);
+            int by = (int)floor((dy + offset) / bin);
+            if (bx < 0 || by < 0 || bx >= nbins || by >= nbins)
+                continue;
+            votes[by * nbins + bx]++;
+        }
+    }
+    for (k=0; k<nbins*nbins; k++) {
+        int bx = k % nbins, by = k / nbins;
+        int sum = 0, x, y;
+        if (!votes[k])
+            continue;
+        for (y=MAX(by-1, 0); y<=MIN(by+1, nbins-1); y++)
+            for (x=MAX(bx-1, 0); x<=MIN(bx+1, nbins-1); x++)
+                sum += votes[y * nbins + x];
+        if (sum > best) {
+            best = sum;
+            bestbin = k;
+        }
+    }
+    free(votes);
+    if (best < SHIFT_MIN_MATCHES) {
+        free(indexpix);
+        return FALSE;
+    }
+
+    // The shift is the average of the pairs that voted for it.
+    for (i=0; i<NF; i++) {
+        double fx = starxy_getx(sp->fieldxy, i);
+        double fy = starxy_gety(sp->fieldxy, i);
+        for (j=0; j<NI; j++) {
+            double dx = fx - (indexpix[2*j] - offset);
+            double dy = fy - (indexpix[2*j+1] - offset);
+            int bx = (int)floor((dx + offset) / bin);
+            int by = (int)floor((dy + offset) / bin);
+            if (abs(bx - bestbin % nbins) > 1 || abs(by - bestbin / nbins) > 1)
+                continue;
+            sumx += dx;
+            sumy += dy;
+            nsum++;
+        }
+    }
+    free(indexpix);
+
+    memcpy(shifted, wcs, sizeof(sip_t));
+    shifted->wcstan.crpix[0] += sumx / nsum;
+    shifted->wcstan.crpix[1] += sumy / nsum;
+    logmsg("Moved the WCS by (%.1f, %.1f) pixels, where %i stars line up\n",
+           sumx / nsum, sumy / nsum, best);
+    return TRUE;
+}
+
 static void check_time_limits(blind_t* bp) {
-    if (bp->total_timelimit || bp->timelimit) {
-        double now = timenow();
+    //# Modified for the StellarSolver Internal Library to use the monotonic clock and check the deadline
+    if (bp->total_timelimit || bp->timelimit || bp->deadline) {
+        double now = timenow_monotonic();
         if (bp->total_timelimit && (now - bp->time_total_start > bp->total_timelimit)) {
             logmsg("Total wall-clock time limit reached!\n");
             bp->hit_total_timelimit = TRUE;
@@ -318,6 +453,10 @@ static void check_time_limits(blind_t* bp) {
             logmsg("Wall-clock time limit reached!\n");
             bp->hit_timelimit = TRUE;
         }
+        if (bp->deadline && (now > bp->deadline)) {
+            logmsg("Solve deadline reached!\n");
+            bp->hit_total_timelimit = TRUE;
+        }
     }
 #ifndef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library
     if (bp->total_cpulimit || bp->cpulimit) {
@@ -345,9 +484,10 @@ void blind_run(blind_t* bp) {
     solver_t* sp = &(bp->solver);
     size_t I; //# Modified by Robert Lancaster for the StellarSolver Internal Library
     size_t Nindexes;
+    size_t Nsequential; //# Added for the StellarSolver Internal Library
 
     // Record current time for total wall-clock time limit.
-    bp->time_total_start = timenow();
+    bp->time_total_start = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
 
     // Record current CPU usage for total cpu-usage limit.
 #ifndef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library
@@ -390,10 +530,26 @@ void blind_run(blind_t* bp) {
         double oldodds = bp->logratio_tosolve;
         bp->logratio_tosolve = HUGE_VAL;
 
+        //# Added for the StellarSolver Internal Library, so that the time limits and the deadline also cover verifying
+#ifndef _WIN32
+        bp->cpu_start = get_cpu_usage();
+#endif
+        bp->time_start = timenow_monotonic();
+
         for (w = 0; w < bl_size(bp->verify_wcs_list); w++) {
             double pixscale;
             double quadlo, quadhi;
             sip_t* wcs = bl_access(bp->verify_wcs_list, w);
+            //# Added for the StellarSolver Internal Library
+            double offset = dl_get(bp->verify_wcs_offsets, w);
+            sip_t shifted;
+
+            //# Added for the StellarSolver Internal Library, there can be many WCSes to verify, so stop between them
+            // once the run is cancelled or out of time.
+            check_time_limits(bp);
+            if (is_cancelled(bp) || bp->hit_total_timelimit || bp->hit_timelimit ||
+                bp->hit_total_cpulimit || bp->hit_cpulimit)
+                break;
 
             // We don't want to try to verify a wide-field image using a narrow-
             // field index, because it will contain a TON of index stars in the
@@ -420,7 +576,10 @@ void blind_run(blind_t* bp) {
                    arcsec2arcmin(quadlo), arcsec2arcmin(quadhi));
 
             for (I=0; I<Nindexes; I++) {
-                index_t* index = get_index(bp, I);
+                index_t* index;
+                if (is_cancelled(bp))
+                    break;
+                index = get_index(bp, I);
                 if (!index_overlaps_scale_range(index, quadlo, quadhi)) {
                     done_with_index(bp, I, index);
                     continue;
@@ -429,11 +588,21 @@ void blind_run(blind_t* bp) {
                 sp->index = index;
                 logmsg("Verifying WCS with index %zu of %zu (%s)\n",  I + 1, Nindexes, index->indexname);
                 // Do it!
-                solve_fields(bp, wcs);
+                //# Modified for the StellarSolver Internal Library, a WCS that may be off by more than the
+                // verification tolerance is verified where the index stars line up with the field stars.
+                if (offset > 0.0 && shift_verify_wcs(bp, index, wcs, offset, &shifted))
+                    solve_fields(bp, &shifted);
+                else
+                    solve_fields(bp, wcs);
                 // Clean up this index...
                 done_with_index(bp, I, index);
                 solver_clear_indexes(sp);
             }
+            //# Added for the StellarSolver Internal Library, the WCSes are alternative guesses, so stop at the first one that solves
+            if (sp->have_best_match && sp->best_match.logodds >= oldodds) {
+                bp->verified_wcs = w;
+                break;
+            }
         }
 
         bp->logratio_tosolve = oldodds;
@@ -454,62 +623,67 @@ void blind_run(blind_t* bp) {
         goto cleanup;
 
     // Start solving...
+    //# Modified for the StellarSolver Internal Library, in parallel mode the loaded indexes are searched together
+    // first, then the ones in "indexnames", which didn't fit in the memory budget, are loaded and searched one at a time.
+    Nsequential = Nindexes;
     if (bp->indexes_inparallel) {
+        size_t Nnamed = sl_size(bp->indexnames);
+        Nsequential = Nnamed;
 
-        // Add all the indexes...
-        for (I=0; I<Nindexes; I++) {
-            index_t* index = get_index(bp, I);
-            solver_add_index(sp, index);
-        }
+        if (Nindexes > Nnamed) {
+            // Add all the loaded indexes...
+            for (I=Nnamed; I<Nindexes; I++) {
+                index_t* index = get_index(bp, I);
+                solver_add_index(sp, index);
+            }
 
-        // Record current CPU usage.
+            // Record current CPU usage.
 #ifndef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library
-        bp->cpu_start = get_cpu_usage();
+            bp->cpu_start = get_cpu_usage();
 #endif
-        // Record current wall-clock time.
-        bp->time_start = time(NULL);
+            // Record current wall-clock time.
+            bp->time_start = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
 
-        // Do it!
-        solve_fields(bp, NULL);
+            // Do it!
+            solve_fields(bp, NULL);
 
-        // Clean up the indices...
-        for (I=0; I<Nindexes; I++) {
-            index_t* index = get_index(bp, I);
-            done_with_index(bp, I, index);
+            // Clean up the indices...
+            for (I=Nnamed; I<Nindexes; I++) {
+                index_t* index = get_index(bp, I);
+                done_with_index(bp, I, index);
+            }
+            solver_clear_indexes(sp);
         }
-        solver_clear_indexes(sp);
-
-    } else {
+    }
 
-        for (I=0; I<Nindexes; I++) {
-            index_t* index;
+    for (I=0; I<Nsequential; I++) {
+        index_t* index;
 
-            if (bp->hit_total_timelimit || bp->hit_total_cpulimit)
-                break;
-            if (bp->single_field_solved)
-                break;
-            if (bp->cancelled)
-                break;
+        if (bp->hit_total_timelimit || bp->hit_total_cpulimit)
+            break;
+        if (bp->single_field_solved)
+            break;
+        if (is_cancelled(bp))
+            break;
 
-            // Load the index...
-            index = get_index(bp, I);
-            solver_add_index(sp, index);
-            logverb("Trying index %s...\n", index->indexname);
+        // Load the index...
+        index = get_index(bp, I);
+        solver_add_index(sp, index);
+        logverb("Trying index %s...\n", index->indexname);
 
-            // Record current CPU usage.
+        // Record current CPU usage.
 #ifndef _WIN32 //# Modified by Robert Lancaster for the StellarSolver Internal Library
-            bp->cpu_start = get_cpu_usage();
+        bp->cpu_start = get_cpu_usage();
 #endif
-            // Record current wall-clock time.
-            bp->time_start = time(NULL);
+        // Record current wall-clock time.
+        bp->time_start = timenow_monotonic(); //# Modified for the StellarSolver Internal Library
 
-            // Do it!
-            solve_fields(bp, NULL);
+        // Do it!
+        solve_fields(bp, NULL);
 
-            // Clean up this index...
-            done_with_index(bp, I, index);
-            solver_clear_indexes(sp);
-        }
+        // Clean up this index...
+        done_with_index(bp, I, index);
+        solver_clear_indexes(sp);
     }
 
  cleanup:
@@ -545,6 +719,7 @@ void blind_init(blind_t* bp) {
     bp->indexnames = sl_new(16);
     bp->indexes = pl_new(16);
     bp->verify_wcs_list = bl_new(1, sizeof(sip_t));
+    bp->verify_wcs_offsets = dl_new(4); //# Added for the StellarSolver Internal Library
     bp->verify_wcsfiles = sl_new(1);
     bp->fieldid_key = strdup("FIELDID");
     blind_set_xcol(bp, NULL);
@@ -554,6 +729,7 @@ void blind_init(blind_t* bp) {
     bp->quad_size_fraction_lo = DEFAULT_QSF_LO;
     bp->quad_size_fraction_hi = DEFAULT_QSF_HI;
     bp->nsolves = 1;
+    bp->verified_wcs = -1; //# Added for the StellarSolver Internal Library
 
     //bp->xyls_tagalong_all = TRUE; //# Modified by Robert Lancaster for the StellarSolver Internal Library, removed xyls
     // don't set sp-> here because solver_set_default_values()
@@ -717,6 +893,8 @@ void blind_cleanup(blind_t* bp) {
     bp->verify_wcsfiles = 0; //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     bl_free(bp->verify_wcs_list);
     bp->verify_wcs_list = 0; //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
+    dl_free(bp->verify_wcs_offsets); //# Added for the StellarSolver Internal Library
+    bp->verify_wcs_offsets = 0;
     sl_free2(bp->rdls_tagalong);
     bp->rdls_tagalong = 0;   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
 
@@ -888,11 +1066,28 @@ static anbool record_match_callback(MatchObj* mo, void* userdata) {
     return FALSE;
 }
 
+//# Added for the StellarSolver Internal Library
+// The earliest of the time limits and the deadline, for the solver to check as it goes.
+static double get_deadline(const blind_t* bp) {
+    double deadline = bp->deadline;
+    if (bp->total_timelimit) {
+        double limit = bp->time_total_start + bp->total_timelimit;
+        if (!deadline || limit < deadline)
+            deadline = limit;
+    }
+    if (bp->timelimit) {
+        double limit = bp->time_start + bp->timelimit;
+        if (!deadline || limit < deadline)
+            deadline = limit;
+    }
+    return deadline;
+}
+
 static time_t timer_callback(void* user_data) {
     blind_t* bp = user_data;
 
     //# Modified by Robert Lancaster for the StellarSolver Internal Library since I got rid of the cancel file and I am just using the boolean
-    if(bp->cancelled)
+    if(is_cancelled(bp))
         return 0;
     check_time_limits(bp);
 
@@ -1037,7 +1232,12 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
         sp->record_match_callback = record_match_callback;
         sp->timer_callback = timer_callback;
         sp->userdata = bp;
-        solver_reset_best_match(sp);
+        sp->cancel_callback = bp->cancel_callback; //# Added for the StellarSolver Internal Library
+        sp->cancel_userdata = bp->cancel_userdata;
+        sp->deadline = get_deadline(bp);
+        //# Modified for the StellarSolver Internal Library, so that a WCS verified with one index is kept when the next index verifies it worse
+        if (!verify_wcs)
+            solver_reset_best_match(sp);
 
         bp->fieldnum = fieldnum;
         bp->nsolves_sofar = 0;
@@ -1057,6 +1257,8 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
 
             // The real thing
             solver_run(sp);
+            //# Added for the StellarSolver Internal Library, so that a time limit the solver stopped for is recorded
+            check_time_limits(bp);
 
             logverb("Field %i: tried %i quads, matched %i codes.\n",
                     fieldnum, sp->numtries, sp->nummatches);
@@ -1067,7 +1269,7 @@ static void solve_fields(blind_t* bp, sip_t* verify_wcs) {
             if (sp->maxmatches && sp->nummatches >= sp->maxmatches)
                 logmsg("  exceeded the number of quads to match: %i >= %i.\n",
                        sp->nummatches, sp->maxmatches);
-            if (bp->cancelled)
+            if (is_cancelled(bp))
                 logmsg("  cancelled at user request.\n");
         }
 
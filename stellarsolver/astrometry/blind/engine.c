@@ -204,6 +204,8 @@ int engine_add_index(engine_t* engine, char* path) {
         ERROR("Failed to load index from path %s", path);
         return -1;
     }
+    if (engine->inparallel)
+        index_apply_residency(ind, &engine->residency); //# Added for the StellarSolver Internal Library
     if (add_index(engine, ind)) {
         ERROR("Failed to add index \"%s\"", path);
         return -1;
@@ -212,16 +214,113 @@ int engine_add_index(engine_t* engine, char* path) {
     return 0;
 }
 
+//# Added for the StellarSolver Internal Library so that indexes owned by the StellarSolver IndexCache can be shared between solves.
+// The caller keeps ownership of "ind", which must outlive the engine.  It may be metadata-only,
+// in which case engine->load_shared_index is called to load it once it is selected for a job.
+int engine_add_shared_index(engine_t* engine, index_t* ind) {
+    if (add_index(engine, ind)) {
+        ERROR("Failed to add index \"%s\"", ind->indexname);
+        return -1;
+    }
+    pl_append(engine->shared_indexes, ind);
+    return 0;
+}
+
 static void add_index_to_blind(engine_t* engine, blind_t* bp,
                                int i) {
     index_t* index;
     index = pl_get(engine->indexes, i);
-    if (engine->inparallel) {
+    //# Modified for the StellarSolver Internal Library, shared indexes stay loaded, so blind doesn't need to reopen them.
+    // Without inparallel, a shared index that isn't loaded yet is given to blind by name like any other,
+    // so it is opened, searched and closed on its own instead of staying mapped in the cache.
+    if (pl_index_of(engine->shared_indexes, index) >= 0) {
+        if (!engine->inparallel && !index_is_loaded(index)) {
+            blind_add_index(bp, index->indexname);
+            return;
+        }
+        if (engine->load_shared_index &&
+            engine->load_shared_index(index, &engine->residency, engine->load_shared_index_userdata)) {
+            logmsg("Failed to load index \"%s\".\n", index->indexname);
+            return;
+        }
+        blind_add_loaded_index(bp, index);
+    } else if (engine->inparallel) {
         blind_add_loaded_index(bp, index);
     } else {
         blind_add_index(bp, index->indexname);
     }
 }
+//# Added for the StellarSolver Internal Library
+typedef struct {
+    int i;
+    double useful;
+    size_t bytes;
+} ranked_index_t;
+
+static int compare_ranked_indexes(const void* v1, const void* v2) {
+    const ranked_index_t* r1 = v1;
+    const ranked_index_t* r2 = v2;
+    if (r1->useful != r2->useful)
+        return (r1->useful > r2->useful) ? -1 : 1;
+    if (r1->bytes != r2->bytes)
+        return (r1->bytes < r2->bytes) ? -1 : 1;
+    return r1->i - r2->i;
+}
+
+//# Added for the StellarSolver Internal Library
+// Adds the indexes selected for a run to blind.  When the engine has a memory budget, the indexes that are most
+// likely to solve the field are kept loaded, and searched together, for as long as they fit in the budget.
+// Shared indexes that are already loaded count against the budget whether or not they were selected, and
+// are always searched from memory, since giving them to blind by name would open the files again.
+// The rest are given to blind by name, so it loads, searches and closes them one at a time after that.
+// An index is more likely to solve the field when more of its range of quad sizes, [fmin, fmax] in arcsec,
+// could be in the field; between equally likely ones, the smaller index is kept.
+static void add_indexes_to_blind(engine_t* engine, blind_t* bp, il* selected,
+                                 double fmin, double fmax) {
+    int N = il_size(selected);
+    ranked_index_t* ranked;
+    size_t used = 0;
+    int k;
+
+    if (!engine->inparallel || !engine->index_memory_budget) {
+        for (k=0; k<N; k++)
+            add_index_to_blind(engine, bp, il_get(selected, k));
+        return;
+    }
+
+    ranked = malloc(MAX(N, 1) * sizeof(ranked_index_t));
+    for (k=0; k<N; k++) {
+        index_t* index = pl_get(engine->indexes, il_get(selected, k));
+        double lo = MAX(index->index_scale_lower, fmin);
+        double hi = MIN(index->index_scale_upper, fmax);
+        ranked[k].i = il_get(selected, k);
+        ranked[k].bytes = index_memory_estimate(index);
+        ranked[k].useful = 0.0;
+        if (lo > 0 && hi > lo && index->index_scale_upper > index->index_scale_lower)
+            ranked[k].useful = log(hi / lo) / log(index->index_scale_upper / index->index_scale_lower);
+    }
+    qsort(ranked, N, sizeof(ranked_index_t), compare_ranked_indexes);
+
+    if (engine->shared_index_bytes)
+        used = engine->shared_index_bytes(engine->load_shared_index_userdata);
+
+    for (k=0; k<N; k++) {
+        index_t* index = pl_get(engine->indexes, ranked[k].i);
+        if (pl_index_of(engine->shared_indexes, index) >= 0 && index_is_loaded(index)) {
+            add_index_to_blind(engine, bp, ranked[k].i);
+        } else if (used + ranked[k].bytes <= engine->index_memory_budget) {
+            used += ranked[k].bytes;
+            add_index_to_blind(engine, bp, ranked[k].i);
+        } else {
+            logverb("Index %s doesn't fit in the memory budget, it will be searched on its own\n", index->indexname);
+            blind_add_index(bp, index->indexname);
+        }
+    }
+    logverb("Keeping %g MB of indexes loaded, the memory budget is %g MB\n",
+            used / (1024.0 * 1024.0), engine->index_memory_budget / (1024.0 * 1024.0));
+    free(ranked);
+}
+
 /* //# Modified by Robert Lancaster for the StellarSolver Internal Library, these functions are not used
 int engine_parse_config_file(engine_t* engine, const char* fn) {
     FILE* fconf;
@@ -417,6 +516,70 @@ static double job_imageh(job_t* job) {
     return job->bp.solver.field_maxy;
 }
 
+//# Added for the StellarSolver Internal Library
+// A healpix grid used by some of the indexes, with whether each of its healpixes overlaps the search cone:
+// -1 if that hasn't been computed yet, otherwise TRUE or FALSE.
+typedef struct {
+    int nside;
+    signed char* inrange;
+} cone_grid_t;
+
+// Grids finer than this are checked healpix by healpix, rather than keeping a table for them.
+#define CONE_GRID_MAX_NSIDE 64
+
+//# Added for the StellarSolver Internal Library
+// Works out once per job which indexes overlap the search cone.  Index series share their healpix grids
+// (all 48 healpixes of each scale of the 5200 series use the same one), so the distance to each healpix is
+// computed once, rather than once per index for every depth and scale the job runs.
+static anbool* indexes_in_cone(engine_t* engine, const job_t* job) {
+    int N = pl_size(engine->indexes);
+    anbool* inrange = malloc(MAX(N, 1) * sizeof(anbool));
+    bl* grids = bl_new(4, sizeof(cone_grid_t));
+    int k, g;
+
+    for (k=0; k<N; k++) {
+        index_t* index = pl_get(engine->indexes, k);
+        cone_grid_t* grid = NULL;
+        int nhp;
+
+        if (!job->use_radec_center || index->healpix == -1) {
+            // no search cone, or an allsky index
+            inrange[k] = TRUE;
+            continue;
+        }
+        nhp = 12 * index->hpnside * index->hpnside;
+        if (index->hpnside <= 0 || index->hpnside > CONE_GRID_MAX_NSIDE ||
+            index->healpix < 0 || index->healpix >= nhp) {
+            inrange[k] = index_is_within_range(index, job->ra_center, job->dec_center, job->search_radius);
+            continue;
+        }
+        for (g=0; g<bl_size(grids); g++) {
+            cone_grid_t* gr = bl_access(grids, g);
+            if (gr->nside == index->hpnside) {
+                grid = gr;
+                break;
+            }
+        }
+        if (!grid) {
+            cone_grid_t newgrid;
+            newgrid.nside = index->hpnside;
+            newgrid.inrange = malloc(nhp);
+            memset(newgrid.inrange, -1, nhp);
+            grid = bl_append(grids, &newgrid);
+        }
+        if (grid->inrange[index->healpix] < 0)
+            grid->inrange[index->healpix] = index_is_within_range(index, job->ra_center, job->dec_center, job->search_radius);
+        inrange[k] = grid->inrange[index->healpix];
+    }
+
+    for (g=0; g<bl_size(grids); g++) {
+        cone_grid_t* gr = bl_access(grids, g);
+        free(gr->inrange);
+    }
+    bl_free(grids);
+    return inrange;
+}
+
 int engine_run_job(engine_t* engine, job_t* job) {
     blind_t* bp = &(job->bp);
     solver_t* sp = &(bp->solver);
@@ -425,6 +588,7 @@ int engine_run_job(engine_t* engine, job_t* job) {
     double app_min_default;
     double app_max_default;
     anbool solved = FALSE;
+    anbool* inrange; //# Added for the StellarSolver Internal Library
 
     //# Modified by Robert Lancaster for the StellarSolver Internal Library
     //if (blind_is_run_obsolete(bp, sp)) {
@@ -442,6 +606,7 @@ int engine_run_job(engine_t* engine, job_t* job) {
                job->search_radius, job->ra_center, job->dec_center);
         solver_set_radec(sp, job->ra_center, job->dec_center, job->search_radius);
     }
+    inrange = indexes_in_cone(engine, job);
 
     for (i=0; i<il_size(job->depths)/2; i++) {
         int startobj = il_get(job->depths, i*2);
@@ -464,6 +629,7 @@ int engine_run_job(engine_t* engine, job_t* job) {
             double app_max, app_min;
             int k;
             il* indexlist;
+            il* selected; //# Added for the StellarSolver Internal Library
 
             // arcsec per pixel range
             app_min = dl_get(job->scales, j * 2);
@@ -512,20 +678,20 @@ int engine_run_job(engine_t* engine, job_t* job) {
                 il_append_list(indexlist, list);
             }
 
+            selected = il_new(16); //# Added for the StellarSolver Internal Library
             for (k=0; k<il_size(indexlist); k++) {
                 int ii = il_get(indexlist, k);
                 index_t* index = pl_get(engine->indexes, ii);
-                anbool inrange = TRUE;
-                if (job->use_radec_center)
-                    inrange = index_is_within_range(index, job->ra_center, job->dec_center, job->search_radius);
-                if (!inrange) {
+                if (!inrange[ii]) { //# Modified for the StellarSolver Internal Library, looked up instead of computed for every run
                     logverb("Not using index %s because it's not within %g degrees of (RA,Dec) = (%g,%g)\n",
                             index->indexname, job->search_radius, job->ra_center, job->dec_center);
                     continue;
                 }
-                add_index_to_blind(engine, bp, ii);
+                il_append(selected, ii); //# Modified for the StellarSolver Internal Library, added below within the memory budget
             }
+            add_indexes_to_blind(engine, bp, selected, fmin, fmax); //# Added for the StellarSolver Internal Library
 
+            il_free(selected); //# Added for the StellarSolver Internal Library
             il_free(indexlist);
 
             logverb("Running blind solver:\n");
@@ -551,6 +717,8 @@ int engine_run_job(engine_t* engine, job_t* job) {
             break;
     }
 
+    free(inrange);
+
     logverb("cx<=dx constraints: %i\n", sp->num_cxdx_skipped);
     logverb("meanx constraints: %i\n", sp->num_meanx_skipped);
     logverb("RA,Dec constraints: %i\n", sp->num_radec_skipped);
@@ -924,12 +1092,16 @@ engine_t* engine_new() {
     engine->index_paths = sl_new(10);
     engine->indexes = pl_new(16);
     engine->free_indexes = pl_new(16);
+    engine->shared_indexes = pl_new(16); //# Added for the StellarSolver Internal Library
     //engine->free_mindexes = pl_new(16); //# Modified by Robert Lancaster for the StellarSolver Internal Library
     engine->ismallest = il_new(4);
     engine->ibiggest = il_new(4);
     engine->default_depths = il_new(4);
     engine->sizesmallest = HUGE_VAL;
     engine->sizebiggest = -HUGE_VAL;
+    //# Added for the StellarSolver Internal Library
+    engine->residency.prefetch = TRUE;
+    engine->residency.random_codes = TRUE;
 
     // Default scale estimate: field width, in degrees:
     engine->minwidth = 0.1;
@@ -958,6 +1130,7 @@ void engine_free(engine_t* engine) {
         pl_free(engine->free_mindexes);
     }
     **/
+    pl_free(engine->shared_indexes); //# Added for the StellarSolver Internal Library, these belong to the caller
     pl_free(engine->indexes);
     if (engine->ismallest)
         il_free(engine->ismallest);
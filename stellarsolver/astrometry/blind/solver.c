@@ -342,6 +342,21 @@ static double field_gety(solver_t* sp, int index) {
     return starxy_gety(sp->fieldxy, index);
 }
 
+//# Added for the StellarSolver Internal Library
+// How many quads are tried between checks of the cancel flag and the deadline.
+#define CANCEL_CHECK_QUADS 256
+
+//# Added for the StellarSolver Internal Library
+// Sets "quit_now" if the solver was cancelled or is past its deadline.
+static anbool check_cancelled(solver_t* sp) {
+    if (sp->quit_now)
+        return TRUE;
+    if ((sp->cancel_callback && sp->cancel_callback(sp->cancel_userdata)) ||
+        (sp->deadline > 0.0 && timenow_monotonic() > sp->deadline))
+        sp->quit_now = TRUE;
+    return sp->quit_now;
+}
+
 static void update_timeused(solver_t* sp) {
     double usertime, systime;
     get_resource_stats(&usertime, &systime, NULL);
@@ -379,6 +394,8 @@ void solver_reset_counters(solver_t* s) {
     s->num_radec_skipped = 0;
     s->num_abscale_skipped = 0;
     s->num_verified = 0;
+    s->pquad_bytes = 0;
+    s->pquad_allocs = 0;
 }
 
 double solver_field_width(const solver_t* s) {
@@ -537,9 +554,30 @@ static void try_all_codes(const pquad* pq,
                           const int* fieldstars, int dimquad,
                           solver_t* solver, double tol2);
 
+//# Added for the StellarSolver Internal Library
+/*
+ The codes that try_all_codes() builds for one quad (both parities,
+ both orders of the backbone stars, and every permutation of the other
+ stars) are all close together in code space.  Rather than searching
+ the code tree for each of them separately, they are collected here and
+ searched together with one walk of the tree (see
+ kdtree_rangesearch_multi_reuse()).
+ */
+typedef struct {
+    int n;
+    int dimquad;
+    double codes[KD_MULTI_MAX * DCMAX];
+    int stars[KD_MULTI_MAX][DQMAX];
+    anbool parity[KD_MULTI_MAX];
+    kdtree_qres_t* results[KD_MULTI_MAX];
+} code_batch;
+
+static void run_code_batch(code_batch* batch, solver_t* solver, double tol2);
+
 static void try_all_codes_2(const int* fieldstars, int dimquad,
                             const double* code, solver_t* solver,
-                            anbool current_parity, double tol2);
+                            anbool current_parity, double tol2,
+                            code_batch* batch);
 
 static void try_permutations(const int* origstars, int dimquad,
                              const double* origcode,
@@ -547,7 +585,7 @@ static void try_permutations(const int* origstars, int dimquad,
                              double tol2,
                              int* stars, double* code,
                              int slot, anbool* placed,
-                             kdtree_qres_t** presult);
+                             code_batch* batch);
 
 static void resolve_matches(kdtree_qres_t* krez, const double *field,
                             const int* fstars, int dimquads,
@@ -645,6 +683,7 @@ static void find_field_boundaries(solver_t* solver) {
 void solver_preprocess_field(solver_t* solver) {
     find_field_boundaries(solver);
     // precompute a kdtree over the field
+    verify_workspace_forget_field(solver->verify_ws); //# Added for the StellarSolver Internal Library
     solver->vf = verify_field_preprocess(solver->fieldxy);
 
     solver->vf->do_uniformize = solver->verify_uniformize;
@@ -656,6 +695,7 @@ void solver_free_field(solver_t* solver) {
     //if (solver->fieldxy)
     //    starxy_free(solver->fieldxy);
     //solver->fieldxy = NULL;
+    verify_workspace_forget_field(solver->verify_ws); //# Added for the StellarSolver Internal Library
     if (solver->vf)
         verify_field_free(solver->vf);
     solver->vf = NULL;
@@ -727,6 +767,284 @@ static void add_stars(const pquad* pq, int* field, int fieldoffset,
 }
 
 
+//# Added for the StellarSolver Internal Library
+/*
+ The "inbox" and "xy" arrays of the pquads are carved out of a few large
+ blocks rather than being malloc'd separately for every AB pair that
+ passes the scale check (up to ~500k allocations for 1000 stars).  Each
+ block holds the "xy" arrays of a run of pquads followed by their "inbox"
+ arrays, so the doubles stay aligned and a scan of one kind of array
+ stays within one contiguous region.
+ */
+typedef struct {
+    pl* blocks;
+    int numxy;
+    int slabs_per_block;
+    int nleft;
+    double* next_xy;
+    anbool* next_inbox;
+    size_t bytes;
+} pquad_arena;
+
+// Aim for blocks of about this size.
+#define PQUAD_ARENA_BLOCK_BYTES (1 << 20)
+
+static void pquad_arena_init(pquad_arena* arena, int numxy) {
+    size_t slab = (size_t)numxy * (2 * sizeof(double) + sizeof(anbool));
+    memset(arena, 0, sizeof(pquad_arena));
+    arena->blocks = pl_new(16);
+    arena->numxy = numxy;
+    arena->slabs_per_block = MAX(16, (int)(PQUAD_ARENA_BLOCK_BYTES / MAX(slab, 1)));
+}
+
+static void pquad_arena_alloc(pquad_arena* arena, pquad* pq) {
+    if (!arena->nleft) {
+        size_t nxy = (size_t)arena->slabs_per_block * arena->numxy * 2;
+        size_t ninbox = (size_t)arena->slabs_per_block * arena->numxy;
+        size_t bytes = nxy * sizeof(double) + ninbox * sizeof(anbool);
+        char* block = malloc(bytes);
+        pl_append(arena->blocks, block);
+        arena->next_xy = (double*)block;
+        arena->next_inbox = (anbool*)(block + nxy * sizeof(double));
+        arena->nleft = arena->slabs_per_block;
+        arena->bytes += bytes;
+    }
+    pq->xy = arena->next_xy;
+    pq->inbox = arena->next_inbox;
+    arena->next_xy += 2 * arena->numxy;
+    arena->next_inbox += arena->numxy;
+    arena->nleft--;
+}
+
+static void pquad_arena_free(pquad_arena* arena) {
+    size_t i;
+    for (i=0; i<pl_size(arena->blocks); i++)
+        free(pl_get(arena->blocks, i));
+    pl_free(arena->blocks);
+    arena->blocks = NULL;
+}
+
+// Only the AB pairs with A < B are used, so the pquads are stored as a
+// packed lower triangle indexed by B, then A.
+static inline pquad* get_pquad(pquad* pquads, int A, int B) {
+    return pquads + ((size_t)B * (B - 1)) / 2 + A;
+}
+
+//# Added for the StellarSolver Internal Library
+/*
+ Parallel quad search.  For each new field star, the quads with the new
+ star as B are split into items of one index and a block of A stars, and
+ the quads with the new star as C (or D) into items of one row B of the
+ pquad triangle, which try all of the indexes.  No two items touch the
+ same pquad, and everything else they read (the field, its verify data and
+ the indexes) is not changed while they run.  Each worker thread searches
+ with its own copy of the solver, so its counters and best match don't need
+ a lock; they are added to the caller's solver after each new star.
+ */
+#define PARALLEL_A_BLOCK 32
+
+typedef struct {
+    solver_t* solver;
+    solver_t* workers;
+    pquad* pquads;
+    const double* minAB2s;
+    const double* maxAB2s;
+    int num_indexes;
+    int newpoint;
+    int nablocks;
+} parallel_search;
+
+// The record_match_callback of the worker solvers.
+static anbool parallel_record_match(MatchObj* mo, void* userdata) {
+    solver_t* worker = userdata;
+    solver_t* sp = worker->parallel_parent;
+    anbool solved = TRUE;
+
+    sp->parallel_lock(sp->parallel_baton, TRUE);
+    // The callback looks at the index the match came from.
+    sp->index = worker->index;
+    if (sp->record_match_callback)
+        solved = sp->record_match_callback(mo, sp->userdata);
+    if (solved)
+        sp->quit_now = TRUE;
+    sp->parallel_lock(sp->parallel_baton, FALSE);
+    return solved;
+}
+
+static solver_t* parallel_workers_new(solver_t* sp) {
+    int w;
+    solver_t* workers = malloc(sp->parallel_workers * sizeof(solver_t));
+    for (w=0; w<sp->parallel_workers; w++) {
+        solver_t* worker = workers + w;
+        memcpy(worker, sp, sizeof(solver_t));
+        worker->parallel_for = NULL;
+        worker->parallel_parent = sp;
+        worker->verify_ws = NULL;
+        worker->timer_callback = NULL;
+        worker->record_match_callback = parallel_record_match;
+        worker->userdata = worker;
+        worker->numtries = worker->nummatches = worker->numscaleok = 0;
+        worker->num_cxdx_skipped = worker->num_meanx_skipped = 0;
+        worker->num_radec_skipped = worker->num_abscale_skipped = 0;
+        worker->num_verified = 0;
+        solver_reset_best_match(worker);
+        worker->best_logodds = sp->best_logodds;
+    }
+    return workers;
+}
+
+// Adds what the workers found to the caller's solver.
+static void parallel_workers_merge(solver_t* sp, solver_t* workers) {
+    int w;
+    for (w=0; w<sp->parallel_workers; w++) {
+        solver_t* worker = workers + w;
+        sp->numtries += worker->numtries;
+        sp->nummatches += worker->nummatches;
+        sp->numscaleok += worker->numscaleok;
+        sp->num_cxdx_skipped += worker->num_cxdx_skipped;
+        sp->num_meanx_skipped += worker->num_meanx_skipped;
+        sp->num_radec_skipped += worker->num_radec_skipped;
+        sp->num_abscale_skipped += worker->num_abscale_skipped;
+        sp->num_verified += worker->num_verified;
+        worker->numtries = worker->nummatches = worker->numscaleok = 0;
+        worker->num_cxdx_skipped = worker->num_meanx_skipped = 0;
+        worker->num_radec_skipped = worker->num_abscale_skipped = 0;
+        worker->num_verified = 0;
+
+        sp->best_logodds = MAX(sp->best_logodds, worker->best_logodds);
+        if (worker->have_best_match) {
+            if (!sp->have_best_match ||
+                (worker->best_match.logodds > sp->best_match.logodds)) {
+                if (sp->have_best_match)
+                    verify_free_matchobj(&sp->best_match);
+                memcpy(&sp->best_match, &worker->best_match, sizeof(MatchObj));
+                sp->have_best_match = TRUE;
+                sp->best_index = worker->best_index;
+            } else {
+                verify_free_matchobj(&worker->best_match);
+            }
+            worker->have_best_match = FALSE;
+        }
+        if (worker->best_match_solves)
+            sp->best_match_solves = TRUE;
+        worker->best_match_solves = FALSE;
+    }
+}
+
+// Frees the workers, adding their verify counts to the caller's workspace.
+static void parallel_workers_free(solver_t* sp, solver_t* workers) {
+    int w;
+    for (w=0; w<sp->parallel_workers; w++) {
+        verify_workspace_t* ws = workers[w].verify_ws;
+        if (!ws)
+            continue;
+        if (!sp->verify_ws)
+            sp->verify_ws = verify_workspace_new();
+        sp->verify_ws->nverified += ws->nverified;
+        sp->verify_ws->nallocs += ws->nallocs;
+        verify_workspace_free(ws);
+    }
+    free(workers);
+}
+
+// Quads with the new star as B, using one index and a block of A stars.
+static void parallel_search_B(parallel_search* ps, solver_t* worker,
+                              int indexnum, int Alo, int Ahi) {
+    int field[DQMAX];
+    int dimquads;
+    index_t* index = pl_get(worker->indexes, indexnum);
+
+    memset(field, 0, sizeof(field));
+    set_index(worker, index);
+    dimquads = index_dimquads(index);
+    field[B] = ps->newpoint;
+    for (field[A] = Alo; field[A] < Ahi; field[A]++) {
+        pquad* pq = get_pquad(ps->pquads, field[A], field[B]);
+        double tol2;
+        if (!pq->scale_ok)
+            continue;
+        if ((pq->scale < ps->minAB2s[indexnum]) ||
+            (pq->scale > ps->maxAB2s[indexnum]))
+            continue;
+        worker->rel_field_noise2 = pq->rel_field_noise2;
+        tol2 = get_tolerance(worker);
+        add_stars(pq, field, C, dimquads-2, 0, ps->newpoint, dimquads, worker, tol2);
+        if (worker->quit_now)
+            return;
+    }
+}
+
+// Quads with the new star as C, for all of the AB pairs in one row B.
+static void parallel_search_C(parallel_search* ps, solver_t* worker, int row) {
+    int field[DQMAX];
+    int i;
+
+    memset(field, 0, sizeof(field));
+    field[B] = row;
+    field[C] = ps->newpoint;
+    for (field[A] = 0; field[A] < field[B]; field[A]++) {
+        pquad* pq = get_pquad(ps->pquads, field[A], field[B]);
+        if (!pq->scale_ok)
+            continue;
+        pq->inbox[field[C]] = TRUE;
+        pq->ninbox = field[C] + 1;
+        check_inbox(pq, field[C], worker);
+        if (!pq->inbox[field[C]])
+            continue;
+
+        worker->rel_field_noise2 = pq->rel_field_noise2;
+        for (i = 0; i < ps->num_indexes; i++) {
+            int dimquads;
+            double tol2;
+            if ((pq->scale < ps->minAB2s[i]) ||
+                (pq->scale > ps->maxAB2s[i]))
+                continue;
+            set_index(worker, pl_get(worker->indexes, i));
+            dimquads = index_dimquads(worker->index);
+            tol2 = get_tolerance(worker);
+            if (dimquads > 3)
+                add_stars(pq, field, D, dimquads-3, 0, ps->newpoint, dimquads, worker, tol2);
+            else
+                TRY_ALL_CODES(pq, field, dimquads, worker, tol2);
+            if (worker->quit_now)
+                return;
+        }
+    }
+}
+
+static void parallel_search_item(int w, int item, void* arg) {
+    parallel_search* ps = arg;
+    solver_t* worker = ps->workers + w;
+
+    // Stop soon after another worker solved the field or the caller gave up.
+    // The other workers set the flag with the lock held, so it is read with the lock held too.
+    ps->solver->parallel_lock(ps->solver->parallel_baton, TRUE);
+    worker->quit_now = ps->solver->quit_now;
+    ps->solver->parallel_lock(ps->solver->parallel_baton, FALSE);
+    if (worker->quit_now)
+        return;
+    if (item < ps->num_indexes * ps->nablocks) {
+        int Alo = (item % ps->nablocks) * PARALLEL_A_BLOCK;
+        parallel_search_B(ps, worker, item / ps->nablocks, Alo,
+                          MIN(Alo + PARALLEL_A_BLOCK, ps->newpoint));
+    } else {
+        // The longest rows go first, so the short ones fill in at the end.
+        parallel_search_C(ps, worker, ps->newpoint - 1 - (item - ps->num_indexes * ps->nablocks));
+    }
+}
+
+static void parallel_search_newpoint(parallel_search* ps, int newpoint) {
+    int nitems;
+    ps->newpoint = newpoint;
+    ps->nablocks = (newpoint + PARALLEL_A_BLOCK - 1) / PARALLEL_A_BLOCK;
+    // The rows B of the quads with the new star as C start at B=1.
+    nitems = ps->num_indexes * ps->nablocks + MAX(newpoint - 1, 0);
+    if (nitems)
+        ps->solver->parallel_for(ps->solver->parallel_baton, nitems,
+                                 parallel_search_item, ps);
+    parallel_workers_merge(ps->solver, ps->workers);
+}
+
 // The real deal
 void solver_run(solver_t* solver) {
     int numxy, newpoint;
@@ -734,9 +1052,12 @@ void solver_run(solver_t* solver) {
     // first timer callback is called after 1 second
     time_t next_timer_callback_time = time(NULL) + 1;
     pquad* pquads;
+    pquad_arena arena;
+    size_t npquads;
     size_t i, num_indexes;
     double tol2;
     int field[DQMAX];
+    parallel_search ps; //# Added for the StellarSolver Internal Library
 
     get_resource_stats(&usertime, &systime, NULL);
 
@@ -813,15 +1134,17 @@ void solver_run(solver_t* solver) {
          MIN(M_PI, arcsec2rad(field_diag * solver->funits_upper)) ...
          */
 
-        pquads = calloc(numxy * numxy, sizeof(pquad));
+        //# Modified for the StellarSolver Internal Library to store only the triangle and use one arena
+        npquads = ((size_t)numxy * (numxy - 1)) / 2;
+        pquads = calloc(MAX(npquads, 1), sizeof(pquad));
+        pquad_arena_init(&arena, numxy);
 
         /* We maintain an array of "potential quads" (pquad) structs, where
          * each struct corresponds to one choice of stars A and B; the struct
-         * at index (B * numxy + A) holds information about quads that could be
-         * created using stars A,B.
+         * returned by get_pquad(pquads, A, B) holds information about quads
+         * that could be created using stars A,B.
          *
-         * (We only use the above-diagonal elements of this 2D array because
-         * A<B.)
+         * (Only the A<B half of this 2D array is stored.)
          *
          * For each AB pair, we cache the scale and the rotation parameters,
          * and we keep an array "inbox" of length "numxy" of booleans, one for
@@ -840,7 +1163,7 @@ void solver_run(solver_t* solver) {
             debug("startobj > 0; priming pquad arrays.\n");
             for (field[B] = 0; field[B] < solver->startobj; field[B]++) {
                 for (field[A] = 0; field[A] < field[B]; field[A]++) {
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = get_pquad(pquads, field[A], field[B]);
                     pq->fieldA = field[A];
                     pq->fieldB = field[B];
                     debug("trying A=%i, B=%i\n", field[A], field[B]);
@@ -849,8 +1172,7 @@ void solver_run(solver_t* solver) {
                         debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
                         continue;
                     }
-                    pq->xy = malloc(numxy * 2 * sizeof(double));
-                    pq->inbox = malloc(numxy * sizeof(anbool));
+                    pquad_arena_alloc(&arena, pq);
                     memset(pq->inbox, TRUE, solver->startobj);
                     pq->ninbox = solver->startobj;
                     pq->inbox[field[A]] = FALSE;
@@ -862,6 +1184,18 @@ void solver_run(solver_t* solver) {
             }
         }
 
+        //# Added for the StellarSolver Internal Library
+        memset(&ps, 0, sizeof(ps));
+        if (solver->parallel_for && solver->parallel_lock && solver->parallel_workers > 0) {
+            ps.solver = solver;
+            ps.pquads = pquads;
+            ps.minAB2s = minAB2s;
+            ps.maxAB2s = maxAB2s;
+            ps.num_indexes = (int)num_indexes;
+            ps.workers = parallel_workers_new(solver);
+            logverb("Searching for quads with %i threads.\n", solver->parallel_workers);
+        }
+
         /* Each time through the "for" loop below, we consider a new star
          * ("newpoint").  First, we try building all quads that have the new
          * star on the diagonal (star B).  Then, we try building all quads that
@@ -891,6 +1225,10 @@ void solver_run(solver_t* solver) {
                 }
             }
 
+            //# Added for the StellarSolver Internal Library
+            if (check_cancelled(solver))
+                break;
+
             solver->last_examined_object = newpoint;
             // quads with the new star on the diagonal:
             field[B] = newpoint;
@@ -899,7 +1237,7 @@ void solver_run(solver_t* solver) {
             // first do an index-independent scale check...
             for (field[A] = 0; field[A] < newpoint; field[A]++) {
                 // initialize the "pquad" struct for this AB combo.
-                pquad* pq = pquads + field[B] * numxy + field[A];
+                pquad* pq = get_pquad(pquads, field[A], field[B]);
                 pq->fieldA = field[A];
                 pq->fieldB = field[B];
                 debug("  trying A=%i, B=%i\n", field[A], field[B]);
@@ -909,8 +1247,7 @@ void solver_run(solver_t* solver) {
                     continue;
                 }
                 // initialize the "inbox" array:
-                pq->inbox = malloc(numxy * sizeof(anbool));
-                pq->xy = malloc(numxy * 2 * sizeof(double));
+                pquad_arena_alloc(&arena, pq);
                 // -try all stars up to "newpoint"...
                 assert(sizeof(anbool) == 1);
                 memset(pq->inbox, TRUE, newpoint + 1);
@@ -923,6 +1260,14 @@ void solver_run(solver_t* solver) {
                 print_inbox(pq);
             }
 
+            //# Added for the StellarSolver Internal Library
+            if (ps.workers) {
+                parallel_search_newpoint(&ps, newpoint);
+                if (check_cancelled(solver))
+                    goto quitnow;
+                goto newpoint_done;
+            }
+
             // Now iterate through the different indices
             for (i = 0; i < num_indexes; i++) {
                 index_t* index = pl_get(solver->indexes, i);
@@ -931,7 +1276,7 @@ void solver_run(solver_t* solver) {
                 dimquads = index_dimquads(index);
                 for (field[A] = 0; field[A] < newpoint; field[A]++) {
                     // initialize the "pquad" struct for this AB combo.
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = get_pquad(pquads, field[A], field[B]);
                     if (!pq->scale_ok)
                         continue;
                     if ((pq->scale < minAB2s[i]) ||
@@ -958,7 +1303,7 @@ void solver_run(solver_t* solver) {
             for (field[A] = 0; field[A] < newpoint; field[A]++) {
                 for (field[B] = field[A] + 1; field[B] < newpoint; field[B]++) {
                     // grab the "pquad" for this AB combo
-                    pquad* pq = pquads + field[B] * numxy + field[A];
+                    pquad* pq = get_pquad(pquads, field[A], field[B]);
                     if (!pq->scale_ok) {
                         debug("  bad scale for A=%i, B=%i\n", field[A], field[B]);
                         continue;
@@ -1000,6 +1345,7 @@ void solver_run(solver_t* solver) {
                     }
                 }
             }
+        newpoint_done: //# Added for the StellarSolver Internal Library
             logverb("object %u of %u: %i quads tried, %i matched.\n",
                     newpoint + 1, numxy, solver->numtries, solver->nummatches);
 
@@ -1010,12 +1356,18 @@ void solver_run(solver_t* solver) {
         }
 
     quitnow:
-        for (i = 0; i < (numxy*numxy); i++) {
-            pquad* pq = pquads + i;
-            free(pq->inbox);
-            free(pq->xy);
-        }
+        solver->pquad_bytes += npquads * sizeof(pquad) + arena.bytes;
+        solver->pquad_allocs += 1 + pl_size(arena.blocks);
+        logverb("pquad storage: %zu bytes in %zu allocations.\n",
+                npquads * sizeof(pquad) + arena.bytes, 1 + pl_size(arena.blocks));
+        pquad_arena_free(&arena);
         free(pquads);
+        //# Added for the StellarSolver Internal Library, their results were merged after each star
+        if (ps.workers)
+            parallel_workers_free(solver, ps.workers);
+        if (solver->verify_ws)
+            logverb("verify: %i matches verified with %i allocations for their reference stars.\n",
+                    solver->verify_ws->nverified, solver->verify_ws->nallocs);
 
 #ifdef _MSC_VER //# Modified by Robert Lancaster for the StellarSolver Internal Library
         free(minAB2s);
@@ -1035,8 +1387,16 @@ static void try_all_codes(const pquad* pq,
     double code[DCMAX];
     double flipcode[DCMAX];
     int i;
+    code_batch batch;
 
     solver->numtries++;
+    //# Added for the StellarSolver Internal Library
+    if (unlikely(solver->numtries % CANCEL_CHECK_QUADS == 0) && check_cancelled(solver))
+        return;
+    batch.n = 0;
+    batch.dimquad = dimquad;
+    for (i=0; i<KD_MULTI_MAX; i++)
+        batch.results[i] = NULL;
 
     debug("  trying quad [");
     for (i=0; i<dimquad; i++) {
@@ -1057,7 +1417,7 @@ static void try_all_codes(const pquad* pq,
             debug("%s%g", (i?", ":""), code[i]);
         debug("].\n");
 
-        try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, tol2);
+        try_all_codes_2(fieldstars, dimquad, code, solver, FALSE, tol2, &batch);
     }
     if (solver->parity == PARITY_FLIP ||
         solver->parity == PARITY_BOTH) {
@@ -1069,8 +1429,13 @@ static void try_all_codes(const pquad* pq,
             debug("%s%g", (i?", ":""), flipcode[i]);
         debug("].\n");
 
-        try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, tol2);
+        try_all_codes_2(fieldstars, dimquad, flipcode, solver, TRUE, tol2, &batch);
     }
+
+    if (!solver->quit_now)
+        run_code_batch(&batch, solver, tol2);
+    for (i=0; i<KD_MULTI_MAX; i++)
+        kdtree_free_query(batch.results[i]);
 }
 
 /**
@@ -1079,9 +1444,9 @@ static void try_all_codes(const pquad* pq,
  */
 static void try_all_codes_2(const int* fieldstars, int dimquad,
                             const double* code, solver_t* solver,
-                            anbool current_parity, double tol2) {
+                            anbool current_parity, double tol2,
+                            code_batch* batch) {
     int i;
-    kdtree_qres_t* result = NULL;
     int dimcode = (dimquad - 2) * 2;
     int stars[DQMAX];
     double flipcode[DCMAX];
@@ -1097,9 +1462,9 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
         placed[i] = FALSE;
 
     try_permutations(fieldstars, dimquad, code, solver, current_parity,
-                     tol2, stars, NULL, 0, placed, &result);
+                     tol2, stars, NULL, 0, placed, batch);
     if (unlikely(solver->quit_now))
-        goto bailout;
+        return;
 
     // Flipped:
     stars[0] = fieldstars[1];
@@ -1112,10 +1477,46 @@ static void try_all_codes_2(const int* fieldstars, int dimquad,
         placed[i] = FALSE;
 
     try_permutations(fieldstars, dimquad, flipcode, solver, current_parity,
-                     tol2, stars, NULL, 0, placed, &result);
+                     tol2, stars, NULL, 0, placed, batch);
+}
+
+//# Added for the StellarSolver Internal Library
+/**
+ Searches the code tree for all of the codes collected in "batch" at
+ once, then resolves the matches of each code in the order the codes
+ were added.  Empties the batch.
+ */
+static void run_code_batch(code_batch* batch, solver_t* solver, double tol2) {
+    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
+        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
+    int dimquad = batch->dimquad;
+    int n = batch->n;
+    int k;
+
+    batch->n = 0;
+    if (n == 0)
+        return;
+    if (kdtree_rangesearch_multi_reuse(solver->index->codekd->tree, batch->results,
+                                       batch->codes, n, tol2, options)) {
+        ERROR("Code tree search failed");
+        return;
+    }
 
- bailout:
-    kdtree_free_query(result);
+    for (k=0; k<n; k++) {
+        const int* stars = batch->stars[k];
+        if (batch->results[k]->nres) {
+            double pixvals[DQMAX*2];
+            int j;
+            for (j=0; j<dimquad; j++) {
+                setx(pixvals, j, field_getx(solver, stars[j]));
+                sety(pixvals, j, field_gety(solver, stars[j]));
+            }
+            resolve_matches(batch->results[k], pixvals, stars, dimquad, solver,
+                            batch->parity[k]);
+        }
+        if (unlikely(solver->quit_now))
+            return;
+    }
 }
 
 /**
@@ -1128,10 +1529,8 @@ static void try_permutations(const int* origstars, int dimquad,
                              double tol2,
                              int* stars, double* code,
                              int slot, anbool* placed,
-                             kdtree_qres_t** presult) {
+                             code_batch* batch) {
     int i;
-    int options = KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_COMPUTE_DISTS |
-        KD_OPTIONS_NO_RESIZE_RESULTS | KD_OPTIONS_USE_SPLIT;
     double mycode[DCMAX];
     int Nstars = dimquad - NBACK;
     int lastslot = dimquad - NBACK - 1;
@@ -1212,7 +1611,7 @@ static void try_permutations(const int* origstars, int dimquad,
             placed[i] = TRUE;
             try_permutations(origstars, dimquad, origcode, solver,
                              current_parity, tol2, stars, code, 
-                             slot+1, placed, presult);
+                             slot+1, placed, batch);
             placed[i] = FALSE;
 
         } else {
@@ -1221,22 +1620,19 @@ static void try_permutations(const int* origstars, int dimquad,
             continue;
 #endif
 				
-            // Search with the code we've built.
-            *presult = kdtree_rangesearch_options_reuse
-                (solver->index->codekd->tree, *presult, code, tol2, options);
-            //debug("      trying ABCD = [%i %i %i %i]: %i results.\n",
-            //fstars[A], fstars[B], fstars[C], fstars[D], result->nres);
-
-            if ((*presult)->nres) {
-                double pixvals[DQMAX*2];
-                int j;
-                for (j=0; j<dimquad; j++) {
-                    setx(pixvals, j, field_getx(solver, stars[j]));
-                    sety(pixvals, j, field_gety(solver, stars[j]));
-                }
-                resolve_matches(*presult, pixvals, stars, dimquad, solver,
-                                current_parity);
+            //# Modified for the StellarSolver Internal Library
+            // Add the code we've built to the batch; the code tree is
+            // searched for the whole batch at once in run_code_batch().
+            {
+                int dimcode = 2 * Nstars;
+                int k = batch->n;
+                memcpy(batch->codes + k * dimcode, code, dimcode * sizeof(double));
+                memcpy(batch->stars[k], stars, dimquad * sizeof(int));
+                batch->parity[k] = current_parity;
+                batch->n++;
             }
+            if (batch->n == KD_MULTI_MAX)
+                run_code_batch(batch, solver, tol2);
             if (unlikely(solver->quit_now))
                 return;
         }
@@ -1390,9 +1786,17 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
     match_distance_in_pixels2 = square(sp->verify_pix) +
         square(sp->index->index_jitter / mo->scale);
 
+    //# Added for the StellarSolver Internal Library, verifying takes a while, so don't start after being cancelled.
+    // This includes the WCSes given to verify, there can be many of them.
+    if (check_cancelled(sp))
+        return FALSE;
+
     logaccept = MIN(sp->logratio_tokeep, sp->logratio_totune);
 
-    verify_hit(sp->index->starkd, sp->index->cutnside,
+    //# Modified for the StellarSolver Internal Library, verifying with a workspace that is kept between matches
+    if (!sp->verify_ws)
+        sp->verify_ws = verify_workspace_new();
+    verify_hit_reuse(sp->verify_ws, sp->index->starkd, sp->index->cutnside,
                mo, sip, sp->vf, match_distance_in_pixels2,
                sp->distractor_ratio, sp->field_maxx, sp->field_maxy,
                sp->logratio_bail_threshold, logaccept,
@@ -1416,7 +1820,7 @@ static int solver_handle_hit(solver_t* sp, MatchObj* mo, sip_t* sip,
         // Since we tuned up this solution, we can't just accept the
         // resulting log-odds at face value.
         if (!fake_match) {
-            verify_hit(sp->index->starkd, sp->index->cutnside,
+            verify_hit_reuse(sp->verify_ws, sp->index->starkd, sp->index->cutnside, //# Modified for the StellarSolver Internal Library
                        mo, mo->sip, sp->vf, match_distance_in_pixels2,
                        sp->distractor_ratio,
                        sp->field_maxx, sp->field_maxy,
@@ -1631,6 +2035,8 @@ void solver_clear_indexes(solver_t* solver) {
 
 void solver_cleanup(solver_t* solver) {
     solver_free_field(solver);
+    verify_workspace_free(solver->verify_ws); //# Added for the StellarSolver Internal Library
+    solver->verify_ws = NULL;
     pl_free(solver->indexes);
     solver->indexes = NULL;
     if (solver->have_best_match) {
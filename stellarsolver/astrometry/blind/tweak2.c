@@ -188,7 +188,31 @@ static char* tdebugfn(const char* name) {
 
 #endif
 
-
+//# Added for the StellarSolver Internal Library
+// Projects the reference sources (unit vectors in "indexxyz", stored as
+// separate x, y and z arrays of "Nindex") into pixel space with the batch
+// SIP kernel, and keeps the ones inside the image bounds in "indexpix" and
+// "indexin".  "projpix" and "projok" are scratch space for Nindex points.
+static int project_index_stars(const sip_t* sip, const double* indexxyz, int Nindex,
+                               double* projpix, anbool* projok,
+                               double* indexpix, int* indexin) {
+    int i, Nin = 0;
+    sip_xyzarrs2pixelxy(sip, indexxyz, indexxyz + Nindex, indexxyz + 2*Nindex, Nindex,
+                        projpix, projpix + Nindex, projok);
+    for (i=0; i<Nindex; i++) {
+        double x = projpix[i];
+        double y = projpix[Nindex + i];
+        if (!projok[i])
+            continue;
+        if (!sip_pixel_is_inside_image(sip, x, y))
+            continue;
+        indexpix[Nin*2+0] = x;
+        indexpix[Nin*2+1] = y;
+        indexin[Nin] = i;
+        Nin++;
+    }
+    return Nin;
+}
 
 
 
@@ -214,6 +238,9 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
     sip_t* sipout;
     int* indexin;
     double* indexpix;
+    double* indexxyz; //# Added for the StellarSolver Internal Library
+    double* projpix; //# Added for the StellarSolver Internal Library
+    anbool* projok; //# Added for the StellarSolver Internal Library
     double* fieldsigma2s;
     double* weights;
     double* matchxyz;
@@ -240,6 +267,15 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
     matchxyz = malloc(Nfield * 3 * sizeof(double));
     matchxy = malloc(Nfield * 2 * sizeof(double));
 
+    //# Added for the StellarSolver Internal Library, the reference sources are
+    // converted to unit vectors once instead of on every annealing step.
+    indexxyz = malloc(Nindex * 3 * sizeof(double));
+    projpix = malloc(Nindex * 2 * sizeof(double));
+    projok = malloc(Nindex * sizeof(anbool));
+    for (i=0; i<Nindex; i++)
+        radecdeg2xyz(indexradec[2*i + 0], indexradec[2*i + 1],
+                     indexxyz + i, indexxyz + Nindex + i, indexxyz + 2*Nindex + i);
+
     // FIXME --- hmmm, how do the annealing steps and iterating up to
     // higher orders interact?
 
@@ -267,7 +303,6 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
         for (step=0; step<STEPS; step++) {
             double iscale;
             double ijitter;
-            double ra, dec;
             double R2;
             int Nmatch;
             int nmatch, nconf, ndist;
@@ -294,22 +329,8 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
                 sip_print_to(sipout); //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve conflict
 
             // Project reference sources into pixel space; keep the ones inside image bounds.
-            Nin = 0;
-            for (i=0; i<Nindex; i++) {
-                anbool ok;
-                double x,y;
-                ra  = indexradec[2*i + 0];
-                dec = indexradec[2*i + 1];
-                ok = sip_radec2pixelxy(sipout, ra, dec, &x, &y);
-                if (!ok)
-                    continue;
-                if (!sip_pixel_is_inside_image(sipout, x, y))
-                    continue;
-                indexpix[Nin*2+0] = x;
-                indexpix[Nin*2+1] = y;
-                indexin[Nin] = i;
-                Nin++;
-            }
+            Nin = project_index_stars(sipout, indexxyz, Nindex, projpix, projok,
+                                      indexpix, indexin); //# Modified for the StellarSolver Internal Library
             logverb("%i reference sources within the image.\n", Nin);
             //logverb("CRPIX is (%g,%g)\n", sip.wcstan.crpix[0], sip.wcstan.crpix[1]);
 
@@ -321,6 +342,9 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
                 free(fieldsigma2s);
                 free(indexpix);
                 free(indexin);
+                free(indexxyz); //# Added for the StellarSolver Internal Library
+                free(projpix); //# Added for the StellarSolver Internal Library
+                free(projok); //# Added for the StellarSolver Internal Library
                 return NULL;
             }
 
@@ -437,6 +461,9 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
                 free(fieldsigma2s);
                 free(indexpix);
                 free(indexin);
+                free(indexxyz); //# Added for the StellarSolver Internal Library
+                free(projpix); //# Added for the StellarSolver Internal Library
+                free(projok); //# Added for the StellarSolver Internal Library
                 free(testperm); //# Modified by Robert Lancaster for the StellarSolver Internal Library, fix memory leak
                 free(refperm); //# Modified by Robert Lancaster for the StellarSolver Internal Library, fix memory leak
                 testperm = NULL; //# Modified by Robert Lancaster for the StellarSolver Internal Library, Fix Memory Leak
@@ -495,7 +522,6 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
         double gamma = 1.0;
         double iscale;
         double ijitter;
-        double ra, dec;
         double R2;
         int nmatch, nconf, ndist;
         double pix2;
@@ -508,22 +534,8 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
         refperm = NULL; //# Modified by Robert Lancaster for the StellarSolver Internal Library, Fix Memory Leak
         gamma = 1.0;
         // Project reference sources into pixel space; keep the ones inside image bounds.
-        Nin = 0;
-        for (i=0; i<Nindex; i++) {
-            anbool ok;
-            double x,y;
-            ra  = indexradec[2*i + 0];
-            dec = indexradec[2*i + 1];
-            ok = sip_radec2pixelxy(sipout, ra, dec, &x, &y);
-            if (!ok)
-                continue;
-            if (!sip_pixel_is_inside_image(sipout, x, y))
-                continue;
-            indexpix[Nin*2+0] = x;
-            indexpix[Nin*2+1] = y;
-            indexin[Nin] = i;
-            Nin++;
-        }
+        Nin = project_index_stars(sipout, indexxyz, Nindex, projpix, projok,
+                                  indexpix, indexin); //# Modified for the StellarSolver Internal Library
         logverb("%i reference sources within the image.\n", Nin);
 
         iscale = sip_pixel_scale(sipout);
@@ -595,6 +607,9 @@ sip_t* tweak2(const double* fieldxy, int Nfield,
 
     free(indexin);
     free(indexpix);
+    free(indexxyz); //# Added for the StellarSolver Internal Library
+    free(projpix); //# Added for the StellarSolver Internal Library
+    free(projok); //# Added for the StellarSolver Internal Library
     free(fieldsigma2s);
     free(weights);
     free(matchxyz);
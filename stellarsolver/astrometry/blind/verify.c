@@ -62,10 +62,138 @@ struct verify_s {
     // temp storage
     int* tbadguys;
 
+    //# Added for the StellarSolver Internal Library
+    // scratch memory kept between matches, if any
+    verify_workspace_t* ws;
 };
 typedef struct verify_s verify_t;
 
 static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t* vf, double nsigmas);
+//# Added for the StellarSolver Internal Library
+static void uniformize_field_cached(verify_workspace_t* ws, const verify_field_t* vf,
+                                    int* perm, int N,
+                                    double fieldW, double fieldH,
+                                    int nw, int nh,
+                                    int** p_binids);
+
+//# Added for the StellarSolver Internal Library
+// The average number of neighbours a field star has within verify_field_t.nbr_r2.
+#define VERIFY_FIELD_NEIGHBOURS 8
+
+//# Added for the StellarSolver Internal Library
+// Sorts the neighbours of one star, nearest first.  There are only a few of them.
+static void sort_neighbours(int* ind, double* d2, int N) {
+    int i, j;
+    for (i=1; i<N; i++) {
+        int ti = ind[i];
+        double td2 = d2[i];
+        for (j=i; j>0 && d2[j-1] > td2; j--) {
+            ind[j] = ind[j-1];
+            d2[j] = d2[j-1];
+        }
+        ind[j] = ti;
+        d2[j] = td2;
+    }
+}
+
+//# Added for the StellarSolver Internal Library
+// Finds the neighbours of each field star for verify_deduplicate_field_stars(), see verify_field_t.
+// The radius is chosen so that there are a few neighbours per star; stars that need a larger
+// radius fall back to searching the kdtree.  The field stars are put in a uniform grid with cells
+// of that radius, so only the 3x3 cells around each star need to be looked at.
+static void verify_field_find_neighbours(verify_field_t* vf) {
+    int N = starxy_n(vf->field);
+    const double* xy = vf->xy;
+    double minx, maxx, miny, maxy, cell;
+    int nx, ny, ncells, i, k, pass, total;
+    int* cellof;
+    int* cellstart;
+    int* cellfill;
+    int* cellstars;
+
+    vf->nbr_r2 = 0;
+    vf->nbr_start = NULL;
+    vf->nbr_ind = NULL;
+    vf->nbr_d2 = NULL;
+    if (N < 2)
+        return;
+
+    minx = maxx = xy[0];
+    miny = maxy = xy[1];
+    for (i=1; i<N; i++) {
+        minx = MIN(minx, xy[2*i]);
+        maxx = MAX(maxx, xy[2*i]);
+        miny = MIN(miny, xy[2*i+1]);
+        maxy = MAX(maxy, xy[2*i+1]);
+    }
+    vf->nbr_r2 = VERIFY_FIELD_NEIGHBOURS * MAX(maxx - minx, 1.0) * MAX(maxy - miny, 1.0) / (M_PI * N);
+    cell = sqrt(vf->nbr_r2);
+    nx = (int)((maxx - minx) / cell) + 1;
+    ny = (int)((maxy - miny) / cell) + 1;
+    ncells = nx * ny;
+
+    cellof = malloc(N * sizeof(int));
+    cellstars = malloc(N * sizeof(int));
+    cellstart = calloc(ncells + 1, sizeof(int));
+    cellfill = malloc(ncells * sizeof(int));
+    for (i=0; i<N; i++) {
+        int cx = MIN(nx - 1, (int)((xy[2*i] - minx) / cell));
+        int cy = MIN(ny - 1, (int)((xy[2*i+1] - miny) / cell));
+        cellof[i] = cy * nx + cx;
+        cellstart[cellof[i] + 1]++;
+    }
+    for (k=0; k<ncells; k++) {
+        cellstart[k+1] += cellstart[k];
+        cellfill[k] = cellstart[k];
+    }
+    for (i=0; i<N; i++)
+        cellstars[cellfill[cellof[i]]++] = i;
+
+    // Count the neighbours, then fill them in.
+    vf->nbr_start = malloc((N + 1) * sizeof(int));
+    for (pass=0; pass<2; pass++) {
+        total = 0;
+        for (i=0; i<N; i++) {
+            int cx = cellof[i] % nx;
+            int cy = cellof[i] / nx;
+            int gx, gy;
+            if (pass == 0)
+                vf->nbr_start[i] = total;
+            for (gy=MAX(cy-1, 0); gy<=MIN(cy+1, ny-1); gy++)
+                for (gx=MAX(cx-1, 0); gx<=MIN(cx+1, nx-1); gx++) {
+                    int c = gy * nx + gx;
+                    for (k=cellstart[c]; k<cellstart[c+1]; k++) {
+                        int j = cellstars[k];
+                        double d2;
+                        if (j <= i)
+                            continue;
+                        d2 = distsq(xy + 2*i, xy + 2*j, 2);
+                        if (d2 > vf->nbr_r2)
+                            continue;
+                        if (pass == 1) {
+                            vf->nbr_ind[total] = j;
+                            vf->nbr_d2[total] = d2;
+                        }
+                        total++;
+                    }
+                }
+            if (pass == 1)
+                sort_neighbours(vf->nbr_ind + vf->nbr_start[i], vf->nbr_d2 + vf->nbr_start[i],
+                                total - vf->nbr_start[i]);
+        }
+        if (pass == 0) {
+            vf->nbr_start[N] = total;
+            vf->nbr_ind = malloc(MAX(total, 1) * sizeof(int));
+            vf->nbr_d2 = malloc(MAX(total, 1) * sizeof(double));
+        }
+    }
+    debug("Field deduplication: %i neighbours within %g pixels of %i stars.\n", total, cell, N);
+
+    free(cellof);
+    free(cellstars);
+    free(cellstart);
+    free(cellfill);
+}
 
 verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
     verify_field_t* vf;
@@ -96,6 +224,8 @@ verify_field_t* verify_field_preprocess(const starxy_t* fieldxy) {
     vf->do_dedup = TRUE;
     vf->do_ror = TRUE;
 
+    verify_field_find_neighbours(vf); //# Added for the StellarSolver Internal Library
+
     return vf;
 }
 
@@ -105,6 +235,10 @@ void verify_field_free(verify_field_t* vf) {
     kdtree_free(vf->ftree);
     free(vf->xy);
     free(vf->fieldcopy);
+    //# Added for the StellarSolver Internal Library
+    free(vf->nbr_start);
+    free(vf->nbr_ind);
+    free(vf->nbr_d2);
     free(vf);
 }
 
@@ -323,7 +457,11 @@ static void verify_apply_ror(verify_t* v,
 
         // uniformize!
         if (uni_nw > 1 || uni_nh > 1) {
-            verify_uniformize_field(vf->xy, v->testperm, v->NT, fieldW, fieldH, uni_nw, uni_nh, NULL, &binids);
+            //# Modified for the StellarSolver Internal Library, with the bins kept in the workspace
+            if (v->ws)
+                uniformize_field_cached(v->ws, vf, v->testperm, v->NT, fieldW, fieldH, uni_nw, uni_nh, &binids);
+            else
+                verify_uniformize_field(vf->xy, v->testperm, v->NT, fieldW, fieldH, uni_nw, uni_nh, NULL, &binids);
             bincenters = verify_uniformize_bin_centers(fieldW, fieldH, uni_nw, uni_nh);
 
             if (DEBUGVERIFY) {
@@ -445,7 +583,8 @@ static void verify_apply_ror(verify_t* v,
         free(goodbins);
     }
     free(bincenters);
-    free(binids);
+    if (!v->ws) //# Modified for the StellarSolver Internal Library, otherwise they belong to the workspace
+        free(binids);
 
     *p_effA = effA;
     if (p_uninw)
@@ -881,11 +1020,20 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
     }
     for (i=0; i<v->NT; i++) {
         double sxy[2];
+        double r2; //# Added for the StellarSolver Internal Library
         ti = v->testperm[i];
         if (!keepers[ti])
             continue;
+        //# Added for the StellarSolver Internal Library, use the neighbours found in verify_field_preprocess()
+        // when they reach far enough.  "testperm" is still in field order here, so "i" is "ti".
+        r2 = nsig2 * v->testsigma[ti];
+        if (vf->nbr_start && r2 <= vf->nbr_r2) {
+            for (j=vf->nbr_start[ti]; j<vf->nbr_start[ti+1] && vf->nbr_d2[j] <= r2; j++)
+                keepers[vf->nbr_ind[j]] = FALSE;
+            continue;
+        }
         starxy_get(vf->field, ti, sxy);
-        res = kdtree_rangesearch_options_reuse(vf->ftree, res, sxy, nsig2 * v->testsigma[ti], options);
+        res = kdtree_rangesearch_options_reuse(vf->ftree, res, sxy, r2, options);
         for (j=0; j<res->nres; j++) {
             int ind = res->inds[j];
             if (ind > i) {
@@ -900,7 +1048,8 @@ static anbool* verify_deduplicate_field_stars(verify_t* v, const verify_field_t*
             }
         }
     }
-    kdtree_free_query(res);
+    if (res) //# Modified for the StellarSolver Internal Library, there may have been no search
+        kdtree_free_query(res);
     return keepers;
 }
 
@@ -1001,6 +1150,76 @@ void verify_uniformize_field(const double* xy,
     free(lists);
 }
 
+//# Added for the StellarSolver Internal Library
+// verify_uniformize_field() for the stars of "vf", using the bins of the field stars that are kept in the workspace,
+// and counting sort instead of a list for each bin.  "*p_binids" belongs to the workspace.
+static void uniformize_field_cached(verify_workspace_t* ws, const verify_field_t* vf,
+                                    int* perm, int N,
+                                    double fieldW, double fieldH,
+                                    int nw, int nh,
+                                    int** p_binids) {
+    int NF = starxy_n(vf->field);
+    int nbins = nw * nh;
+    int i, k, p;
+
+    if (NF > ws->nfieldcap) {
+        ws->nfieldcap = MAX(NF, 2 * ws->nfieldcap);
+        ws->starbin = realloc(ws->starbin, ws->nfieldcap * sizeof(int));
+        ws->binned = realloc(ws->binned, ws->nfieldcap * sizeof(int));
+        ws->binids = realloc(ws->binids, ws->nfieldcap * sizeof(int));
+        ws->bin_field = NULL;
+        ws->nallocs += 3;
+    }
+    if (nbins + 1 > ws->nbincap) {
+        ws->nbincap = MAX(nbins + 1, 2 * ws->nbincap);
+        ws->binstart = realloc(ws->binstart, ws->nbincap * sizeof(int));
+        ws->nallocs++;
+    }
+    *p_binids = ws->binids;
+    if (N <= 0 || nw <= 0 || nh <= 0)
+        return;
+
+    if (ws->bin_field != vf || ws->bin_nw != nw || ws->bin_nh != nh ||
+        ws->bin_W != fieldW || ws->bin_H != fieldH) {
+        for (i=0; i<NF; i++)
+            ws->starbin[i] = get_xy_bin(vf->xy + 2*i, fieldW, fieldH, nw, nh);
+        ws->bin_field = vf;
+        ws->bin_nw = nw;
+        ws->bin_nh = nh;
+        ws->bin_W = fieldW;
+        ws->bin_H = fieldH;
+    }
+
+    // put the stars in the appropriate bins, keeping their order.
+    memset(ws->binstart, 0, (nbins + 1) * sizeof(int));
+    for (i=0; i<N; i++)
+        ws->binstart[ws->starbin[perm[i]] + 1]++;
+    for (k=0; k<nbins; k++)
+        ws->binstart[k+1] += ws->binstart[k];
+    for (i=0; i<N; i++) {
+        int bin = ws->starbin[perm[i]];
+        ws->binned[ws->binstart[bin]++] = perm[i];
+    }
+    // binstart[k] is now where bin k+1 starts.
+    for (k=nbins; k>0; k--)
+        ws->binstart[k] = ws->binstart[k-1];
+    ws->binstart[0] = 0;
+
+    // make sweeps through the bins, grabbing one star from each.
+    p=0;
+    for (k=0;; k++) {
+        for (i=0; i<nbins; i++) {
+            if (ws->binstart[i] + k >= ws->binstart[i+1])
+                continue;
+            perm[p] = ws->binned[ws->binstart[i] + k];
+            ws->binids[p] = i;
+            p++;
+        }
+        if (p == N)
+            break;
+    }
+}
+
 double* verify_uniformize_bin_centers(double fieldW, double fieldH,
                                       int nw, int nh) {
     int i,j;
@@ -1230,12 +1449,91 @@ void verify_count_hits(int* theta, int besti, int* p_nmatch, int* p_nconflict, i
 }
 
 
+//# Added for the StellarSolver Internal Library
+verify_workspace_t* verify_workspace_new(void) {
+    return calloc(1, sizeof(verify_workspace_t));
+}
+
+//# Added for the StellarSolver Internal Library
+void verify_workspace_free(verify_workspace_t* ws) {
+    if (!ws)
+        return;
+    if (ws->res)
+        kdtree_free_query(ws->res);
+    free(ws->x);
+    free(ws->y);
+    free(ws->z);
+    free(ws->px);
+    free(ws->py);
+    free(ws->ok);
+    free(ws->refxy);
+    free(ws->refstarid);
+    free(ws->refperm);
+    free(ws->sweep);
+    free(ws->badguys);
+    free(ws->starbin);
+    free(ws->binned);
+    free(ws->binstart);
+    free(ws->binids);
+    free(ws);
+}
+
+//# Added for the StellarSolver Internal Library
+void verify_workspace_forget_field(verify_workspace_t* ws) {
+    if (ws)
+        ws->bin_field = NULL;
+}
+
+//# Added for the StellarSolver Internal Library
+// Makes the arrays of the workspace big enough for N reference stars.
+static void verify_workspace_reserve(verify_workspace_t* ws, int N) {
+    int cap;
+    if (N <= ws->capacity)
+        return;
+    cap = MAX(N, MAX(2 * ws->capacity, 256));
+    ws->x = realloc(ws->x, cap * sizeof(double));
+    ws->y = realloc(ws->y, cap * sizeof(double));
+    ws->z = realloc(ws->z, cap * sizeof(double));
+    ws->px = realloc(ws->px, cap * sizeof(double));
+    ws->py = realloc(ws->py, cap * sizeof(double));
+    ws->ok = realloc(ws->ok, cap * sizeof(anbool));
+    ws->refxy = realloc(ws->refxy, cap * 2 * sizeof(double));
+    ws->refstarid = realloc(ws->refstarid, cap * sizeof(int));
+    ws->refperm = realloc(ws->refperm, cap * sizeof(int));
+    ws->sweep = realloc(ws->sweep, cap * sizeof(int));
+    ws->badguys = realloc(ws->badguys, cap * sizeof(int));
+    ws->capacity = cap;
+    ws->nallocs += 11;
+}
+
+//# Added for the StellarSolver Internal Library
+static void* verify_memdup(const void* data, size_t bytes) {
+    void* copy = malloc(MAX(bytes, 1));
+    memcpy(copy, data, bytes);
+    return copy;
+}
+
 void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
                 const sip_t* sip, const verify_field_t* vf,
                 double pix2, double distractors,
                 double fieldW, double fieldH,
                 double logbail, double logaccept, double logstoplooking,
                 anbool do_gamma, anbool fake_match) {
+    //# Modified for the StellarSolver Internal Library, callers that verify many matches keep a workspace and call verify_hit_reuse()
+    verify_workspace_t* ws = verify_workspace_new();
+    verify_hit_reuse(ws, skdt, index_cutnside, mo, sip, vf, pix2, distractors,
+                     fieldW, fieldH, logbail, logaccept, logstoplooking,
+                     do_gamma, fake_match);
+    verify_workspace_free(ws);
+}
+
+void verify_hit_reuse(verify_workspace_t* ws,
+                      const startree_t* skdt, int index_cutnside, MatchObj* mo,
+                      const sip_t* sip, const verify_field_t* vf,
+                      double pix2, double distractors,
+                      double fieldW, double fieldH,
+                      double logbail, double logaccept, double logstoplooking,
+                      anbool do_gamma, anbool fake_match) {
     int i,j;
     double* fieldcenter;
     double fieldr2;
@@ -1251,12 +1549,14 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
     verify_t* v = &the_v;
     int NRimage;
     int ibailed, istopped;
+    int rescap; //# Added for the StellarSolver Internal Library
 
     assert(mo->wcs_valid || sip);
     assert(isfinite(logaccept));
     assert(isfinite(logbail));
 
     memset(v, 0, sizeof(verify_t));
+    v->ws = ws; //# Added for the StellarSolver Internal Library
 
     if (sip)
         v->wcs = sip;
@@ -1302,22 +1602,45 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
      hold these indices temporarily.
      */
     assert(skdt->sweep);
+    ws->nverified++;
+    //# Modified for the StellarSolver Internal Library, the reference stars go in the workspace rather than
+    // new arrays; "refxyz", "v->refxy", "v->refstarid", "v->refperm" and "v->badguys" all belong to it.
     // Find all index stars within the bounding circle of the field.
-    startree_search_for(skdt, fieldcenter, fieldr2, &refxyz, NULL, &v->refstarid, &v->NRall);
+    rescap = ws->res ? ws->res->capacity : -1;
+    ws->res = kdtree_rangesearch_options_reuse(skdt->tree, ws->res, fieldcenter, fieldr2,
+                                               KD_OPTIONS_SMALL_RADIUS | KD_OPTIONS_RETURN_POINTS |
+                                               KD_OPTIONS_NO_RESIZE_RESULTS);
+    if (ws->res && ws->res->capacity != rescap)
+        ws->nallocs++;
+    v->NRall = ws->res ? ws->res->nres : 0;
     debug2("%i reference stars in the bounding circle\n", v->NRall);
-    if (!refxyz) {
+    if (!v->NRall) {
         // no stars in range.
         logverb("No reference stars in the bounding circle\n");
         goto bailout;
     }
+    refxyz = ws->res->results.d;
+    verify_workspace_reserve(ws, v->NRall);
+    v->refstarid = ws->refstarid;
+    v->refxy = ws->refxy;
+    v->refperm = ws->refperm;
+    sweep = ws->sweep;
+    // Project them into pixel space as separate x and y arrays, so the projection can be vectorized.
+    for (i=0; i<v->NRall; i++) {
+        v->refstarid[i] = ws->res->inds[i];
+        ws->x[i] = refxyz[i*3 + 0];
+        ws->y[i] = refxyz[i*3 + 1];
+        ws->z[i] = refxyz[i*3 + 2];
+    }
+    sip_xyzarrs2pixelxy(v->wcs, ws->x, ws->y, ws->z, v->NRall, ws->px, ws->py, ws->ok);
     //logverb("Found %i reference stars in the bounding circle\n", v->NRall);
     // Find index stars within the rectangular field.
-    v->refxy = malloc(v->NRall * 2 * sizeof(double));
-    v->refperm = malloc(v->NRall * sizeof(int));
     igood = 0;
     for (i=0; i<v->NRall; i++) {
-        if (!sip_xyzarr2pixelxy(v->wcs, refxyz+i*3, v->refxy+i*2, v->refxy+i*2 +1) ||
-            !sip_pixel_is_inside_image(v->wcs, v->refxy[i*2], v->refxy[i*2+1])) {
+        v->refxy[i*2 + 0] = ws->px[i];
+        v->refxy[i*2 + 1] = ws->py[i];
+        if (!ws->ok[i] ||
+            !sip_pixel_is_inside_image(v->wcs, ws->px[i], ws->py[i])) {
             continue;
         }
         v->refperm[igood] = i;
@@ -1338,20 +1661,18 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
     // bottom "NRimage" of the "refperm" array will be accessed in the
     // permuted_sort below, so none of
     // the elements between NRimage and NRall will be touched.)
-    sweep = malloc(v->NRall * sizeof(int));
     for (i=0; i<v->NRall; i++)
         sweep[i] = skdt->sweep[v->refstarid[i]];
     // Note here that we're passing in an existing permutation array; it
     // gets re-permuted during this call.
     permuted_sort(sweep, sizeof(int), compare_ints_asc, v->refperm, v->NR);
-    free(sweep);
     sweep = NULL;
     debug2("Found %i reference stars.\n", v->NR);
 
     // "refstarids" are indices into the star kdtree and could be used to
     // retrieve "tag-along" data with, eg, startree_get_data_column().
 
-    v->badguys = malloc(v->NR * sizeof(int));
+    v->badguys = ws->badguys;
 
     // remove reference stars that are part of the quad.
     if (!fake_match) {
@@ -1478,12 +1799,10 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
 
         mo->theta = etheta;
         mo->matchodds = eodds;
-        mo->refxyz = refxyz;
-        refxyz = NULL;
-        mo->refxy = v->refxy;
-        v->refxy = NULL;
-        mo->refstarid = v->refstarid;
-        v->refstarid = NULL;
+        //# Modified for the StellarSolver Internal Library, the match gets copies, the workspace keeps its arrays.
+        mo->refxyz = verify_memdup(refxyz, v->NRall * 3 * sizeof(double));
+        mo->refxy = verify_memdup(v->refxy, v->NRall * 2 * sizeof(double));
+        mo->refstarid = verify_memdup(v->refstarid, v->NRall * sizeof(int));
         mo->testperm = v->testperm;
         v->testperm = NULL;
 
@@ -1491,16 +1810,12 @@ void verify_hit(const startree_t* skdt, int index_cutnside, MatchObj* mo,
     }
 
  cleanup:
-    free(refxyz);
+    //# Modified for the StellarSolver Internal Library, the reference star arrays belong to the workspace
     free(theta);
     free(allodds);
     free(v->testperm);
     free(v->testsigma);
     free(v->tbadguys);
-    free(v->refperm);
-    free(v->refxy);
-    free(v->refstarid);
-    free(v->badguys);
     return;
 
  bailout:
@@ -42,6 +42,12 @@ struct blind_params {
     // WCS instances to verify.  (sip_t structs)
     bl* verify_wcs_list;
 
+    //# Added for the StellarSolver Internal Library
+    // How far, in pixels, each WCS in verify_wcs_list may be off, in the same
+    // order.  One that may be off by more than the verification tolerance is
+    // moved to where the index stars line up with the field stars first.
+    dl* verify_wcs_offsets;
+
     // Output solved file.
     char *solved_out;
     // Input solved file.
@@ -106,7 +112,7 @@ struct blind_params {
     anbool hit_cpulimit;
 
     int timelimit;
-    time_t time_start;
+    double time_start; //# Modified for the StellarSolver Internal Library, on the timenow_monotonic() clock like time_total_start
     anbool hit_timelimit;
 
     float total_cpulimit;
@@ -117,12 +123,27 @@ struct blind_params {
     double time_total_start;
     anbool hit_total_timelimit;
 
+    //# Added for the StellarSolver Internal Library
+    // If non-zero, the timenow_monotonic() time at which to give up.  It counts as
+    // reaching the total time limit.
+    double deadline;
+
+    //# Added for the StellarSolver Internal Library
+    // The position in verify_wcs_list of the WCS that solved the field, or -1.
+    int verified_wcs;
+
     anbool single_field_solved;
 
     // filename for cancelling
     char* cancelfname;
     anbool cancelled;
 
+    //# Added for the StellarSolver Internal Library
+    // Called with "cancel_userdata" to find out whether another thread has
+    // cancelled the run.  "cancelled" is only set from it, on the solving thread.
+    anbool (*cancel_callback)(void* userdata);
+    void* cancel_userdata;
+
     anbool best_hit_only;
 };
 typedef struct blind_params blind_t;
@@ -142,6 +163,8 @@ void blind_set_xcol(blind_t* bp, const char* x);
 void blind_set_ycol(blind_t* bp, const char* x);
 
 void blind_add_verify_wcs(blind_t* bp, sip_t* wcs);
+//# Added for the StellarSolver Internal Library, adds a WCS that may be off by up to "offset" pixels.
+void blind_add_verify_wcs_near(blind_t* bp, sip_t* wcs, double offset);
 void blind_add_loaded_index(blind_t* bp, index_t* ind);
 void blind_add_index(blind_t* bp, const char* index);
 
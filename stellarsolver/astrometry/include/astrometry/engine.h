@@ -24,6 +24,23 @@ struct engine {
 
     // indexes that need to be freed
     pl* free_indexes;
+    //# Added for the StellarSolver Internal Library
+    // indexes that belong to the caller and are shared with other engines.  They may be
+    // metadata-only; with "inparallel", "load_shared_index" is called to load one before it is used, and to apply
+    // the residency policy for as long as the caller holds it.  Without "inparallel", the ones that are not
+    // loaded are searched by name, like the engine's own indexes.  "shared_index_bytes" tells how many
+    // bytes of the shared indexes are already loaded, so they count against "index_memory_budget".
+    pl* shared_indexes;
+    int (*load_shared_index)(index_t* ind, const index_residency_t* residency, void* userdata);
+    size_t (*shared_index_bytes)(void* userdata);
+    void* load_shared_index_userdata;
+    //# Added for the StellarSolver Internal Library
+    // how the loaded indexes selected for a job are kept in memory
+    index_residency_t residency;
+    //# Added for the StellarSolver Internal Library
+    // with "inparallel", the bytes of indexes that may be kept loaded, 0 for no limit.  This includes the
+    // shared indexes that are already loaded.  The indexes that don't fit are searched one at a time after the loaded ones.
+    size_t index_memory_budget;
     // multiindexes that need to be freed
     //pl* free_mindexes; //# Modified by Robert Lancaster for the StellarSolver Internal Library
 
@@ -59,6 +76,9 @@ void engine_add_search_path(engine_t* engine, const char* path);
 char* engine_find_index(engine_t*, const char* name);
 // note that "path" must be a full path name.
 int engine_add_index(engine_t* engine, char* path);
+//# Added for the StellarSolver Internal Library: add an index that is owned by the caller and may be shared
+// with other engines.  The engine will not free it.
+int engine_add_shared_index(engine_t* engine, index_t* ind);
 // look in all the search path directories for index files.
 int engine_autoindex_search_paths(engine_t* engine);
 int engine_parse_config_file_stream(engine_t* engine, FILE* fconf);
@@ -156,6 +156,61 @@ void index_unload(index_t* index);
 
 int index_reload(index_t* index);
 
+//# Added for the StellarSolver Internal Library
+/**
+ Sets the index name and the quad, code and star filenames of an index
+ whose metadata was filled in by the caller (for example from a
+ manifest), without opening any files.  The files are opened by
+ index_reload().
+ */
+int index_set_filenames(index_t* index, const char* indexname);
+
+//# Added for the StellarSolver Internal Library
+/**
+ How the memory mapped files of a loaded index are kept in memory, see
+ index_apply_residency().
+ */
+struct index_residency {
+    // Start reading the star tree, code tree and quads in the background,
+    // so the solver doesn't wait on page faults (MADV_WILLNEED).
+    anbool prefetch;
+    // The code tree is searched in no particular order, so turn off
+    // readahead on its page faults (MADV_RANDOM).
+    anbool random_codes;
+    // Lock up to this many bytes of the top levels of each kd-tree in memory,
+    // 0 for none.  These are read by every search.
+    size_t lock_tree_tops;
+};
+typedef struct index_residency index_residency_t;
+
+/**
+ Gives the kernel the access hints of the residency policy for the files
+ of a loaded index.  The hints are only hints, so failures are ignored.
+ */
+void index_apply_residency(index_t* index, const index_residency_t* residency);
+
+//# Added for the StellarSolver Internal Library
+/**
+ Undoes index_apply_residency() with the same policy: unlocks the tree
+ tops and goes back to the default paging, so the kernel may page the
+ index out again.
+ */
+void index_release_residency(index_t* index, const index_residency_t* residency);
+
+//# Added for the StellarSolver Internal Library
+/**
+ A rough estimate of the bytes a loaded index takes, from its metadata, so
+ it can be used before the index is loaded.
+ */
+size_t index_memory_estimate(const index_t* index);
+
+//# Added for the StellarSolver Internal Library
+/**
+ Whether the quad, code and star files of an index are loaded, that is,
+ it is not metadata-only.
+ */
+anbool index_is_loaded(const index_t* index);
+
 /**
  Closes the FILE*s in this index.  Once you have index_reload()ed,
  you can call this function and the index will remain valid.
@@ -99,6 +99,27 @@ void get_mmap_size(size_t start, size_t size, off_t* mapstart, size_t* mapsize,
 char* mmap_file(int fildes, off_t mapsize);
 #endif
 
+//# Added for the StellarSolver Internal Library
+// How a range of memory mapped file data is going to be read, see memory_advise().
+enum memory_advice {
+    MEMORY_ADVICE_NORMAL,
+    // read in no particular order, so reading ahead of a page fault is wasted
+    MEMORY_ADVICE_RANDOM,
+    // needed soon, so start reading it in the background
+    MEMORY_ADVICE_WILLNEED,
+};
+
+// Passes the advice on to madvise().  The range need not be page aligned.
+// Returns 0 on success, -1 if it failed or this system doesn't take advice.
+int memory_advise(const void* start, size_t size, enum memory_advice advice);
+
+// Locks a range of memory so it is never paged out, with mlock().  The range need not be page aligned.
+// The lock goes away when the memory is unmapped.  Returns 0 on success.
+int memory_lock(const void* start, size_t size);
+
+// Unlocks a range locked with memory_lock(), so it can be paged out again.  Returns 0 on success.
+int memory_unlock(const void* start, size_t size);
+
 // If "dir" is NULL, create temp file in $TMP, or /tmp if not set.
 char* create_temp_file(const char* fn, const char* dir);
 
@@ -45,6 +45,9 @@ enum kd_rangesearch_options {
     KD_OPTIONS_NO_RESIZE_RESULTS = 0x100
 };
 
+//# Added for the StellarSolver Internal Library: the most query points in one kdtree_rangesearch_multi_reuse() call.
+#define KD_MULTI_MAX 32
+
 enum kd_build_options {
     KD_BUILD_BBOX           = 0x1,
     KD_BUILD_SPLIT          = 0x2,
@@ -139,6 +142,8 @@ struct kdtree_funcs {
 
     void  (*nearest_neighbour_internal)(const kdtree_t* kd, const void* query, double* bestd2, int* pbest);
     kdtree_qres_t* (*rangesearch)(const kdtree_t* kd, kdtree_qres_t* res, const void* pt, double maxd2, int options);
+    //# Added for the StellarSolver Internal Library
+    int (*rangesearch_multi)(const kdtree_t* kd, kdtree_qres_t** results, const void* pts, int N, double maxd2, int options);
 
     void (*nodes_contained)(const kdtree_t* kd,
                             const void* querylow, const void* queryhi,
@@ -586,6 +591,15 @@ kdtree_t* KDFUNC(kdtree_build)
                                                                                                                                                      */
                                                                                                                                                     kdtree_qres_t* KDFUNC(kdtree_rangesearch_options_reuse)(const kdtree_t *kd, kdtree_qres_t* res, const void *pt, double maxd2, int options);
 
+/*
+ //# Added for the StellarSolver Internal Library
+ Like kdtree_rangesearch_options_reuse, for "N" query points (at most
+ KD_MULTI_MAX) stored one after another in "pts".  The tree is walked
+ once for all of them.  The results for query i go in results[i],
+ which may be NULL or a kdtree_qres_t* to reuse.  Returns 0 on success.
+ */
+int KDFUNC(kdtree_rangesearch_multi_reuse)(const kdtree_t *kd, kdtree_qres_t** results, const void *pts, int N, double maxd2, int options);
+
 #if !defined(KD_DIM)
 #undef KD_DIM_GENERIC
 #endif
@@ -108,6 +108,14 @@ void setAstroLogger(AstrometryLogger* logger);
 
 int log_get_level(void);
 
+//# Added for the StellarSolver Internal Library
+/**
+ Copy the calling thread's logging settings, or replace them, so that
+ worker threads can log the same way as the thread that started them.
+ */
+void log_get_settings(log_t* settings);
+void log_set_settings(const log_t* settings);
+
 FILE* log_get_fid(void);
 
 extern log_t _logger_global;
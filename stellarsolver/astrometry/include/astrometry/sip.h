@@ -149,6 +149,29 @@ anbool sip_xyzarr2pixelxy(const sip_t* sip, const double* xyz, double *px, doubl
 WarnUnusedResult
 anbool sip_xyz2pixelxy(const sip_t* sip, double x, double y, double z, double *px, double *py);
 
+//# Added for the StellarSolver Internal Library
+/*
+ Like sip_xyzarr2pixelxy for "N" unit vectors stored as separate x, y and z
+ arrays.  "ok[i]" is set to whether point i could be projected (it is on the
+ same side of the sky as CRVAL); px, py are only valid where it is.
+ */
+void sip_xyzarrs2pixelxy(const sip_t* sip, const double* x, const double* y, const double* z,
+                         int N, double* px, double* py, anbool* ok);
+
+//# Added for the StellarSolver Internal Library
+/*
+ Like sip_radec2pixelxy for "N" points; "ok" is as in sip_xyzarrs2pixelxy.
+ */
+void sip_radec2pixelxyarrs(const sip_t* sip, const double* ra, const double* dec, int N,
+                           double* px, double* py, anbool* ok);
+
+//# Added for the StellarSolver Internal Library
+/*
+ Like sip_pixelxy2radec for "N" points, RA,Dec in degrees.
+ */
+void sip_pixelxy2radecarrs(const sip_t* sip, const double* px, const double* py, int N,
+                           double* ra, double* dec);
+
 // Pixels to Intermediate World Coordinates in degrees.
 void sip_pixelxy2iwc(const sip_t* sip, double px, double py,
                      double *iwcx, double* iwcy);
@@ -163,6 +186,13 @@ double sip_pixel_scale(const sip_t* sip);
 // these take *relative* pixel coords (WRT crpix)
 void   sip_calc_inv_distortion(const sip_t* sip, double U, double V, double* u, double *v);
 void   sip_calc_distortion(const sip_t* sip, double u, double v, double* U, double *V);
+
+//# Added for the StellarSolver Internal Library
+// like the two above for "N" points; the outputs may be the same arrays as the inputs.
+void sip_calc_inv_distortion_arrs(const sip_t* sip, const double* U, const double* V, int N,
+                                  double* u, double* v);
+void sip_calc_distortion_arrs(const sip_t* sip, const double* u, const double* v, int N,
+                              double* U, double* V);
       
 // Applies forward SIP distortion to pixel coords.
 // This applies the A,B matrix terms;
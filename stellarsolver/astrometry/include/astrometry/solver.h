@@ -136,12 +136,40 @@ struct solver_t {
     // calling again.  The parameter is "userdata".
     time_t (*timer_callback)(void*);
 
+    //# Added for the StellarSolver Internal Library
+    // Parallel quad search: if "parallel_for" is set, solver_run() splits the
+    // quads built with each new field star into work items and hands them to
+    // it.  It must call run(worker, item, arg) once for every item in
+    // [0, nitems), from at most "parallel_workers" threads at a time, where
+    // "worker" in [0, parallel_workers) is different for each of the threads
+    // running at the same time, and return when all of the items are done.
+    // "parallel_lock" must lock (lock=TRUE) or unlock a mutex; matches are
+    // recorded, and "quit_now" is read and written, with it held while the
+    // workers run.  "parallel_baton" is passed to both.
+    void (*parallel_for)(void* baton, int nitems,
+                         void (*run)(int worker, int item, void* arg), void* arg);
+    void (*parallel_lock)(void* baton, anbool lock);
+    void* parallel_baton;
+    int parallel_workers;
+
     // FIELDS THAT AFFECT THE RUNNING SOLVER ON CALLBACK
     // =================================================
 
     // Bail out ASAP.
     anbool quit_now;
 
+    //# Added for the StellarSolver Internal Library
+    // If "cancel_callback" is set, solver_run() bails out soon after it
+    // returns TRUE.  It is called on the solving thread with
+    // "cancel_userdata", so whatever it reads when another thread cancels the
+    // run has to be an atomic, like a std::atomic<bool>.  If "deadline" is
+    // non-zero, it bails out once timenow_monotonic() passes it.  Both are
+    // checked every few hundred quads and before each verification, rather
+    // than once a second like "timer_callback".
+    anbool (*cancel_callback)(void* userdata);
+    void* cancel_userdata;
+    double deadline;
+
     // SOLVER OUTPUTS
     // ==============
     // NOTE: these are only incremented, not initialized.  It's up to you to set
@@ -161,6 +189,11 @@ struct solver_t {
     int num_abscale_skipped;
     // The number of times we ran verification on a quad.
     int num_verified;
+    //# Added for the StellarSolver Internal Library
+    // Memory used for the "potential quad" (pquad) storage in solver_run():
+    // total bytes and number of heap allocations.
+    size_t pquad_bytes;
+    int pquad_allocs;
 
     // INTERNAL PARAMETERS; DO NOT MODIFY
     // ==================================
@@ -204,6 +237,14 @@ struct solver_t {
 
     // Cached data about this field, for verify_hit().
     verify_field_t* vf;
+    //# Added for the StellarSolver Internal Library
+    // Scratch memory for verify_hit_reuse(), created when it is first needed.
+    verify_workspace_t* verify_ws;
+
+    //# Added for the StellarSolver Internal Library
+    // For the copies of the solver used by the parallel quad search, the
+    // solver they were copied from.
+    struct solver_t* parallel_parent;
 };
 typedef struct solver_t solver_t;
 
@@ -24,4 +24,9 @@ double millis_between(struct timeval* tv1, struct timeval* tv2);
 // You probably only want to look at differences in the values returned by this function.
 double timenow();
 
+//# Added for the StellarSolver Internal Library
+// Returns seconds on a monotonic clock, which doesn't jump when the system time is changed.
+// Only differences in its values mean anything.
+double timenow_monotonic();
+
 #endif
@@ -28,6 +28,17 @@ struct verify_field_t {
     anbool do_dedup;
     // apply radius-of-relevance filtering
     anbool do_ror;
+
+    //# Added for the StellarSolver Internal Library
+    // For each field star, the fainter field stars (those with larger indices)
+    // within "nbr_r2" pixels^2 of it, nearest first: those of star i are
+    // nbr_ind[nbr_start[i]] up to nbr_ind[nbr_start[i+1]-1], at distances^2
+    // nbr_d2[].  They are found once, with a uniform grid, so deduplicating
+    // the field for each match doesn't need a kdtree search per star.
+    double nbr_r2;
+    int* nbr_start;
+    int* nbr_ind;
+    double* nbr_d2;
 };
 typedef struct verify_field_t verify_field_t;
 
@@ -105,6 +116,84 @@ void verify_hit(const startree_t* skdt,
                 anbool distance_from_quad_bonus,
                 anbool fake_match);
 
+//# Added for the StellarSolver Internal Library
+/*
+ Scratch memory for verify_hit_reuse(), kept between calls so that fetching
+ and projecting the reference stars of each match doesn't allocate.  The
+ arrays only grow.  A workspace must only be used by one thread at a time.
+ */
+struct verify_workspace_t {
+    // the star kdtree search results
+    kdtree_qres_t* res;
+    // the number of reference stars the arrays below can hold
+    int capacity;
+    // reference star unit vectors and their pixel positions, as separate
+    // arrays, and whether each could be projected.
+    double* x;
+    double* y;
+    double* z;
+    double* px;
+    double* py;
+    anbool* ok;
+    // the reference star arrays verify_hit() used to allocate for every match
+    double* refxy;
+    int* refstarid;
+    int* refperm;
+    int* sweep;
+    int* badguys;
+    // the number of matches verified with this workspace, and the number of
+    // allocations it made for them.
+    int nverified;
+    int nallocs;
+
+    // The uniformization bin of each star of the field "bin_field", for
+    // bin_nw x bin_nh bins over bin_W x bin_H pixels.  Matches from indexes
+    // with the same scale use the same bins, so they are kept for the next one.
+    const struct verify_field_t* bin_field;
+    int bin_nw;
+    int bin_nh;
+    double bin_W;
+    double bin_H;
+    int* starbin;
+    // the stars of each bin and where each bin starts, and the bin of each
+    // star after uniformizing.
+    int* binned;
+    int* binstart;
+    int* binids;
+    int nfieldcap;
+    int nbincap;
+};
+typedef struct verify_workspace_t verify_workspace_t;
+
+verify_workspace_t* verify_workspace_new(void);
+
+void verify_workspace_free(verify_workspace_t* ws);
+
+/*
+ Drops what the workspace remembers about a field; call it before the field
+ is freed.
+ */
+void verify_workspace_forget_field(verify_workspace_t* ws);
+
+/*
+ Like verify_hit(), using the scratch memory in "ws".
+ */
+void verify_hit_reuse(verify_workspace_t* ws,
+                      const startree_t* skdt,
+                      int index_cutnside,
+                      MatchObj* mo,
+                      const sip_t* sip,
+                      const verify_field_t* vf,
+                      double verify_pix2,
+                      double distractors,
+                      double fieldW,
+                      double fieldH,
+                      double logratio_tobail,
+                      double logratio_toaccept,
+                      double logratio_tostoplooking,
+                      anbool distance_from_quad_bonus,
+                      anbool fake_match);
+
 // Distractor
 #define THETA_DISTRACTOR -1
 // Conflict
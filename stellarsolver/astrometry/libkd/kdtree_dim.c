@@ -50,4 +50,9 @@ kdtree_qres_t* KDFUNC(kdtree_rangesearch_options_reuse)
     return kd->fun.rangesearch(kd, res, pt, maxd2, options);
 }
 
-
+//# Added for the StellarSolver Internal Library
+int KDFUNC(kdtree_rangesearch_multi_reuse)
+     (const kdtree_t *kd, kdtree_qres_t** results, const void *pts, int N, double maxd2, int options) {
+    assert(kd->fun.rangesearch_multi);
+    return kd->fun.rangesearch_multi(kd, results, pts, N, maxd2, options);
+}
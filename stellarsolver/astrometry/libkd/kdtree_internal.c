@@ -410,7 +410,7 @@ static void compute_splitbits(kdtree_t* kd) {
 /* Sorts results by kq->sdists */
 static int kdtree_qsort_results(kdtree_qres_t *kq, int D) {
     int beg[KDTREE_MAX_RESULTS], end[KDTREE_MAX_RESULTS], i = 0, j, L, R;
-    static etype piv_vec[KDTREE_MAX_DIM];
+    etype piv_vec[KDTREE_MAX_DIM]; //# Modified for the StellarSolver Internal Library, not static so that trees can be searched from several threads
     unsigned int piv_perm;
     double piv;
 
@@ -1445,6 +1445,191 @@ kdtree_qres_t* MANGLE(kdtree_rangesearch_options)
 }
 
 
+//# Added for the StellarSolver Internal Library
+static anbool prepare_results(kdtree_qres_t** pres, int D,
+                              anbool do_dists, anbool do_points) {
+    kdtree_qres_t* res = *pres;
+    if (res) {
+        if (!res->capacity)
+            resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
+        else
+            resize_results(res, res->capacity, D, do_dists, do_points);
+        res->nres = 0;
+    } else {
+        res = CALLOC(1, sizeof(kdtree_qres_t));
+        if (!res) {
+            SYSERROR("Failed to allocate kdtree_qres_t struct");
+            return FALSE;
+        }
+        resize_results(res, KDTREE_MAX_RESULTS, D, do_dists, do_points);
+        *pres = res;
+    }
+    return TRUE;
+}
+
+/*
+ //# Added for the StellarSolver Internal Library
+ Range search for up to KD_MULTI_MAX query points at once.  The tree is
+ walked a single time; each node carries a bit mask of the queries that
+ can still reach it, so nearby queries share the upper levels of the
+ tree instead of each starting again from the root.  Only trees with
+ split planes are walked this way; trees with only bounding boxes fall
+ back to one search per query.  The set of results for each query is
+ the same as kdtree_rangesearch_options() gives, only the order within
+ one query's results can differ.
+ */
+int MANGLE(kdtree_rangesearch_multi)
+     (const kdtree_t* kd, kdtree_qres_t** results, const void* vqueries,
+      int nq, double maxd2, int options)
+{
+    int nodestack[100];
+    u32 maskstack[100];
+    int stackpos = 0;
+    int D = kd->ndim;
+    int q;
+    anbool do_dists, do_points = TRUE;
+    anbool use_tsplit = TRUE;
+    double maxdist;
+    ttype tlinf = 0;
+    ttype* tqueries = NULL;
+    const etype* queries = vqueries;
+    u32 allmask;
+
+    if (nq <= 0)
+        return 0;
+    assert(nq <= KD_MULTI_MAX);
+#if defined(KD_DIM)
+    D = KD_DIM;
+#endif
+
+    if (!kd->split.any) {
+        for (q=0; q<nq; q++) {
+            results[q] = MANGLE(kdtree_rangesearch_options)(kd, results[q], queries + q*D, maxd2, options);
+            if (!results[q])
+                return -1;
+        }
+        return 0;
+    }
+
+    if (options & KD_OPTIONS_SORT_DISTS)
+        options |= KD_OPTIONS_COMPUTE_DISTS;
+    do_dists = options & KD_OPTIONS_COMPUTE_DISTS;
+    maxdist = sqrt(maxd2);
+
+    for (q=0; q<nq; q++)
+        if (!prepare_results(results + q, D, do_dists, do_points))
+            return -1;
+
+    // Use integer split comparisons, like kdtree_rangesearch_options(), if every query fits.
+    if (TTYPE_INTEGER) {
+        double dtlinf = DIST_ET(kd, maxdist, );
+        tqueries = MALLOC((size_t)nq * D * sizeof(ttype));
+        use_tsplit = (tqueries && dtlinf < TTYPE_MAX);
+        for (q=0; use_tsplit && q<nq; q++)
+            use_tsplit = ttype_query(kd, queries + q*D, tqueries + q*D);
+        tlinf = ceil(dtlinf);
+    } else
+        use_tsplit = FALSE;
+
+    allmask = (nq == 32) ? 0xffffffffu : ((1u << nq) - 1);
+    nodestack[0] = 0;
+    maskstack[0] = allmask;
+
+    while (stackpos >= 0) {
+        int nodeid = nodestack[stackpos];
+        u32 mask = maskstack[stackpos];
+        u32 leftmask = 0, rightmask = 0;
+        int dim = -1;
+        ttype split;
+        stackpos--;
+
+        if (KD_IS_LEAF(kd, nodeid)) {
+            int i;
+            int L = kdtree_left(kd, nodeid);
+            int R = kdtree_right(kd, nodeid);
+            for (i=L; i<=R; i++) {
+                const dtype* data = KD_DATA(kd, D, i);
+                for (q=0; q<nq; q++) {
+                    anbool bailedout = FALSE;
+                    double dsqd = HUGE_VAL;
+                    if (!(mask & (1u << q)))
+                        continue;
+                    if (do_dists) {
+                        dist2_bailout(kd, queries + q*D, data, D, maxd2, &bailedout, &dsqd);
+                        if (bailedout)
+                            continue;
+                    } else if (dist2_exceeds(kd, queries + q*D, data, D, maxd2))
+                        continue;
+                    if (!add_result(kd, results[q], dsqd, KD_PERM(kd, i), data,
+                                    D, do_dists, do_points)) {
+                        FREE(tqueries);
+                        return -1;
+                    }
+                }
+            }
+            continue;
+        }
+
+        split = *KD_SPLIT(kd, nodeid);
+        if (kd->splitdim)
+            dim = kd->splitdim[nodeid];
+        else if (TTYPE_INTEGER) {
+            bigint tmpsplit = split;
+            dim = tmpsplit & kd->dimmask;
+            split = tmpsplit & kd->splitmask;
+        }
+
+        for (q=0; q<nq; q++) {
+            if (!(mask & (1u << q)))
+                continue;
+            if (use_tsplit) {
+                ttype tq = tqueries[q*D + dim];
+                if (tq < split) {
+                    leftmask |= (1u << q);
+                    if (split - tq <= tlinf)
+                        rightmask |= (1u << q);
+                } else {
+                    rightmask |= (1u << q);
+                    if (tq - split <= tlinf)
+                        leftmask |= (1u << q);
+                }
+            } else {
+                etype qd = queries[q*D + dim];
+                etype rsplit = POINT_TE(kd, dim, split);
+                if (qd < rsplit) {
+                    leftmask |= (1u << q);
+                    if (rsplit - qd <= maxdist)
+                        rightmask |= (1u << q);
+                } else {
+                    rightmask |= (1u << q);
+                    if (qd - rsplit <= maxdist)
+                        leftmask |= (1u << q);
+                }
+            }
+        }
+        if (rightmask) {
+            stackpos++;
+            nodestack[stackpos] = KD_CHILD_RIGHT(nodeid);
+            maskstack[stackpos] = rightmask;
+        }
+        if (leftmask) {
+            stackpos++;
+            nodestack[stackpos] = KD_CHILD_LEFT(nodeid);
+            maskstack[stackpos] = leftmask;
+        }
+    }
+    FREE(tqueries);
+
+    for (q=0; q<nq; q++) {
+        if (!(options & KD_OPTIONS_NO_RESIZE_RESULTS))
+            resize_results(results[q], results[q]->nres, D, do_dists, do_points);
+        if (options & KD_OPTIONS_SORT_DISTS)
+            kdtree_qsort_results(results[q], kd->ndim);
+    }
+    return 0;
+}
+
+
 static void* get_data(const kdtree_t* kd, int i) {
     return KD_DATA(kd, kd->ndim, i);
 }
@@ -2999,6 +3184,7 @@ void MANGLE(kdtree_update_funcs)(kdtree_t* kd) {
     kd->fun.fix_bounding_boxes = MANGLE(kdtree_fix_bounding_boxes);
     kd->fun.nearest_neighbour_internal = MANGLE(kdtree_nn);
     kd->fun.rangesearch = MANGLE(kdtree_rangesearch_options);
+    kd->fun.rangesearch_multi = MANGLE(kdtree_rangesearch_multi); //# Added for the StellarSolver Internal Library
     kd->fun.nodes_contained = MANGLE(kdtree_nodes_contained);
 }
 
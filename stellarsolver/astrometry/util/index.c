@@ -390,7 +390,30 @@ index_t* index_load(const char* indexname, int flags, index_t* dest) {
     return NULL;
 }
 
+//# Added for the StellarSolver Internal Library
+int index_set_filenames(index_t* index, const char* indexname) {
+    anbool singlefile;
+    free(index->indexname);
+    free(index->quadfn);
+    free(index->codefn);
+    free(index->starfn);
+    index->indexname = strdup(indexname);
+    get_filenames(indexname, &(index->quadfn), &(index->codefn), &(index->starfn),
+                  &singlefile);
+    return 0;
+}
+
 int index_reload(index_t* index) {
+    //# Modified for the StellarSolver Internal Library so that a single-file index whose metadata came from
+    //a manifest (and so was never opened) can be opened on demand.
+    if (!index->fits && index->quadfn && index->codefn && index->starfn &&
+        streq(index->quadfn, index->codefn) && streq(index->quadfn, index->starfn)) {
+        index->fits = anqfits_open(index->quadfn);
+        if (!index->fits) {
+            ERROR("Failed to open FITS file %s", index->quadfn);
+            goto bailout;
+        }
+    }
     // Read .skdt file...
     if (!index->starkd) {
         if (index->fits)
@@ -453,6 +476,96 @@ void index_unload(index_t* index) {
     }
 }
 
+//# Added for the StellarSolver Internal Library
+static void tree_apply_residency(const kdtree_t* kd, const index_residency_t* residency, anbool random) {
+    if (!kd)
+        return;
+    if (random) {
+        memory_advise(kd->lr, kdtree_sizeof_lr(kd), MEMORY_ADVICE_RANDOM);
+        memory_advise(kd->perm, kdtree_sizeof_perm(kd), MEMORY_ADVICE_RANDOM);
+        memory_advise(kd->bb.any, kdtree_sizeof_bb(kd), MEMORY_ADVICE_RANDOM);
+        memory_advise(kd->split.any, kdtree_sizeof_split(kd), MEMORY_ADVICE_RANDOM);
+        memory_advise(kd->data.any, kdtree_sizeof_data(kd), MEMORY_ADVICE_RANDOM);
+    }
+    if (residency->prefetch) {
+        memory_advise(kd->lr, kdtree_sizeof_lr(kd), MEMORY_ADVICE_WILLNEED);
+        memory_advise(kd->perm, kdtree_sizeof_perm(kd), MEMORY_ADVICE_WILLNEED);
+        memory_advise(kd->bb.any, kdtree_sizeof_bb(kd), MEMORY_ADVICE_WILLNEED);
+        memory_advise(kd->split.any, kdtree_sizeof_split(kd), MEMORY_ADVICE_WILLNEED);
+        memory_advise(kd->data.any, kdtree_sizeof_data(kd), MEMORY_ADVICE_WILLNEED);
+    }
+    // The nodes are stored level by level, so the top levels are at the start of the node arrays.
+    if (residency->lock_tree_tops) {
+        if (kd->bb.any)
+            memory_lock(kd->bb.any, MIN(kdtree_sizeof_bb(kd), residency->lock_tree_tops));
+        if (kd->split.any)
+            memory_lock(kd->split.any, MIN(kdtree_sizeof_split(kd), residency->lock_tree_tops));
+    }
+}
+
+//# Added for the StellarSolver Internal Library
+void index_apply_residency(index_t* index, const index_residency_t* residency) {
+    if (!index || !residency)
+        return;
+    if (index->starkd)
+        tree_apply_residency(index->starkd->tree, residency, FALSE);
+    if (index->codekd)
+        tree_apply_residency(index->codekd->tree, residency, residency->random_codes);
+    if (index->quads && index->quads->quadarray && residency->prefetch)
+        memory_advise(index->quads->quadarray,
+                      (size_t)index->quads->numquads * index->quads->dimquads * sizeof(uint32_t),
+                      MEMORY_ADVICE_WILLNEED);
+}
+
+//# Added for the StellarSolver Internal Library
+static void tree_release_residency(const kdtree_t* kd, const index_residency_t* residency) {
+    if (!kd)
+        return;
+    if (residency->lock_tree_tops) {
+        if (kd->bb.any)
+            memory_unlock(kd->bb.any, MIN(kdtree_sizeof_bb(kd), residency->lock_tree_tops));
+        if (kd->split.any)
+            memory_unlock(kd->split.any, MIN(kdtree_sizeof_split(kd), residency->lock_tree_tops));
+    }
+    memory_advise(kd->lr, kdtree_sizeof_lr(kd), MEMORY_ADVICE_NORMAL);
+    memory_advise(kd->perm, kdtree_sizeof_perm(kd), MEMORY_ADVICE_NORMAL);
+    memory_advise(kd->bb.any, kdtree_sizeof_bb(kd), MEMORY_ADVICE_NORMAL);
+    memory_advise(kd->split.any, kdtree_sizeof_split(kd), MEMORY_ADVICE_NORMAL);
+    memory_advise(kd->data.any, kdtree_sizeof_data(kd), MEMORY_ADVICE_NORMAL);
+}
+
+//# Added for the StellarSolver Internal Library
+void index_release_residency(index_t* index, const index_residency_t* residency) {
+    if (!index || !residency)
+        return;
+    if (index->starkd)
+        tree_release_residency(index->starkd->tree, residency);
+    if (index->codekd)
+        tree_release_residency(index->codekd->tree, residency);
+}
+
+//# Added for the StellarSolver Internal Library
+size_t index_memory_estimate(const index_t* index) {
+    size_t nquads, nstars, dimquads, dimcodes;
+    if (!index)
+        return 0;
+    nquads = (size_t)MAX(index->nquads, 0);
+    nstars = (size_t)MAX(index->nstars, 0);
+    dimquads = (size_t)MAX(index->dimquads, 0);
+    dimcodes = (size_t)dimquad2dimcode(index->dimquads);
+    // quads, the code tree (16-bit codes and the permutation) and the
+    // star tree (32-bit positions and the sweep numbers).  The tree nodes
+    // are small next to these and are left out.
+    return nquads * dimquads * sizeof(uint32_t) +
+        nquads * (dimcodes * sizeof(uint16_t) + sizeof(uint32_t)) +
+        nstars * (3 * sizeof(uint32_t) + sizeof(uint8_t));
+}
+
+//# Added for the StellarSolver Internal Library
+anbool index_is_loaded(const index_t* index) {
+    return index && index->quads && index->codekd && index->starkd;
+}
+
 int index_close_fds(index_t* ind) {
     kdtree_fits_t* io;
     if (ind->quads->fb->fid) {
@@ -35,6 +35,7 @@
 #else
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/mman.h> //# Added for the StellarSolver Internal Library
 #include <sys/resource.h>
 #include <sys/select.h>
 #include <arpa/inet.h>
@@ -863,6 +864,80 @@ void get_mmap_size(size_t start, size_t size, off_t* mapstart, size_t* mapsize,
     *pgap = gap;
 }
 
+//# Added for the StellarSolver Internal Library
+static size_t memory_page_size(void) {
+#ifdef _WIN32
+    SYSTEM_INFO system_info;
+    GetSystemInfo (&system_info);
+    return system_info.dwPageSize;
+#else
+    return getpagesize();
+#endif
+}
+
+//# Added for the StellarSolver Internal Library
+// Widens [start, start+size) to whole pages.
+static void memory_page_range(const void* start, size_t size, char** pstart, size_t* psize) {
+    size_t ps = memory_page_size();
+    uintptr_t first = (uintptr_t)start & ~(uintptr_t)(ps - 1);
+    *pstart = (char*)first;
+    *psize = (uintptr_t)start + size - first;
+}
+
+//# Added for the StellarSolver Internal Library
+int memory_advise(const void* start, size_t size, enum memory_advice advice) {
+#ifdef _WIN32
+    return -1;
+#else
+    char* pstart;
+    size_t psize;
+    int flag;
+    if (!start || !size)
+        return -1;
+    switch (advice) {
+    case MEMORY_ADVICE_RANDOM:
+        flag = MADV_RANDOM;
+        break;
+    case MEMORY_ADVICE_WILLNEED:
+        flag = MADV_WILLNEED;
+        break;
+    default:
+        flag = MADV_NORMAL;
+        break;
+    }
+    memory_page_range(start, size, &pstart, &psize);
+    return madvise(pstart, psize, flag) ? -1 : 0;
+#endif
+}
+
+//# Added for the StellarSolver Internal Library
+int memory_lock(const void* start, size_t size) {
+    char* pstart;
+    size_t psize;
+    if (!start || !size)
+        return -1;
+    memory_page_range(start, size, &pstart, &psize);
+#ifdef _WIN32
+    return VirtualLock(pstart, psize) ? 0 : -1;
+#else
+    return mlock(pstart, psize) ? -1 : 0;
+#endif
+}
+
+//# Added for the StellarSolver Internal Library
+int memory_unlock(const void* start, size_t size) {
+    char* pstart;
+    size_t psize;
+    if (!start || !size)
+        return -1;
+    memory_page_range(start, size, &pstart, &psize);
+#ifdef _WIN32
+    return VirtualUnlock(pstart, psize) ? 0 : -1;
+#else
+    return munlock(pstart, psize) ? -1 : 0;
+#endif
+}
+
 #ifdef _WIN32
 char* mmap_file(int fildes, off_t mapsize)
 {
@@ -199,6 +199,16 @@ int log_get_level() {
     return get_logger()->level;
 }
 
+//# Added for the StellarSolver Internal Library
+void log_get_settings(log_t* settings) {
+    memcpy(settings, get_logger(), sizeof(log_t));
+}
+
+//# Added for the StellarSolver Internal Library
+void log_set_settings(const log_t* settings) {
+    memcpy(get_logger(), settings, sizeof(log_t));
+}
+
 FILE* log_get_fid() {
     return get_logger()->f;
 }
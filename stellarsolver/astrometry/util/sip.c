@@ -285,6 +285,184 @@ anbool sip_xyzarr2pixelxy(const sip_t* sip, const double* xyz, double *px, doubl
 }
 
 
+//# Added for the StellarSolver Internal Library
+// The batch conversions below work on blocks of this many points, so that
+// their scratch arrays fit on the stack.
+#define SIP_BLOCK 256
+
+// out[i] = sum over p+q <= order of coeffs[p][q] * u[i]^p * v[i]^q,
+// worked out with Horner's rule in v and then in u.  The loops over the
+// points are innermost so that the compiler can vectorize them.
+static void sip_polynomial_arrs(const double coeffs[SIP_MAXORDER][SIP_MAXORDER], int order,
+                                const double* u, const double* v, int N,
+                                double* out, double* scratch) {
+    int p, q, i;
+    for (i=0; i<N; i++)
+        out[i] = 0.0;
+    for (p=order; p>=0; p--) {
+        double c = coeffs[p][order-p];
+        for (i=0; i<N; i++)
+            scratch[i] = c;
+        for (q=order-p-1; q>=0; q--) {
+            c = coeffs[p][q];
+            for (i=0; i<N; i++)
+                scratch[i] = scratch[i] * v[i] + c;
+        }
+        for (i=0; i<N; i++)
+            out[i] = out[i] * u[i] + scratch[i];
+    }
+}
+
+// The forward (a, b) or inverse (ap, bp) polynomials over relative pixel
+// coordinates; "U" and "V" may be the same arrays as "u" and "v".
+static void sip_distortion_arrs(const sip_t* sip, anbool inverse,
+                                const double* u, const double* v, int N,
+                                double* U, double* V) {
+    double f[SIP_BLOCK], g[SIP_BLOCK], scratch[SIP_BLOCK];
+    int i, n, j;
+    for (i=0; i<N; i+=SIP_BLOCK) {
+        n = MIN(SIP_BLOCK, N - i);
+        if (inverse) {
+            sip_polynomial_arrs(sip->ap, sip->ap_order, u+i, v+i, n, f, scratch);
+            sip_polynomial_arrs(sip->bp, sip->bp_order, u+i, v+i, n, g, scratch);
+        } else {
+            sip_polynomial_arrs(sip->a, sip->a_order, u+i, v+i, n, f, scratch);
+            sip_polynomial_arrs(sip->b, sip->b_order, u+i, v+i, n, g, scratch);
+        }
+        for (j=0; j<n; j++) {
+            U[i+j] = u[i+j] + f[j];
+            V[i+j] = v[i+j] + g[j];
+        }
+    }
+}
+
+void sip_calc_distortion_arrs(const sip_t* sip, const double* u, const double* v, int N,
+                              double* U, double* V) {
+    sip_distortion_arrs(sip, FALSE, u, v, N, U, V);
+}
+
+void sip_calc_inv_distortion_arrs(const sip_t* sip, const double* U, const double* V, int N,
+                                  double* u, double* v) {
+    sip_distortion_arrs(sip, TRUE, U, V, N, u, v);
+}
+
+void sip_pixelxy2radecarrs(const sip_t* sip, const double* px, const double* py, int N,
+                           double* ra, double* dec) {
+    const tan_t* tan = &(sip->wcstan);
+    double u[SIP_BLOCK], v[SIP_BLOCK];
+    double r[3], ix, iy, norm, j[3];
+    int i, n, k;
+
+    // The tangent plane basis of tan_iwc2xyzarr(), worked out once for all of the points.
+    radecdeg2xyzarr(tan->crval[0], tan->crval[1], r);
+    ix = r[1];
+    iy = -r[0];
+    norm = hypot(ix, iy);
+    ix /= norm;
+    iy /= norm;
+    j[0] = iy * r[2];
+    j[1] = -ix * r[2];
+    j[2] = ix * r[1] - iy * r[0];
+    normalize_3(j);
+
+    for (i=0; i<N; i+=SIP_BLOCK) {
+        n = MIN(SIP_BLOCK, N - i);
+        for (k=0; k<n; k++) {
+            u[k] = px[i+k] - tan->crpix[0];
+            v[k] = py[i+k] - tan->crpix[1];
+        }
+        if (has_distortions(sip))
+            sip_distortion_arrs(sip, FALSE, u, v, n, u, v);
+
+        // No branches in here, so that it can be vectorized; the sign of x
+        // is the same as in tan_iwc2xyzarr().
+        for (k=0; k<n; k++) {
+            double x = -deg2rad(tan->cd[0][0] * u[k] + tan->cd[0][1] * v[k]);
+            double y =  deg2rad(tan->cd[1][0] * u[k] + tan->cd[1][1] * v[k]);
+            double rfrac = tan->sin ? sqrt(1.0 - (x*x + y*y)) : 1.0;
+            double X = ix*x + j[0]*y + r[0] * rfrac;
+            double Y = iy*x + j[1]*y + r[1] * rfrac;
+            double Z =        j[2]*y + r[2] * rfrac;
+            double invlen = tan->sin ? 1.0 : 1.0 / sqrt(X*X + Y*Y + Z*Z);
+            u[k] = X * invlen;
+            v[k] = Y * invlen;
+            dec[i+k] = rad2deg(asin(Z * invlen));
+        }
+        for (k=0; k<n; k++)
+            ra[i+k] = rad2deg(xy2ra(u[k], v[k]));
+    }
+}
+
+void sip_radec2pixelxyarrs(const sip_t* sip, const double* ra, const double* dec, int N,
+                           double* px, double* py, anbool* ok) {
+    double x[SIP_BLOCK], y[SIP_BLOCK], z[SIP_BLOCK];
+    int i, n, k;
+    for (i=0; i<N; i+=SIP_BLOCK) {
+        n = MIN(SIP_BLOCK, N - i);
+        for (k=0; k<n; k++)
+            radecdeg2xyz(ra[i+k], dec[i+k], x + k, y + k, z + k);
+        sip_xyzarrs2pixelxy(sip, x, y, z, n, px + i, py + i, ok + i);
+    }
+}
+
+//# Added for the StellarSolver Internal Library
+void sip_xyzarrs2pixelxy(const sip_t* sip, const double* x, const double* y, const double* z,
+                         int N, double* px, double* py, anbool* ok) {
+    const tan_t* tan = &(sip->wcstan);
+    double r[3], eta[2], xi[3];
+    double cdi[2][2];
+    int i;
+
+    if (invert_2by2_arr((const double*)tan->cd, (double*)cdi)) {
+        memset(ok, 0, N * sizeof(anbool));
+        return;
+    }
+
+    // The tangent plane basis of star_coords(), worked out once for all of the points.
+    radecdeg2xyzarr(tan->crval[0], tan->crval[1], r);
+    if (r[2] == 1.0 || r[2] == -1.0) {
+        // at a pole
+        eta[0] = 1.0;
+        eta[1] = 0.0;
+        xi[0] = 0.0;
+        xi[1] = r[2];
+        xi[2] = 0.0;
+    } else {
+        double inv_en = 1.0 / hypot(r[0], r[1]);
+        eta[0] = -r[1] * inv_en;
+        eta[1] =  r[0] * inv_en;
+        xi[0] = -r[2] * eta[1];
+        xi[1] =  r[2] * eta[0];
+        xi[2] =  r[0] * eta[1] - r[1] * eta[0];
+    }
+
+    // No branches in here, so that it can be vectorized; the points on the
+    // far side of the sky get garbage pixels and are flagged in "ok".
+    for (i=0; i<N; i++) {
+        double sdotr = x[i] * r[0] + y[i] * r[1] + z[i] * r[2];
+        double u = x[i] * eta[0] + y[i] * eta[1];
+        double v = x[i] * xi[0] + y[i] * xi[1] + z[i] * xi[2];
+        double scale = (tan->sin ? 1.0 : 1.0 / sdotr) * (180.0 / M_PI);
+        u *= scale;
+        v *= scale;
+        px[i] = cdi[0][0] * u + cdi[0][1] * v + tan->crpix[0];
+        py[i] = cdi[1][0] * u + cdi[1][1] * v + tan->crpix[1];
+        ok[i] = (sdotr > 0.0);
+    }
+
+    if (has_distortions(sip)) {
+        for (i=0; i<N; i++) {
+            px[i] -= tan->crpix[0];
+            py[i] -= tan->crpix[1];
+        }
+        sip_distortion_arrs(sip, TRUE, px, py, N, px, py);
+        for (i=0; i<N; i++) {
+            px[i] += tan->crpix[0];
+            py[i] += tan->crpix[1];
+        }
+    }
+}
+
 anbool sip_xyzarr2iwc(const sip_t* sip, const double* xyz,
                       double* iwcx, double* iwcy) {
     return tan_xyzarr2iwc(&(sip->wcstan), xyz, iwcx, iwcy);
@@ -58,6 +58,23 @@ double timenow() {
     return (double)(tv.tv_sec - 3600*24*365*30) + tv.tv_usec * 1e-6;
 }
 
+//# Added for the StellarSolver Internal Library
+double timenow_monotonic() {
+#ifdef _WIN32
+    LARGE_INTEGER count, frequency;
+    QueryPerformanceCounter(&count);
+    QueryPerformanceFrequency(&frequency);
+    return (double)count.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts)) {
+        ERROR("Failed to read the monotonic clock");
+        return timenow();
+    }
+    return (double)ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
 double millis_between(struct timeval* tv1, struct timeval* tv2) {
     return
         (tv2->tv_usec - tv1->tv_usec)*1e-3 +
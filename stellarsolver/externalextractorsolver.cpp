@@ -367,6 +367,7 @@ void ExternalExtractorSolver::abort()
     }
     if(extractorProcess)
         extractorProcess->kill();
+    m_Cancelled = true;
     if(!isChildSolver)
         emit logOutput("Aborting ...");
     quit();
@@ -0,0 +1,66 @@
+/*  ExtractionContext, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+//Qt Includes
+#include <QMutexLocker>
+
+//Project Includes
+#include "extractioncontext.h"
+#include "sep/extract.h"
+
+ExtractionContext::~ExtractionContext()
+{
+    // A context must outlive the extractions that use it, so by now every workspace has been released.
+    for (auto *workspace : m_Free)
+        freeWorkspace(workspace);
+    m_Free.clear();
+}
+
+ExtractionContext::Workspace *ExtractionContext::acquire(const QRect &area)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_InUse++;
+    if (m_Free.isEmpty())
+        return new Workspace;
+    for (int i = m_Free.size() - 1; i >= 0; i--)
+    {
+        if (m_Free[i]->area == area)
+            return m_Free.takeAt(i);
+    }
+    return m_Free.takeLast();
+}
+
+void ExtractionContext::release(Workspace *workspace)
+{
+    if (!workspace)
+        return;
+    QMutexLocker locker(&m_Mutex);
+    m_InUse--;
+    m_Free.append(workspace);
+}
+
+void ExtractionContext::clear()
+{
+    QMutexLocker locker(&m_Mutex);
+    for (auto *workspace : m_Free)
+        freeWorkspace(workspace);
+    m_Free.clear();
+}
+
+int ExtractionContext::workspaceCount() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Free.count() + m_InUse;
+}
+
+void ExtractionContext::freeWorkspace(Workspace *workspace)
+{
+    delete workspace->extractor;
+    SEP::sep_bkg_free(workspace->background);
+    delete workspace;
+}
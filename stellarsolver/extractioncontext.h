@@ -0,0 +1,78 @@
+/*  ExtractionContext, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//Qt Includes
+#include <QList>
+#include <QMutex>
+#include <QRect>
+
+namespace SEP
+{
+class Extract;
+struct sep_bkg;
+}
+
+/**
+ * @brief The ExtractionContext class keeps the scratch memory of the internal star extractor between extractions.
+ * Each extraction (or each partition of it, when the image is partitioned) allocates a background map, the pixel list
+ * and the deblending buffers, which are several megabytes, and frees them again at the end.  Programs that extract
+ * stars from frame after frame of the same size (focusing and guiding, for instance) can attach one ExtractionContext
+ * to their StellarSolver with StellarSolver::setExtractionContext(), and then these buffers are only allocated
+ * for the first frame.  The context can be shared by several StellarSolvers, it keeps one workspace for each
+ * partition that is being extracted at the same time.  With Parameters::incrementalBackground, a partition that gets
+ * the workspace it used for the last frame only measures the parts of the background that changed.
+ */
+class ExtractionContext
+{
+    public:
+        ExtractionContext() = default;
+        ~ExtractionContext();
+
+        // The scratch memory used for extracting one partition.
+        struct Workspace
+        {
+            SEP::Extract *extractor {nullptr};      // Keeps the pixel list and the deblending buffers
+            SEP::sep_bkg *background {nullptr};     // The background of the last partition extracted with this workspace
+            QRect area;                             // That partition, in image coordinates
+        };
+
+        /**
+         * @brief acquire gets a workspace that is not in use, making a new one if they all are.
+         * @param area The partition that will be extracted, a free workspace that last extracted it is preferred
+         * @return The workspace, which must be released when the partition is done.
+         */
+        Workspace *acquire(const QRect &area = QRect());
+
+        /**
+         * @brief release gives a workspace back so that the next partition can use it.
+         * @param workspace The workspace to release
+         */
+        void release(Workspace *workspace);
+
+        /**
+         * @brief clear frees the memory of all of the workspaces that are not in use.
+         */
+        void clear();
+
+        /**
+         * @brief workspaceCount gets the number of workspaces the context holds
+         * @return The number of workspaces, including the ones in use
+         */
+        int workspaceCount() const;
+
+    private:
+        ExtractionContext(const ExtractionContext &) = delete;
+        ExtractionContext &operator=(const ExtractionContext &) = delete;
+
+        static void freeWorkspace(Workspace *workspace);
+
+        QList<Workspace *> m_Free;      // Workspaces that are ready to be used
+        int m_InUse {0};                // The number of workspaces that are acquired right now
+        mutable QMutex m_Mutex;
+};
@@ -13,8 +13,12 @@
 #include <QDir>
 #include <QVector>
 
+//System Includes
+#include <chrono>
+
 //Project Includes
 #include "structuredefinitions.h"
+#include "starcatalog.h"
 #include "parameters.h"
 #include "wcsdata.h"
 
@@ -72,6 +76,9 @@ class ExtractorSolver : public QThread
         int depthlo = -1;                   // This is the low depth of this child solver
         int depthhi = -1;                   // This is the high depth of this child solver
 
+        // The time by which a solve has to be done, set by StellarSolver::solveWithin.  The default means there is no deadline.
+        std::chrono::steady_clock::time_point m_Deadline = std::chrono::steady_clock::time_point::max();
+
         // Astrometry Position Parameters, These are not saved parameters and change for each image, use the methods to set them
         bool m_UsePosition = false;         // Whether or not to use initial information about the position
         double search_ra = HUGE_VAL;        // RA of field center for search, format: decimal degrees
@@ -167,9 +174,18 @@ class ExtractorSolver : public QThread
 
         /**
          * @brief getStarList gets the list of stars found during star extraction
-         * @return A QList full of stars and their properties
+         * @return A QList full of stars and their properties, made from getStarCatalog() when it changes
          */
         const QList<FITSImage::Star> &getStarList() const
+        {
+            return m_ExtractedStars.list();
+        }
+
+        /**
+         * @brief getStarCatalog gets the stars found during star extraction without copying them
+         * @return The stars and their properties
+         */
+        const FITSImage::StarCatalog &getStarCatalog() const
         {
             return m_ExtractedStars;
         }
@@ -272,7 +288,7 @@ class ExtractorSolver : public QThread
     // The Results
 
         FITSImage::Background m_Background;     // This is a report on the background levels found during star extraction
-        QList<FITSImage::Star> m_ExtractedStars;// This is the list of stars that get extracted from the image
+        FITSImage::StarCatalog m_ExtractedStars;// This is the list of stars that get extracted from the image
         FITSImage::Solution m_Solution;         // This is the solution that comes back from the Solver
         short solutionIndexNumber = -1;         // This is the index number of the index used to solve the image.
         short solutionHealpix = -1;             // This is the healpix of the index used to solve the image.
@@ -0,0 +1,365 @@
+/*  IndexCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+//Qt Includes
+#include <QFileInfo>
+#include <QDateTime>
+#include <QMutexLocker>
+
+//Project Includes
+#include "indexcache.h"
+#include "indexmanifest.h"
+
+//System Includes
+#include <algorithm>
+#include <cmath>
+
+IndexCache *IndexCache::instance()
+{
+    static IndexCache cache;
+    return &cache;
+}
+
+IndexCache::~IndexCache()
+{
+    for(auto &entry : m_Entries)
+        freeLocked(entry.index);
+    m_Entries.clear();
+}
+
+IndexCache::FileStamp IndexCache::stampFor(const QString &path)
+{
+    QFileInfo info(path);
+    FileStamp stamp;
+    if(info.exists())
+    {
+        stamp.size = info.size();
+        stamp.modified = info.lastModified().toMSecsSinceEpoch();
+    }
+    return stamp;
+}
+
+IndexCache::Entry *IndexCache::findLocked(const QString &path, const FileStamp &stamp)
+{
+    auto it = m_Entries.find(path);
+    if(it == m_Entries.end())
+        return nullptr;
+    // If the file was replaced on disk, drop the old index, but only once nobody is using it.
+    if(it->stamp == stamp || it->refCount > 0)
+        return &(*it);
+    freeLocked(it->index);
+    m_Entries.erase(it);
+    return nullptr;
+}
+
+IndexCache::Entry *IndexCache::entryForLocked(const index_t *index)
+{
+    for(auto &entry : m_Entries)
+    {
+        if(entry.index == index)
+            return &entry;
+    }
+    return nullptr;
+}
+
+index_t *IndexCache::acquire(const QString &path)
+{
+    const FileStamp stamp = stampFor(path);
+    {
+        QMutexLocker locker(&m_Mutex);
+        Entry *existing = findLocked(path, stamp);
+        if(existing)
+        {
+            existing->refCount++;
+            return existing->index;
+        }
+    }
+
+    // Only the metadata is read now, the rest of the index is loaded when it is needed.
+    // The file is read without holding the lock, so other solvers can use the cache in the meantime.
+    index_t *index = index_load(path.toUtf8().constData(), INDEX_ONLY_LOAD_METADATA, nullptr);
+    if(!index)
+        return nullptr;
+
+    QMutexLocker locker(&m_Mutex);
+    return insertLocked(path, stamp, index);
+}
+
+QList<index_t *> IndexCache::acquireFolder(const QString &folder)
+{
+    QList<index_t *> indexes;
+
+    // Solvers that search the same folder take turns refreshing its manifest, but the other folders and the rest
+    // of the cache stay available while the folder is read.
+    QSharedPointer<QMutex> folderLock;
+    {
+        QMutexLocker locker(&m_Mutex);
+        folderLock = m_FolderLocks.value(folder);
+        if(!folderLock)
+        {
+            folderLock.reset(new QMutex);
+            m_FolderLocks.insert(folder, folderLock);
+        }
+    }
+    QMutexLocker folderLocker(folderLock.data());
+
+    IndexManifest manifest(folder);
+    if(!manifest.refresh())
+        return indexes;
+
+    for(const auto &manifestEntry : manifest.indexEntries())
+    {
+        const QString path = manifest.pathFor(manifestEntry);
+        FileStamp stamp;
+        stamp.size = manifestEntry.size;
+        stamp.modified = manifestEntry.modified;
+        {
+            QMutexLocker locker(&m_Mutex);
+            Entry *existing = findLocked(path, stamp);
+            if(existing)
+            {
+                existing->refCount++;
+                indexes.append(existing->index);
+                continue;
+            }
+        }
+
+        index_t *index = manifest.createIndex(manifestEntry);
+        if(!index)
+            continue;
+        QMutexLocker locker(&m_Mutex);
+        indexes.append(insertLocked(path, stamp, index));
+    }
+    return indexes;
+}
+
+index_t *IndexCache::insertLocked(const QString &path, const FileStamp &stamp, index_t *index)
+{
+    // Another solver may have added the same file while this one was reading it, then the first one wins.
+    Entry *existing = findLocked(path, stamp);
+    if(existing)
+    {
+        index_free(index);
+        existing->refCount++;
+        return existing->index;
+    }
+
+    Entry entry;
+    entry.index = index;
+    entry.stamp = stamp;
+    entry.refCount = 1;
+    entry.loadLock.reset(new QMutex);
+    m_Entries.insert(path, entry);
+    return index;
+}
+
+int IndexCache::loadIndex(index_t *index, const index_residency_t *residency, void *cache)
+{
+    return static_cast<IndexCache *>(cache)->load(index, residency);
+}
+
+size_t IndexCache::loadedBytesOf(void *cache)
+{
+    return static_cast<size_t>(static_cast<IndexCache *>(cache)->loadedBytes());
+}
+
+int IndexCache::load(index_t *index, const index_residency_t *residency)
+{
+    // Several solvers can select the same index at the same time, so only one of them does the loading.
+    // Each index has its own lock for this, so loading one index doesn't hold up solvers using the others.
+    QSharedPointer<QMutex> loadLock;
+    {
+        QMutexLocker locker(&m_Mutex);
+        Entry *entry = entryForLocked(index);
+        if(entry)
+            loadLock = entry->loadLock;
+    }
+    if(!loadLock)
+        return -1;
+
+    QMutexLocker loadLocker(loadLock.data());
+    if(!index_is_loaded(index))
+    {
+        if(index_reload(index))
+        {
+            index_unload(index);
+            return -1;
+        }
+        // The data is memory mapped now, so there is no need to keep a file descriptor open for every cached index.
+        index_close_fds(index);
+
+        QMutexLocker locker(&m_Mutex);
+        m_LoadedBytes += static_cast<qint64>(index_memory_estimate(index));
+        evictLocked();
+    }
+
+    // The residency policy is only kept while a solver holds the index, release() undoes it, so it is given
+    // again whenever an index that is already loaded is used again.  The caller holds the index, so it can't
+    // be released or unloaded while the policy is applied, and locking the memory is done without the cache lock.
+    bool pin = false;
+    {
+        QMutexLocker locker(&m_Mutex);
+        Entry *entry = entryForLocked(index);
+        if(residency && entry && !entry->pinned)
+        {
+            entry->pinned = true;
+            entry->residency = *residency;
+            pin = true;
+        }
+    }
+    if(pin)
+        index_apply_residency(index, residency);
+    return 0;
+}
+
+void IndexCache::freeLocked(index_t *index)
+{
+    if(index_is_loaded(index))
+        m_LoadedBytes -= static_cast<qint64>(index_memory_estimate(index));
+    index_free(index);
+}
+
+void IndexCache::evictLocked()
+{
+    if(m_MemoryBudget <= 0 || m_LoadedBytes <= m_MemoryBudget)
+        return;
+
+    // Unloading the largest unused indexes first frees the most memory while unloading the fewest indexes.
+    // The metadata stays in the cache, so an unloaded index is simply loaded again the next time it is selected.
+    QList<Entry *> unused;
+    for(auto &entry : m_Entries)
+    {
+        if(entry.refCount == 0 && index_is_loaded(entry.index))
+            unused.append(&entry);
+    }
+    std::sort(unused.begin(), unused.end(), [](const Entry * e1, const Entry * e2)
+    {
+        return index_memory_estimate(e1->index) > index_memory_estimate(e2->index);
+    });
+    for(auto entry : unused)
+    {
+        if(m_LoadedBytes <= m_MemoryBudget)
+            break;
+        m_LoadedBytes -= static_cast<qint64>(index_memory_estimate(entry->index));
+        index_unload(entry->index);
+    }
+}
+
+void IndexCache::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker locker(&m_Mutex);
+    m_MemoryBudget = std::max<qint64>(bytes, 0);
+    evictLocked();
+}
+
+int IndexCache::prewarm(const QStringList &folders, const QStringList &files, double ra, double dec, double radius,
+                        double quadLow, double quadHigh, const index_residency_t &residency, qint64 memoryBudget)
+{
+    QList<index_t *> indexes;
+    for(const auto &file : files)
+    {
+        index_t *index = acquire(file);
+        if(index)
+            indexes.append(index);
+    }
+    for(const auto &folder : folders)
+        indexes.append(acquireFolder(folder));
+
+    // The same checks and the same order the engine uses to select indexes and to decide which ones it keeps loaded,
+    // so only the ones a solve would load are read.
+    struct Candidate
+    {
+        index_t *index;
+        double useful;
+        qint64 bytes;
+    };
+    QList<Candidate> candidates;
+    for(auto index : indexes)
+    {
+        if(!index_overlaps_scale_range(index, quadLow, quadHigh) || !index_is_within_range(index, ra, dec, radius))
+            continue;
+        const double lo = qMax(index->index_scale_lower, quadLow);
+        const double hi = qMin(index->index_scale_upper, quadHigh);
+        double useful = 0;
+        if(lo > 0 && hi > lo && index->index_scale_upper > index->index_scale_lower)
+            useful = log(hi / lo) / log(index->index_scale_upper / index->index_scale_lower);
+        Candidate candidate {index, useful, static_cast<qint64>(index_memory_estimate(index))};
+        candidates.append(candidate);
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [](const Candidate & c1, const Candidate & c2)
+    {
+        if(c1.useful != c2.useful)
+            return c1.useful > c2.useful;
+        return c1.bytes < c2.bytes;
+    });
+
+    int warmed = 0;
+    for(const auto &candidate : candidates)
+    {
+        if(!index_is_loaded(candidate.index) && memoryBudget > 0 && loadedBytes() + candidate.bytes > memoryBudget)
+            continue;
+        if(load(candidate.index, &residency) == 0)
+            warmed++;
+    }
+
+    for(auto index : indexes)
+        release(index);
+    return warmed;
+}
+
+void IndexCache::release(index_t *index)
+{
+    if(!index)
+        return;
+    QMutexLocker locker(&m_Mutex);
+    Entry *entry = entryForLocked(index);
+    if(!entry)
+        return;
+    if(entry->refCount > 0)
+        entry->refCount--;
+    if(entry->refCount > 0)
+        return;
+    // Nobody is using the index now, so its memory is no longer locked, and it may be paged out or unloaded.
+    if(entry->pinned)
+    {
+        if(index_is_loaded(entry->index))
+            index_release_residency(entry->index, &entry->residency);
+        entry->pinned = false;
+    }
+    evictLocked();
+}
+
+int IndexCache::purgeUnused()
+{
+    QMutexLocker locker(&m_Mutex);
+    int purged = 0;
+    for(auto it = m_Entries.begin(); it != m_Entries.end();)
+    {
+        if(it->refCount == 0)
+        {
+            freeLocked(it->index);
+            it = m_Entries.erase(it);
+            purged++;
+        }
+        else
+            ++it;
+    }
+    return purged;
+}
+
+int IndexCache::loadedCount() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Entries.count();
+}
+
+qint64 IndexCache::loadedBytes() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_LoadedBytes;
+}
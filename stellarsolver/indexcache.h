@@ -0,0 +1,170 @@
+/*  IndexCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//Qt Includes
+#include <QString>
+#include <QStringList>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSharedPointer>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+}
+
+/**
+ * @brief The IndexCache class keeps astrometry.net index files loaded between solves.
+ * Opening an index means parsing its FITS headers and mapping the star kd-tree, quad file and code kd-tree.
+ * Programs that solve over and over against the same folders (guiding, for instance) would otherwise repeat
+ * that work for every solve.  There is one cache for the whole process and every solver, including the child
+ * solvers used for parallel solving, shares the same loaded index_t objects.  The indexes are only read by the solver,
+ * so several solvers can use the same index at the same time.
+ * The indexes start out as metadata only (taken from the IndexManifest of their folder when there is one), and the files
+ * are only opened and mapped when an engine selects the index for a job, see loadIndex().
+ * Each acquired index must be released again.  Indexes that are no longer used stay loaded while they fit in the
+ * memory budget, see setMemoryBudget(), or until purgeUnused() is called.
+ */
+class IndexCache
+{
+    public:
+        /**
+         * @brief instance gets the process wide index cache
+         * @return The IndexCache
+         */
+        static IndexCache *instance();
+
+        /**
+         * @brief acquire gets the index for the file from the cache, reading its metadata if it is not already in the cache.
+         * @param path The path to the index file
+         * @return The index, or nullptr if the file is not an index.  A returned index must be released.
+         */
+        index_t *acquire(const QString &path);
+
+        /**
+         * @brief acquireFolder gets all of the index files in a folder, the same files engine_autoindex_search_paths would find.
+         * The folder's IndexManifest is used so that only new or changed files are opened.
+         * @param folder The folder to search
+         * @return The indexes in the order the engine would have added them.  All of them must be released.
+         */
+        QList<index_t *> acquireFolder(const QString &folder);
+
+        /**
+         * @brief loadIndex opens and maps the files of an index from the cache if that hasn't been done yet,
+         * and applies the residency policy to it if it isn't already applied.  The policy, including any locked
+         * memory, is only kept while the index is acquired, and is undone when the last solver releases it.
+         * It is meant to be used as the load_shared_index callback of an engine.
+         * @param index The index, which must have come from the cache
+         * @param residency How the index should be kept in memory once it is loaded
+         * @param cache The IndexCache
+         * @return 0 if the index is loaded
+         */
+        static int loadIndex(index_t *index, const index_residency_t *residency, void *cache);
+
+        /**
+         * @brief loadedBytesOf gets the estimated bytes of the loaded indexes in the cache.
+         * It is meant to be used as the shared_index_bytes callback of an engine.
+         * @param cache The IndexCache
+         * @return The bytes of the loaded indexes
+         */
+        static size_t loadedBytesOf(void *cache);
+
+        /**
+         * @brief prewarm loads the indexes that could solve a field at a position and scale, so that they are read into
+         * memory in the background before the solve that needs them.  The indexes most likely to solve the field are
+         * loaded first, and only while they fit in the memory budget along with the indexes that are already loaded.
+         * @param folders The index folders
+         * @param files The individual index files
+         * @param ra The Right Ascension of the field in degrees
+         * @param dec The Declination of the field in degrees
+         * @param radius The search radius in degrees
+         * @param quadLow The smallest quad that could be found in the field in arcseconds
+         * @param quadHigh The largest quad that could be found in the field in arcseconds
+         * @param residency How the indexes should be kept in memory
+         * @param memoryBudget The bytes of indexes that may be loaded, 0 for no limit
+         * @return The number of indexes that were warmed up
+         */
+        int prewarm(const QStringList &folders, const QStringList &files, double ra, double dec, double radius,
+                    double quadLow, double quadHigh, const index_residency_t &residency, qint64 memoryBudget);
+
+        /**
+         * @brief release gives back an index acquired from the cache.  Once no solver is using the index, its residency
+         * policy is undone, and it stays loaded in the cache unless the loaded indexes no longer fit in the memory budget.
+         * @param index The index to release
+         */
+        void release(index_t *index);
+
+        /**
+         * @brief setMemoryBudget sets how many bytes of indexes the cache keeps loaded.  When the loaded indexes
+         * don't fit, the ones that no solver is using are unloaded, the largest first, until they do.
+         * Indexes that are in use are never unloaded, so the cache can go over the budget while they are.
+         * @param bytes The bytes of indexes that may stay loaded, 0 for no limit
+         */
+        void setMemoryBudget(qint64 bytes);
+
+        /**
+         * @brief purgeUnused unloads all of the indexes that are not being used by a solver right now.
+         * @return The number of indexes that were unloaded
+         */
+        int purgeUnused();
+
+        /**
+         * @brief loadedCount gets the number of indexes currently held in the cache
+         * @return The number of loaded indexes
+         */
+        int loadedCount() const;
+
+        /**
+         * @brief loadedBytes gets the estimated memory taken by the indexes in the cache whose files are loaded
+         * @return The bytes of the loaded indexes
+         */
+        qint64 loadedBytes() const;
+
+    private:
+        IndexCache() = default;
+        ~IndexCache();
+        IndexCache(const IndexCache &) = delete;
+        IndexCache &operator=(const IndexCache &) = delete;
+
+        // The file size and modification time are used to notice when an index file has been replaced on disk.
+        struct FileStamp
+        {
+            qint64 size {-1};
+            qint64 modified {-1};
+            bool operator==(const FileStamp &other) const
+            {
+                return size == other.size && modified == other.modified;
+            }
+        };
+
+        struct Entry
+        {
+            index_t *index {nullptr};
+            FileStamp stamp;
+            int refCount {0};
+            QSharedPointer<QMutex> loadLock;    // Held while the index files are opened, see load()
+            bool pinned {false};                // Whether the residency policy below is applied to the loaded index
+            index_residency_t residency {};
+        };
+
+        static FileStamp stampFor(const QString &path);
+        Entry *findLocked(const QString &path, const FileStamp &stamp);
+        Entry *entryForLocked(const index_t *index);
+        index_t *insertLocked(const QString &path, const FileStamp &stamp, index_t *index);
+        int load(index_t *index, const index_residency_t *residency);
+        void freeLocked(index_t *index);
+        void evictLocked();
+
+        QHash<QString, Entry> m_Entries;            // Indexes keyed by file path
+        QHash<QString, QSharedPointer<QMutex>> m_FolderLocks;  // Held while the manifest of a folder is refreshed
+        qint64 m_LoadedBytes {0};                   // The estimated bytes of the loaded indexes
+        qint64 m_MemoryBudget {0};                  // The bytes of indexes that may stay loaded, 0 for no limit
+        mutable QMutex m_Mutex;                     // Guards the above, but is never held while files are read
+};
@@ -0,0 +1,268 @@
+/*  IndexManifest, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+//Qt Includes
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+
+//Project Includes
+#include "indexmanifest.h"
+
+//System Includes
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace
+{
+// The manifest file starts with these so that old or foreign files are ignored.
+const quint32 MANIFEST_MAGIC = 0x5353494d; // "SSIM"
+const quint32 MANIFEST_VERSION = 2;
+}
+
+IndexManifest::IndexManifest(const QString &folder)
+{
+    m_Folder = QDir(folder).absolutePath();
+}
+
+QString IndexManifest::manifestPath(const QString &folder)
+{
+    const QByteArray key = QDir(folder).absolutePath().toUtf8();
+    const QString name = QCryptographicHash::hash(key, QCryptographicHash::Md5).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/stellarsolver/indexmanifests/" + name + ".ssim";
+}
+
+QString IndexManifest::pathFor(const Entry &entry) const
+{
+    return m_Folder + "/" + entry.fileName;
+}
+
+qint64 IndexManifest::folderStamp(const QString &folder)
+{
+    QFileInfo info(folder);
+    return info.exists() ? info.lastModified().toMSecsSinceEpoch() : -1;
+}
+
+bool IndexManifest::load()
+{
+    m_Entries.clear();
+    m_FolderModified = -1;
+    QFile file(manifestPath(m_Folder));
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0, version = 0;
+    QString folder;
+    in >> magic >> version;
+    if(magic != MANIFEST_MAGIC || version != MANIFEST_VERSION)
+        return false;
+    in >> folder >> m_FolderModified;
+    if(folder != m_Folder)
+        return false;
+
+    quint32 count = 0;
+    in >> count;
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        Entry e;
+        in >> e.fileName >> e.size >> e.modified >> e.isIndex;
+        if(e.isIndex)
+        {
+            in >> e.indexid >> e.healpix >> e.hpnside >> e.indexJitter
+               >> e.cutnside >> e.cutnsweep >> e.cutdedup >> e.cutband >> e.cutmargin
+               >> e.circle >> e.cxLessThanDx >> e.meanxLessThanHalf
+               >> e.scaleUpper >> e.scaleLower >> e.dimquads >> e.nstars >> e.nquads;
+        }
+        m_Entries.insert(e.fileName, e);
+    }
+    if(in.status() != QDataStream::Ok)
+    {
+        m_Entries.clear();
+        return false;
+    }
+    return true;
+}
+
+bool IndexManifest::save() const
+{
+    const QString path = manifestPath(m_Folder);
+    if(!QDir().mkpath(QFileInfo(path).absolutePath()))
+        return false;
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << MANIFEST_MAGIC << MANIFEST_VERSION << m_Folder << m_FolderModified << quint32(m_Entries.count());
+    for(const auto &e : m_Entries)
+    {
+        out << e.fileName << e.size << e.modified << e.isIndex;
+        if(e.isIndex)
+        {
+            out << e.indexid << e.healpix << e.hpnside << e.indexJitter
+                << e.cutnside << e.cutnsweep << e.cutdedup << e.cutband << e.cutmargin
+                << e.circle << e.cxLessThanDx << e.meanxLessThanHalf
+                << e.scaleUpper << e.scaleLower << e.dimquads << e.nstars << e.nquads;
+        }
+    }
+    return file.commit();
+}
+
+IndexManifest::Entry IndexManifest::readFile(const QString &path, const QString &fileName, qint64 size, qint64 modified)
+{
+    Entry e;
+    e.fileName = fileName;
+    e.size = size;
+    e.modified = modified;
+
+    const QByteArray pathBytes = path.toUtf8();
+    if(!index_is_file_index(pathBytes.constData()))
+        return e;
+    index_t *index = index_load(pathBytes.constData(), INDEX_ONLY_LOAD_METADATA, nullptr);
+    if(!index)
+        return e;
+
+    e.isIndex = true;
+    e.indexid = index->indexid;
+    e.healpix = index->healpix;
+    e.hpnside = index->hpnside;
+    e.indexJitter = index->index_jitter;
+    e.cutnside = index->cutnside;
+    e.cutnsweep = index->cutnsweep;
+    e.cutdedup = index->cutdedup;
+    e.cutband = index->cutband ? QString(index->cutband) : QString();
+    e.cutmargin = index->cutmargin;
+    e.circle = index->circle;
+    e.cxLessThanDx = index->cx_less_than_dx;
+    e.meanxLessThanHalf = index->meanx_less_than_half;
+    e.scaleUpper = index->index_scale_upper;
+    e.scaleLower = index->index_scale_lower;
+    e.dimquads = index->dimquads;
+    e.nstars = index->nstars;
+    e.nquads = index->nquads;
+    index_free(index);
+    return e;
+}
+
+bool IndexManifest::refresh()
+{
+    QDir dir(m_Folder);
+    if(!dir.exists())
+        return false;
+
+    load();
+    // The folder is stamped before it is listed, so a file added while it is listed makes the manifest stale.
+    const qint64 folderModified = folderStamp(m_Folder);
+    bool changed = folderModified != m_FolderModified;
+    m_FolderModified = folderModified;
+
+    QHash<QString, Entry> current;
+    const QFileInfoList files = dir.entryInfoList(QDir::Files | QDir::Hidden);
+    for(const auto &info : files)
+    {
+        const QString name = info.fileName();
+        const qint64 size = info.size();
+        const qint64 modified = info.lastModified().toMSecsSinceEpoch();
+        auto known = m_Entries.constFind(name);
+        if(known != m_Entries.constEnd() && known->size == size && known->modified == modified)
+        {
+            current.insert(name, *known);
+            continue;
+        }
+        current.insert(name, readFile(info.absoluteFilePath(), name, size, modified));
+        changed = true;
+    }
+    // Files that were removed from the folder also change the manifest.
+    if(current.count() != m_Entries.count())
+        changed = true;
+    m_Entries = current;
+
+    if(changed)
+        save();
+    return true;
+}
+
+bool IndexManifest::refreshIfStale()
+{
+    if(!load() || m_FolderModified < 0 || m_FolderModified != folderStamp(m_Folder))
+        return refresh();
+    // Overwriting or replacing a file in place doesn't change the folder, so each file in the manifest is still checked.
+    for(const auto &e : m_Entries)
+    {
+        const QFileInfo info(pathFor(e));
+        if(!info.exists() || info.size() != e.size || info.lastModified().toMSecsSinceEpoch() != e.modified)
+            return refresh();
+    }
+    return true;
+}
+
+QList<IndexManifest::Entry> IndexManifest::entries(const QStringList &nameFilters) const
+{
+    QList<Entry> files;
+    for(const auto &e : m_Entries)
+    {
+        if(QDir::match(nameFilters, e.fileName))
+            files.append(e);
+    }
+    std::sort(files.begin(), files.end(), [](const Entry & a, const Entry & b)
+    {
+        return a.fileName.compare(b.fileName, Qt::CaseInsensitive) < 0;
+    });
+    return files;
+}
+
+QList<IndexManifest::Entry> IndexManifest::indexEntries() const
+{
+    QList<Entry> indexes;
+    for(const auto &e : m_Entries)
+    {
+        if(e.isIndex)
+            indexes.append(e);
+    }
+    // engine_autoindex_search_paths adds the indexes in reverse sorted order, so this does the same.
+    std::sort(indexes.begin(), indexes.end(), [](const Entry & a, const Entry & b)
+    {
+        return a.fileName > b.fileName;
+    });
+    return indexes;
+}
+
+index_t *IndexManifest::createIndex(const Entry &entry) const
+{
+    index_t *index = (index_t*)calloc(1, sizeof(index_t));
+    if(!index)
+        return nullptr;
+    index->indexid = entry.indexid;
+    index->healpix = entry.healpix;
+    index->hpnside = entry.hpnside;
+    index->index_jitter = entry.indexJitter;
+    index->cutnside = entry.cutnside;
+    index->cutnsweep = entry.cutnsweep;
+    index->cutdedup = entry.cutdedup;
+    index->cutband = entry.cutband.isNull() ? nullptr : strdup(entry.cutband.toUtf8().constData());
+    index->cutmargin = entry.cutmargin;
+    index->circle = entry.circle;
+    index->cx_less_than_dx = entry.cxLessThanDx;
+    index->meanx_less_than_half = entry.meanxLessThanHalf;
+    index->index_scale_upper = entry.scaleUpper;
+    index->index_scale_lower = entry.scaleLower;
+    index->dimquads = entry.dimquads;
+    index->nstars = entry.nstars;
+    index->nquads = entry.nquads;
+    index_set_filenames(index, pathFor(entry).toUtf8().constData());
+    return index;
+}
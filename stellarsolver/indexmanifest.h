@@ -0,0 +1,122 @@
+/*  IndexManifest, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//Qt Includes
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QHash>
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/index.h"
+}
+
+/**
+ * @brief The IndexManifest class is a small binary catalog of the index files in one folder.
+ * Finding the index files in a folder and learning their scale range, healpix and code properties normally means
+ * opening every file and parsing its FITS headers.  The manifest keeps that metadata, along with the size and
+ * modification time of each file, so that only files that are new or have changed need to be opened again.
+ * Manifests are stored in the user's cache folder, one per index folder, so read only index folders work too.
+ */
+class IndexManifest
+{
+    public:
+        // The metadata of one file in the folder.  Files that turned out not to be index files are kept too,
+        // so that they aren't checked again.
+        struct Entry
+        {
+            QString fileName;
+            qint64 size {-1};
+            qint64 modified {-1};
+            bool isIndex {false};
+
+            int indexid {0};
+            int healpix {-1};
+            int hpnside {0};
+            double indexJitter {0};
+            int cutnside {-1};
+            int cutnsweep {0};
+            double cutdedup {0};
+            QString cutband;
+            int cutmargin {-1};
+            bool circle {false};
+            bool cxLessThanDx {false};
+            bool meanxLessThanHalf {false};
+            double scaleUpper {0};
+            double scaleLower {0};
+            int dimquads {0};
+            int nstars {0};
+            int nquads {0};
+        };
+
+        explicit IndexManifest(const QString &folder);
+
+        /**
+         * @brief refresh reads the saved manifest for the folder, checks it against the files in the folder, opens
+         * only the files that are new or changed, and saves the manifest again if anything changed.
+         * @return true if the folder could be read
+         */
+        bool refresh();
+
+        /**
+         * @brief refreshIfStale reads the saved manifest for the folder, and only lists the folder again, like refresh(),
+         * if the folder has changed since the manifest was saved or a file in the manifest has a new size or time.
+         * Adding, removing or renaming files changes the folder, but overwriting a file in place doesn't, so the files
+         * in the manifest are each looked up, which is still much cheaper than listing the folder and reading headers.
+         * @return true if the folder could be read
+         */
+        bool refreshIfStale();
+
+        /**
+         * @brief entries gets the files in the folder that match name filters, index files or not, sorted by name like QDir would
+         * @param nameFilters The wildcard filters, for instance "*.fits"
+         * @return The entries for the files
+         */
+        QList<Entry> entries(const QStringList &nameFilters) const;
+
+        /**
+         * @brief indexEntries gets the index files in the folder, in the order engine_autoindex_search_paths would add them
+         * @return The entries for the index files
+         */
+        QList<Entry> indexEntries() const;
+
+        /**
+         * @brief pathFor gets the full path to a file in the folder
+         * @param entry The manifest entry
+         * @return The full path
+         */
+        QString pathFor(const Entry &entry) const;
+
+        /**
+         * @brief createIndex makes a metadata-only index_t from a manifest entry without opening the file.
+         * The index files are opened later by index_reload().
+         * @param entry The manifest entry, which must be an index file
+         * @return The new index, to be freed with index_free()
+         */
+        index_t *createIndex(const Entry &entry) const;
+
+        /**
+         * @brief manifestPath gets the file where the manifest for a folder is saved
+         * @param folder The index folder
+         * @return The path to the manifest file
+         */
+        static QString manifestPath(const QString &folder);
+
+    private:
+        bool load();
+        bool save() const;
+        static Entry readFile(const QString &path, const QString &fileName, qint64 size, qint64 modified);
+
+        static qint64 folderStamp(const QString &folder);
+
+        QString m_Folder;                   // The absolute path to the index folder
+        qint64 m_FolderModified {-1};       // The modification time of the folder when the manifest was made
+        QHash<QString, Entry> m_Entries;    // The entries keyed by file name
+};
@@ -12,6 +12,8 @@
 
 //Project Includes
 #include "internalextractorsolver.h"
+#include "indexcache.h"
+#include "solutioncache.h"
 
 //System Includes
 #if defined(__APPLE__)
@@ -24,6 +26,9 @@
 #endif
 
 #include <memory>
+#include <atomic>
+#include <functional>
+#include <limits>
 
 
 //SEP Includes
@@ -36,6 +41,7 @@
 extern "C" {
 #include "astrometry/log.h"
 #include "astrometry/sip-utils.h"
+#include "astrometry/tic.h"
 }
 
 using namespace SSolver;
@@ -50,15 +56,17 @@ InternalExtractorSolver::InternalExtractorSolver(ProcessType pType, ExtractorTyp
     //This sets the base name used for the temp files.
     m_BaseName = "internalExtractorSolver_" + QString::number(solverNum++);
     m_PartitionThreads = QThread::idealThreadCount();
+    m_LoadedDataType = m_Statistics.dataType;
+    m_LoadedBytesPerPixel = m_Statistics.bytesPerPixel;
 }
 
 InternalExtractorSolver::~InternalExtractorSolver()
 {
     waitSEP(); // Just in case it has not shut down
-    if(downSampledBuffer)
+    if(extractionBuffer)
     {
-        delete [] downSampledBuffer;
-        downSampledBuffer = nullptr;
+        delete [] extractionBuffer;
+        extractionBuffer = nullptr;
     }
     if(mergedChannelBuffer)
     {
@@ -73,13 +81,13 @@ InternalExtractorSolver::~InternalExtractorSolver()
     }
 }
 
-//This is the abort method.  For the internal solver it sets a cancel variable. It quits the thread.  And it cancels any SEP threads that are in progress.
+//This is the abort method.  For the internal solver it sets a cancel variable. It quits the thread.
+//The SEP threads and the astrometry engine check the cancel variable, so this doesn't wait for them.
 void InternalExtractorSolver::abort()
 {
-    waitSEP();
+    m_Cancelled = true;
     quit();
 
-    thejob.bp.cancelled = TRUE;
     if(!isChildSolver)
         emit logOutput("Aborting...");
     m_WasAborted = true;
@@ -91,11 +99,9 @@ void InternalExtractorSolver::waitSEP()
     if (futures.empty())
         return;
 
+    // Tiles that are still queued use this object too, so wait for those as well as the running ones.
     for (auto &oneFuture : futures)
-    {
-        if(oneFuture.isRunning())
-            oneFuture.waitForFinished();
-    }
+        oneFuture.waitForFinished();
 
     futures.clear();
 }
@@ -129,6 +135,11 @@ ExtractorSolver* InternalExtractorSolver::spawnChildSolver(int n)
         connect(solver, &ExtractorSolver::logOutput, this,  &ExtractorSolver::logOutput);
     solver->usingDownsampledImage = usingDownsampledImage;
     solver->m_ColorChannel = m_ColorChannel;
+    solver->m_ExtractionContext = m_ExtractionContext;
+    solver->m_Deadline = m_Deadline;
+    solver->m_UsePriorSolution = m_UsePriorSolution;
+    solver->m_PriorSolution = m_PriorSolution;
+    solver->m_IndexMemoryBudget = m_IndexMemoryBudget;
     return solver;
 }
 
@@ -195,29 +206,34 @@ void InternalExtractorSolver::cleanupTempFiles()
     //There are NO temp files anymore for the internal SEP or Astrometry builds!!!
 }
 
-float* InternalExtractorSolver::allocateDataBuffer(uint32_t x, uint32_t y, uint32_t w, uint32_t h)
+int InternalExtractorSolver::sepDataType() const
 {
     switch (m_Statistics.dataType)
     {
         case SEP_TBYTE:
-            return getFloatBuffer<uint8_t>(x, y, w, h);
+            return SEP_TBYTE;
         case TSHORT:
-            return getFloatBuffer<int16_t>(x, y, w, h);
+            return SEP_TSHORT;
         case TUSHORT:
-            return getFloatBuffer<uint16_t>(x, y, w, h);
+            return SEP_TUSHORT;
         case TLONG:
-            return getFloatBuffer<int32_t>(x, y, w, h);
+            return SEP_TINT;
         case TULONG:
-            return getFloatBuffer<uint32_t>(x, y, w, h);
+            return SEP_TUINT;
         case TFLOAT:
-            return getFloatBuffer<float>(x, y, w, h);
+            return SEP_TFLOAT;
         case TDOUBLE:
-            return getFloatBuffer<double>(x, y, w, h);
+            return SEP_TDOUBLE;
         default:
-            emit logOutput("Failed to allocate memory.");
-            return nullptr;
+            return 0;
     }
-    return nullptr;
+}
+
+uint8_t const *InternalExtractorSolver::partitionData(uint32_t x, uint32_t y) const
+{
+    int channelShift = (m_Statistics.channels < 3 || usingDownsampledImage
+                        || usingMergedChannelImage) ? 0 : ( m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel );
+    return m_ImageBuffer + channelShift + (static_cast<size_t>(y) * m_Statistics.width + x) * m_Statistics.bytesPerPixel;
 }
 
 namespace
@@ -274,21 +290,20 @@ int InternalExtractorSolver::runSEPExtractor()
 
     emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
     emit logOutput("Starting Internal StellarSolver Star Extractor with the " + m_ActiveParameters.listName + " profile . . .");
+    const int threads = m_ActiveParameters.partitionThreads > 0 ? m_ActiveParameters.partitionThreads : static_cast<int>(m_PartitionThreads);
+    m_TilePool.setMaxThreadCount(std::max(1, threads));
+
     //Only merge image channels if it is an RGB image and we are either averaging or integrating the channels
-    if(m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB || m_ColorChannel == FITSImage::INTEGRATED_RGB))
-    {
-        if (mergeImageChannels() == false)
-        {
-            emit logOutput("Merging image channels failed.");
-            return -1;
-        }
-    }
+    const bool merge = m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB
+                       || m_ColorChannel == FITSImage::INTEGRATED_RGB);
     //Only downsample images before SEP if the Star extraction is being used for plate solving
-    if(m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER && m_ActiveParameters.downsample != 1)
+    const int downsample = (m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER) ? m_ActiveParameters.downsample : 1;
+    //Both are done in one pass that writes the float image SEP reads, otherwise SEP reads the loaded image directly
+    if((merge || downsample > 1) && extractionBuffer == nullptr)
     {
-        if (downsampleImage(m_ActiveParameters.downsample) == false)
+        if (prepareExtractionImage(downsample, threads) == false)
         {
-            emit logOutput("Downsampling failed.");
+            emit logOutput(downsample > 1 ? "Downsampling failed." : "Merging image channels failed.");
             return -1;
         }
     }
@@ -321,9 +336,15 @@ int InternalExtractorSolver::runSEPExtractor()
                   innerStartX(inX1), innerStartY(inY1), innerEndX(inX2), innerEndY(inY2) {}
     };
 
-    QVector<float *> dataBuffers;
-    QList<StartupOffset> startupOffsets;
-    QList<FITSImage::Background> backgrounds;
+    // SEP reads the partitions directly from the image buffer, so it has to understand the data type.
+    const int dtype = sepDataType();
+    if (dtype == 0)
+    {
+        emit logOutput("The image data type is not supported by the star extractor.");
+        return -1;
+    }
+
+    QList<StartupOffset> tiles;
 
     // The margin is extra image placed around partitions, so we can detect large stars near
     // the edges of the partitions. The margin size needs to be about half the size of a star to
@@ -339,11 +360,19 @@ int InternalExtractorSolver::runSEPExtractor()
         DEFAULT_MARGIN = 50;
 
     // Only partition if:
-    // We have 2 or more threads.
-    // The image width and height is larger than partition size.
-    constexpr int PARTITION_SIZE = 200;
-    if (m_ActiveParameters.partition &&  w > PARTITION_SIZE && h > PARTITION_SIZE && (m_PartitionThreads % 2) == 0)
+    // Partitioning is enabled and we have 2 or more threads.
+    // The image width and height is larger than the smallest tile size.
+    // The image is split into several tiles per thread.  The tiles are queued on a thread pool, so a thread
+    // that finishes a tile with few stars just takes the next one instead of waiting on a crowded tile.
+    constexpr int MIN_PARTITION_SIZE = 200;
+    constexpr int TILES_PER_THREAD = 4;
+    if (m_ActiveParameters.partition && threads > 1 && w > MIN_PARTITION_SIZE && h > MIN_PARTITION_SIZE)
     {
+        int tileSize = m_ActiveParameters.partitionSize;
+        if (tileSize <= 0)
+            tileSize = static_cast<int>(sqrt(static_cast<double>(w) * h / (threads * TILES_PER_THREAD)));
+        tileSize = std::max(tileSize, MIN_PARTITION_SIZE);
+
         // Partition the image to regions.
         // If there is extra at the end, we add an offset.
         // e.g. 500x400 image with patitions sized 200x200 would have 4 paritions
@@ -351,21 +380,12 @@ int InternalExtractorSolver::runSEPExtractor()
         // #2 200, 0, 200 + 100, 200 (300 x 200)
         // #3 0, 200, 200, 200 (200 x 200)
         // #4 200, 200, 200 + 100, 200 (300 x 200)
-
-        int W_PARTITION_SIZE = PARTITION_SIZE;
-        int H_PARTITION_SIZE = PARTITION_SIZE;
-
-        // Limit it to PARTITION_THREADS
-        if ( (w * h) / (W_PARTITION_SIZE * H_PARTITION_SIZE) > m_PartitionThreads)
-        {
-            W_PARTITION_SIZE = w / (m_PartitionThreads / 2);
-            H_PARTITION_SIZE = h / 2;
-        }
-
-        int horizontalPartitions = w / W_PARTITION_SIZE;
-        int verticalPartitions = h / H_PARTITION_SIZE;
-        int horizontalOffset = w - (W_PARTITION_SIZE * horizontalPartitions);
-        int verticalOffset = h - (H_PARTITION_SIZE * verticalPartitions);
+        const int horizontalPartitions = std::max(1, static_cast<int>(w) / tileSize);
+        const int verticalPartitions = std::max(1, static_cast<int>(h) / tileSize);
+        const int W_PARTITION_SIZE = std::min(static_cast<int>(w), tileSize);
+        const int H_PARTITION_SIZE = std::min(static_cast<int>(h), tileSize);
+        const int horizontalOffset = w - (W_PARTITION_SIZE * horizontalPartitions);
+        const int verticalOffset = h - (H_PARTITION_SIZE * verticalPartitions);
 
         for (int i = 0; i < verticalPartitions; i++)
         {
@@ -384,38 +404,8 @@ int InternalExtractorSolver::runSEPExtractor()
                               m_Statistics.width, m_Statistics.height, DEFAULT_MARGIN,
                               &startX, &startY, &subWidth, &subHeight);
 
-                startupOffsets.append(StartupOffset(startX, startY, subWidth, subHeight,
-                                                    rawStartX, rawStartY, rawEndX - 1, rawEndY - 1));
-
-                float* data = allocateDataBuffer(startX, startY, subWidth, subHeight);
-                if(data == nullptr)
-                {
-                    for (auto *buffer : dataBuffers)
-                        delete [] buffer;
-                    dataBuffers.clear();
-                    emit logOutput("Failed to allocate memory.");
-                    return -1;
-                }
-                if(data)
-                    dataBuffers.append(data);
-                FITSImage::Background tempBackground;
-                backgrounds.append(tempBackground);
-
-                ImageParams parameters = {data,
-                                          subWidth,
-                                          subHeight,
-                                          0,
-                                          0,
-                                          subWidth,
-                                          subHeight,
-                                          m_ActiveParameters.initialKeep / m_PartitionThreads,
-                                          &backgrounds[backgrounds.size() - 1]
-                                         };
-                #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-                    futures.append(QtConcurrent::run(&InternalExtractorSolver::extractPartition, this, parameters));
-                #else
-                    futures.append(QtConcurrent::run(this, &InternalExtractorSolver::extractPartition, parameters));
-                #endif
+                tiles.append(StartupOffset(startX, startY, subWidth, subHeight,
+                                           rawStartX, rawStartY, rawEndX - 1, rawEndY - 1));
             }
         }
     }
@@ -427,109 +417,174 @@ int InternalExtractorSolver::runSEPExtractor()
         computeMargin(x, y, x + w - 1, y + h - 1, m_Statistics.width, m_Statistics.height, DEFAULT_MARGIN,
                       &startX, &startY, &subWidth, &subHeight);
 
-        auto* data = allocateDataBuffer(startX, startY, subWidth, subHeight);
-        if(data == nullptr)
+        tiles.append(StartupOffset(startX, startY, subWidth, subHeight, x, y, x + w - 1, y + h - 1));
+    }
+
+    // When there are fewer tiles than threads, the threads that are left over help the tiles measure their stars.
+    const int photometryThreads = std::max(1, threads / static_cast<int>(tiles.size()));
+    m_PhotometryPool.setMaxThreadCount(std::max(1, threads - static_cast<int>(tiles.size())));
+
+    // For solving, only the keepNum brightest stars are needed.  A quick look at a binned copy of the image picks a
+    // threshold that leaves about half as many again, so the stars below it aren't extracted and measured at all.
+    const double configuredMultiple = m_ActiveParameters.threshold_bg_multiple;
+    double thresholdMultiple = configuredMultiple;
+    if (m_ActiveParameters.brightestOnly && m_ActiveParameters.resort && m_ActiveParameters.keepNum > 0)
+    {
+        const double brightestMultiple = brightestStarsThreshold(x, y, w, h, static_cast<int>(ceil(1.5 * m_ActiveParameters.keepNum)));
+        if (brightestMultiple > configuredMultiple)
         {
-            for (auto *buffer : dataBuffers)
-            {
-                if(buffer)
-                    delete [] buffer;
-                buffer = nullptr;
-            }
-            dataBuffers.clear();
-            emit logOutput("Failed to allocate memory.");
-            return -1;
+            emit logOutput(QString("Raising the detection threshold to %1 times the background noise to extract about the %2 brightest stars")
+                           .arg(brightestMultiple, 0, 'f', 1).arg(m_ActiveParameters.keepNum));
+            thresholdMultiple = brightestMultiple;
         }
-        if(data)
-            dataBuffers.append(data);
-        startupOffsets.append(StartupOffset(startX, startY, subWidth, subHeight, x, y, x + w - 1, y + h - 1));
-        FITSImage::Background tempBackground;
-        backgrounds.append(tempBackground);
-
-        ImageParams parameters = {data, subWidth, subHeight, 0, 0, subWidth, subHeight, static_cast<uint32_t>(m_ActiveParameters.initialKeep), &backgrounds[backgrounds.size() - 1]};
-        #if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-            futures.append(QtConcurrent::run(&InternalExtractorSolver::extractPartition, this, parameters));
-        #else
-            futures.append(QtConcurrent::run(this, &InternalExtractorSolver::extractPartition, parameters));
-        #endif
     }
 
-    for (auto &oneFuture : futures)
+    // This extracts all of the tiles with the given threshold and merges their stars and backgrounds.
+    auto extractTiles = [&](double multiple)
     {
-        oneFuture.waitForFinished();
-        QList<FITSImage::Star> partitionStars = oneFuture.result();
-        QList<FITSImage::Star> acceptedStars;
-        if (!startupOffsets.empty())
+        // Each tile saves its background to its own entry, so this must not be resized once the tiles are started.
+        QVector<FITSImage::Background> backgrounds(tiles.size());
+        // The stars found in each tile, in the same way.
+        QVector<FITSImage::StarCatalog> tileStars(tiles.size());
+        for (int t = 0; t < tiles.size(); t++)
         {
-            const StartupOffset oneOffset = startupOffsets.takeFirst();
-            const int startX = oneOffset.startX;
-            const int startY = oneOffset.startY;
-            for (auto &oneStar : partitionStars)
+            const StartupOffset tile = tiles[t];
+
+            // The stars to keep before HFR are shared out between the tiles by area.
+            uint32_t keep = static_cast<uint32_t>(m_ActiveParameters.initialKeep);
+            if (tiles.size() > 1)
             {
-                // Don't use stars from the margins (they're detected in other partitions).
-                if (oneStar.x < (oneOffset.innerStartX - startX) ||
-                        oneStar.y < (oneOffset.innerStartY - startY) ||
-                        oneStar.x > (oneOffset.innerEndX   - startX) ||
-                        oneStar.y > (oneOffset.innerEndY   - startY))
-                    continue;
-                oneStar.x += startX;
-                oneStar.y += startY;
-                acceptedStars.append(oneStar);
+                const double tileArea = static_cast<double>(tile.innerEndX - tile.innerStartX + 1) * (tile.innerEndY - tile.innerStartY + 1);
+                keep = static_cast<uint32_t>(std::max(1.0, ceil(m_ActiveParameters.initialKeep * tileArea / (static_cast<double>(w) * h))));
             }
+
+            ImageParams parameters = {partitionData(tile.startX, tile.startY),
+                                      dtype,
+                                      m_Statistics.width,
+                                      static_cast<uint32_t>(tile.height),
+                                      0,
+                                      0,
+                                      static_cast<uint32_t>(tile.width),
+                                      static_cast<uint32_t>(tile.height),
+                                      keep,
+                                      &backgrounds[t],
+                                      QRect(QPoint(tile.innerStartX - tile.startX, tile.innerStartY - tile.startY),
+                                            QPoint(tile.innerEndX - tile.startX, tile.innerEndY - tile.startY)),
+                                      QRect(tile.startX, tile.startY, tile.width, tile.height),
+                                      photometryThreads,
+                                      multiple
+                                     };
+
+            // The thread that extracts the tile moves its stars to image coordinates and stores them in the tile's own
+            // entry, so nothing needs a lock and all of the tile's SEP memory is freed before the next tile starts.
+            auto extractTile = [this, parameters, tile, &tileStars, t]()
+            {
+                // The tiles that haven't started when the extraction is aborted are skipped.
+                if (m_Cancelled)
+                    return;
+                FITSImage::StarCatalog stars = extractPartition(parameters);
+                for (auto &oneStar : stars)
+                {
+                    oneStar.x += tile.startX;
+                    oneStar.y += tile.startY;
+                }
+                tileStars[t] = std::move(stars);
+            };
+            futures.append(QtConcurrent::run(&m_TilePool, extractTile));
         }
-        m_ExtractedStars.append(acceptedStars);
-    }
 
-    double sumGlobal = 0, sumRmsSq = 0;
-    for (const auto &bg : std::as_const(backgrounds))
-    {
-        sumGlobal += bg.global;
-        sumRmsSq += bg.globalrms * bg.globalrms;
-    }
-    if (!backgrounds.empty())
+        // The tiles finish in any order, but their stars are added in tile order so the star list doesn't change from run to run.
+        int starCount = 0;
+        for (auto &oneFuture : futures)
+            oneFuture.waitForFinished();
+        for (const auto &stars : std::as_const(tileStars))
+            starCount += stars.size();
+        m_ExtractedStars.reserve(m_ExtractedStars.size() + starCount);
+        for (auto &stars : tileStars)
+        {
+            m_ExtractedStars.append(stars);
+            stars.clear();
+        }
+
+        double sumGlobal = 0, sumRmsSq = 0;
+        for (const auto &bg : std::as_const(backgrounds))
+        {
+            sumGlobal += bg.global;
+            sumRmsSq += bg.globalrms * bg.globalrms;
+        }
+        if (!backgrounds.empty())
+        {
+            m_Background.bw = backgrounds[0].bw;
+            m_Background.bh = backgrounds[0].bh;
+        }
+        m_Background.num_stars_detected = m_ExtractedStars.size();
+        m_Background.global = sumGlobal / backgrounds.size();
+        m_Background.globalrms = sqrt( sumRmsSq / backgrounds.size() );
+
+        futures.clear();
+    };
+
+    extractTiles(thresholdMultiple);
+    if (m_Cancelled)
     {
-        m_Background.bw = backgrounds[0].bw;
-        m_Background.bh = backgrounds[0].bh;
+        emit logOutput("Star extraction was aborted.");
+        return -1;
     }
-    m_Background.num_stars_detected = m_ExtractedStars.size();
-    m_Background.global = sumGlobal / backgrounds.size();
-    m_Background.globalrms = sqrt( sumRmsSq / backgrounds.size() );
-
     applyStarFilters(m_ExtractedStars);
 
-
-    for (auto * buffer : dataBuffers)
+    // The threshold is only an estimate, if it left too few stars they are extracted again with the configured one.
+    if (thresholdMultiple > configuredMultiple && m_ExtractedStars.size() < m_ActiveParameters.keepNum)
     {
-        if(buffer)
-            delete [] buffer;
+        emit logOutput("Too few stars were above the raised threshold, extracting them again with the configured one.");
+        m_ExtractedStars.clear();
+        extractTiles(configuredMultiple);
+        if (m_Cancelled)
+        {
+            emit logOutput("Star extraction was aborted.");
+            return -1;
+        }
+        applyStarFilters(m_ExtractedStars);
     }
-    dataBuffers.clear();
-    futures.clear();
 
     m_HasExtracted = true;
 
     return 0;
 }
 
-QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImageParams &parameters)
+FITSImage::StarCatalog InternalExtractorSolver::extractPartition(const ImageParams &parameters)
 {
-    float *imback = nullptr;
     double *fluxerr = nullptr, *area = nullptr;
     short *flag = nullptr;
     int status = 0;
     sep_bkg *bkg = nullptr;
     sep_catalog * catalog = nullptr;
-    QList<FITSImage::Star> partitionStars;
+    FITSImage::StarCatalog partitionStars;
     const uint32_t maxRadius = 50;
 
+    // With an ExtractionContext, the background and the extractor's buffers from an earlier partition are used again.
+    ExtractionContext::Workspace *workspace = m_ExtractionContext ? m_ExtractionContext->acquire(parameters.area) : nullptr;
+    // The background can only be updated from the last frame if this workspace last extracted the same partition.
+    bool updateBackground = false;
+    if (workspace)
+    {
+        bkg = workspace->background;
+        updateBackground = m_ActiveParameters.incrementalBackground && bkg && workspace->area == parameters.area;
+        workspace->area = parameters.area;
+    }
+
     auto cleanup = [ & ]()
     {
-        sep_bkg_free(bkg);
+        if (workspace)
+        {
+            workspace->background = bkg;
+            m_ExtractionContext->release(workspace);
+            workspace = nullptr;
+        }
+        else
+            sep_bkg_free(bkg);
         bkg = nullptr;
         Extract::sep_catalog_free(catalog);
         catalog = nullptr;
-        free(imback);
-        imback = nullptr;
         free(fluxerr);
         fluxerr = nullptr;
         free(area);
@@ -537,7 +592,8 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
         free(flag);
         flag = nullptr;
 
-        if (status != 0)
+        // An aborted extraction stops every tile, that isn't worth a message from each of them.
+        if (status != 0 && !m_Cancelled)
         {
             char errorMessage[512];
             sep_get_errmsg(status, errorMessage);
@@ -547,17 +603,16 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
 
     //These are for the HFR
     double requested_frac[2] = { 0.5, 0.99 };
-    double flux_fractions[2] = {0};
-    short flux_flag = 0;
     std::vector<std::pair<int, double>> ovals;
     int numToProcess = 0;
 
     // #0 Create SEP Image structure
-    sep_image im = {parameters.data,
+    // The data is only read, the background is subtracted as SEP reads it.
+    sep_image im = {const_cast<uint8_t *>(parameters.data),
                     nullptr,
                     nullptr,
                     nullptr,
-                    SEP_TFLOAT,
+                    parameters.dtype,
                     0,
                     0,
                     0,
@@ -568,20 +623,17 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
                     0,
                     SEP_NOISE_NONE,
                     1.0,
-                    0
+                    0,
+                    nullptr,
+                    nullptr
                    };
 
     // #1 Background estimate
-    status = sep_background(&im, 64, 64, 3, 3, 0.0, &bkg);
-    if (status != 0)
-    {
-        cleanup();
-        return partitionStars;
-    }
-
-    // #2 Background evaluation
-    imback = (float *)malloc((parameters.subW * parameters.subH) * sizeof(float));
-    status = sep_bkg_array(bkg, imback, SEP_TFLOAT);
+    // Only the rows of background tiles that changed since the last frame are measured again when updating.
+    if (updateBackground)
+        status = sep_background_update(&im, 3, 3, 0.0, m_ActiveParameters.backgroundDrift, &bkg, nullptr);
+    else
+        status = sep_background_reuse(&im, 64, 64, 3, 3, 0.0, &bkg);
     if (status != 0)
     {
         cleanup();
@@ -594,19 +646,42 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     parameters.background->global = bkg->global;
     parameters.background->globalrms = bkg->globalrms;
 
-    // #3 Background subtraction
-    status = sep_bkg_subarray(bkg, im.data, im.dtype);
-    if (status != 0)
+    // #2 Background subtraction, done by SEP while reading the image
+    im.back = bkg;
+
+    std::unique_ptr<Extract> ownExtractor;
+    Extract *extractor = nullptr;
+    if (workspace)
     {
-        cleanup();
-        return partitionStars;
+        if (!workspace->extractor)
+            workspace->extractor = new Extract();
+        extractor = workspace->extractor;
     }
-
-    std::unique_ptr<Extract> extractor;
-    extractor.reset(new Extract());
-    // #4 Source Extraction
+    else
+    {
+        ownExtractor.reset(new Extract());
+        extractor = ownExtractor.get();
+    }
+    // #3 Source Extraction
     // Note that we set deblend_cont = 1.0 to turn off deblending.
-    const double extractionThreshold = m_ActiveParameters.threshold_bg_multiple * bkg->globalrms +
+    // The objects are deblended on the same photometry pool that measures the stars below.
+    extractor->sep_set_deblend_threads(parameters.photometryThreads, [this](int workers, const std::function<void(int)> &work)
+    {
+        QVector<QFuture<void>> workerFutures;
+        for (int worker = 1; worker < workers; worker++)
+        {
+            workerFutures.append(QtConcurrent::run(&m_PhotometryPool, [&work, worker]()
+            {
+                work(worker);
+            }));
+        }
+        work(0);
+        for (auto &oneFuture : workerFutures)
+            oneFuture.waitForFinished();
+    });
+    // SEP stops between image lines and between deblended objects once the extraction is aborted.
+    extractor->sep_set_cancel_flag(&m_Cancelled);
+    const double extractionThreshold = parameters.thresholdMultiple * bkg->globalrms +
                                        m_ActiveParameters.threshold_offset;
     //fprintf(stderr, "Using %.1f =  %.1f * %.1f + %.1f\n", extractionThreshold, m_ActiveParameters.threshold_bg_multiple, bkg->globalrms,  m_ActiveParameters.threshold_offset);
     status = extractor->sep_extract(&im, extractionThreshold, SEP_THRESH_ABS, m_ActiveParameters.minarea,
@@ -614,6 +689,9 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
                                     sqrt(convFilter.size()), sqrt(convFilter.size()), SEP_FILTER_CONV,
                                     m_ActiveParameters.deblend_thresh,
                                     m_ActiveParameters.deblend_contrast, m_ActiveParameters.clean, m_ActiveParameters.clean_param, &catalog);
+    // An extractor kept in the ExtractionContext may be used next by another solver, so it doesn't keep this one's pool.
+    extractor->sep_set_deblend_threads(1, nullptr);
+    extractor->sep_set_cancel_flag(nullptr);
     if (status != 0)
     {
         cleanup();
@@ -623,126 +701,180 @@ QList<FITSImage::Star> InternalExtractorSolver::extractPartition(const ImagePara
     // Record the number of stars detected.
     parameters.background->num_stars_detected = catalog->nobj;
 
+    // The Lutz and deblending buffers aren't needed for the photometry below, unless they are kept in the ExtractionContext.
+    ownExtractor.reset();
+
     // Find the oval sizes for each detection in the detected star catalog, and sort by that. Oval size
     // correlates very well with HFR and likely magnitude.
+    ovals.reserve(catalog->nobj);
     for (int i = 0; i < catalog->nobj; i++)
     {
+        // Don't use stars from the margins (they're detected in other partitions).
+        // The positions are checked the same way as the star positions below.
+        const float xPos = catalog->x[i] + 1;
+        const float yPos = catalog->y[i] + 1;
+        if (xPos < parameters.inner.left() || yPos < parameters.inner.top() ||
+                xPos > parameters.inner.right() || yPos > parameters.inner.bottom())
+            continue;
         const double ovalSizeSq = catalog->a[i] * catalog->a[i] + catalog->b[i] * catalog->b[i];
         ovals.push_back(std::pair<int, double>(i, ovalSizeSq));
     }
-    if(catalog->nobj > 0)
+    if(!ovals.empty())
         std::sort(ovals.begin(), ovals.end(), [](const std::pair<int, double> &o1, const std::pair<int, double> &o2) -> bool { return o1.second > o2.second;});
 
-    numToProcess = std::min(static_cast<uint32_t>(catalog->nobj), parameters.keep);
+    numToProcess = std::min(static_cast<uint32_t>(ovals.size()), parameters.keep);
+
+    // Processing detections in the order of the sort above, but don't accept detections that go over the boundary.
+    std::vector<int> selected;
+    selected.reserve(numToProcess);
     for (int index = 0; index < numToProcess; index++)
     {
-        // Processing detections in the order of the sort above.
-        int i = ovals[index].first;
+        if (!(catalog->flag[ovals[index].first] & SEP_OBJ_TRUNC))
+            selected.push_back(ovals[index].first);
+    }
+    const int numSelected = static_cast<int>(selected.size());
+    partitionStars.reserve(numSelected);
+    std::vector<FITSImage::Star> measured(numSelected);
 
-        if (catalog->flag[i] & SEP_OBJ_TRUNC)
+    // This measures the stars from begin up to end, their apertures one at a time and then their HFRs together.
+    auto measureStars = [&](sep_image & image, int begin, int end)
+    {
+        for (int index = begin; index < end; index++)
         {
-            // Don't accept detections that go over the boundary.
-            continue;
-        }
+            int i = selected[index];
+
+            //Variables that are obtained from the catalog
+            //FOR SOME REASON, I FOUND THAT THE POSITIONS WERE OFF BY 1 PIXEL??
+            //This might be because of this: https://sextractor.readthedocs.io/en/latest/Param.html
+            //" Following the FITS convention, in SExtractor the center of the first image pixel has coordinates (1.0,1.0). "
+            float xPos = catalog->x[i] + 1;
+            float yPos = catalog->y[i] + 1;
+            float a = catalog->a[i];
+            float b = catalog->b[i];
+            float theta = catalog->theta[i];
+            float cxx = catalog->cxx[i];
+            float cyy = catalog->cxx[i];
+            float cxy = catalog->cxy[i];
+            double peak = catalog->peak[i];
+            int numPixels = catalog->npix[i];
+
+            //Variables that will be obtained through methods
+            double kronrad;
+            short kron_flag;
+            double sum = 0;
+            double sumerr;
+            double kron_area;
+
+            //This will need to be done for both auto and ellipse
+            if(m_ActiveParameters.apertureShape != SHAPE_CIRCLE)
+            {
+                //Constant values
+                //The instructions say to use a fixed value of 6: https://sep.readthedocs.io/en/v1.0.x/api/sep.kron_radius.html
+                //Finding the kron radius for the star extraction
 
-        //Variables that are obtained from the catalog
-        //FOR SOME REASON, I FOUND THAT THE POSITIONS WERE OFF BY 1 PIXEL??
-        //This might be because of this: https://sextractor.readthedocs.io/en/latest/Param.html
-        //" Following the FITS convention, in SExtractor the center of the first image pixel has coordinates (1.0,1.0). "
-        float xPos = catalog->x[i] + 1;
-        float yPos = catalog->y[i] + 1;
-        float a = catalog->a[i];
-        float b = catalog->b[i];
-        float theta = catalog->theta[i];
-        float cxx = catalog->cxx[i];
-        float cyy = catalog->cxx[i];
-        float cxy = catalog->cxy[i];
-        double flux = catalog->flux[i];
-        double peak = catalog->peak[i];
-        int numPixels = catalog->npix[i];
-
-        //Variables that will be obtained through methods
-        double kronrad;
-        short kron_flag;
-        double sum = 0;
-        double sumerr;
-        double kron_area;
-
-        //This will need to be done for both auto and ellipse
-        if(m_ActiveParameters.apertureShape != SHAPE_CIRCLE)
-        {
-            //Constant values
-            //The instructions say to use a fixed value of 6: https://sep.readthedocs.io/en/v1.0.x/api/sep.kron_radius.html
-            //Finding the kron radius for the star extraction
+                sep_kron_radius(&image, xPos, yPos, cxx, cyy, cxy, 6, 0, &kronrad, &kron_flag);
+            }
 
-            sep_kron_radius(&im, xPos, yPos, cxx, cyy, cxy, 6, 0, &kronrad, &kron_flag);
-        }
+            bool use_circle;
 
-        bool use_circle;
+            switch(m_ActiveParameters.apertureShape)
+            {
+                case SHAPE_AUTO:
+                    use_circle = kronrad * sqrt(a * b) < m_ActiveParameters.r_min;
+                    break;
 
-        switch(m_ActiveParameters.apertureShape)
-        {
-            case SHAPE_AUTO:
-                use_circle = kronrad * sqrt(a * b) < m_ActiveParameters.r_min;
-                break;
+                case SHAPE_CIRCLE:
+                    use_circle = true;
+                    break;
 
-            case SHAPE_CIRCLE:
-                use_circle = true;
-                break;
+                case SHAPE_ELLIPSE:
+                    use_circle = false;
+                    break;
 
-            case SHAPE_ELLIPSE:
-                use_circle = false;
-                break;
+            }
 
-        }
+            if(use_circle)
+            {
+                sep_sum_circle(&image, xPos, yPos, m_ActiveParameters.r_min, 0, m_ActiveParameters.subpix, m_ActiveParameters.inflags, &sum,
+                               &sumerr, &kron_area, &kron_flag);
+            }
+            else
+            {
+                sep_sum_ellipse(&image, xPos, yPos, a, b, theta, m_ActiveParameters.kron_fact * kronrad, 0, m_ActiveParameters.subpix,
+                                m_ActiveParameters.inflags, &sum, &sumerr,
+                                &kron_area, &kron_flag);
+            }
 
-        if(use_circle)
-        {
-            sep_sum_circle(&im, xPos, yPos, m_ActiveParameters.r_min, 0, m_ActiveParameters.subpix, m_ActiveParameters.inflags, &sum,
-                           &sumerr, &kron_area, &kron_flag);
-        }
-        else
-        {
-            sep_sum_ellipse(&im, xPos, yPos, a, b, theta, m_ActiveParameters.kron_fact * kronrad, 0, m_ActiveParameters.subpix,
-                            m_ActiveParameters.inflags, &sum, &sumerr,
-                            &kron_area, &kron_flag);
+            float mag = m_ActiveParameters.magzero - 2.5 * log10(sum);
+
+            measured[index] = {xPos,
+                               yPos,
+                               mag,
+                               static_cast<float>(sum),
+                               static_cast<float>(peak),
+                               0,
+                               a,
+                               b,
+                               qRadiansToDegrees(theta),
+                               0,
+                               0,
+                               numPixels
+                              };
         }
 
-        float mag = m_ActiveParameters.magzero - 2.5 * log10(sum);
-        float HFR = 0;
-
-        if(m_ProcessType == EXTRACT_WITH_HFR)
+        if(m_ProcessType == EXTRACT_WITH_HFR && end > begin)
         {
-            //Get HFR
-            sep_flux_radius(&im, catalog->x[i], catalog->y[i], maxRadius, 0, m_ActiveParameters.subpix, 0, &flux, requested_frac, 2,
-                            flux_fractions,
-                            &flux_flag);
-            HFR = flux_fractions[0];
+            //Get HFR, the annuli of each star are only summed out to the largest requested fraction of its flux
+            const int count = end - begin;
+            std::vector<double> xs(count), ys(count), fluxes(count), radii(2 * count);
+            for (int k = 0; k < count; k++)
+            {
+                int i = selected[begin + k];
+                xs[k] = catalog->x[i];
+                ys[k] = catalog->y[i];
+                fluxes[k] = catalog->flux[i];
+            }
+            if (sep_flux_radius_batch(&image, xs.data(), ys.data(), count, maxRadius, 0, m_ActiveParameters.subpix, 0,
+                                      fluxes.data(), requested_frac, 2, radii.data(), nullptr) == 0)
+            {
+                for (int k = 0; k < count; k++)
+                    measured[begin + k].HFR = radii[2 * k];
+            }
         }
+    };
+
+    // The stars are measured in chunks.  When the partition has photometry threads to spare, the calling thread and the
+    // photometry pool each take the next chunk until there are none left.  Each star has its own entry in measured,
+    // so the stars come out in the same order however the chunks are shared out.
+    constexpr int PHOTOMETRY_CHUNK = 32;
+    const int chunks = (numSelected + PHOTOMETRY_CHUNK - 1) / PHOTOMETRY_CHUNK;
+    const int workers = std::min(parameters.photometryThreads, chunks);
+    std::atomic<int> nextChunk {0};
+    auto work = [&]()
+    {
+        // Each thread has its own row for the background, so the aperture functions don't allocate one for every star.
+        std::vector<float> backline(im.back ? im.w : 0);
+        sep_image workerImage = im;
+        workerImage.backline = backline.empty() ? nullptr : backline.data();
+        for (int chunk = nextChunk++; chunk < chunks; chunk = nextChunk++)
+            measureStars(workerImage, chunk * PHOTOMETRY_CHUNK, std::min(numSelected, (chunk + 1) * PHOTOMETRY_CHUNK));
+    };
+    QVector<QFuture<void>> workerFutures;
+    for (int worker = 1; worker < workers; worker++)
+        workerFutures.append(QtConcurrent::run(&m_PhotometryPool, work));
+    work();
+    for (auto &oneFuture : workerFutures)
+        oneFuture.waitForFinished();
 
-        FITSImage::Star oneStar = {xPos,
-                                   yPos,
-                                   mag,
-                                   static_cast<float>(sum),
-                                   static_cast<float>(peak),
-                                   HFR,
-                                   a,
-                                   b,
-                                   qRadiansToDegrees(theta),
-                                   0,
-                                   0,
-                                   numPixels
-                                  };
-        // Make a copy and add it to QList
+    for (const auto &oneStar : measured)
         partitionStars.append(oneStar);
-    }
 
     cleanup();
 
     return partitionStars;
 }
 
-void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
+void InternalExtractorSolver::applyStarFilters(FITSImage::StarCatalog &starList)
 {
     if(starList.size() > 1)
     {
@@ -780,10 +912,7 @@ void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
             int numToRemove = starList.count() * (m_ActiveParameters.removeBrightest / 100.0);
             emit logOutput(QString("Removing the %1 brightest stars").arg(numToRemove));
             if(numToRemove > 1)
-            {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeFirst();
-            }
+                starList.erase(starList.begin(), starList.begin() + numToRemove);
         }
 
         if(m_ActiveParameters.resort && m_ActiveParameters.removeDimmest > 0.0 && m_ActiveParameters.removeDimmest < 100.0)
@@ -791,10 +920,7 @@ void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
             int numToRemove = starList.count() * (m_ActiveParameters.removeDimmest / 100.0);
             emit logOutput(QString("Removing the %1 dimmest stars").arg(numToRemove));
             if(numToRemove > 1)
-            {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeLast();
-            }
+                starList.truncate(starList.count() - numToRemove);
         }
 
         if(m_ActiveParameters.maxEllipse > 1)
@@ -809,10 +935,10 @@ void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
         if(m_ActiveParameters.saturationLimit > 0.0 && m_ActiveParameters.saturationLimit < 100.0)
         {
             double maxSizeofDataType;
-            if(m_Statistics.dataType == TSHORT || m_Statistics.dataType == TLONG || m_Statistics.dataType == TLONGLONG)
-                maxSizeofDataType = pow(2, m_Statistics.bytesPerPixel * 8) / 2 - 1;
-            else if(m_Statistics.dataType == TUSHORT || m_Statistics.dataType == TULONG)
-                maxSizeofDataType = pow(2, m_Statistics.bytesPerPixel * 8) - 1;
+            if(m_LoadedDataType == TSHORT || m_LoadedDataType == TLONG || m_LoadedDataType == TLONGLONG)
+                maxSizeofDataType = pow(2, m_LoadedBytesPerPixel * 8) / 2 - 1;
+            else if(m_LoadedDataType == TUSHORT || m_LoadedDataType == TULONG)
+                maxSizeofDataType = pow(2, m_LoadedBytesPerPixel * 8) - 1;
             else // Float and Double Images saturation level is not so easy to determine, especially since they were probably processed by another program and the saturation level is now changed.
                 maxSizeofDataType = -1;
 
@@ -836,136 +962,247 @@ void InternalExtractorSolver::applyStarFilters(QList<FITSImage::Star> &starList)
             emit logOutput(QString("Keeping just the %1 brightest stars").arg(m_ActiveParameters.keepNum));
             int numToRemove = starList.size() - m_ActiveParameters.keepNum;
             if(numToRemove > 1)
-            {
-                for(int i = 0; i < numToRemove; i++)
-                    starList.removeLast();
-            }
+                starList.truncate(m_ActiveParameters.keepNum);
         }
         emit logOutput(QString("Stars Found after Filtering: %1").arg(starList.size()));
     }
 }
 
+bool InternalExtractorSolver::prepareExtractionImage(int d, int threads)
+{
+    switch (m_Statistics.dataType)
+    {
+        case SEP_TBYTE:
+            return prepareExtractionImageType<uint8_t>(d, threads);
+        case TSHORT:
+            return prepareExtractionImageType<int16_t>(d, threads);
+        case TUSHORT:
+            return prepareExtractionImageType<uint16_t>(d, threads);
+        case TLONG:
+            return prepareExtractionImageType<int32_t>(d, threads);
+        case TULONG:
+            return prepareExtractionImageType<uint32_t>(d, threads);
+        case TFLOAT:
+            return prepareExtractionImageType<float>(d, threads);
+        case TDOUBLE:
+            return prepareExtractionImageType<double>(d, threads);
+        default:
+            return false;
+    }
+}
+
 template <typename T>
-float* InternalExtractorSolver::getFloatBuffer(int x, int y, int w, int h)
+bool InternalExtractorSolver::prepareExtractionImageType(int d, int threads)
 {
-    float* buffer = nullptr;
+    d = std::max(1, d);
+    const int w = m_Statistics.width;
+    const int outW = w / d;
+    const int outH = m_Statistics.height / d;
+    if(outW < 1 || outH < 1)
+        return false;
+
+    if(extractionBuffer)
+        delete [] extractionBuffer;
+    extractionBuffer = nullptr;
     try
     {
-        buffer = new float[w * h];
+        extractionBuffer = new float[static_cast<size_t>(outW) * outH];
     }
     catch (std::bad_alloc&)
     {
+        extractionBuffer = nullptr;
         emit logOutput("Failed to allocate memory.");
-        return nullptr;
+        return false;
     }
 
-    int channelShift = (m_Statistics.channels < 3 || usingDownsampledImage
-                        || usingMergedChannelImage) ? 0 : ( m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel );
-    auto * rawBuffer = reinterpret_cast<T const *>(m_ImageBuffer + channelShift);
-    float * floatPtr = buffer;
-
-    int x2 = x + w;
-    int y2 = y + h;
+    // The channels that are added up for each pixel, all three when they are merged, otherwise just the selected one
+    const bool merge = m_Statistics.channels == 3 && (m_ColorChannel == FITSImage::AVERAGE_RGB
+                       || m_ColorChannel == FITSImage::INTEGRATED_RGB);
+    auto * source = reinterpret_cast<T const *>(m_ImageBuffer);
+    const size_t nextChannel = m_Statistics.samples_per_channel;
+    QVector<T const *> channels;
+    if(merge)
+        channels = { source, source + nextChannel, source + nextChannel * 2 };
+    else if(m_Statistics.channels == 3)
+        channels = { source + nextChannel * m_ColorChannel };
+    else
+        channels = { source };
+    // Integrating adds the channels, averaging divides them by 3, and downsampling averages the d x d pixels
+    const float scale = (merge && m_ColorChannel == FITSImage::AVERAGE_RGB ? 1.0f / 3 : 1.0f) / (d * d);
+
+    // The source rows of each output row are added up in a float line first.  That loop runs over consecutive pixels,
+    // so the compiler vectorizes the conversion and the adds, and then each d pixels of the line make one output pixel.
+    // Each thread takes the next band of rows until there are none left.
+    constexpr int BAND_ROWS = 16;
+    const int lineW = outW * d;
+    const int bands = (outH + BAND_ROWS - 1) / BAND_ROWS;
+    std::atomic<int> nextBand {0};
+    auto work = [&]()
+    {
+        std::vector<float> line(lineW);
+        float *sum = line.data();
+        for (int band = nextBand++; band < bands; band = nextBand++)
+        {
+            for (int row = band * BAND_ROWS; row < std::min(outH, (band + 1) * BAND_ROWS); row++)
+            {
+                std::fill(line.begin(), line.end(), 0.0f);
+                for (int dy = 0; dy < d; dy++)
+                {
+                    for (T const *channel : channels)
+                    {
+                        T const *sourceRow = channel + static_cast<size_t>(row * d + dy) * w;
+                        for (int x = 0; x < lineW; x++)
+                            sum[x] += static_cast<float>(sourceRow[x]);
+                    }
+                }
+                float *destination = extractionBuffer + static_cast<size_t>(row) * outW;
+                if (d == 1)
+                {
+                    for (int x = 0; x < outW; x++)
+                        destination[x] = sum[x] * scale;
+                }
+                else
+                {
+                    for (int x = 0; x < outW; x++)
+                    {
+                        float total = 0;
+                        for (int dx = 0; dx < d; dx++)
+                            total += sum[x * d + dx];
+                        destination[x] = total * scale;
+                    }
+                }
+            }
+        }
+    };
+    const int workers = std::min(std::max(1, threads), bands);
+    QVector<QFuture<void>> workerFutures;
+    for (int worker = 1; worker < workers; worker++)
+        workerFutures.append(QtConcurrent::run(&m_TilePool, work));
+    work();
+    for (auto &oneFuture : workerFutures)
+        oneFuture.waitForFinished();
 
-    for (int y1 = y; y1 < y2; y1++)
+    m_ImageBuffer = reinterpret_cast<uint8_t const *>(extractionBuffer);
+    m_Statistics.dataType = TFLOAT;
+    m_Statistics.bytesPerPixel = sizeof(float);
+    m_Statistics.samples_per_channel = static_cast<uint32_t>(outW) * outH;
+    m_Statistics.width = outW;
+    m_Statistics.height = outH;
+    if(merge)
+        usingMergedChannelImage = true;
+    if(d > 1)
     {
-        int offset = y1 * m_Statistics.width;
-        for (int x1 = x; x1 < x2; x1++)
+        if(scaleunit == ARCSEC_PER_PIX)
         {
-            *floatPtr++ = rawBuffer[offset + x1];
+            scalelo *= d;
+            scalehi *= d;
         }
+        usingDownsampledImage = true;
     }
-
-    return buffer;
+    return true;
 }
 
-bool InternalExtractorSolver::downsampleImage(int d)
+double InternalExtractorSolver::brightestStarsThreshold(uint32_t x, uint32_t y, uint32_t w, uint32_t h, int count)
 {
     switch (m_Statistics.dataType)
     {
         case SEP_TBYTE:
-            return downSampleImageType<uint8_t>(d);
+            return brightestStarsThresholdType<uint8_t>(x, y, w, h, count);
         case TSHORT:
-            return downSampleImageType<int16_t>(d);
+            return brightestStarsThresholdType<int16_t>(x, y, w, h, count);
         case TUSHORT:
-            return downSampleImageType<uint16_t>(d);
+            return brightestStarsThresholdType<uint16_t>(x, y, w, h, count);
         case TLONG:
-            return downSampleImageType<int32_t>(d);
+            return brightestStarsThresholdType<int32_t>(x, y, w, h, count);
         case TULONG:
-            return downSampleImageType<uint32_t>(d);
+            return brightestStarsThresholdType<uint32_t>(x, y, w, h, count);
         case TFLOAT:
-            return downSampleImageType<float>(d);
+            return brightestStarsThresholdType<float>(x, y, w, h, count);
         case TDOUBLE:
-            return downSampleImageType<double>(d);
+            return brightestStarsThresholdType<double>(x, y, w, h, count);
         default:
-            return false;
+            return 0;
     }
 }
 
 template <typename T>
-bool InternalExtractorSolver::downSampleImageType(int d)
+double InternalExtractorSolver::brightestStarsThresholdType(uint32_t x, uint32_t y, uint32_t w, uint32_t h, int count)
 {
-    int w = m_Statistics.width;
-    int h = m_Statistics.height;
-    int oldBufferSize = m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel;
-    //It is d times smaller in width and height
-    int newBufferSize = oldBufferSize / (d * d);
-    if(downSampledBuffer)
-        delete [] downSampledBuffer;   
-    downSampledBuffer = nullptr;
-    try
-    {
-        downSampledBuffer = new uint8_t[newBufferSize];
-    }
-    catch (std::bad_alloc&)
-    {
-        downSampledBuffer = nullptr;
-        emit logOutput("Failed to allocate memory.");
-        return false;
-    }
-    int channelShift = ( m_Statistics.channels < 3
-                         || usingMergedChannelImage) ? 0 : ( m_Statistics.samples_per_channel * m_Statistics.bytesPerPixel * m_ColorChannel );
-    auto * sourceBuffer = reinterpret_cast<T const *>(m_ImageBuffer + channelShift);
-    auto * destinationBuffer = reinterpret_cast<T *>(downSampledBuffer);
-
-    for(int y = 0; y < h - d; y += d)
+    // The image is binned to about a megapixel, and at least 2x2, which also smooths the noise the way SEP's filter does.
+    constexpr double BINNED_PIXELS = 1e6;
+    // A local maximum of the binned image has to be this many times its noise above the background to count as a star.
+    constexpr double STAR_SIGNIFICANCE = 5.0;
+    // SEP compares the threshold with the filtered image, whose peaks are lower than the brightest pixels, so it is scaled down by this.
+    constexpr double THRESHOLD_MARGIN = 0.75;
+
+    const int bin = std::max(2, static_cast<int>(ceil(sqrt(static_cast<double>(w) * h / BINNED_PIXELS))));
+    const int binnedW = w / bin;
+    const int binnedH = h / bin;
+    if (count <= 0 || binnedW < 3 || binnedH < 3)
+        return 0;
+
+    // The mean and the brightest pixel of each bin
+    std::vector<float> means(static_cast<size_t>(binnedW) * binnedH);
+    std::vector<float> peaks(means.size());
+    std::vector<double> sums(binnedW);
+    for (int by = 0; by < binnedH; by++)
     {
-        for (int x = 0; x < w - d; x += d)
+        float *peakRow = peaks.data() + static_cast<size_t>(by) * binnedW;
+        std::fill(sums.begin(), sums.end(), 0.0);
+        std::fill(peakRow, peakRow + binnedW, std::numeric_limits<float>::lowest());
+        for (int dy = 0; dy < bin; dy++)
         {
-            //The sum of all the pixels in the sample
-            double total = 0;
-
-            for(int y2 = 0; y2 < d; y2++)
+            T const *row = reinterpret_cast<T const *>(partitionData(x, y + by * bin + dy));
+            for (int bx = 0; bx < binnedW; bx++)
             {
-                //The offset for the current line of the sample to take, since we have to sample different rows
-                int currentLine = w * y2;
-
-                auto *sample = sourceBuffer + currentLine + x;
-                for(int x2 = 0; x2 < d; x2++)
+                for (int dx = 0; dx < bin; dx++)
                 {
-                    //This iterates the sample x2 spots to the right,
-                    total += *sample++;
+                    const float value = row[bx * bin + dx];
+                    sums[bx] += value;
+                    peakRow[bx] = std::max(peakRow[bx], value);
                 }
             }
-            //This calculates the average pixel value and puts it in the new downsampled image.
-            int pixel = (x / d) + (y / d) * (w / d);
-            destinationBuffer[pixel] = total / (d * d);
         }
-        //Shifts the pointer by a whole line, d times
-        sourceBuffer += w * d;
+        for (int bx = 0; bx < binnedW; bx++)
+            means[static_cast<size_t>(by) * binnedW + bx] = sums[bx] / (bin * bin);
     }
 
-    m_ImageBuffer = downSampledBuffer;
-    m_Statistics.samples_per_channel /= (d * d);
-    m_Statistics.width /= d;
-    m_Statistics.height /= d;
-    if(scaleunit == ARCSEC_PER_PIX)
+    // The background is the median of the bins and the noise comes from their median absolute deviation.
+    std::vector<float> deviations(means);
+    auto middle = deviations.begin() + deviations.size() / 2;
+    std::nth_element(deviations.begin(), middle, deviations.end());
+    const float background = *middle;
+    for (auto &value : deviations)
+        value = std::fabs(value - background);
+    std::nth_element(deviations.begin(), middle, deviations.end());
+    const double binnedNoise = 1.4826 * *middle;
+    if (binnedNoise <= 0)
+        return 0;
+    // A bin averages bin * bin pixels, so the noise of one pixel is bin times larger.
+    const double noise = binnedNoise * bin;
+
+    std::vector<float> starPeaks;
+    for (int by = 1; by < binnedH - 1; by++)
     {
-        scalelo *= d;
-        scalehi *= d;
+        for (int bx = 1; bx < binnedW - 1; bx++)
+        {
+            const float *center = means.data() + static_cast<size_t>(by) * binnedW + bx;
+            const float value = *center;
+            if (value - background < STAR_SIGNIFICANCE * binnedNoise)
+                continue;
+            // Ties go to the first of the bins, so a flat topped star is only counted once.
+            if (value <= center[-binnedW - 1] || value <= center[-binnedW] || value <= center[-binnedW + 1] || value <= center[-1] ||
+                    value < center[1] || value < center[binnedW - 1] || value < center[binnedW] || value < center[binnedW + 1])
+                continue;
+            starPeaks.push_back(peaks[center - means.data()] - background);
+        }
     }
-    usingDownsampledImage = true;
-    return true;
+    if (static_cast<int>(starPeaks.size()) <= count)
+        return 0;
+
+    // The threshold is just below the brightest pixel of the star after the ones that are wanted.
+    std::nth_element(starPeaks.begin(), starPeaks.begin() + count, starPeaks.end(), std::greater<float>());
+    return THRESHOLD_MARGIN * starPeaks[count] / noise;
 }
 
 bool InternalExtractorSolver::mergeImageChannels()
@@ -1015,7 +1252,7 @@ bool InternalExtractorSolver::mergeImageChannelsType()
     }
     catch (std::bad_alloc&)
     {
-        downSampledBuffer = nullptr;
+        mergedChannelBuffer = nullptr;
         emit logOutput("Failed to allocate memory.");
         return false;
     }
@@ -1065,6 +1302,10 @@ bool InternalExtractorSolver::prepare_job()
     blind_init(bp);
     solver_set_default_values(sp);
 
+    //abort() cancels the solve from another thread through this
+    bp->cancel_callback = &InternalExtractorSolver::isCancelled;
+    bp->cancel_userdata = this;
+
     //These set the width and the height of the image in the solver
     sp->field_maxx = m_Statistics.width;
     sp->field_maxy = m_Statistics.height;
@@ -1146,6 +1387,169 @@ bool InternalExtractorSolver::prepare_job()
     return true;
 }
 
+//The fingerprint is taken from the stars that will be solved, so it is in the same pixels as the cached WCS.
+void InternalExtractorSolver::addCachedSolutionToVerify()
+{
+    // The cached WCS is verified like the other WCSes, which stops when the solve is aborted or out of time,
+    // so there is no point in looking it up if that has already happened.
+    if(m_Cancelled || std::chrono::steady_clock::now() >= m_Deadline)
+        return;
+
+    m_SolutionCacheKey = SolutionCache::fingerprint(m_ExtractedStars, m_Statistics.width, m_Statistics.height,
+                         &m_SolutionCachePose);
+    if(m_SolutionCacheKey.isEmpty())
+        return;
+
+    SolutionCache::Entry entry;
+    if(!SolutionCache::instance()->find(m_SolutionCacheKey, m_SolutionCachePose, entry))
+    {
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("The stars were not found in the solution cache");
+        return;
+    }
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Found a cached solution with index %1, verifying it before the search").arg(entry.indexid));
+    blind_add_verify_wcs(&(job->bp), &entry.wcs);
+    m_CachedWCSCount = 1;
+}
+
+//The prior solution is turned back into a TAN WCS and verified before the quad search, see blind_run() in blind.c.
+//The field may have moved by up to priorSolutionOffset since then, so the engine first shifts the WCS to where the index
+//stars line up with the field stars.  Larger moves have to come with a search position, and if none of these WCSes
+//solve, the engine goes on to the blind search.
+void InternalExtractorSolver::addPriorSolutionToVerify()
+{
+    blind_t* bp = &(job->bp);
+
+    // The prior is in arcsec per pixel of the full image, the solver works on the downsampled one.
+    double scale = arcsec2deg(m_PriorSolution.pixscale);
+    if(usingDownsampledImage)
+        scale *= m_ActiveParameters.downsample;
+    if(scale <= 0)
+        return;
+
+    // A shift of more than half the field leaves too few stars in common with the prior to be found.
+    const double offset = std::min(arcmin2deg(m_ActiveParameters.priorSolutionOffset) / scale,
+                                   0.5 * std::min(m_Statistics.width, m_Statistics.height));
+
+    // The search position is where the mount says it is now, so it goes first.
+    QVector<QPointF> centers;
+    if(m_UsePosition)
+        centers.append(QPointF(search_ra, search_dec));
+    centers.append(QPointF(m_PriorSolution.ra, m_PriorSolution.dec));
+
+    const double theta = deg2rad(m_PriorSolution.orientation);
+    const double c = cos(theta) * scale;
+    const double s = sin(theta) * scale;
+
+    // Note, positive parity = negative determinant, as in the solution.  See tan_get_orientation() for the angle.
+    double cd[2][2];
+    if(m_PriorSolution.parity == FITSImage::POSITIVE)
+    {
+        cd[0][0] = -c;
+        cd[0][1] = s;
+        cd[1][0] = s;
+        cd[1][1] = c;
+    }
+    else
+    {
+        cd[0][0] = c;
+        cd[0][1] = s;
+        cd[1][0] = -s;
+        cd[1][1] = c;
+    }
+
+    // At most four WCSes are verified, for the search position and the prior.
+    int count = 0;
+    for(const QPointF &center : centers)
+    {
+        // After a meridian flip, the same field is rotated by 180 degrees.
+        for(double flip : {1.0, -1.0})
+        {
+            tan_t tan;
+            memset(&tan, 0, sizeof(tan_t));
+            tan.crval[0] = center.x();
+            tan.crval[1] = center.y();
+            tan.crpix[0] = wcs_pixel_center_for_size(m_Statistics.width);
+            tan.crpix[1] = wcs_pixel_center_for_size(m_Statistics.height);
+            for(int i = 0; i < 2; i++)
+                for(int j = 0; j < 2; j++)
+                    tan.cd[i][j] = flip * cd[i][j];
+            tan.imagew = m_Statistics.width;
+            tan.imageh = m_Statistics.height;
+
+            sip_t sip;
+            sip_wrap_tan(&tan, &sip);
+            blind_add_verify_wcs_near(bp, &sip, offset);
+            count++;
+        }
+    }
+    if(m_SSLogLevel != LOG_OFF)
+        emit logOutput(QString("Verifying %1 WCSes near the prior solution before the blind search").arg(count));
+}
+
+//The calling thread is worker 0, the others run on the quad search pool.
+//Each worker takes the next item until there are none left, so a few slow items don't hold up the others.
+void InternalExtractorSolver::searchQuadsInParallel(void *baton, int nitems, void (*run)(int, int, void *), void *arg)
+{
+    auto *solver = static_cast<InternalExtractorSolver *>(baton);
+    //The first field stars only make a few small items, which take less time to search than starting the pool jobs does.
+    //So the items are only spread over as many threads as get several of them each, and the rest run on this thread alone.
+    constexpr int MIN_ITEMS_PER_THREAD = 8;
+    const int workers = std::min(solver->m_QuadSearchPool.maxThreadCount() + 1, nitems / MIN_ITEMS_PER_THREAD);
+    if (workers <= 1)
+    {
+        for (int item = 0; item < nitems; item++)
+            run(0, item, arg);
+        return;
+    }
+    std::atomic<int> next {0};
+    log_t logSettings;
+    log_get_settings(&logSettings);
+
+    auto work = [&](int worker)
+    {
+        for (int item = next++; item < nitems; item = next++)
+            run(worker, item, arg);
+    };
+    QVector<QFuture<void>> workerFutures;
+    workerFutures.reserve(workers);
+    for (int worker = 1; worker < workers; worker++)
+    {
+        workerFutures.append(QtConcurrent::run(&solver->m_QuadSearchPool, [&work, &logSettings, worker]()
+        {
+            // Astrometry.net logs per thread, so the workers log the same way as the solver thread.
+            log_set_settings(&logSettings);
+            work(worker);
+        }));
+    }
+    work(0);
+    for (auto &oneFuture : workerFutures)
+        oneFuture.waitForFinished();
+}
+
+void InternalExtractorSolver::lockMatches(void *baton, anbool lock)
+{
+    auto *solver = static_cast<InternalExtractorSolver *>(baton);
+    if (lock)
+        solver->m_MatchMutex.lock();
+    else
+        solver->m_MatchMutex.unlock();
+}
+
+anbool InternalExtractorSolver::isCancelled(void *userdata)
+{
+    return static_cast<InternalExtractorSolver *>(userdata)->m_Cancelled ? TRUE : FALSE;
+}
+
+void InternalExtractorSolver::releaseCachedIndexes()
+{
+    IndexCache *indexCache = IndexCache::instance();
+    for(auto index : m_CachedIndexes)
+        indexCache->release(index);
+    m_CachedIndexes.clear();
+}
+
 //This method was adapted from the main method in engine-main.c in astrometry.net
 int InternalExtractorSolver::runInternalSolver()
 {
@@ -1160,8 +1564,11 @@ int InternalExtractorSolver::runInternalSolver()
 
     //This sets some basic engine settings
     engine->inparallel = m_ActiveParameters.inParallel ? TRUE : FALSE;
+    engine->index_memory_budget = static_cast<size_t>(std::max<qint64>(m_IndexMemoryBudget, 0));
     engine->minwidth = m_ActiveParameters.minwidth;
     engine->maxwidth = m_ActiveParameters.maxwidth;
+    engine->residency.prefetch = m_ActiveParameters.prefetchIndexes ? TRUE : FALSE;
+    engine->residency.lock_tree_tops = static_cast<size_t>(std::max(m_ActiveParameters.indexTreeLockKB, 0)) * 1024;
 
     log_init((log_level)m_AstrometryLogLevel);
 
@@ -1180,19 +1587,29 @@ int InternalExtractorSolver::runInternalSolver()
         if(logFile)
             log_to(logFile);
     }
+    //The index files come from the IndexCache so that they are only opened once per process, not once per solve.
+    //The child solvers of a parallel solve all get the same loaded indexes from the cache.
+    IndexCache *indexCache = IndexCache::instance();
     for(const auto &onePath : indexFiles)
     {
-        engine_add_index(engine, onePath.toUtf8().data());
+        index_t *index = indexCache->acquire(onePath);
+        if(index)
+            m_CachedIndexes.append(index);
+        else
+            emit logOutput(QString("Failed to load index file: %1").arg(onePath));
     }
-    //These set the folders in which Astrometry.net will look for index files, based on the folers set before the solver was started.
+    //These are the folders in which to look for index files, based on the folers set before the solver was started.
     for(const auto &onePath : indexFolderPaths)
     {
-        engine_add_search_path(engine, onePath.toLatin1().constData());
+        m_CachedIndexes.append(indexCache->acquireFolder(onePath));
     }
 
-    //This actually adds the index files in the directories above.
-    if(indexFolderPaths.count() > 0)
-        engine_autoindex_search_paths(engine);
+    //This actually adds the index files found above to the engine.  They are only loaded once the engine selects them.
+    engine->load_shared_index = &IndexCache::loadIndex;
+    engine->shared_index_bytes = &IndexCache::loadedBytesOf;
+    engine->load_shared_index_userdata = indexCache;
+    for(auto index : m_CachedIndexes)
+        engine_add_shared_index(engine, index);
 
     //This checks to see that index files were found in the paths above, if not, it prints this warning and aborts.
     if (!pl_size(engine->indexes))
@@ -1205,6 +1622,7 @@ int InternalExtractorSolver::runInternalSolver()
                                "\n"));
         engine_free(engine);
         engine = nullptr;
+        releaseCachedIndexes();
         return -1;
     }
 
@@ -1212,6 +1630,26 @@ int InternalExtractorSolver::runInternalSolver()
 
     blind_t* bp = &(job->bp);
 
+    // The cached solution goes first, so m_CachedWCSCount tells whether it was the one that solved.
+    m_SolutionCacheKey.clear();
+    m_CachedWCSCount = 0;
+    m_SolvedFromCache = false;
+    if(m_ActiveParameters.useSolutionCache)
+        addCachedSolutionToVerify();
+    if(m_UsePriorSolution && m_ActiveParameters.usePriorSolution)
+        addPriorSolutionToVerify();
+
+    //With MULTI_SHARED, this one engine searches for quads in several threads, which share the field and the indexes.
+    if(m_ActiveParameters.multiAlgorithm == MULTI_SHARED)
+    {
+        const int threads = std::max(1, QThread::idealThreadCount());
+        m_QuadSearchPool.setMaxThreadCount(std::max(1, threads - 1));
+        bp->solver.parallel_for = &InternalExtractorSolver::searchQuadsInParallel;
+        bp->solver.parallel_lock = &InternalExtractorSolver::lockMatches;
+        bp->solver.parallel_baton = this;
+        bp->solver.parallel_workers = threads;
+    }
+
     //This will set up the field file to solve as an xylist
     double *xArray = nullptr;
     double *yArray = nullptr;
@@ -1227,16 +1665,14 @@ int InternalExtractorSolver::runInternalSolver()
         if(yArray)
             delete [] yArray;
         emit logOutput("Failed to allocate memory.");
+        engine_free(engine);
+        engine = nullptr;
+        releaseCachedIndexes();
         return -1;
     }
 
-    int i = 0;
-    for(const auto &oneStar : m_ExtractedStars)
-    {
-        xArray[i] = oneStar.x;
-        yArray[i] = oneStar.y;
-        i++;
-    }
+    m_ExtractedStars.copyColumn(&FITSImage::Star::x, xArray);
+    m_ExtractedStars.copyColumn(&FITSImage::Star::y, yArray);
 
     starxy_t* fieldToSolve = (starxy_t*)calloc(1, sizeof(starxy_t));
     fieldToSolve->x = xArray;
@@ -1276,6 +1712,8 @@ int InternalExtractorSolver::runInternalSolver()
     if (engine->minwidth <= 0.0 || engine->maxwidth <= 0.0 || engine->minwidth > engine->maxwidth)
     {
         emit logOutput(QString("\"minwidth\" and \"maxwidth\" must be positive and the maxwidth must be greater!\n"));
+        engine_free(engine);
+        releaseCachedIndexes();
         return -1;
     }
     ///This sets the scales based on the minwidth and maxwidth if the image scale isn't known
@@ -1300,6 +1738,13 @@ int InternalExtractorSolver::runInternalSolver()
         bp->total_timelimit = bp->timelimit;
         bp->total_cpulimit  = bp->cpulimit ;
     }
+
+    // The deadline from StellarSolver::solveWithin is moved to the monotonic clock the engine checks it on.
+    if (m_Deadline != std::chrono::steady_clock::time_point::max())
+    {
+        const double remaining = std::chrono::duration<double>(m_Deadline - std::chrono::steady_clock::now()).count();
+        bp->deadline = timenow_monotonic() + std::max(remaining, 0.0);
+    }
     emit logOutput("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++");
     emit logOutput("Starting Internal StellarSolver Astrometry.net based Engine with the " + m_ActiveParameters.listName +
                    " profile. . .");
@@ -1317,6 +1762,7 @@ int InternalExtractorSolver::runInternalSolver()
     //This deletes or frees the items that are no longer needed.
     engine_free(engine);
     engine = nullptr;
+    releaseCachedIndexes();
     bl_free(job->scales);
     job->scales = nullptr;
     dl_free(job->depths);
@@ -1396,6 +1842,14 @@ int InternalExtractorSolver::runInternalSolver()
         solutionIndexNumber = match.indexid;
         solutionHealpix = match.healpix;
         m_HasSolved = true;
+
+        if(!m_SolutionCacheKey.isEmpty())
+        {
+            m_SolvedFromCache = bp->verified_wcs >= 0 && bp->verified_wcs < m_CachedWCSCount;
+            if(m_SolvedFromCache)
+                emit logOutput("Solved by verifying the cached solution");
+            SolutionCache::instance()->insert(m_SolutionCacheKey, m_SolutionCachePose, wcs, match.indexid, match.healpix);
+        }
         returnCode = 0;
     }
     else
@@ -11,12 +11,16 @@
 #include <QtConcurrent>
 #include "qmutex.h"
 
+#include <atomic>
+
 //SEP Includes
 #include "sep/sep.h"
 
 //Project Includes
 #include "extractorsolver.h"
+#include "extractioncontext.h"
 #include "astrometrylogger.h"
+#include "solutioncache.h"
 
 //Astrometry.net includes
 extern "C" {
@@ -37,8 +41,9 @@ class InternalExtractorSolver: public ExtractorSolver
         // This struct contains information about the image used by SEP
         typedef struct
         {
-            float *data;
-            uint32_t width;
+            uint8_t const *data;    // First pixel of the partition, inside the image buffer
+            int dtype;              // SEP element type of the data
+            uint32_t width;         // Row stride of the data, in pixels
             uint32_t height;
             uint32_t subX;
             uint32_t subY;
@@ -46,6 +51,10 @@ class InternalExtractorSolver: public ExtractorSolver
             uint32_t subH;
             uint32_t keep;
             FITSImage::Background *background;
+            QRect inner;            // Stars outside of this, in partition coordinates, are in the margins and are dropped
+            QRect area;             // The partition in image coordinates, used to find the workspace it had last time
+            int photometryThreads;  // The number of threads, including the partition's own, that deblend and measure its stars
+            double thresholdMultiple; // The detection threshold, in units of the background noise
         } ImageParams;
 
         /**
@@ -77,6 +86,34 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         WCSData getWCSData() override;
 
+        /**
+         * @brief checkedSolutionCache Whether or not the last solve looked for a cached solution, see Parameters::useSolutionCache
+         * @return true if the solution cache was used
+         */
+        bool checkedSolutionCache() const
+        {
+            return !m_SolutionCacheKey.isEmpty();
+        }
+
+        /**
+         * @brief solvedFromSolutionCache Whether or not the last solve was solved by verifying a cached solution
+         * @return true if the cached solution was verified
+         */
+        bool solvedFromSolutionCache() const
+        {
+            return m_SolvedFromCache;
+        }
+
+        // The scratch memory kept for the star extractor between extractions, if any
+        QSharedPointer<ExtractionContext> m_ExtractionContext;
+
+        // The solution of an earlier frame, which the solver tries to verify before it starts a blind search
+        bool m_UsePriorSolution = false;
+        FITSImage::Solution m_PriorSolution;
+
+        // The bytes of index files that may be kept loaded when searching in parallel, 0 for no limit
+        qint64 m_IndexMemoryBudget = 0;
+
 
 
     protected:
@@ -87,6 +124,14 @@ class InternalExtractorSolver: public ExtractorSolver
         //This boolean gets set internally if we are using a Merged Channel image buffer
         bool usingMergedChannelImage = false;
 
+        //The data type and size of the image as it was loaded. Once the image is merged or downsampled for SEP,
+        //m_Statistics describes the float image instead.
+        uint32_t m_LoadedDataType { 0 };
+        int m_LoadedBytesPerPixel { 1 };
+
+        //This is set by abort(), the star extraction and the astrometry engine check it while they run
+        std::atomic<bool> m_Cancelled { false };
+
         /**
          * @brief runSEPExtractor is the method that actually runs internal SEP
          * @return
@@ -97,25 +142,46 @@ class InternalExtractorSolver: public ExtractorSolver
          * @brief applyStarFilters filters the stars list so that the list can be reduced for faster solving
          * @param starList
          */
-        void applyStarFilters(QList<FITSImage::Star> &starList);
+        void applyStarFilters(FITSImage::StarCatalog &starList);
 
         /**
          * @brief extractPartition actually performs star extraction in separate threads for different parts of the image
          * @param parameters The details about the image partition
-         * @return A QList containing Stars with all the details found during the operation
+         * @return A StarCatalog containing Stars with all the details found during the operation
          */
-        QList<FITSImage::Star> extractPartition(const ImageParams &parameters);
+        FITSImage::StarCatalog extractPartition(const ImageParams &parameters);
 
         /**
-         * @brief allocateDataBuffer allocates the space needed for the image buffer object used by SEP
-         * @param data is the image buffer used by SEP being allocated
+         * @brief partitionData finds a partition of the image in the image buffer, so SEP can read it in place
          * @param x is the starting x coordinate of the partition to be processed
          * @param y is the starting y coordinate of the partition to be processed
-         * @param w is the width of the partition to be processed
-         * @param h is the height of the partition to be processed
-         * @return The data buffer if successfull, a nullptr otherwise.
+         * @return A pointer to the first pixel of the partition
+         */
+        uint8_t const *partitionData(uint32_t x, uint32_t y) const;
+
+        /**
+         * @brief sepDataType gets the SEP element type matching the image data type
+         * @return The SEP element type, or 0 if SEP can't read this data type
+         */
+        int sepDataType() const;
+
+        /**
+         * @brief brightestStarsThreshold looks at a binned copy of part of the image to find a detection threshold that leaves about
+         * the given number of the brightest stars.  The background and noise are estimated from the binned pixels, and the stars
+         * are the local maxima of the binned image that stand well above the noise, measured by their brightest full size pixel.
+         * @param x is the starting x coordinate of the part of the image to look at
+         * @param y is the starting y coordinate of the part of the image to look at
+         * @param w is the width of the part of the image to look at
+         * @param h is the height of the part of the image to look at
+         * @param count The number of stars wanted
+         * @return The threshold in units of the background noise, or 0 if there aren't more stars than that
+         */
+        double brightestStarsThreshold(uint32_t x, uint32_t y, uint32_t w, uint32_t h, int count);
+
+        /**
+         * @brief brightestStarsThresholdType allows the brightestStarsThreshold method to handle different data types
          */
-        float* allocateDataBuffer(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+        template <typename T> double brightestStarsThresholdType(uint32_t x, uint32_t y, uint32_t w, uint32_t h, int count);
 
         /**
          * @brief mergeImageChannels merges the R, G, and B channels of a 3 channel image
@@ -130,8 +196,8 @@ class InternalExtractorSolver: public ExtractorSolver
 
     private:
 
-        // The generic data buffer containing the downsampled image data
-        uint8_t *downSampledBuffer { nullptr };
+        // The merged and/or downsampled image that SEP extracts the stars from
+        float *extractionBuffer { nullptr };
 
         // The generic data buffer containing an RGB image's merged channels data
         uint8_t *mergedChannelBuffer { nullptr };
@@ -139,6 +205,16 @@ class InternalExtractorSolver: public ExtractorSolver
         // This is the number of threads used for star extraction with SEP
         uint32_t m_PartitionThreads = {16};
 
+        // The thread pool the image tiles are queued on for star extraction with SEP
+        QThreadPool m_TilePool;
+
+        // The thread pool that helps the partitions measure their stars when there are fewer partitions than threads
+        QThreadPool m_PhotometryPool;
+
+        // The thread pool for the quad search of a MULTI_SHARED solve, and the mutex held while it records a match
+        QThreadPool m_QuadSearchPool;
+        QMutex m_MatchMutex;
+
         // Job File related
         job_t thejob;                   //This is the job file that will be created for astrometry.net to solve
         job_t* job = &thejob;           //This is a pointer to that job file
@@ -147,13 +223,22 @@ class InternalExtractorSolver: public ExtractorSolver
         MatchObj match;                 //This is where the match object gets stored once the solving is done.
         sip_t wcs;                      //This is where the WCS data gets saved once the solving is done
 
+        // Solution cache related
+        QByteArray m_SolutionCacheKey;  // The fingerprint of the stars of this solve, empty if the cache isn't used
+        SolutionCache::Pose m_SolutionCachePose;   // Where the fingerprint stars are in this image
+        int m_CachedWCSCount = 0;       // The number of WCSes from the cache at the start of the job's verify list
+        bool m_SolvedFromCache = false; // Whether the solution came from the cache
+
+        // Index related
+        QList<index_t*> m_CachedIndexes;  // The indexes acquired from the IndexCache for the current solve
+
         // Logging related
         FILE *logFile = nullptr;        // This is the name of the log file used
         AstrometryLogger astroLogger;  // This is an object that lets C based astrometry report to C++ based code
 
         // This is for star extraction, these are the futures for separate threads
-        // We need to keep a variable for this avaiable so we can abort the process if needed.
-        QVector<QFuture<QList<FITSImage::Star>>> futures;
+        // We need to keep a variable for this avaiable so the destructor can wait for them to finish.
+        QVector<QFuture<void>> futures;
         QBasicMutex futuresMutex;
 
         // InternalExtractorSolver Methods
@@ -164,6 +249,16 @@ class InternalExtractorSolver: public ExtractorSolver
          */
         bool prepare_job();
 
+        /**
+         * @brief addPriorSolutionToVerify adds WCSes near the prior solution to the job, so the engine verifies them before it starts the quad search
+         */
+        void addPriorSolutionToVerify();
+
+        /**
+         * @brief addCachedSolutionToVerify looks for the fingerprint of the stars in the SolutionCache, and adds the solution found to the job, so the engine verifies it before anything else
+         */
+        void addCachedSolutionToVerify();
+
         /**
          * @brief run starts the InternalExtractorSolver to do SEP or solving in a separate thread.
          */
@@ -176,31 +271,47 @@ class InternalExtractorSolver: public ExtractorSolver
         int runInternalSolver();
 
         /**
-         * @brief cancelSEP will cancel a star extraction and wait for it to finish
+         * @brief releaseCachedIndexes gives the indexes used by the current solve back to the IndexCache
          */
-        void waitSEP();
+        void releaseCachedIndexes();
 
         /**
-         * @brief getFloatBuffer gets a float buffer from the image buffer for SEP to perform star extraction
-         * @param buffer is a pointer to the created image buffer
-         * @param x is the starting x coordinate of the buffer
-         * @param y is the starting y coordinate of the buffer
-         * @param w is the width of the buffer
-         * @param h is the height of the buffer
+         * @brief searchQuadsInParallel runs the quad search items of one field star for solver_run(), see solver_t::parallel_for
+         * @param baton is the InternalExtractorSolver
+         * @param nitems is the number of items to run
+         * @param run is called once for each item, with the number of the worker running it
+         * @param arg is passed to run
          */
-        template <typename T> float* getFloatBuffer(int x, int y, int w, int h);
+        static void searchQuadsInParallel(void *baton, int nitems, void (*run)(int worker, int item, void *arg), void *arg);
+
+        /**
+         * @brief lockMatches locks or unlocks the mutex held while the quad search records a match, see solver_t::parallel_lock
+         */
+        static void lockMatches(void *baton, anbool lock);
+
+        /**
+         * @brief isCancelled tells the astrometry engine whether abort() was called, see blind_t::cancel_callback
+         * @param userdata is the InternalExtractorSolver
+         */
+        static anbool isCancelled(void *userdata);
+
+        /**
+         * @brief cancelSEP will cancel a star extraction and wait for it to finish
+         */
+        void waitSEP();
 
         /**
-         * @brief downsampleImage downsamples the image by the requested factor
-         * @param d The factor to downsample by in both dimensions
+         * @brief prepareExtractionImage makes the float image SEP extracts from in one pass over the loaded image,
+         * merging the channels of an RGB image and downsampling it on the way
+         * @param d The factor to downsample by in both dimensions, 1 to keep the full size
+         * @param threads The number of threads, including this one, that share the rows of the image
          */
-        bool downsampleImage(int d);
+        bool prepareExtractionImage(int d, int threads);
 
         /**
-         * @brief downSampleImageType allows the downsampling code to handle various data types
-         * @param d The factor to downsample by in both dimensions
+         * @brief prepareExtractionImageType allows the prepareExtractionImage method to handle various data types
          */
-        template <typename T> bool downSampleImageType(int d);
+        template <typename T> bool prepareExtractionImageType(int d, int threads);
 
 
 };
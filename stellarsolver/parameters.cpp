@@ -25,6 +25,12 @@ bool SSolver::Parameters::operator==(const Parameters& o)
 
             //Option to partition star extraction in separate threads or not
             partition == o.partition &&
+            partitionSize == o.partitionSize &&
+            partitionThreads == o.partitionThreads &&
+
+            //Option to update the background of repeated frames
+            incrementalBackground == o.incrementalBackground &&
+            backgroundDrift == o.backgroundDrift &&
 
             threshold_offset == o.threshold_offset &&
             threshold_bg_multiple == o.threshold_bg_multiple &&
@@ -35,6 +41,7 @@ bool SSolver::Parameters::operator==(const Parameters& o)
             maxEllipse == o.maxEllipse &&
             initialKeep == o.initialKeep &&
             keepNum == o.keepNum &&
+            brightestOnly == o.brightestOnly &&
             removeBrightest == o.removeBrightest &&
             removeDimmest == o.removeDimmest &&
             saturationLimit == o.saturationLimit &&
@@ -47,6 +54,12 @@ bool SSolver::Parameters::operator==(const Parameters& o)
             solverTimeLimit == o.solverTimeLimit &&
             minwidth == o.minwidth &&
             maxwidth == o.maxwidth &&
+            useSolutionCache == o.useSolutionCache &&
+            usePriorSolution == o.usePriorSolution &&
+            priorSolutionOffset == o.priorSolutionOffset &&
+            prefetchIndexes == o.prefetchIndexes &&
+            indexTreeLockKB == o.indexTreeLockKB &&
+            indexMemoryBudgetMB == o.indexMemoryBudgetMB &&
 
             //Basic Astrometry settings
             resort == o.resort &&
@@ -87,6 +100,12 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
 
     //Option to partition star extraction in separate threads or not
     settingsMap.insert("partition", QVariant(params.partition));
+    settingsMap.insert("partitionSize", QVariant(params.partitionSize));
+    settingsMap.insert("partitionThreads", QVariant(params.partitionThreads));
+
+    //Option to update the background of repeated frames
+    settingsMap.insert("incrementalBackground", QVariant(params.incrementalBackground));
+    settingsMap.insert("backgroundDrift", QVariant(params.backgroundDrift));
 
     settingsMap.insert("threshold_offset", QVariant(params.threshold_offset));
     settingsMap.insert("threshold_bg_multiple", QVariant(params.threshold_bg_multiple));
@@ -97,6 +116,7 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
     settingsMap.insert("maxEllipse", QVariant(params.maxEllipse));
     settingsMap.insert("initialKeep", QVariant(params.initialKeep));
     settingsMap.insert("keepNum", QVariant(params.keepNum));
+    settingsMap.insert("brightestOnly", QVariant(params.brightestOnly));
     settingsMap.insert("removeBrightest", QVariant(params.removeBrightest));
     settingsMap.insert("removeDimmest", QVariant(params.removeDimmest ));
     settingsMap.insert("saturationLimit", QVariant(params.saturationLimit));
@@ -109,6 +129,12 @@ QMap<QString, QVariant> SSolver::Parameters::convertToMap(const Parameters &para
     settingsMap.insert("minwidth", QVariant(params.minwidth)) ;
     settingsMap.insert("inParallel", QVariant(params.inParallel)) ;
     settingsMap.insert("solverTimeLimit", QVariant(params.solverTimeLimit));
+    settingsMap.insert("useSolutionCache", QVariant(params.useSolutionCache));
+    settingsMap.insert("usePriorSolution", QVariant(params.usePriorSolution));
+    settingsMap.insert("priorSolutionOffset", QVariant(params.priorSolutionOffset));
+    settingsMap.insert("prefetchIndexes", QVariant(params.prefetchIndexes));
+    settingsMap.insert("indexTreeLockKB", QVariant(params.indexTreeLockKB));
+    settingsMap.insert("indexMemoryBudgetMB", QVariant(params.indexMemoryBudgetMB));
 
     //Astrometry Basic Parameters
     settingsMap.insert("resort", QVariant(params.resort)) ;
@@ -154,6 +180,12 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
 
     //Option to partition star extraction in separate threads or not
     params.partition = settingsMap.value("partition", params.partition).toBool();
+    params.partitionSize = settingsMap.value("partitionSize", params.partitionSize).toInt();
+    params.partitionThreads = settingsMap.value("partitionThreads", params.partitionThreads).toInt();
+
+    //Option to update the background of repeated frames
+    params.incrementalBackground = settingsMap.value("incrementalBackground", params.incrementalBackground).toBool();
+    params.backgroundDrift = settingsMap.value("backgroundDrift", params.backgroundDrift).toDouble();
 
     //StellarSolver Star Filter Settings
     params.maxSize = settingsMap.value("maxSize", params.maxSize).toDouble();
@@ -161,6 +193,7 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
     params.maxEllipse = settingsMap.value("maxEllipse", params.maxEllipse).toDouble();
     params.initialKeep = settingsMap.value("initialKeep", params.initialKeep).toInt();
     params.keepNum = settingsMap.value("keepNum", params.keepNum).toInt();
+    params.brightestOnly = settingsMap.value("brightestOnly", params.brightestOnly).toBool();
     params.removeBrightest = settingsMap.value("removeBrightest", params.removeBrightest).toDouble();
     params.removeDimmest = settingsMap.value("removeDimmest", params.removeDimmest ).toDouble();
     params.saturationLimit = settingsMap.value("saturationLimit", params.saturationLimit).toDouble();
@@ -173,6 +206,12 @@ SSolver::Parameters SSolver::Parameters::convertFromMap(const QMap<QString, QVar
     params.minwidth = settingsMap.value("minwidth", params.minwidth).toDouble() ;
     params.inParallel = settingsMap.value("inParallel", params.inParallel).toBool() ;
     params.solverTimeLimit = settingsMap.value("solverTimeLimit", params.solverTimeLimit).toInt();
+    params.useSolutionCache = settingsMap.value("useSolutionCache", params.useSolutionCache).toBool();
+    params.usePriorSolution = settingsMap.value("usePriorSolution", params.usePriorSolution).toBool();
+    params.priorSolutionOffset = settingsMap.value("priorSolutionOffset", params.priorSolutionOffset).toDouble();
+    params.prefetchIndexes = settingsMap.value("prefetchIndexes", params.prefetchIndexes).toBool();
+    params.indexTreeLockKB = settingsMap.value("indexTreeLockKB", params.indexTreeLockKB).toInt();
+    params.indexMemoryBudgetMB = settingsMap.value("indexMemoryBudgetMB", params.indexMemoryBudgetMB).toInt();
 
     //Astrometry Basic Parameters
     params.resort = settingsMap.value("resort", params.resort).toBool();
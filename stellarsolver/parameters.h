@@ -224,7 +224,8 @@ static QString getCommandString(SSolver::ProcessType processType, SSolver::Extra
 typedef enum {NOT_MULTI,    // This option does not use parallel solving
               MULTI_SCALES, // This option generates multiple threads based on different image scales
               MULTI_DEPTHS, // This option generates multiple threads based on different image "depths"
-              MULTI_AUTO    // This option generates multiple threads (or not) automatically based on the algorithm that is best
+              MULTI_AUTO,   // This option generates multiple threads (or not) automatically based on the algorithm that is best
+              MULTI_SHARED  // This option searches with one solver in multiple threads that share the stars and the index files, only for the internal solver.  MULTI_AUTO does not choose it.
              } MultiAlgo;
 
 //This gets a string for which Parallel Solving Algorithm we are using
@@ -243,6 +244,10 @@ static QString getMultiAlgoString(SSolver::MultiAlgo multi)
         case MULTI_DEPTHS:
             return "Depths";
             break;
+
+        case MULTI_SHARED:
+            return "Shared";
+            break;
         default:
             return "";
             break;
@@ -350,6 +355,12 @@ class Parameters
 
         // Automatically partition the image to several threads to speed it up.
         bool partition = true;
+        int partitionSize = 0;      // The width and height in pixels of the image tiles extracted in separate threads, 0 picks it from the image size and the number of threads.  It is never below 200.
+        int partitionThreads = 0;   // The number of threads used to extract the tiles, 0 uses one per core.
+
+        // Update the background from the last frame instead of measuring all of it again.  This needs an ExtractionContext.
+        bool incrementalBackground = false;
+        double backgroundDrift = 0.25;  // How far, in units of a background tile's noise, a tile must change to be measured again.
 
         // gain
         double threshold_offset = 0;
@@ -362,6 +373,7 @@ class Parameters
         double maxEllipse = 0;      // The maximum ratio (a/b) for stars to include, this eliminates oblong stars
         int initialKeep = 1000000;  // Number of stars to keep in the list before HFR.  This is based on star size.  This is most useful for SEP operations involving HFR like Focusing images, Guiding, and monitoring image HFR over time.  It is important to reduce the number of stars prior to doing HFR calculations
         int keepNum = 0;            // The number of brightest stars to keep in the list.  This is based on magnitude.  This is most useful for Solving because limiting the number of stars to the brightest ones greatly speeds up the solver.
+        bool brightestOnly = false; // With keepNum, raise the detection threshold from a quick look at the image so that only about 1.5 x keepNum stars are extracted and measured.
         double removeBrightest = 0; // The percentage of brightest stars to remove from the list
         double removeDimmest = 0;   // The percentage of dimmest stars to remove from the list
         double saturationLimit = 0; // Remove all stars above a certain threshhold percentage of saturation
@@ -371,9 +383,15 @@ class Parameters
         MultiAlgo multiAlgorithm = MULTI_AUTO;
             // Note: If the indices you are using take less than 2 GB of space, and you have at least as much physical memory as indices, you want inParallel enabled for sure.
         bool inParallel = true;     // Check the indices in parallel? This loads them in memory at the same time.
+        bool prefetchIndexes = true;    // Start reading the indexes a solve selects in the background, so the search doesn't wait on page faults.
+        int indexTreeLockKB = 0;        // The kB of the top levels of each index kd-tree to lock in memory while a solve uses it, 0 for none.
+        int indexMemoryBudgetMB = 0;    // With inParallel, the MB of indexes kept loaded at once, the rest are searched one at a time.  0 uses the available RAM.
         int solverTimeLimit = 600;  // Give up solving after the specified number of seconds of CPU time
         double minwidth = 0.1;      // If no scale estimate is given, this is the limit on the minimum field width in degrees.
         double maxwidth = 180;      // If no scale estimate is given, this is the limit on the maximum field width in degrees.
+        bool useSolutionCache = false;      // Remember solutions by a fingerprint of the brightest stars, and verify the remembered one first when the same field comes back.
+        bool usePriorSolution = false;      // Verify WCSes near the last solution, or the one from setPriorSolution, before the blind search.
+        double priorSolutionOffset = 5;     // How far, in arcminutes, the field may have moved from the prior solution and still be verified.
 
 
         //Astrometry Basic Parameters
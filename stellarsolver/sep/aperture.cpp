@@ -159,6 +159,26 @@ static void oversamp_ann_ellipse(double r, double b, double *r_in2, double *r_ou
     *r_out2 = (*r_out2) * (*r_out2);
 }
 
+//# Added for the StellarSolver Internal Library
+/* the row buffer for the background when it hasn't been subtracted from the data: the scratch line given with
+ * the image if there is one, so measuring many objects doesn't allocate a row for each of them, otherwise a line
+ * allocated for this call that the caller frees through *ownbackline. */
+static int get_backline(const sep_image *im, PIXTYPE **backline, PIXTYPE **ownbackline)
+{
+    *backline = *ownbackline = NULL;
+    if (!im->back)
+        return RETURN_OK;
+    if (im->backline)
+    {
+        *backline = im->backline;
+        return RETURN_OK;
+    }
+    if (!(*ownbackline = (PIXTYPE *)malloc(im->w * sizeof(PIXTYPE))))
+        return MEMORY_ALLOC_ERROR;
+    *backline = *ownbackline;
+    return RETURN_OK;
+}
+
 /*****************************************************************************/
 /* circular aperture */
 
@@ -332,6 +352,7 @@ int sep_sum_circann_multi(sep_image *im,
     converter convert, econvert, mconvert, sconvert;
     double rpix, r_out, r_out2, d, prevbinmargin, nextbinmargin, step, stepdens;
     int j, ismasked;
+    PIXTYPE *backline, *ownbackline;  //# Added for the StellarSolver Internal Library
 
     /* input checks */
     if (rmax < 0.0 || n < 1)
@@ -397,6 +418,10 @@ int sep_sum_circann_multi(sep_image *im,
     boxextent(x, y, r_out, r_out, im->w, im->h, &xmin, &xmax, &ymin, &ymax,
               flag);
 
+    //# Added for the StellarSolver Internal Library, the background of the current row if it hasn't been subtracted from the data
+    if ((status = get_backline(im, &backline, &ownbackline)))
+        return status;
+
     /* loop over rows in the box */
     for (iy = ymin; iy < ymax; iy++)
     {
@@ -409,6 +434,8 @@ int sep_sum_circann_multi(sep_image *im,
             maskt = reinterpret_cast<uint8_t *>(im->mask) + pos * msize;
         if (im->segmap)
             segt = reinterpret_cast<uint8_t *>(im->segmap) + pos * ssize;
+        if (backline)
+            bkg_line_flt_range(im->back, iy, xmin, xmax, backline);
 
         /* loop over pixels in this row */
         for (ix = xmin; ix < xmax; ix++)
@@ -420,6 +447,8 @@ int sep_sum_circann_multi(sep_image *im,
             {
                 /* get pixel values */
                 pix = convert(datat);
+                if (backline)
+                    pix -= backline[ix - xmin];
                 if (errisarray)
                 {
                     varpix = econvert(errort);
@@ -545,6 +574,7 @@ int sep_sum_circann_multi(sep_image *im,
             if (sum[j] > 0.0)
                 sumvar[j] += sum[j] / im->gain;
 
+    free(ownbackline);
     return status;
 }
 
@@ -609,6 +639,208 @@ int sep_flux_radius(sep_image *im,
     return status;
 }
 
+//# Added for the StellarSolver Internal Library
+/* The first stage of sep_flux_radius_batch() measures this many annuli,
+ * each later stage doubles it. */
+#define FLUX_RADIUS_FIRST_STAGE 8
+
+/* Add the unmasked pixels of annuli kstart <= j < kend, of width `step`
+ * around (x, y), to sum[j].  Each row of the box is read, has its background
+ * subtracted and has its pixel radii computed in one pass; pixels that can't
+ * reach one of the annuli are skipped.  The sums are the same as those of
+ * sep_sum_circann_multi() for these annuli. */
+static int flux_radius_annuli(sep_image *im, double x, double y, double step,
+                              int kstart, int kend, int subpix,
+                              array_converter convert, int size,
+                              PIXTYPE *pixline, PIXTYPE *backline, double *rline,
+                              double *sum)
+{
+    double dx, dy, dx1, dy2, offset, scale, scale2, d, rin, rout;
+    double prevbinmargin, nextbinmargin, stepdens;
+    int ix, iy, xmin, xmax, ymin, ymax, sx, sy, j, nx, status;
+    long pos;
+    short boxflag;
+    PIXTYPE pix;
+
+    status = RETURN_OK;
+    scale = 1.0 / subpix;
+    scale2 = scale * scale;
+    offset = 0.5 * (scale - 1.0);
+    stepdens = 1.0 / step;
+    prevbinmargin = 0.7072;
+    nextbinmargin = step - 0.7072;
+
+    /* a subpixel is less than 0.7072 from the center of its pixel */
+    rin = kstart * step - 0.7072;
+    rout = kend * step + 0.7072;
+
+    /* the flag of the whole measurement is set by the caller */
+    boxflag = 0;
+    boxextent(x, y, kend * step + 1.5, kend * step + 1.5, im->w, im->h,
+              &xmin, &xmax, &ymin, &ymax, &boxflag);
+    nx = xmax - xmin;
+
+    for (iy = ymin; iy < ymax; iy++)
+    {
+        dy = iy - y;
+
+        /* the pixel values and radii of the row */
+        pos = (iy % im->raw_h) * im->raw_w + xmin;
+        convert(reinterpret_cast<uint8_t *>(im->data) + pos * size, nx, pixline);
+        if (im->back)
+        {
+            if ((status = bkg_line_flt_range(im->back, iy, xmin, xmax, backline)))
+                return status;
+            for (ix = 0; ix < nx; ix++)
+                pixline[ix] -= backline[ix];
+        }
+        for (ix = 0; ix < nx; ix++)
+        {
+            dx = xmin + ix - x;
+            rline[ix] = sqrt(dx * dx + dy * dy);
+        }
+
+        for (ix = 0; ix < nx; ix++)
+        {
+            if (rline[ix] < rin || rline[ix] >= rout)
+                continue;
+            pix = pixline[ix];
+
+            /* check if oversampling is needed (close to bin boundary?) */
+            d = fmod(rline[ix], step);
+            if (d < prevbinmargin || d > nextbinmargin)
+            {
+                dx = xmin + ix - x + offset;
+                dy = iy - y + offset;
+                for (sy = subpix; sy--; dy += scale)
+                {
+                    dx1 = dx;
+                    dy2 = dy * dy;
+                    for (sx = subpix; sx--; dx1 += scale)
+                    {
+                        j = (int)(sqrt(dx1 * dx1 + dy2) * stepdens);
+                        if (j >= kstart && j < kend)
+                            sum[j] += scale2 * pix;
+                    }
+                }
+            }
+            else
+            {
+                j = (int)(rline[ix] * stepdens);
+                if (j >= kstart && j < kend)
+                    sum[j] += pix;
+            }
+        }
+    }
+
+    return status;
+}
+
+int sep_flux_radius_batch(sep_image *im, const double *x, const double *y,
+                          int nobj, double rmax, int id, int subpix,
+                          short inflag, const double *fluxtot,
+                          const double *fluxfrac, int n, double *r,
+                          short *flag)
+{
+    int status, size, i, k, kstart, kend, xmin, xmax, ymin, ymax;
+    short objflag;
+    double step, maxfrac, target, cumsum;
+    double sumbuf[FLUX_RADIUS_BUFSIZE];
+    PIXTYPE *pixline, *backline, *ownbackline;
+    double *rline;
+    array_converter convert;
+
+    status = RETURN_OK;
+    pixline = backline = ownbackline = NULL;
+    rline = NULL;
+
+    /* the annuli are only summed outwards in stages with a total flux, and
+     * without a mask or segmentation map; otherwise each object is measured
+     * by itself. */
+    if (!fluxtot || im->mask || im->segmap)
+    {
+        for (k = 0; k < nobj; k++)
+        {
+            status = sep_flux_radius(im, x[k], y[k], rmax, id, subpix, inflag,
+                                     fluxtot ? const_cast<double *>(fluxtot + k) : NULL,
+                                     const_cast<double *>(fluxfrac), n, r + k * n, &objflag);
+            if (flag)
+                flag[k] = objflag;
+            if (status)
+                return status;
+        }
+        return status;
+    }
+
+    if (rmax < 0.0)
+        return ILLEGAL_APER_PARAMS;
+    if (subpix < 1)
+        return ILLEGAL_SUBPIX;
+    if ((status = get_array_converter(im->dtype, &convert, &size)))
+        return status;
+
+    QMALLOC(pixline, PIXTYPE, im->w, status);
+    QMALLOC(rline, double, im->w, status);
+    if ((status = get_backline(im, &backline, &ownbackline)))
+        goto exit;
+
+    step = rmax / FLUX_RADIUS_BUFSIZE;
+    maxfrac = 0.0;
+    for (i = 0; i < n; i++)
+        if (fluxfrac[i] > maxfrac)
+            maxfrac = fluxfrac[i];
+
+    for (k = 0; k < nobj; k++)
+    {
+        memset(sumbuf, 0, sizeof(sumbuf));
+        target = maxfrac * fluxtot[k];
+        cumsum = 0.0;
+        kstart = 0;
+
+        /* the flag is that of the box out to rmax, as in sep_flux_radius(),
+         * however few stages are measured */
+        objflag = 0;
+        boxextent(x[k], y[k], rmax + 1.5, rmax + 1.5, im->w, im->h,
+                  &xmin, &xmax, &ymin, &ymax, &objflag);
+
+        /* without a positive total flux the sums can't be compared with the
+         * target, so all of the annuli are measured in one pass */
+        if (fluxtot[k] <= 0.0)
+            kend = FLUX_RADIUS_BUFSIZE;
+        else
+            kend = FLUX_RADIUS_FIRST_STAGE < FLUX_RADIUS_BUFSIZE ? FLUX_RADIUS_FIRST_STAGE : FLUX_RADIUS_BUFSIZE;
+
+        /* stop as soon as the largest requested fraction of the flux is in */
+        for (;;)
+        {
+            if ((status = flux_radius_annuli(im, x[k], y[k], step, kstart, kend,
+                                             subpix, convert, size, pixline,
+                                             backline, rline, sumbuf)))
+                goto exit;
+            for (i = kstart; i < kend; i++)
+            {
+                cumsum += sumbuf[i];
+                sumbuf[i] = cumsum;
+            }
+            if (kend == FLUX_RADIUS_BUFSIZE || cumsum >= target)
+                break;
+            kstart = kend;
+            kend = 2 * kend < FLUX_RADIUS_BUFSIZE ? 2 * kend : FLUX_RADIUS_BUFSIZE;
+        }
+
+        for (i = 0; i < n; i++)
+            r[k * n + i] = inverse(kend * step, sumbuf, kend, fluxfrac[i] * fluxtot[k]);
+        if (flag)
+            flag[k] = objflag;
+    }
+
+exit:
+    free(pixline);
+    free(ownbackline);
+    free(rline);
+    return status;
+}
+
 /*****************************************************************************/
 /* calculate Kron radius from pixels within an ellipse. */
 int sep_kron_radius(sep_image *im, double x, double y,
@@ -623,6 +855,7 @@ int sep_kron_radius(sep_image *im, double x, double y,
 
     BYTE *datat, *maskt, *segt;
     converter convert, mconvert, sconvert;
+    PIXTYPE *backline, *ownbackline;  //# Added for the StellarSolver Internal Library
 
     r2 = r * r;
     r1 = v1 = 0.0;
@@ -643,6 +876,10 @@ int sep_kron_radius(sep_image *im, double x, double y,
     boxextent_ellipse(x, y, cxx, cyy, cxy, r, im->w, im->h,
                       &xmin, &xmax, &ymin, &ymax, flag);
 
+    //# Added for the StellarSolver Internal Library, the background of the current row if it hasn't been subtracted from the data
+    if ((status = get_backline(im, &backline, &ownbackline)))
+        return status;
+
     /* loop over rows in the box */
     for (iy = ymin; iy < ymax; iy++)
     {
@@ -653,6 +890,8 @@ int sep_kron_radius(sep_image *im, double x, double y,
             maskt = reinterpret_cast<uint8_t *>(im->mask) + pos * msize;
         if (im->segmap)
             segt = reinterpret_cast<uint8_t *>(im->segmap) + pos * ssize;
+        if (backline)
+            bkg_line_flt_range(im->back, iy, xmin, xmax, backline);
 
         /* loop over pixels in this row */
         for (ix = xmin; ix < xmax; ix++)
@@ -663,6 +902,8 @@ int sep_kron_radius(sep_image *im, double x, double y,
             if (rpix2 <= r2)
             {
                 pix = convert(datat);
+                if (backline)
+                    pix -= backline[ix - xmin];
                 ismasked = 0;
                 if ((pix < -BIG) || (im->mask && mconvert(maskt) > im->maskthresh))
                     ismasked = 1;
@@ -728,6 +969,7 @@ int sep_kron_radius(sep_image *im, double x, double y,
         *kronrad = r1 / v1;
     }
 
+    free(ownbackline);
     return RETURN_OK;
 }
 
@@ -788,6 +1030,7 @@ int sep_windowed(sep_image *im,
     BYTE *datat, *errort, *maskt;
     converter convert, econvert, mconvert;
     double r2, r_in2, r_out2;
+    PIXTYPE *backline, *ownbackline;  //# Added for the StellarSolver Internal Library
 
     /* input checks */
     if (sig < 0.0)
@@ -841,6 +1084,10 @@ int sep_windowed(sep_image *im,
          */
     }
 
+    //# Added for the StellarSolver Internal Library, the background of the current row if it hasn't been subtracted from the data
+    if ((status = get_backline(im, &backline, &ownbackline)))
+        return status;
+
     /* iteration loop */
     for (i = 0; i < WINPOS_NITERMAX; i++)
     {
@@ -868,6 +1115,8 @@ int sep_windowed(sep_image *im,
                 errort = reinterpret_cast<uint8_t *>(im->noise) + pos * esize;
             if (im->mask)
                 maskt = reinterpret_cast<uint8_t *>(im->mask) + pos * msize;
+            if (backline)
+                bkg_line_flt_range(im->back, iy, xmin, xmax, backline);
 
             /* loop over pixels in this row */
             for (ix = xmin; ix < xmax; ix++)
@@ -903,6 +1152,8 @@ int sep_windowed(sep_image *im,
 
                     /* get pixel value and variance value */
                     pix = convert(datat);
+                    if (backline)
+                        pix -= backline[ix - xmin];
                     if (errisarray)
                     {
                         varpix = econvert(errort);
@@ -995,6 +1246,7 @@ int sep_windowed(sep_image *im,
     *yout = y;
     *niter = i + 1;
 
+    free(ownbackline);
     return status;
 }
 
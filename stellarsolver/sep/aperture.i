@@ -19,6 +19,7 @@ int APER_NAME(sep_image *im,
     short errisarray, errisstd;
     BYTE *datat, *errort, *maskt, *segt;
     converter convert, econvert, mconvert, sconvert;
+    PIXTYPE *backline, *ownbackline;  //# Added for the StellarSolver Internal Library
     APER_DECL;
 
     /* input checks */
@@ -70,6 +71,10 @@ int APER_NAME(sep_image *im,
     /* get extent of box */
     APER_BOXEXTENT;
 
+    //# Added for the StellarSolver Internal Library, the background of the current row if it hasn't been subtracted from the data
+    if ((status = get_backline(im, &backline, &ownbackline)))
+        return status;
+
     /* loop over rows in the box */
     for (iy = ymin; iy < ymax; iy++)
     {
@@ -82,6 +87,8 @@ int APER_NAME(sep_image *im,
             maskt = reinterpret_cast<uint8_t*>(im->mask) + pos * msize;
         if (im->segmap)
             segt = reinterpret_cast<uint8_t*>(im->segmap) + pos * ssize;
+        if (backline)
+            bkg_line_flt_range(im->back, iy, xmin, xmax, backline);
 
         /* loop over pixels in this row */
         for (ix = xmin; ix < xmax; ix++)
@@ -118,6 +125,8 @@ int APER_NAME(sep_image *im,
                     overlap = 1.0;
 
                 pix = convert(datat);
+                if (backline)
+                    pix -= backline[ix - xmin];
 
                 if (errisarray)
                 {
@@ -203,5 +212,6 @@ int APER_NAME(sep_image *im,
     *sumerr = sqrt(sigtv);
     *area = totarea;
 
+    free(ownbackline);
     return status;
 }
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
 #include "sep.h"
 #include "sepcore.h"
 
@@ -34,6 +35,7 @@ namespace SEP
 #define	QUANTIF_NSIGMA     5     /* histogram limits */
 #define	QUANTIF_NMAXLEVELS 4096  /* max nb of quantif. levels */
 #define	QUANTIF_AMIN       4     /* min nb of "mode pixels" */
+#define	PROBE_STEP         4     /* pixel spacing of the samples used by sep_background_update() */ //# Added for the StellarSolver Internal Library
 
 /* Background info in a single mesh*/
 typedef struct
@@ -56,10 +58,110 @@ void backstat(backstruct *backmesh,
 int filterback(sep_bkg *bkg, int fw, int fh, double fthresh);
 float backguess(backstruct *bkg, float *mean, float *sigma);
 int makebackspline(sep_bkg *bkg, float *map, float *dmap);
+//# Added for the StellarSolver Internal Library
+static int background_internal(sep_image *image, int bw, int bh, int fw, int fh,
+                               double fthresh, const char *rowmask, sep_bkg **bkg);
+static int backprobe(sep_image *image, sep_bkg *bkg, float *probe);
 
 
 int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
                    double fthresh, sep_bkg **bkg)
+{
+    *bkg = NULL;
+    return sep_background_reuse(image, bw, bh, fw, fh, fthresh, bkg);
+}
+
+//# Added for the StellarSolver Internal Library
+int sep_background_reuse(sep_image* image, int bw, int bh, int fw, int fh,
+                         double fthresh, sep_bkg **bkg)
+{
+    return background_internal(image, bw, bh, fw, fh, fthresh, NULL, bkg);
+}
+
+//# Added for the StellarSolver Internal Library
+int sep_background_update(sep_image *image, int fw, int fh, double fthresh,
+                          double drift, sep_bkg **bkg, int *changed)
+{
+    sep_bkg *b;
+    float *probe;
+    char *rowmask;
+    double tol;
+    int i, j, k, nchanged, status;
+
+    probe = NULL;
+    rowmask = NULL;
+    nchanged = 0;
+    if (changed)
+        *changed = 0;
+
+    b = *bkg;
+    if (!b || b->w != image->w || b->h != image->h)
+        return ILLEGAL_BKG_SIZE;
+
+    QMALLOC(probe, float, b->n, status);
+    QCALLOC(rowmask, char, b->ny, status);
+    if ((status = backprobe(image, b, probe)) != RETURN_OK)
+        goto exit;
+
+    /* a row of boxes is measured again if the sample of any of its boxes
+     * moved by more than `drift` times that box's noise. */
+    for (j = 0; j < b->ny; j++)
+    {
+        if (!b->probe || !b->meshback)
+            rowmask[j] = 1;
+        else
+            for (i = 0; i < b->nx; i++)
+            {
+                k = i + b->nx * j;
+                tol = drift * (b->meshsigma[k] > 0.0 ? b->meshsigma[k] : b->globalrms);
+                if (fabs(probe[k] - b->probe[k]) > tol)
+                {
+                    rowmask[j] = 1;
+                    break;
+                }
+            }
+        nchanged += rowmask[j];
+    }
+
+    /* nothing moved, so the filtered map and its splines are still good */
+    if (nchanged)
+    {
+        if ((status = background_internal(image, b->bw, b->bh, fw, fh, fthresh,
+                                          rowmask, bkg)) != RETURN_OK)
+            goto exit;
+        b = *bkg;
+
+        /* only the rows that were measured again get new samples, so a slow
+         * drift still adds up until it is large enough to be noticed */
+        if (!b->probe)
+        {
+            b->probe = probe;
+            probe = NULL;
+        }
+        else
+            for (j = 0; j < b->ny; j++)
+                if (rowmask[j])
+                    memcpy(b->probe + b->nx * j, probe + b->nx * j, b->nx * sizeof(float));
+    }
+
+    if (changed)
+        *changed = nchanged;
+
+exit:
+    free(probe);
+    free(rowmask);
+    if (status != RETURN_OK)
+    {
+        sep_bkg_free(*bkg);
+        *bkg = NULL;
+    }
+    return status;
+}
+
+//# Added for the StellarSolver Internal Library, the body of sep_background().
+//# If rowmask is given, only the rows of boxes it marks are measured and the rest keep their estimates from the last call.
+static int background_internal(sep_image* image, int bw, int bh, int fw, int fh,
+                               double fthresh, const char *rowmask, sep_bkg **bkg)
 {
     BYTE *imt, *maskt;
     int npix;                   /* size of image */
@@ -100,24 +202,39 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
     for (m = nx; m--; bm++)
         bm->histo = NULL;
 
-    /* Allocate the returned struct */
-    bkgout = static_cast<sep_bkg*>(malloc(sizeof(sep_bkg)));
-    //QMALLOC(bkgout, sep_bkg, 1, status);
-    bkgout->w = image->w;
-    bkgout->h = image->h;
-    bkgout->nx = nx;
-    bkgout->ny = ny;
-    bkgout->n = nb;
-    bkgout->bw = bw;
-    bkgout->bh = bh;
-    bkgout->back = NULL;
-    bkgout->sigma = NULL;
-    bkgout->dback = NULL;
-    bkgout->dsigma = NULL;
-    QMALLOC(bkgout->back, float, nb, status);
-    QMALLOC(bkgout->sigma, float, nb, status);
-    QMALLOC(bkgout->dback, float, nb, status);
-    QMALLOC(bkgout->dsigma, float, nb, status);
+    //# Modified for the StellarSolver Internal Library, an earlier result with the same sizes is filled in again
+    if (*bkg && (*bkg)->w == image->w && (*bkg)->h == image->h &&
+            (*bkg)->bw == bw && (*bkg)->bh == bh)
+    {
+        bkgout = *bkg;
+    }
+    else
+    {
+        sep_bkg_free(*bkg);
+        *bkg = NULL;
+
+        /* Allocate the returned struct */
+        bkgout = static_cast<sep_bkg*>(malloc(sizeof(sep_bkg)));
+        //QMALLOC(bkgout, sep_bkg, 1, status);
+        bkgout->w = image->w;
+        bkgout->h = image->h;
+        bkgout->nx = nx;
+        bkgout->ny = ny;
+        bkgout->n = nb;
+        bkgout->bw = bw;
+        bkgout->bh = bh;
+        bkgout->back = NULL;
+        bkgout->sigma = NULL;
+        bkgout->dback = NULL;
+        bkgout->dsigma = NULL;
+        bkgout->meshback = NULL;
+        bkgout->meshsigma = NULL;
+        bkgout->probe = NULL;
+        QMALLOC(bkgout->back, float, nb, status);
+        QMALLOC(bkgout->sigma, float, nb, status);
+        QMALLOC(bkgout->dback, float, nb, status);
+        QMALLOC(bkgout->dsigma, float, nb, status);
+    }
 
     /* cast input array pointers. These are used to step through the arrays. */
     imt = (BYTE *)image->data;
@@ -134,16 +251,16 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
             goto exit;
     }
 
-    /* If the input array type is not PIXTYPE, allocate a buffer to hold
-       converted values */
-    if (image->dtype != PIXDTYPE)
+    /* If the input array type is not PIXTYPE, or its rows are not contiguous,
+       allocate a buffer to hold converted values */
+    if (image->dtype != PIXDTYPE || image->raw_w != image->w)
     {
         QMALLOC(buf, PIXTYPE, bufsize, status);
         buft = buf;
         if (status != RETURN_OK)
             goto exit;
     }
-    if (image->mask && (image->mdtype != PIXDTYPE))
+    if (image->mask && (image->mdtype != PIXDTYPE || image->raw_w != image->w))
     {
         QMALLOC(mbuf, PIXTYPE, bufsize, status);
         mbuft = mbuf;
@@ -164,15 +281,33 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
         if (j == ny - 1 && npix % bufsize)
             bufsize = npix % bufsize;
 
+        //# Added for the StellarSolver Internal Library, a row that is not measured again keeps its earlier estimates
+        if (rowmask && !rowmask[j])
+        {
+            memcpy(bkgout->back + nx * j, bkgout->meshback + nx * j, nx * sizeof(float));
+            memcpy(bkgout->sigma + nx * j, bkgout->meshsigma + nx * j, nx * sizeof(float));
+            imt += elsize * imgbufsize;
+            if (image->mask)
+                maskt += melsize * imgbufsize;
+            continue;
+        }
+
         /* convert this row to PIXTYPE and store in buffer(s)*/
-        if (image->dtype != PIXDTYPE)
+        //# Modified for the StellarSolver Internal Library, a subframe of a wider image is converted one line at a time
+        if (image->raw_w != image->w)
+            for (k = 0; k < bufsize / image->w; k++)
+                convert(imt + elsize * image->raw_w * k, image->w, buft + image->w * k);
+        else if (image->dtype != PIXDTYPE)
             convert(imt, bufsize, buft);
         else
             buft = (PIXTYPE *)imt;
 
         if (image->mask)
         {
-            if (image->mdtype != PIXDTYPE)
+            if (image->raw_w != image->w)
+                for (k = 0; k < bufsize / image->w; k++)
+                    mconvert(maskt + melsize * image->raw_w * k, image->w, mbuft + image->w * k);
+            else if (image->mdtype != PIXDTYPE)
                 mconvert(maskt, bufsize, mbuft);
             else
                 mbuft = (PIXTYPE *)maskt;
@@ -217,6 +352,17 @@ int sep_background(sep_image* image, int bw, int bh, int fw, int fh,
     free(backmesh);
     backmesh = NULL;
 
+    //# Added for the StellarSolver Internal Library, keep the box estimates from before filtering for sep_background_update()
+    if (rowmask)
+    {
+        if (!bkgout->meshback)
+            QMALLOC(bkgout->meshback, float, nb, status);
+        if (!bkgout->meshsigma)
+            QMALLOC(bkgout->meshsigma, float, nb, status);
+        memcpy(bkgout->meshback, bkgout->back, nb * sizeof(float));
+        memcpy(bkgout->meshsigma, bkgout->sigma, nb * sizeof(float));
+    }
+
     /* Median-filter and check suitability of the background map */
     if ((status = filterback(bkgout, fw, fh, fthresh)) != RETURN_OK)
         goto exit;
@@ -255,6 +401,61 @@ exit:
     return status;
 }
 
+//# Added for the StellarSolver Internal Library
+/******************************** backprobe *********************************/
+/*
+Take the median of a sparse sample of the pixels of each background box,
+every PROBE_STEP pixels in x and y. It is a cheap way to see whether a box
+changed since the background was last measured.
+*/
+static int backprobe(sep_image *image, sep_bkg *bkg, float *probe)
+{
+    converter convert;
+    BYTE *row;
+    PIXTYPE *sample;
+    PIXTYPE pix;
+    int elsize, i, j, n, x, y, x0, x1, y0, y1, status;
+
+    sample = NULL;
+    status = get_converter(image->dtype, &convert, &elsize);
+    if (status != RETURN_OK)
+        return status;
+    QMALLOC(sample, PIXTYPE, (bkg->bw / PROBE_STEP + 1) * (bkg->bh / PROBE_STEP + 1), status);
+
+    for (j = 0; j < bkg->ny; j++)
+    {
+        y0 = j * bkg->bh;
+        y1 = std::min(y0 + bkg->bh, image->h);
+        for (i = 0; i < bkg->nx; i++)
+        {
+            x0 = i * bkg->bw;
+            x1 = std::min(x0 + bkg->bw, image->w);
+            n = 0;
+            for (y = y0 + (y1 - y0 > PROBE_STEP / 2 ? PROBE_STEP / 2 : 0); y < y1; y += PROBE_STEP)
+            {
+                row = (BYTE *)image->data + (size_t)elsize * y * image->raw_w;
+                for (x = x0 + (x1 - x0 > PROBE_STEP / 2 ? PROBE_STEP / 2 : 0); x < x1; x += PROBE_STEP)
+                {
+                    pix = convert(row + elsize * x);
+                    if (pix > -BIG && pix == pix)
+                        sample[n++] = pix;
+                }
+            }
+            if (n)
+            {
+                std::nth_element(sample, sample + n / 2, sample + n);
+                probe[i + bkg->nx * j] = sample[n / 2];
+            }
+            else
+                probe[i + bkg->nx * j] = -BIG;
+        }
+    }
+
+exit:
+    free(sample);
+    return status;
+}
+
 /******************************** backstat **********************************/
 /*
 Compute robust statistical estimators in a row of meshes.
@@ -782,14 +983,17 @@ float sep_bkg_pix(sep_bkg *bkg, int x, int y)
 /*****************************************************************************/
 
 int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
-                          float *line)
+                          int xstart, int xend, float *line)
 /* Interpolate background at line y (bicubic spline interpolation between
  * background map vertices) and save to line.
  * (values, dvalues) is either (bkg->back, bkg->dback) or
  * (bkg->sigma, bkg->dsigma) depending on whether the background value or rms
- * is being evaluated. */
+ * is being evaluated.
+ * //# Modified for the StellarSolver Internal Library
+ * Only pixels xstart <= x < xend of the line are evaluated, so line holds
+ * xend - xstart values. */
 {
-    int i, j, x, yl, nbx, nbxm1, nby, nx, width, ystep, changepoint, status;
+    int i, j, x, yl, nbx, nbxm1, nby, nx, ystep, changepoint, status, k;
     float	dx, dx0, dy, dy3, cdx, cdy, cdy3, temp, xstep;
     float *nodebuf, *dnodebuf, *u;
     float *node, *nodep, *dnode, *blo, *bhi, *dblo, *dbhi;
@@ -799,7 +1003,6 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
     dnodebuf = dnode = NULL;
     u = NULL;
 
-    width = bkg->w;
     nbx = bkg->nx;
     nbxm1 = nbx - 1;
     nby = bkg->ny;
@@ -877,11 +1080,31 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
         changepoint = nx / 2;
         dx  = (xstep - 1) / 2;	/* dx of the first pixel in the row */
         dx0 = ((nx + 1) % 2) * xstep / 2;	/* dx of the 1st pixel right to a bkgnd node */
-        blo = node;
-        bhi = node + 1;
-        dblo = dnode;
-        dbhi = dnode + 1;
-        for (x = i = 0, j = width; j--; i++, dx += xstep)
+        x = i = j = k = 0;
+        /* The first nx + 1 pixels use the first pair of nodes, then each
+         * following run of nx pixels moves on to the next pair at its
+         * changepoint, where dx restarts at dx0.  Start at the last such
+         * change before xstart rather than at the start of the line. */
+        if (changepoint > 0 && xstart >= nx + changepoint)
+        {
+            k = (xstart - nx - changepoint) / nx + 1;
+            if (k > nbx - 2)
+                k = nbx - 2;
+            if (k > 0)
+            {
+                j = nx + changepoint + (k - 1) * nx;
+                x = k;
+                i = changepoint;
+                k--;   /* the change at pixel j is made in the loop */
+            }
+            else
+                k = 0;
+        }
+        blo = node + k;
+        bhi = node + k + 1;
+        dblo = dnode + k;
+        dbhi = dnode + k + 1;
+        for (; j < xend; j++, i++, dx += xstep)
         {
             if (i == changepoint && x > 0 && x < nbxm1)
             {
@@ -893,8 +1116,9 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
             }
             cdx = 1 - dx;
 
-            *(line++) = (float)(cdx * (*blo + (cdx * cdx - 1)**dblo)
-                                + dx * (*bhi + (dx * dx - 1)**dbhi));
+            if (j >= xstart)
+                *(line++) = (float)(cdx * (*blo + (cdx * cdx - 1)**dblo)
+                                    + dx * (*bhi + (dx * dx - 1)**dbhi));
 
             if (i == nx)
             {
@@ -904,7 +1128,7 @@ int bkg_line_flt_internal(sep_bkg *bkg, float *values, float *dvalues, int y,
         }
     }
     else
-        for (j = width; j--;)
+        for (j = xstart; j < xend; j++)
         {
             *(line++) = (float) * node;
         }
@@ -920,7 +1144,14 @@ int sep_bkg_line_flt(sep_bkg *bkg, int y, float *line)
 /* Interpolate background at line y (bicubic spline interpolation between
  * background map vertices) and save to line */
 {
-    return bkg_line_flt_internal(bkg, bkg->back, bkg->dback, y, line);
+    return bkg_line_flt_internal(bkg, bkg->back, bkg->dback, y, 0, bkg->w, line);
+}
+
+//# Added for the StellarSolver Internal Library
+int bkg_line_flt_range(sep_bkg *bkg, int y, int xstart, int xend, float *line)
+/* Interpolate background at pixels xstart <= x < xend of line y */
+{
+    return bkg_line_flt_internal(bkg, bkg->back, bkg->dback, y, xstart, xend, line);
 }
 
 /*****************************************************************************/
@@ -929,7 +1160,7 @@ int sep_bkg_rmsline_flt(sep_bkg *bkg, int y, float *line)
 /* Interpolate background rms at line y (bicubic spline interpolation between
  * background map vertices) and save to line */
 {
-    return bkg_line_flt_internal(bkg, bkg->sigma, bkg->dsigma, y, line);
+    return bkg_line_flt_internal(bkg, bkg->sigma, bkg->dsigma, y, 0, bkg->w, line);
 }
 
 /*****************************************************************************/
@@ -1138,6 +1369,9 @@ void sep_bkg_free(sep_bkg *bkg)
         bkg->sigma = 0;     //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
         free(bkg->dsigma);
         bkg->dsigma = 0;    //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
+        free(bkg->meshback);    //# Added for the StellarSolver Internal Library
+        free(bkg->meshsigma);
+        free(bkg->probe);
     }
     free(bkg);
 
@@ -23,30 +23,334 @@ f* GNU Lesser General Public License for more details.
 #include "sep.h"
 #include "sepcore.h"
 
+#include <atomic>
 #include <cmath>
 
+//# Added for the StellarSolver Internal Library, SIMD line operations
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SEP_SIMD_X86 1
+#define SEP_TARGET(isa) __attribute__((target(isa)))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define SEP_SIMD_X86 1
+#define SEP_TARGET(isa)
+#include <intrin.h>
+#endif
+
+#ifdef SEP_SIMD_X86
+#include <immintrin.h>
+#endif
+
 namespace SEP
 {
 
+/*
+ * The convolution and matched filter are built from two operations on whole
+ * lines, one per kernel pixel.  They are vectorized with SSE2 or AVX2,
+ * chosen when first used from what the CPU supports, with a plain loop
+ * for other CPUs.  All versions do the same operations per pixel, so they
+ * give the same results within float rounding; they can differ in the last
+ * bit where the compiler contracts the plain loop into fused multiply-adds.
+ */
+namespace
+{
+
+/* dst[i] += c * src[i] */
+typedef void (*line_madd_func)(PIXTYPE *dst, const PIXTYPE *src, PIXTYPE c, int n);
+
+/* num[i] += c * im[i] / var[i]; denom[i] += c * c / var[i], skipping pixels
+ * with var[i] == 0.  var[i] is noise[i], or noise[i]^2 if the noise is a
+ * standard deviation. */
+typedef void (*line_matched_func)(PIXTYPE *num, PIXTYPE *denom, const PIXTYPE *im,
+                                  const PIXTYPE *noise, PIXTYPE c, int n, int isvar);
+
+typedef struct
+{
+    line_madd_func madd;
+    line_matched_func matched;
+} lineops;
+
+void line_madd_scalar(PIXTYPE *dst, const PIXTYPE *src, PIXTYPE c, int n)
+{
+    for (int i = 0; i < n; i++)
+        dst[i] += c * src[i];
+}
+
+void line_matched_scalar(PIXTYPE *num, PIXTYPE *denom, const PIXTYPE *im,
+                         const PIXTYPE *noise, PIXTYPE c, int n, int isvar)
+{
+    for (int i = 0; i < n; i++)
+    {
+        PIXTYPE varval = isvar ? noise[i] : noise[i] * noise[i];
+        if (varval != 0.0)
+        {
+            num[i] += c * im[i] / varval;
+            denom[i] += c * c / varval;
+        }
+    }
+}
+
+#ifdef SEP_SIMD_X86
+
+SEP_TARGET("sse2")
+void line_madd_sse2(PIXTYPE *dst, const PIXTYPE *src, PIXTYPE c, int n)
+{
+    __m128 vc = _mm_set1_ps(c);
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(dst + i, _mm_add_ps(_mm_loadu_ps(dst + i),
+                                          _mm_mul_ps(vc, _mm_loadu_ps(src + i))));
+    line_madd_scalar(dst + i, src + i, c, n - i);
+}
+
+SEP_TARGET("sse2")
+void line_matched_sse2(PIXTYPE *num, PIXTYPE *denom, const PIXTYPE *im,
+                       const PIXTYPE *noise, PIXTYPE c, int n, int isvar)
+{
+    __m128 vc = _mm_set1_ps(c);
+    __m128 vc2 = _mm_set1_ps(c * c);
+    __m128 zero = _mm_setzero_ps();
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 var = _mm_loadu_ps(noise + i);
+        if (!isvar)
+            var = _mm_mul_ps(var, var);
+        /* pixels with no variance add nothing (the division gives inf or nan there) */
+        __m128 ok = _mm_cmpneq_ps(var, zero);
+        __m128 vnum = _mm_div_ps(_mm_mul_ps(vc, _mm_loadu_ps(im + i)), var);
+        __m128 vdenom = _mm_div_ps(vc2, var);
+        _mm_storeu_ps(num + i, _mm_add_ps(_mm_loadu_ps(num + i), _mm_and_ps(ok, vnum)));
+        _mm_storeu_ps(denom + i, _mm_add_ps(_mm_loadu_ps(denom + i), _mm_and_ps(ok, vdenom)));
+    }
+    line_matched_scalar(num + i, denom + i, im + i, noise + i, c, n - i, isvar);
+}
+
+SEP_TARGET("avx2")
+void line_madd_avx2(PIXTYPE *dst, const PIXTYPE *src, PIXTYPE c, int n)
+{
+    __m256 vc = _mm256_set1_ps(c);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(_mm256_loadu_ps(dst + i),
+                                                _mm256_mul_ps(vc, _mm256_loadu_ps(src + i))));
+    line_madd_scalar(dst + i, src + i, c, n - i);
+}
+
+SEP_TARGET("avx2")
+void line_matched_avx2(PIXTYPE *num, PIXTYPE *denom, const PIXTYPE *im,
+                       const PIXTYPE *noise, PIXTYPE c, int n, int isvar)
+{
+    __m256 vc = _mm256_set1_ps(c);
+    __m256 vc2 = _mm256_set1_ps(c * c);
+    __m256 zero = _mm256_setzero_ps();
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 var = _mm256_loadu_ps(noise + i);
+        if (!isvar)
+            var = _mm256_mul_ps(var, var);
+        __m256 ok = _mm256_cmp_ps(var, zero, _CMP_NEQ_UQ);
+        __m256 vnum = _mm256_div_ps(_mm256_mul_ps(vc, _mm256_loadu_ps(im + i)), var);
+        __m256 vdenom = _mm256_div_ps(vc2, var);
+        _mm256_storeu_ps(num + i, _mm256_add_ps(_mm256_loadu_ps(num + i), _mm256_and_ps(ok, vnum)));
+        _mm256_storeu_ps(denom + i, _mm256_add_ps(_mm256_loadu_ps(denom + i), _mm256_and_ps(ok, vdenom)));
+    }
+    line_matched_scalar(num + i, denom + i, im + i, noise + i, c, n - i, isvar);
+}
+
+bool cpu_has_sse2()
+{
+#if defined(__GNUC__)
+    return __builtin_cpu_supports("sse2");
+#elif defined(_M_X64)
+    return true;
+#else
+    int info[4];
+    __cpuid(info, 1);
+    return (info[3] & (1 << 26)) != 0;
+#endif
+}
+
+bool cpu_has_avx2()
+{
+#if defined(__GNUC__)
+    return __builtin_cpu_supports("avx2");
+#else
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7)
+        return false;
+    __cpuid(info, 1);
+    /* the OS has to save the AVX registers too */
+    if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#endif
+}
+
+#endif /* SEP_SIMD_X86 */
+
+lineops pick_lineops()
+{
+    lineops ops = { line_madd_scalar, line_matched_scalar };
+#ifdef SEP_SIMD_X86
+    if (cpu_has_avx2())
+    {
+        ops.madd = line_madd_avx2;
+        ops.matched = line_matched_avx2;
+    }
+    else if (cpu_has_sse2())
+    {
+        ops.madd = line_madd_sse2;
+        ops.matched = line_matched_sse2;
+    }
+#endif
+    return ops;
+}
+
+/* whether the vector versions may be used, see sep_set_filter_simd() */
+std::atomic<bool> simd_enabled(true);
+
+const lineops &get_lineops()
+{
+    static const lineops ops = pick_lineops();
+    static const lineops scalar_ops = { line_madd_scalar, line_matched_scalar };
+    return simd_enabled.load(std::memory_order_relaxed) ? ops : scalar_ops;
+}
+
+} // namespace
+
+void sep_set_filter_simd(int enable)
+{
+    simd_enabled.store(enable != 0, std::memory_order_relaxed);
+}
+
+namespace
+{
+
+/* Split the kernel into a sum of at most maxterms separable terms,
+ * conv[y][x] = sum_t cols[t][y] * rows[t][x], by repeatedly taking out the row
+ * and column through the largest remaining element.  This is exact for the
+ * Gaussian kernels (one term) and the Mexican hat and ring kernels (two terms)
+ * up to float rounding.  Returns the number of terms, or -1 if the kernel
+ * needs more than maxterms. */
+int separate_kernel(const float *conv, int convw, int convh, int maxterms,
+                    float *rows, float *cols)
+{
+    int convn = convw * convh;
+    int i, t, x, y, pivot;
+    double scale = 0.0, p;
+    double *res = (double *)malloc(convn * sizeof(double));
+    if (!res)
+        return -1;
+
+    for (i = 0; i < convn; i++)
+    {
+        res[i] = conv[i];
+        scale = fmax(scale, fabs(res[i]));
+    }
+
+    for (t = 0; ; t++)
+    {
+        pivot = 0;
+        for (i = 1; i < convn; i++)
+            if (fabs(res[i]) > fabs(res[pivot]))
+                pivot = i;
+        if (fabs(res[pivot]) <= 1e-6 * scale)
+            break;
+        if (t == maxterms)
+        {
+            t = -1;
+            break;
+        }
+        p = res[pivot];
+        x = pivot % convw;
+        y = pivot / convw;
+        for (i = 0; i < convw; i++)
+            rows[t * convw + i] = res[y * convw + i];
+        for (i = 0; i < convh; i++)
+            cols[t * convh + i] = res[i * convw + x] / p;
+        for (i = 0; i < convn; i++)
+            res[i] -= (double)cols[t * convh + i / convw] * rows[t * convw + i % convw];
+    }
+    free(res);
+    return t;
+}
+
+}
+
+/* Prepare a kernel for convolve().
+ *
+ * kern : kernel to initialize
+ * conv : convolution kernel, kept by reference
+ * convw, convh : width and height of conv
+ * bw : width of the lines that will be convolved
+ *
+ * If applying the kernel as a sum of separable terms (a vertical pass then a
+ * horizontal pass for each) takes fewer line operations than applying it
+ * directly, the terms are stored in kern.
+ */
+int convkernel_init(convkernel *kern, float *conv, int convw, int convh, int bw)
+{
+    int status = RETURN_OK;
+    int maxterms = (convw * convh - 1) / (convw + convh);
+
+    memset(kern, 0, sizeof(convkernel));
+    kern->conv = conv;
+    kern->convw = convw;
+    kern->convh = convh;
+    if (maxterms < 1)
+        return RETURN_OK;
+
+    QMALLOC(kern->rows, float, maxterms * convw, status);
+    QMALLOC(kern->cols, float, maxterms * convh, status);
+    kern->nterms = separate_kernel(conv, convw, convh, maxterms, kern->rows, kern->cols);
+    if (kern->nterms > 0)
+    {
+        QMALLOC(kern->work, PIXTYPE, bw, status);
+        return RETURN_OK;
+    }
+
+exit:
+    convkernel_free(kern);
+    kern->conv = conv;
+    kern->convw = convw;
+    kern->convh = convh;
+    return status;
+}
+
+void convkernel_free(convkernel *kern)
+{
+    free(kern->rows);
+    free(kern->cols);
+    free(kern->work);
+    kern->rows = kern->cols = NULL;
+    kern->work = NULL;
+    kern->nterms = 0;
+}
+
 /* Convolve one line of an image with a given kernel.
  *
  * buf : arraybuffer struct containing buffer of data to convolve, and image
          dimension metadata.
- * conv : convolution kernel
- * convw, convh : width and height of conv
+ * kern : convolution kernel, prepared with convkernel_init()
  * buf : output convolved line (buf->dw elements long)
  */
-int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE *out)
+int convolve(arraybuffer *buf, int y, const convkernel *kern, PIXTYPE *out)
 {
-    int convw2, convn, cx, cy, i, dcx, y0;
+    int convw, convh, convw2, cx, cy, dcx, y0, n, t, ystart;
+    float *conv;
     PIXTYPE *line;    /* current line in input buffer */
-    PIXTYPE *outend;  /* end of output buffer */
-    PIXTYPE *src, *dst, *dstend;
+    const lineops &ops = get_lineops();
 
-    //outend = out + buf->dw;
-    outend = out + (buf->bw - 1);
+    conv = kern->conv;
+    convw = kern->convw;
+    convh = kern->convh;
+    n = buf->bw - 1;  /* length of the output line */
     convw2 = convw / 2;
     y0 = y - convh / 2; /* start line in image */
+    ystart = 0;         /* first kernel row used */
 
     /* Cut off top of kernel if it extends beyond image */
     if (y0 + convh > buf->dh)
@@ -56,7 +360,7 @@ int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE
     if (y0 < 0)
     {
         convh = convh + y0;
-        conv += convw * (-y0);
+        ystart = -y0;
         y0 = 0;
     }
 
@@ -64,35 +368,49 @@ int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE
     if ((y0 < buf->yoff) || (y0 + convh > buf->yoff + buf->bh))
         return LINE_NOT_IN_BUF;
 
-    memset(out, 0, (buf->bw - 1) * sizeof(PIXTYPE)); /* initialize output to zero */
+    memset(out, 0, n * sizeof(PIXTYPE)); /* initialize output to zero */
 
-    /* loop over pixels in the convolution kernel */
-    convn = convw * convh;
-    for (i = 0; i < convn; i++)
+    if (kern->nterms > 0)
     {
-        cx = i % convw;  /* x index in conv kernel */
-        cy = i / convw;  /* y index in conv kernel */
-        line = buf->bptr + buf->bw * (y0 - buf->yoff + cy); /* start of line */
-
-        /* get start and end positions in the source and target line */
-        dcx = cx - convw2; /* offset of conv pixel from conv center;
-                            determines offset between in and out line */
-        if (dcx >= 0)
+        /* separable kernel: for each term, combine the lines with the column
+         * weights, then shift and add that line with the row weights */
+        for (t = 0; t < kern->nterms; t++)
         {
-            src = line + dcx;
-            dst = out;
-            dstend = outend - dcx;
+            const float *col = kern->cols + t * kern->convh + ystart;
+            const float *row = kern->rows + t * convw;
+            memset(kern->work, 0, n * sizeof(PIXTYPE));
+            for (cy = 0; cy < convh; cy++)
+            {
+                line = buf->bptr + buf->bw * (y0 - buf->yoff + cy);
+                ops.madd(kern->work, line, col[cy], n);
+            }
+            for (cx = 0; cx < convw; cx++)
+            {
+                dcx = cx - convw2;
+                if (dcx >= 0)
+                    ops.madd(out, kern->work + dcx, row[cx], n - dcx);
+                else
+                    ops.madd(out - dcx, kern->work, row[cx], n + dcx);
+            }
         }
-        else
+        return RETURN_OK;
+    }
+
+    /* loop over pixels in the convolution kernel */
+    conv += convw * ystart;
+    for (cy = 0; cy < convh; cy++)
+    {
+        line = buf->bptr + buf->bw * (y0 - buf->yoff + cy); /* start of line */
+        for (cx = 0; cx < convw; cx++)
         {
-            src = line;
-            dst = out - dcx;
-            dstend = outend;
+            /* offset of conv pixel from conv center;
+               determines offset between in and out line */
+            dcx = cx - convw2;
+            if (dcx >= 0)
+                ops.madd(out, line + dcx, conv[cy * convw + cx], n - dcx);
+            else
+                ops.madd(out - dcx, line, conv[cy * convw + cx], n + dcx);
         }
-
-        /* multiply and add the values */
-        while (dst < dstend)
-            *(dst++) += conv[i] * *(src++);
     }
 
     return RETURN_OK;
@@ -125,10 +443,10 @@ int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y,
                    PIXTYPE *work, PIXTYPE *out, int noise_type)
 {
     int convw2, convn, cx, cy, i, dcx, y0;
-    PIXTYPE imval, varval;
     PIXTYPE *imline, *nline;    /* current line in input buffer */
     PIXTYPE *outend;            /* end of output buffer */
     PIXTYPE *src_im, *src_n, *dst_num, *dst_denom, *dst_num_end;
+    const lineops &ops = get_lineops();
 
     outend = out + (imbuf->bw - 1);
     convw2 = convw / 2;
@@ -189,20 +507,8 @@ int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y,
         }
 
         /* actually calculate values */
-        while (dst_num < dst_num_end)
-        {
-            imval = *src_im;
-            varval = (noise_type == SEP_NOISE_VAR) ? (*src_n) : (*src_n) * (*src_n);
-            if (varval != 0.0)
-            {
-                *dst_num   += conv[i] * imval / varval;
-                *dst_denom += conv[i] * conv[i] / varval;
-            }
-            src_im++;
-            src_n++;
-            dst_num++;
-            dst_denom++;
-        }
+        ops.matched(dst_num, dst_denom, src_im, src_n, conv[i],
+                    (int)(dst_num_end - dst_num), noise_type == SEP_NOISE_VAR);
     }  /* close loop over convolution kernel */
 
     /* take the square root of the denominator (work) buffer and divide the
@@ -349,7 +349,9 @@ int Deblend::gatherup(objliststruct *objlistin, objliststruct *objlistout)
             }
             if (p[nobj - 1] > 1.0e-31)
             {
-                drand = p[nobj - 1] * rand() / RAND_MAX;
+                //# Modified for the StellarSolver Internal Library, the random numbers belong to this Deblend
+                drand = p[nobj - 1] * (float)(randomNumbers() - randomNumbers.min()) /
+                        (randomNumbers.max() - randomNumbers.min());
                 for (i = 1; i < nobj && p[i] < drand; i++);
                 if (i == nobj)
                     i = iclst;
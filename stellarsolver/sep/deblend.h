@@ -25,6 +25,8 @@
 #include "sep.h"
 #include "sepcore.h"
 
+#include <random>
+
 
 namespace SEP
 {
@@ -41,6 +43,13 @@ class Deblend
         int deblend(objliststruct *objlistin, int l, objliststruct *objlistout,
                     int deblend_nthresh, double deblend_mincont, int minarea, SEP::Lutz *lutz);
 
+        //# Added for the StellarSolver Internal Library
+        /* seed the random numbers used to share the faint pixels between the deblended objects */
+        void seedrandom(unsigned int seed)
+        {
+            randomNumbers.seed(seed);
+        }
+
     protected:
 
         int belong(int, objliststruct *, int, objliststruct *);
@@ -59,6 +68,7 @@ class Deblend
         objliststruct	debobjlist, debobjlist2;
         plistvalues plist_values;
         int plistsize;
+        std::minstd_rand randomNumbers;     //# Added for the StellarSolver Internal Library, instead of rand()
 };
 
 }
@@ -25,8 +25,12 @@
 #include "deblend.h"
 #include "analyse.h"
 #include <cstdio>
+#include <cstring>
 
+#include <algorithm>
+#include <atomic>
 #include <cmath>
+#include <new>
 
 namespace SEP
 {
@@ -38,7 +42,7 @@ Extract::Extract()
 
 Extract::~Extract()
 {
-
+    free(pixelStack); //# Added for the StellarSolver Internal Library
 }
 
 
@@ -46,8 +50,9 @@ Extract::~Extract()
 
 /* initialize buffer */
 /* bufw must be less than or equal to w */
+/* if bkg is given, the background is subtracted from each line as it is read */
 int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                              int bufw, int bufh)
+                              int bufw, int bufh, sep_bkg *bkg)
 {
     int status, yl;
     //status = RETURN_OK; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
@@ -59,7 +64,11 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
 
     /* buffer array info */
     buf->bptr = NULL;
+    buf->bkg = bkg;
+    buf->bkgline = NULL;
     QMALLOC(buf->bptr, PIXTYPE, bufw * bufh, status);
+    if (bkg)
+        QMALLOC(buf->bkgline, PIXTYPE, bufw, status);
     buf->bw = bufw;
     buf->bh = bufh;
 
@@ -83,6 +92,8 @@ int Extract::arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int
 exit:
     free(buf->bptr);
     buf->bptr = NULL;
+    free(buf->bkgline);
+    buf->bkgline = NULL;
     return status;
 }
 
@@ -105,9 +116,18 @@ void Extract::arraybuffer_readline(arraybuffer *buf)
     //                      buf->lastline);
 
     if (y < buf->dh)
+    {
         buf->readline(buf->dptr + buf->elsize * buf->dw * y, buf->bw - 1,
                       buf->lastline);
 
+        //# Added for the StellarSolver Internal Library, subtract the background here instead of from a copy of the whole image
+        if (buf->bkg && bkg_line_flt_range(buf->bkg, y, 0, buf->bw - 1, buf->bkgline) == RETURN_OK)
+        {
+            for (int i = 0; i < buf->bw - 1; i++)
+                buf->lastline[i] -= buf->bkgline[i];
+        }
+    }
+
     return;
 }
 
@@ -116,6 +136,8 @@ void Extract::arraybuffer_free(arraybuffer *buf)
     if(buf && buf->bptr){    //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
         free(buf->bptr);
         buf->bptr = NULL;
+        free(buf->bkgline);
+        buf->bkgline = NULL;
     }
 }
 
@@ -182,6 +204,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     PIXTYPE           *scan, *cdscan, *wscan, *dummyscan;
     PIXTYPE           *sigscan, *workscan;
     float             *convnorm;
+    convkernel        convkern;          //# Added for the StellarSolver Internal Library
     int               *start, *end, *survives;
     pixstatus         *psstack;
     char              errtext[512];
@@ -190,6 +213,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     //status = RETURN_OK; //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
     pixel = NULL;
     convnorm = NULL;
+    memset(&convkern, 0, sizeof(convkernel));
     scan = wscan = cdscan = dummyscan = NULL;
     sigscan = workscan = NULL;
     info = NULL;
@@ -212,9 +236,11 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
     mem_pixstack = sep_get_extract_pixstack();
 
-    /* seed the random number generator consistently on each call to get
-     * consistent results. rand() is used in deblending. */
-    srand(1);
+    //# Modified for the StellarSolver Internal Library, deblending no longer uses rand(). Every object is deblended
+    //# with its own random numbers, seeded by the order it was found in, so the results don't depend on the threads.
+    queuedObjects.clear();
+    queuedPixels.clear();
+    objectsQueued = 0;
 
     /* Noise characteristics of the image: None, scalar or variable? */
     if (image->noise_type == SEP_NOISE_NONE) { } /* nothing to do */
@@ -289,7 +315,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
      */
     bufh = conv ? convh : 1;
     status = arraybuffer_init(&dbuf, image->data, image->dtype, image->raw_w, h, stacksize,
-                              bufh);
+                              bufh, image->back);
     if (status != RETURN_OK) goto exit;
     if (isvarnoise)
     {
@@ -335,7 +361,18 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
     /* Allocate memory for the pixel list */
     plistinit((conv != NULL), (image->noise_type != SEP_NOISE_NONE));
-    if (!(pixel = objlist.plist = (pliststruct *)malloc(nposize = mem_pixstack * plistsize)))
+    //# Modified for the StellarSolver Internal Library, the pixel list from the last call is used again if it is the same size
+    nposize = mem_pixstack * plistsize;
+    if (pixelStack && pixelStackSize == (size_t)nposize)
+        pixel = pixelStack;
+    else
+    {
+        free(pixelStack);
+        pixel = (pliststruct *)malloc(nposize);
+    }
+    pixelStack = NULL;
+    pixelStackSize = 0;
+    if (!(objlist.plist = pixel))
     {
         status = MEMORY_ALLOC_ERROR;
         goto exit;
@@ -371,6 +408,11 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
             sum += fabs(conv[i]);
         for (i = 0; i < convn; i++)
             convnorm[i] = conv[i] / sum;
+
+        //# Added for the StellarSolver Internal Library, split the filter into separable terms if that is faster
+        status = convkernel_init(&convkern, convnorm, convw, convh, stacksize);
+        if (status != RETURN_OK)
+            goto exit;
     }
 
     plist_values.plistexist_cdvalue = plistexist_cdvalue;
@@ -382,14 +424,46 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     plist_values.plistoff_var = plistoff_var;
     plist_values.plistsize = plistsize;
 
-    analyze.reset(new Analyze(plist_values));
-    lutz.reset(new Lutz(image->w, image->h, analyze.get(), plist_values));
-    deblend.reset(new Deblend(deblend_nthresh, plist_values));
+    //# Modified for the StellarSolver Internal Library, the scanning buffers are kept while the image size and pixel list don't change
+    if (!lutz || lutzWidth != image->w || lutzHeight != image->h ||
+            memcmp(&lutzValues, &plist_values, sizeof(plistvalues)) != 0)
+    {
+        analyze.reset(new Analyze(plist_values));
+        lutz.reset(new Lutz(image->w, image->h, analyze.get(), plist_values));
+        lutzWidth = image->w;
+        lutzHeight = image->h;
+        lutzValues = plist_values;
+        workerLutzes.clear();
+    }
+    //# Modified for the StellarSolver Internal Library, the deblending buffers are kept while the settings don't change
+    if (!deblend || deblendNthresh != deblend_nthresh ||
+            memcmp(&deblendValues, &plist_values, sizeof(plistvalues)) != 0)
+    {
+        deblend.reset(new Deblend(deblend_nthresh, plist_values));
+        deblendNthresh = deblend_nthresh;
+        deblendValues = plist_values;
+        workerDeblends.clear();
+    }
+    //# Added for the StellarSolver Internal Library, every extra deblending thread has its own buffers
+    workerDeblends.resize(deblend_threads - 1);
+    for (auto &workerDeblend : workerDeblends)
+        if (!workerDeblend)
+            workerDeblend.reset(new Deblend(deblend_nthresh, plist_values));
+    workerLutzes.resize(deblend_threads - 1);
+    for (auto &workerLutz : workerLutzes)
+        if (!workerLutz)
+            workerLutz.reset(new Lutz(image->w, image->h, analyze.get(), plist_values));
 
 
     /*----- MAIN LOOP ------ */
     for (yl = 0; yl <= h; yl++)
     {
+        //# Added for the StellarSolver Internal Library, stop when another thread cancels the extraction
+        if (cancel_flag && *cancel_flag)
+        {
+            status = EXTRACTION_CANCELLED;
+            goto exit;
+        }
 
         ps = COMPLETE;
         cs = NONOBJECT;
@@ -425,7 +499,7 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
             /* filter the lines */
             if (conv)
             {
-                status = convolve(&dbuf, yl, convnorm, convw, convh, cdscan);
+                status = convolve(&dbuf, yl, &convkern, cdscan);
                 if (status != RETURN_OK)
                     goto exit;
 
@@ -640,13 +714,17 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
                         {
                             if ((int)info[co].pixnb >= minarea)
                             {
-                                /* update threshold before object is processed */
-                                objlist.thresh = thresh;
-
-                                status = sortit(&info[co], &objlist, minarea,
-                                                finalobjlist, deblend_nthresh, deblend_cont, image->gain);
+                                //# Modified for the StellarSolver Internal Library, the object is copied out of the
+                                //# pixel list and deblended later, together with the others
+                                status = queueobject(&info[co], thresh, pixel);
                                 if (status != RETURN_OK)
                                     goto exit;
+                                if (queuedPixels.size() >= mem_pixstack * plistsize)
+                                {
+                                    status = deblendqueue(minarea, finalobjlist, deblend_nthresh, deblend_cont, image->gain);
+                                    if (status != RETURN_OK)
+                                        goto exit;
+                                }
                             }
 
                             /* free the chain-list */
@@ -692,6 +770,11 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
 
     } /*---------------- End of the loop over the y's -----------------------*/
 
+    //# Added for the StellarSolver Internal Library, deblend the objects that are still queued
+    status = deblendqueue(minarea, finalobjlist, deblend_nthresh, deblend_cont, image->gain);
+    if (status != RETURN_OK)
+        goto exit;
+
     /* convert `finalobjlist` to an array of `sepobj` structs */
     /* if cleaning, see which objects "survive" cleaning. */
     if (clean_flag)
@@ -714,6 +797,8 @@ int Extract::sep_extract(sep_image *image, float thresh, int thresh_type,
     if (status != RETURN_OK) goto exit;
 
 exit:
+    queuedObjects.clear();       //# Added for the StellarSolver Internal Library
+    queuedPixels.clear();
     if(finalobjlist)
     {
         if(finalobjlist->obj)
@@ -725,7 +810,14 @@ exit:
         free(finalobjlist);
         finalobjlist = 0;        //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     }
-    free(pixel);
+    //# Modified for the StellarSolver Internal Library, the pixel list is kept for the next call
+    if (pixel && pixelStack == NULL)
+    {
+        pixelStack = pixel;
+        pixelStackSize = nposize;
+    }
+    else
+        free(pixel);
     pixel = 0;                   //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
     free(info);
     info = 0;                    //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
@@ -746,6 +838,7 @@ exit:
         arraybuffer_free(&nbuf);
     if (image->mask)
         arraybuffer_free(&mbuf);
+    convkernel_free(&convkern);
     if (conv){
         free(convnorm);
         convnorm = 0;            //# Added by Hy Murveit for the StellarSolver Internal Library for memory safety.
@@ -786,9 +879,10 @@ exit:
 build the object structure.
 */
 int Extract::sortit(infostruct *info, objliststruct *objlist, int minarea, objliststruct *finalobjlist, int deblend_nthresh,
-                    double deblend_mincont, double gain)
+                    double deblend_mincont, double gain, Deblend *deblender, Lutz *lutzer)
 {
     objliststruct objlistout, *objlist2;
+    objstruct obj;   //# Modified for the StellarSolver Internal Library, local so that objects can be sorted in parallel
     int i, status;
 
     //status = RETURN_OK;  //# Modified by Robert Lancaster for the StellarSolver Internal Library to resolve warning
@@ -809,7 +903,7 @@ int Extract::sortit(infostruct *info, objliststruct *objlist, int minarea, objli
 
     analyze->preanalyse(0, objlist);
 
-    status = deblend->deblend(objlist, 0, &objlistout, deblend_nthresh, deblend_mincont, minarea, lutz.get());
+    status = deblender->deblend(objlist, 0, &objlistout, deblend_nthresh, deblend_mincont, minarea, lutzer);
     if (status)
     {
         /* formerly, this wasn't a fatal error, so a flag was set for
@@ -847,6 +941,114 @@ exit:
     return status;
 }
 
+//# Added for the StellarSolver Internal Library
+/******************************* queueobject *********************************/
+/*
+copy the pixels of a detected object out of the pixel list, so that it can be
+deblended after the pixel list has been used again.
+*/
+int Extract::queueobject(infostruct *info, PIXTYPE thresh, pliststruct *pixel)
+{
+    queuedobject queued;
+    pliststruct *pixt;
+    size_t npix = 0;
+    int i, j;
+
+    for (i = info->firstpix; i != -1; i = PLIST(pixel + i, nextpix))
+        npix++;
+
+    queued.info = *info;
+    queued.offset = queuedPixels.size();
+    queued.thresh = thresh;
+    queued.seed = ++objectsQueued;
+    try
+    {
+        queuedPixels.resize(queued.offset + npix * plistsize);
+        queuedObjects.push_back(queued);
+    }
+    catch (std::bad_alloc &)
+    {
+        return MEMORY_ALLOC_ERROR;
+    }
+
+    /* the pixels are linked in the same order, by their offsets from the
+     * object's first pixel */
+    pixt = queuedPixels.data() + queued.offset;
+    j = 0;
+    for (i = info->firstpix; i != -1; i = PLIST(pixel + i, nextpix))
+    {
+        memcpy(pixt, pixel + i, (size_t)plistsize);
+        PLIST(pixt, nextpix) = (j += plistsize);
+        pixt += plistsize;
+    }
+    PLIST(pixt - plistsize, nextpix) = -1;
+    queuedObjects.back().info.firstpix = 0;
+    queuedObjects.back().info.lastpix = j - plistsize;
+
+    return RETURN_OK;
+}
+
+//# Added for the StellarSolver Internal Library
+/******************************* deblendqueue ********************************/
+/*
+deblend and analyse the queued objects, on up to deblend_threads threads that
+each have their own Deblend and Lutz, started by the deblend_runner, then add
+them to the final list in the order they were found.
+*/
+int Extract::deblendqueue(int minarea, objliststruct *finalobjlist, int deblend_nthresh, double deblend_mincont,
+                          double gain)
+{
+    const int nqueued = (int)queuedObjects.size();
+    int status = RETURN_OK;
+
+    if (nqueued == 0)
+        return status;
+
+    std::vector<objliststruct> sorted(nqueued);
+    std::vector<int> statuses(nqueued, RETURN_OK);
+    std::atomic<int> next(0);
+    auto work = [&](int worker)
+    {
+        Deblend *deblender = worker == 0 ? deblend.get() : workerDeblends[worker - 1].get();
+        Lutz *lutzer = worker == 0 ? lutz.get() : workerLutzes[worker - 1].get();
+        for (int k = next++; k < nqueued; k = next++)
+        {
+            if (cancel_flag && *cancel_flag)
+            {
+                statuses[k] = EXTRACTION_CANCELLED;
+                break;
+            }
+            queuedobject &queued = queuedObjects[k];
+            objliststruct objlist;
+            objlist.plist = queuedPixels.data() + queued.offset;
+            objlist.thresh = queued.thresh;
+            deblender->seedrandom(queued.seed);
+            statuses[k] = sortit(&queued.info, &objlist, minarea, &sorted[k], deblend_nthresh,
+                                 deblend_mincont, gain, deblender, lutzer);
+        }
+    };
+
+    const int workers = deblend_runner ? std::min((int)workerDeblends.size() + 1, nqueued) : 1;
+    if (workers > 1)
+        deblend_runner(workers, work);
+    else
+        work(0);
+
+    for (int k = 0; k < nqueued; k++)
+    {
+        if (status == RETURN_OK)
+            status = statuses[k];
+        for (int i = 0; status == RETURN_OK && i < sorted[k].nobj; i++)
+            status = addobjdeep(i, &sorted[k], finalobjlist, plistsize);
+        free(sorted[k].obj);
+        free(sorted[k].plist);
+    }
+    queuedObjects.clear();
+    queuedPixels.clear();
+
+    return status;
+}
+
 /****************************** plistinit ************************************
  * (originally init_plist() in sextractor)
 PURPOSE	initialize a pixel-list and its components.
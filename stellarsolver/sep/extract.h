@@ -27,6 +27,10 @@
 
 #include <stdint.h>
 #include <cstring>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
 
 namespace SEP
 {
@@ -51,10 +55,40 @@ class Extract
         static void free_catalog_fields(sep_catalog *catalog);
         static void sep_catalog_free(sep_catalog *catalog);
 
+        //# Added for the StellarSolver Internal Library
+        /* runs work(worker) for every worker in [0, workers), worker 0 on the calling thread, and returns once they
+           have all finished.  The other workers may start late, the work is shared out so that it doesn't matter. */
+        typedef std::function<void(int workers, const std::function<void(int worker)> &work)> parallelrunner;
+
+        /* get and set the number of threads, including the calling one, that deblend the detected objects,
+           and the runner that starts the extra threads.  Without a runner, the objects are deblended on the calling thread. */
+        void sep_set_deblend_threads(int val, parallelrunner runner)
+        {
+            deblend_threads = val > 1 ? val : 1;
+            deblend_runner = std::move(runner);
+        }
+
+        int sep_get_deblend_threads() const
+        {
+            return deblend_threads;
+        }
+
+        /* set the flag that another thread sets to stop sep_extract, which then returns EXTRACTION_CANCELLED.
+           It is checked before each image line and each object deblended.  NULL means it can't be cancelled. */
+        void sep_set_cancel_flag(const std::atomic<bool> *flag)
+        {
+            cancel_flag = flag;
+        }
+
     protected:
 
         int sortit(infostruct *info, objliststruct *objlist, int minarea,
-                   objliststruct *finalobjlist, int deblend_nthresh, double deblend_mincont, double gain);
+                   objliststruct *finalobjlist, int deblend_nthresh, double deblend_mincont, double gain,
+                   Deblend *deblender, Lutz *lutzer);
+
+        //# Added for the StellarSolver Internal Library, objects are deblended in parallel once the scan has queued them
+        int queueobject(infostruct *info, PIXTYPE thresh, pliststruct *pixel);
+        int deblendqueue(int minarea, objliststruct *finalobjlist, int deblend_nthresh, double deblend_mincont, double gain);
 
         /* get and set pixstack */
         void sep_set_extract_pixstack(size_t val)
@@ -72,7 +106,7 @@ class Extract
 
 
         int arraybuffer_init(arraybuffer *buf, void *arr, int dtype, int w, int h,
-                             int bufw, int bufh);
+                             int bufw, int bufh, sep_bkg *bkg = NULL);
         void arraybuffer_readline(arraybuffer *buf);
         void arraybuffer_free(arraybuffer *buf);
 
@@ -90,7 +124,33 @@ class Extract
         int plistsize;
         size_t extract_pixstack = 300000;
         plistvalues plist_values;
-        objstruct obj;
+
+        //# Added for the StellarSolver Internal Library, scratch memory kept for the next call of sep_extract
+        pliststruct *pixelStack = nullptr;  /* the pixel list */
+        size_t pixelStackSize = 0;          /* size of the pixel list in bytes */
+        int deblendNthresh = 0;             /* deblend_nthresh the Deblend object was made for */
+        plistvalues deblendValues;          /* pixel list layout the Deblend object was made for */
+        int lutzWidth = 0;                  /* image width the Lutz objects were made for */
+        int lutzHeight = 0;                 /* image height the Lutz objects were made for */
+        plistvalues lutzValues;             /* pixel list layout the Lutz and Analyze objects were made for */
+
+        //# Added for the StellarSolver Internal Library, objects waiting for deblending and the extra deblending threads
+        typedef struct
+        {
+            infostruct info;                /* firstpix and lastpix are offsets into the object's own pixels */
+            size_t offset;                  /* where the object's pixels start in queuedPixels */
+            PIXTYPE thresh;                 /* detection threshold when the object was completed */
+            unsigned int seed;              /* seed of the random numbers used to deblend the object */
+        } queuedobject;
+
+        int deblend_threads = 1;
+        parallelrunner deblend_runner;
+        const std::atomic<bool> *cancel_flag = nullptr;
+        std::vector<queuedobject> queuedObjects;
+        std::vector<pliststruct> queuedPixels;
+        unsigned int objectsQueued = 0;     /* objects queued since sep_extract started */
+        std::vector<std::unique_ptr<Deblend>> workerDeblends;
+        std::vector<std::unique_ptr<Lutz>> workerLutzes;
 };
 
 }
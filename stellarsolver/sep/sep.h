@@ -32,6 +32,13 @@ namespace SEP
 /* native int type */
 #define SEP_TFLOAT       42
 #define SEP_TDOUBLE      82
+//# Added for the StellarSolver Internal Library, so that images can be read without converting them first
+#define SEP_TUSHORT      20
+/* 16-bit unsigned short */
+#define SEP_TSHORT       21
+/* 16-bit signed short */
+#define SEP_TUINT        30
+/* 32-bit unsigned int */
 
 /* object & aperture flags */
 #define SEP_OBJ_MERGED       0x0001  /* object is result of deblending */
@@ -84,6 +91,8 @@ typedef struct
     short noise_type;  /* interpretation of noise value                  */
     double gain;       /* (poisson counts / data unit)                   */
     double maskthresh; /* pixel considered masked if mask > maskthresh   */
+    struct sep_bkg *back; /* background subtracted from data as it is read (can be NULL) */ //# Added for the StellarSolver Internal Library
+    float *backline;   /* scratch row of at least w pixels for the background in the aperture functions (can be NULL) */ //# Added for the StellarSolver Internal Library
 } sep_image;
 
 /* sep_bkg
@@ -91,7 +100,7 @@ typedef struct
  * The result of sep_background() -- represents a smooth image background
  * and its noise with splines.
  */
-typedef struct
+typedef struct sep_bkg
 {
     int w, h;          /* original image width, height */
     int bw, bh;        /* single tile width, height */
@@ -103,6 +112,10 @@ typedef struct
     float *dback;
     float *sigma;
     float *dsigma;
+    //# Added for the StellarSolver Internal Library, only filled in by sep_background_update()
+    float *meshback;   /* tile estimates before filtering */
+    float *meshsigma;
+    float *probe;      /* median of a sparse sample of each tile */
 } sep_bkg;
 
 /* sep_catalog
@@ -161,6 +174,33 @@ int sep_background(sep_image *image,
                    double fthresh,   /* filter threshold                 */
                    sep_bkg **bkg);   /* OUTPUT                           */
 
+//# Added for the StellarSolver Internal Library
+/* sep_background_reuse()
+ *
+ * Same as sep_background(), but `*bkg` can hold the result of an earlier call
+ * (or NULL). If its image and tile sizes are the same, its maps are
+ * overwritten instead of allocating new ones; otherwise it is freed and a new
+ * background is returned. On error `*bkg` is freed and set to NULL.
+ */
+int sep_background_reuse(sep_image *image, int bw, int bh, int fw, int fh,
+                         double fthresh, sep_bkg **bkg);
+
+//# Added for the StellarSolver Internal Library
+/* sep_background_update()
+ *
+ * Update a background made from an earlier frame of the same size for a new
+ * frame. A sparse sample of each tile is compared with the one taken last
+ * time, and only the rows of tiles where it moved by more than `drift` times
+ * the tile's noise are measured again. The filtered map and its splines are
+ * only rebuilt if something changed. The first update of a background
+ * measures every tile. `changed` (can be NULL) gets the number of rows of
+ * tiles that were measured again. Returns ILLEGAL_BKG_SIZE if `*bkg` was made
+ * for an image of another size; on other errors `*bkg` is freed and set to
+ * NULL.
+ */
+int sep_background_update(sep_image *image, int fw, int fh, double fthresh,
+                          double drift, sep_bkg **bkg, int *changed);
+
 
 /* sep_bkg_global[rms]()
  *
@@ -295,6 +335,26 @@ int sep_flux_radius(sep_image *im,
                     double *fluxtot, double *fluxfrac, int n,
                     double *r, short *flag);
 
+//# Added for the StellarSolver Internal Library
+/* sep_flux_radius_batch()
+ *
+ * sep_flux_radius() for `nobj` objects at (x[k], y[k]). The same radii are
+ * found, but the annuli of each object are summed outwards in stages that
+ * stop once the largest of the requested fractions of fluxtot[k] is
+ * reached, instead of always going out to `rmax`, and the buffers are
+ * shared by all of the objects. Objects whose fluxtot[k] is not positive
+ * are measured out to `rmax` in one pass. Without `fluxtot`, or with a mask
+ * or segmentation map, each object is measured by sep_flux_radius().
+ *
+ * r : (output) nobj * n radii, r[k * n + i] is for fluxfrac[i] of object k
+ * flag : (output, can be NULL) nobj flags
+ */
+int sep_flux_radius_batch(sep_image *im, const double *x, const double *y,
+                          int nobj, double rmax, int id, int subpix,
+                          short inflag, const double *fluxtot,
+                          const double *fluxfrac, int n, double *r,
+                          short *flag);
+
 /* sep_kron_radius()
  *
  * Calculate Kron radius within an ellipse given by
@@ -363,6 +423,15 @@ void sep_ellipse_coeffs(double a, double b, double theta,
 
 /*----------------------- info & error messaging ----------------------------*/
 
+//# Added for the StellarSolver Internal Library
+/* sep_set_filter_simd()
+ *
+ * Turn the SSE2/AVX2 versions of the line filtering in sep_extract() off
+ * (enable = 0) or back on (the default). The plain loops give the same
+ * results within float rounding; this is for checking that.
+ */
+void sep_set_filter_simd(int enable);
+
 /* sep_version_string : library version (e.g., "0.2.0") */
 extern char *sep_version_string;
 
@@ -38,6 +38,8 @@ namespace SEP
 #define LINE_NOT_IN_BUF     8
 #define RELTHRESH_NO_NOISE  9
 #define UNKNOWN_NOISE_TYPE  10
+#define ILLEGAL_BKG_SIZE    11  //# Added for the StellarSolver Internal Library
+#define EXTRACTION_CANCELLED 12 //# Added for the StellarSolver Internal Library
 
 #define	BIG 1e+30f  /* a huge number (< biggest value a float can store) */
 #define	PI  3.1415926535898
@@ -141,6 +143,8 @@ typedef struct
     array_converter readline;  /* function to read a data line into buffer */
     int elsize;         /* size in bytes of one element in original data */
     int yoff;           /* line index in original data corresponding to bufptr */
+    sep_bkg *bkg;       /* background subtracted from each line as it is read (can be NULL) */ //# Added for the StellarSolver Internal Library
+    PIXTYPE *bkgline;   /* background of the line being read */
 } arraybuffer;
 
 typedef struct
@@ -194,6 +198,18 @@ typedef struct
     PIXTYPE       thresh;   /* detection threshold */
 } objliststruct;
 
+//# Added for the StellarSolver Internal Library
+/* convolution kernel prepared by convkernel_init() */
+typedef struct
+{
+    float *conv;        /* kernel (convw * convh), not owned */
+    int convw, convh;   /* kernel width, height */
+    int nterms;         /* number of separable terms, 0 to apply conv directly */
+    float *rows;        /* nterms rows of convw elements */
+    float *cols;        /* nterms columns of convh elements */
+    PIXTYPE *work;      /* line buffer for the separable terms */
+} convkernel;
+
 float fqmedian(float *ra, int n);
 void put_errdetail(char *errtext);
 
@@ -204,7 +220,11 @@ int get_array_subtractor(int dtype, array_writer *f, int *size);
 
 int addobjdeep(int objnb, objliststruct *objl1, objliststruct *objl2, int plistsize);
 
-int convolve(arraybuffer *buf, int y, float *conv, int convw, int convh, PIXTYPE *out);
+int bkg_line_flt_range(sep_bkg *bkg, int y, int xstart, int xend, float *line);
+
+int convkernel_init(convkernel *kern, float *conv, int convw, int convh, int bw);
+void convkernel_free(convkernel *kern);
+int convolve(arraybuffer *buf, int y, const convkernel *kern, PIXTYPE *out);
 int matched_filter(arraybuffer *imbuf, arraybuffer *nbuf, int y, float *conv, int convw, int convh,
                    PIXTYPE *work, PIXTYPE *out, int noise_type);
 
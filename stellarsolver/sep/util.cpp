@@ -52,6 +52,22 @@ PIXTYPE convert_byt(void *ptr)
     return *(BYTE *)ptr;
 }
 
+//# Added for the StellarSolver Internal Library
+PIXTYPE convert_ush(void *ptr)
+{
+    return *(unsigned short *)ptr;
+}
+
+PIXTYPE convert_sht(void *ptr)
+{
+    return *(short *)ptr;
+}
+
+PIXTYPE convert_uin(void *ptr)
+{
+    return *(unsigned int *)ptr;
+}
+
 /* return the correct converter depending on the datatype code */
 int get_converter(int dtype, converter *f, int *size)
 {
@@ -77,6 +93,21 @@ int get_converter(int dtype, converter *f, int *size)
         *f = convert_byt;
         *size = sizeof(BYTE);
     }
+    else if (dtype == SEP_TUSHORT)
+    {
+        *f = convert_ush;
+        *size = sizeof(unsigned short);
+    }
+    else if (dtype == SEP_TSHORT)
+    {
+        *f = convert_sht;
+        *size = sizeof(short);
+    }
+    else if (dtype == SEP_TUINT)
+    {
+        *f = convert_uin;
+        *size = sizeof(unsigned int);
+    }
     else
     {
         *f = NULL;
@@ -119,6 +150,30 @@ void convert_array_byt(void *ptr, int n, PIXTYPE *target)
         target[i] = *source;
 }
 
+void convert_array_ush(void *ptr, int n, PIXTYPE *target)
+{
+    unsigned short *source = (unsigned short *)ptr;
+    int i;
+    for (i = 0; i < n; i++, source++)
+        target[i] = *source;
+}
+
+void convert_array_sht(void *ptr, int n, PIXTYPE *target)
+{
+    short *source = (short *)ptr;
+    int i;
+    for (i = 0; i < n; i++, source++)
+        target[i] = *source;
+}
+
+void convert_array_uin(void *ptr, int n, PIXTYPE *target)
+{
+    unsigned int *source = (unsigned int *)ptr;
+    int i;
+    for (i = 0; i < n; i++, source++)
+        target[i] = *source;
+}
+
 int get_array_converter(int dtype, array_converter *f, int *size)
 {
     int status = RETURN_OK;
@@ -143,6 +198,21 @@ int get_array_converter(int dtype, array_converter *f, int *size)
         *f = convert_array_dbl;
         *size = sizeof(double);
     }
+    else if (dtype == SEP_TUSHORT)
+    {
+        *f = convert_array_ush;
+        *size = sizeof(unsigned short);
+    }
+    else if (dtype == SEP_TSHORT)
+    {
+        *f = convert_array_sht;
+        *size = sizeof(short);
+    }
+    else if (dtype == SEP_TUINT)
+    {
+        *f = convert_array_uin;
+        *size = sizeof(unsigned int);
+    }
     else
     {
         *f = NULL;
@@ -299,6 +369,12 @@ void sep_get_errmsg(int status, char *errtext)
         case UNKNOWN_NOISE_TYPE:
             strcpy(errtext, "image has unknown noise_type");
             break;
+        case ILLEGAL_BKG_SIZE:  //# Added for the StellarSolver Internal Library
+            strcpy(errtext, "background was made for an image of another size");
+            break;
+        case EXTRACTION_CANCELLED:  //# Added for the StellarSolver Internal Library
+            strcpy(errtext, "extraction was cancelled");
+            break;
         default:
             strcpy(errtext, "unknown error status");
             break;
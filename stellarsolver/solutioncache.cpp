@@ -0,0 +1,357 @@
+/*  SolutionCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+
+//Qt Includes
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QCryptographicHash>
+#include <QMutexLocker>
+#include <QVector>
+
+//Project Includes
+#include "solutioncache.h"
+
+//System Includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+// The cache file starts with these so that old or foreign files are ignored.
+const quint32 CACHE_MAGIC = 0x53535343; // "SSSC"
+const quint32 CACHE_VERSION = 3;
+
+// The number of solutions kept, the least recently used ones are dropped after that.
+const int CACHE_SIZE = 1000;
+// New solutions are saved at most this often, the rest are saved when the process exits.
+const qint64 SAVE_INTERVAL_MS = 60000;
+// When the stars turned more than this, in radians, the distortion of the cached solution is left out, since it is in the old orientation.
+const double SIP_ROTATION_LIMIT = 0.01;
+// The same when the distances between the stars changed by more than this fraction, since it is in the old pixels.
+const double SIP_SCALE_LIMIT = 0.01;
+
+// The fingerprint uses the distances between this many of the brightest stars, and it needs at least the minimum.
+const int FINGERPRINT_STARS = 8;
+const int FINGERPRINT_MIN_STARS = 5;
+// The relative distances are rounded to this many steps, so small errors in the star positions don't change it.
+const int FINGERPRINT_STEPS = 64;
+
+void writeSip(QDataStream &out, const sip_t &sip)
+{
+    const tan_t &tan = sip.wcstan;
+    out << tan.crval[0] << tan.crval[1] << tan.crpix[0] << tan.crpix[1]
+        << tan.cd[0][0] << tan.cd[0][1] << tan.cd[1][0] << tan.cd[1][1]
+        << tan.imagew << tan.imageh << bool(tan.sin);
+    out << qint32(sip.a_order) << qint32(sip.b_order) << qint32(sip.ap_order) << qint32(sip.bp_order);
+    for(int p = 0; p <= sip.a_order; p++)
+        for(int q = 0; q <= sip.a_order - p; q++)
+            out << sip.a[p][q];
+    for(int p = 0; p <= sip.b_order; p++)
+        for(int q = 0; q <= sip.b_order - p; q++)
+            out << sip.b[p][q];
+    for(int p = 0; p <= sip.ap_order; p++)
+        for(int q = 0; q <= sip.ap_order - p; q++)
+            out << sip.ap[p][q];
+    for(int p = 0; p <= sip.bp_order; p++)
+        for(int q = 0; q <= sip.bp_order - p; q++)
+            out << sip.bp[p][q];
+}
+
+bool readSip(QDataStream &in, sip_t &sip)
+{
+    memset(&sip, 0, sizeof(sip_t));
+    tan_t &tan = sip.wcstan;
+    bool sin = false;
+    in >> tan.crval[0] >> tan.crval[1] >> tan.crpix[0] >> tan.crpix[1]
+       >> tan.cd[0][0] >> tan.cd[0][1] >> tan.cd[1][0] >> tan.cd[1][1]
+       >> tan.imagew >> tan.imageh >> sin;
+    tan.sin = sin;
+    qint32 orders[4];
+    in >> orders[0] >> orders[1] >> orders[2] >> orders[3];
+    for(qint32 order : orders)
+        if(order < 0 || order >= SIP_MAXORDER)
+            return false;
+    sip.a_order = orders[0];
+    sip.b_order = orders[1];
+    sip.ap_order = orders[2];
+    sip.bp_order = orders[3];
+    for(int p = 0; p <= sip.a_order; p++)
+        for(int q = 0; q <= sip.a_order - p; q++)
+            in >> sip.a[p][q];
+    for(int p = 0; p <= sip.b_order; p++)
+        for(int q = 0; q <= sip.b_order - p; q++)
+            in >> sip.b[p][q];
+    for(int p = 0; p <= sip.ap_order; p++)
+        for(int q = 0; q <= sip.ap_order - p; q++)
+            in >> sip.ap[p][q];
+    for(int p = 0; p <= sip.bp_order; p++)
+        for(int q = 0; q <= sip.bp_order - p; q++)
+            in >> sip.bp[p][q];
+    return in.status() == QDataStream::Ok;
+}
+}
+
+SolutionCache *SolutionCache::instance()
+{
+    static SolutionCache cache;
+    // The changes that are left are saved while the application is still running, StellarSolver saves them too
+    // when its last instance is deleted, for programs that never quit through the event loop.
+    static const bool connected = []()
+    {
+        if(!QCoreApplication::instance())
+            return false;
+        QObject::connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, []()
+        {
+            cache.save();
+        });
+        return true;
+    }();
+    Q_UNUSED(connected);
+    return &cache;
+}
+
+QString SolutionCache::cachePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/stellarsolver/solutioncache.sssc";
+}
+
+QByteArray SolutionCache::fingerprint(const FITSImage::StarCatalog &stars, int width, int height, Pose *pose)
+{
+    if(stars.count() < FINGERPRINT_MIN_STARS)
+        return QByteArray();
+
+    std::vector<FITSImage::Star> brightest(stars.begin(), stars.end());
+    const int count = std::min(FINGERPRINT_STARS, static_cast<int>(brightest.size()));
+    std::partial_sort(brightest.begin(), brightest.begin() + count, brightest.end(),
+                      [](const FITSImage::Star & s1, const FITSImage::Star & s2)
+    {
+        return s1.flux > s2.flux;
+    });
+
+    QVector<double> distances;
+    distances.reserve(count * (count - 1) / 2);
+    for(int i = 0; i < count; i++)
+        for(int j = i + 1; j < count; j++)
+            distances.append(std::hypot(brightest[i].x - brightest[j].x, brightest[i].y - brightest[j].y));
+    std::sort(distances.begin(), distances.end());
+    const double longest = distances.last();
+    if(longest <= 0)
+        return QByteArray();
+
+    if(pose)
+    {
+        pose->x = 0;
+        pose->y = 0;
+        for(int i = 0; i < count; i++)
+        {
+            pose->x += brightest[i].x / count;
+            pose->y += brightest[i].y / count;
+        }
+        pose->angle = std::atan2(brightest[0].y - pose->y, brightest[0].x - pose->x);
+        pose->size = longest;
+    }
+
+    // The image size is part of the key, since the cached WCS is in its pixels.
+    QByteArray pattern;
+    QDataStream out(&pattern, QIODevice::WriteOnly);
+    out << qint32(width) << qint32(height);
+    for(double distance : distances)
+        out << quint8(qRound(distance / longest * FINGERPRINT_STEPS));
+    return QCryptographicHash::hash(pattern, QCryptographicHash::Md5);
+}
+
+bool SolutionCache::find(const QByteArray &key, const Pose &pose, Entry &entry)
+{
+    QMutexLocker locker(&m_Mutex);
+    loadLocked();
+    auto it = m_Entries.find(key);
+    if(it == m_Entries.end())
+        return false;
+    it->lastUsed = ++m_UseCounter;
+    entry = *it;
+    moveWcs(entry.wcs, entry.pose, pose);
+    entry.pose = pose;
+    return true;
+}
+
+//The stars have the same shape, so the new pixels are the old ones turned about the old centroid, scaled by the change
+//in the distances between the stars, and moved to the new centroid.  The WCS is moved the same way, so that it puts the
+//same stars at the same sky positions, and its CD matrix is scaled so that a pixel covers as much more or less sky.
+void SolutionCache::moveWcs(sip_t &wcs, const Pose &from, const Pose &to)
+{
+    tan_t &tan = wcs.wcstan;
+    const double turn = to.angle - from.angle;
+    const double scale = from.size > 0 && to.size > 0 ? to.size / from.size : 1.0;
+    const double c = std::cos(turn);
+    const double s = std::sin(turn);
+
+    const double dx = tan.crpix[0] - from.x;
+    const double dy = tan.crpix[1] - from.y;
+    tan.crpix[0] = to.x + scale * (c * dx - s * dy);
+    tan.crpix[1] = to.y + scale * (s * dx + c * dy);
+
+    for(int i = 0; i < 2; i++)
+    {
+        const double cd0 = tan.cd[i][0];
+        const double cd1 = tan.cd[i][1];
+        tan.cd[i][0] = (cd0 * c - cd1 * s) / scale;
+        tan.cd[i][1] = (cd0 * s + cd1 * c) / scale;
+    }
+
+    if(std::fabs(std::atan2(s, c)) > SIP_ROTATION_LIMIT || std::fabs(scale - 1.0) > SIP_SCALE_LIMIT)
+    {
+        wcs.a_order = 0;
+        wcs.b_order = 0;
+        wcs.ap_order = 0;
+        wcs.bp_order = 0;
+    }
+}
+
+void SolutionCache::insert(const QByteArray &key, const Pose &pose, const sip_t &wcs, int indexid, int healpix)
+{
+    QByteArray data;
+    {
+        QMutexLocker locker(&m_Mutex);
+        loadLocked();
+        Entry entry;
+        entry.wcs = wcs;
+        entry.pose = pose;
+        entry.indexid = indexid;
+        entry.healpix = healpix;
+        entry.lastUsed = ++m_UseCounter;
+        m_Entries.insert(key, entry);
+
+        while(m_Entries.count() > CACHE_SIZE)
+        {
+            auto oldest = std::min_element(m_Entries.begin(), m_Entries.end(), [](const Entry & e1, const Entry & e2)
+            {
+                return e1.lastUsed < e2.lastUsed;
+            });
+            m_Entries.erase(oldest);
+        }
+        m_Dirty = true;
+        // Solving the same fields over and over would otherwise rewrite the whole file after every solve.
+        if(m_SinceSave.isValid() && m_SinceSave.elapsed() < SAVE_INTERVAL_MS)
+            return;
+        data = serializeLocked();
+    }
+    // The file is written without holding the lock, so other solvers aren't held up by the disk.
+    writeFile(data);
+}
+
+bool SolutionCache::save()
+{
+    QByteArray data;
+    {
+        QMutexLocker locker(&m_Mutex);
+        if(!m_Dirty)
+            return true;
+        data = serializeLocked();
+    }
+    return writeFile(data);
+}
+
+void SolutionCache::recordLookup(bool hit)
+{
+    QMutexLocker locker(&m_Mutex);
+    if(hit)
+        m_Hits++;
+    else
+        m_Misses++;
+}
+
+int SolutionCache::hits() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Hits;
+}
+
+int SolutionCache::misses() const
+{
+    QMutexLocker locker(&m_Mutex);
+    return m_Misses;
+}
+
+void SolutionCache::clear()
+{
+    QMutexLocker locker(&m_Mutex);
+    m_Entries.clear();
+    m_Loaded = true;
+    m_Dirty = false;
+    QFile::remove(cachePath());
+}
+
+void SolutionCache::loadLocked()
+{
+    if(m_Loaded)
+        return;
+    m_Loaded = true;
+
+    QFile file(cachePath());
+    if(!file.open(QIODevice::ReadOnly))
+        return;
+
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0, version = 0, count = 0;
+    in >> magic >> version;
+    if(magic != CACHE_MAGIC || version != CACHE_VERSION)
+        return;
+    in >> count;
+    for(quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++)
+    {
+        QByteArray key;
+        Entry entry;
+        in >> key >> entry.indexid >> entry.healpix >> entry.lastUsed >> entry.pose.x >> entry.pose.y >> entry.pose.angle
+           >> entry.pose.size;
+        if(!readSip(in, entry.wcs))
+            break;
+        m_Entries.insert(key, entry);
+        m_UseCounter = std::max(m_UseCounter, entry.lastUsed);
+    }
+    if(in.status() != QDataStream::Ok)
+        m_Entries.clear();
+}
+
+QByteArray SolutionCache::serializeLocked()
+{
+    m_Dirty = false;
+    m_SinceSave.start();
+
+    QByteArray data;
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << CACHE_MAGIC << CACHE_VERSION << quint32(m_Entries.count());
+    for(auto it = m_Entries.constBegin(); it != m_Entries.constEnd(); ++it)
+    {
+        out << it.key() << it->indexid << it->healpix << it->lastUsed << it->pose.x << it->pose.y << it->pose.angle
+            << it->pose.size;
+        writeSip(out, it->wcs);
+    }
+    return data;
+}
+
+bool SolutionCache::writeFile(const QByteArray &data)
+{
+    const QString path = cachePath();
+    if(!QDir().mkpath(QFileInfo(path).absolutePath()))
+        return false;
+    QSaveFile file(path);
+    if(!file.open(QIODevice::WriteOnly))
+        return false;
+    if(file.write(data) != data.size())
+        return false;
+    return file.commit();
+}
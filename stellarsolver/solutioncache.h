@@ -0,0 +1,150 @@
+/*  SolutionCache, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//Qt Includes
+#include <QByteArray>
+#include <QString>
+#include <QList>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+
+//Project Includes
+#include "structuredefinitions.h"
+#include "starcatalog.h"
+
+//Astrometry.net includes
+extern "C" {
+#include "astrometry/sip.h"
+}
+
+/**
+ * @brief The SolutionCache class remembers plate solutions so that a field that comes back can be solved without a search.
+ * Solutions are keyed by a fingerprint of the brightest extracted stars that does not change when the field is moved,
+ * rotated or scaled, see fingerprint().  Since the cached WCS does depend on where the stars are in the image, the pose
+ * of the stars is stored with it, and the WCS is moved, turned and scaled to the pose of the new stars when it is found.
+ * When the fingerprint of a new image is in the cache, the internal solver verifies the moved WCS against the new stars
+ * first, and only searches if that fails.
+ * There is one cache for the whole process.  It is saved in the user's cache folder, so it lasts between sessions.
+ * Changes are saved at most once a minute, when the application is about to quit, and when the last StellarSolver
+ * is deleted.  The cache is never saved from its own destructor, since that runs after Qt has shut down.
+ */
+class SolutionCache
+{
+    public:
+        // Where the fingerprint stars are in the image: their centroid, the angle from it to the brightest star in radians,
+        // and the largest distance between them in pixels.
+        struct Pose
+        {
+            double x {0};
+            double y {0};
+            double angle {0};
+            double size {0};
+        };
+
+        // A cached solution, in the pixels of the image that was solved, which may have been downsampled.
+        struct Entry
+        {
+            sip_t wcs;
+            Pose pose;
+            int indexid {0};
+            int healpix {-1};
+            quint64 lastUsed {0};
+        };
+
+        /**
+         * @brief instance gets the process wide solution cache
+         * @return The SolutionCache
+         */
+        static SolutionCache *instance();
+
+        /**
+         * @brief fingerprint computes the key of an image from its brightest stars.  The distances between the stars
+         * are divided by the largest one, sorted and rounded, so that moving, rotating or scaling the stars doesn't change it.
+         * @param stars The extracted stars
+         * @param width The width of the image the stars are in
+         * @param height The height of the image the stars are in
+         * @param pose Gets where the fingerprint stars are in the image, if it is not null
+         * @return The fingerprint, or an empty array if there are too few stars
+         */
+        static QByteArray fingerprint(const FITSImage::StarCatalog &stars, int width, int height, Pose *pose = nullptr);
+
+        /**
+         * @brief find looks up a solution in the cache
+         * @param key The fingerprint of the image
+         * @param pose Where the fingerprint stars are in the new image
+         * @param entry Gets the cached solution if there is one, with its WCS moved, turned and scaled to the new pose
+         * @return true if the solution was found
+         */
+        bool find(const QByteArray &key, const Pose &pose, Entry &entry);
+
+        /**
+         * @brief insert adds or replaces a solution in the cache.  The least recently used solutions are dropped
+         * when the cache is full.  The cache is saved if it hasn't been for a while.
+         * @param key The fingerprint of the image
+         * @param pose Where the fingerprint stars are in the image
+         * @param wcs The solution
+         * @param indexid The index that solved the image
+         * @param healpix The healpix of that index
+         */
+        void insert(const QByteArray &key, const Pose &pose, const sip_t &wcs, int indexid, int healpix);
+
+        /**
+         * @brief save writes the cache to its file now if it has changed since it was last saved
+         * @return true if the cache was saved or didn't need to be
+         */
+        bool save();
+
+        /**
+         * @brief recordLookup counts whether a solve that looked in the cache was solved by the cached solution
+         * @param hit true if the cached solution was verified
+         */
+        void recordLookup(bool hit);
+
+        /**
+         * @brief hits gets the number of solves that were solved by a cached solution since the process started
+         */
+        int hits() const;
+
+        /**
+         * @brief misses gets the number of solves that looked in the cache but had to search since the process started
+         */
+        int misses() const;
+
+        /**
+         * @brief clear removes all of the solutions from the cache, and the saved file
+         */
+        void clear();
+
+        /**
+         * @brief cachePath gets the file where the cache is saved
+         * @return The path to the cache file
+         */
+        static QString cachePath();
+
+    private:
+        SolutionCache() = default;
+        ~SolutionCache() = default;
+        SolutionCache(const SolutionCache &) = delete;
+        SolutionCache &operator=(const SolutionCache &) = delete;
+
+        void loadLocked();
+        QByteArray serializeLocked();
+        static bool writeFile(const QByteArray &data);
+        static void moveWcs(sip_t &wcs, const Pose &from, const Pose &to);
+
+        QHash<QByteArray, Entry> m_Entries;     // Solutions keyed by fingerprint
+        bool m_Loaded {false};                  // Whether the saved cache has been read yet
+        bool m_Dirty {false};                   // Whether there are changes that haven't been saved
+        QElapsedTimer m_SinceSave;              // The time since the cache was last saved
+        quint64 m_UseCounter {0};               // Increases with every use, to find the least recently used solution
+        int m_Hits {0};
+        int m_Misses {0};
+        mutable QMutex m_Mutex;
+};
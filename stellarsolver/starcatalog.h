@@ -0,0 +1,235 @@
+/*  StarCatalog, StellarSolver Internal Library developed by Robert Lancaster, 2020
+
+    This application is free software; you can redistribute it and/or
+    modify it under the terms of the GNU General Public
+    License as published by the Free Software Foundation; either
+    version 2 of the License, or (at your option) any later version.
+*/
+#pragma once
+
+//Qt Includes
+#include <QList>
+#include <QVector>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtGlobal>
+
+//System Includes
+#include <utility>
+
+//Project Includes
+#include "structuredefinitions.h"
+
+namespace FITSImage
+{
+
+/**
+ * @brief The StarCatalog class holds the stars found by star extraction in one contiguous block of memory.
+ * In Qt 5, a QList of Stars allocates every star separately.  Copies of a StarCatalog share the block until one of
+ * them is changed, so handing the stars from the extractor to the StellarSolver and to its child solvers doesn't copy
+ * them, and moving a StarCatalog doesn't even count a reference.  data() and size() give the stars as one span, and
+ * copyColumn() copies one of their members into an array, for code that wants the positions as separate columns.
+ * list() gives a QList of the stars, for code that still uses the older QList based API.  The list is only made
+ * when it is asked for, and is kept until the catalog changes.
+ */
+class StarCatalog
+{
+    public:
+        typedef Star value_type;
+        typedef QVector<Star>::iterator iterator;
+        typedef QVector<Star>::const_iterator const_iterator;
+
+        StarCatalog() = default;
+        explicit StarCatalog(const QList<Star> &stars) : m_Stars(stars.cbegin(), stars.cend()), m_List(stars),
+            m_ListValid(true) {}
+
+        // Each catalog has its own list lock, so these copy or move the stars and the list, but not the lock.
+        StarCatalog(const StarCatalog &other) : m_Stars(other.m_Stars)
+        {
+            QMutexLocker locker(&other.m_ListMutex);
+            m_List = other.m_List;
+            m_ListValid = other.m_ListValid;
+        }
+        StarCatalog(StarCatalog &&other) noexcept : m_Stars(std::move(other.m_Stars)), m_List(std::move(other.m_List)),
+            m_ListValid(other.m_ListValid)
+        {
+            other.m_ListValid = false;
+        }
+        StarCatalog &operator=(const StarCatalog &other)
+        {
+            if (this != &other)
+            {
+                StarCatalog copy(other);
+                *this = std::move(copy);
+            }
+            return *this;
+        }
+        StarCatalog &operator=(StarCatalog &&other) noexcept
+        {
+            if (this != &other)
+            {
+                m_Stars = std::move(other.m_Stars);
+                m_List = std::move(other.m_List);
+                m_ListValid = other.m_ListValid;
+                other.m_ListValid = false;
+            }
+            return *this;
+        }
+
+        int size() const
+        {
+            return m_Stars.size();
+        }
+        int count() const
+        {
+            return m_Stars.size();
+        }
+        bool isEmpty() const
+        {
+            return m_Stars.isEmpty();
+        }
+
+        void reserve(int size)
+        {
+            m_Stars.reserve(size);
+        }
+        void clear()
+        {
+            m_Stars.clear();
+            changed();
+        }
+
+        /**
+         * @brief data gets the first star, the rest follow it in memory
+         */
+        const Star *data() const
+        {
+            return m_Stars.constData();
+        }
+        Star *data()
+        {
+            changed();
+            return m_Stars.data();
+        }
+
+        const Star &at(int i) const
+        {
+            return m_Stars.at(i);
+        }
+        const Star &operator[](int i) const
+        {
+            return m_Stars[i];
+        }
+        Star &operator[](int i)
+        {
+            changed();
+            return m_Stars[i];
+        }
+
+        iterator begin()
+        {
+            changed();
+            return m_Stars.begin();
+        }
+        iterator end()
+        {
+            changed();
+            return m_Stars.end();
+        }
+        const_iterator begin() const
+        {
+            return m_Stars.cbegin();
+        }
+        const_iterator end() const
+        {
+            return m_Stars.cend();
+        }
+        const_iterator cbegin() const
+        {
+            return m_Stars.cbegin();
+        }
+        const_iterator cend() const
+        {
+            return m_Stars.cend();
+        }
+
+        void append(const Star &star)
+        {
+            m_Stars.append(star);
+            changed();
+        }
+        void append(const StarCatalog &stars)
+        {
+            m_Stars.append(stars.m_Stars);
+            changed();
+        }
+
+        void removeAt(int i)
+        {
+            m_Stars.remove(i);
+            changed();
+        }
+        iterator erase(iterator first, iterator last)
+        {
+            changed();
+            return m_Stars.erase(first, last);
+        }
+
+        /**
+         * @brief truncate removes the stars after the first count stars
+         */
+        void truncate(int count)
+        {
+            if (count < m_Stars.size())
+            {
+                m_Stars.resize(count);
+                changed();
+            }
+        }
+
+        /**
+         * @brief copyColumn copies one member of every star into an array, in the order of the stars
+         * @param member The member to copy, for instance &FITSImage::Star::x
+         * @param column The array, it must have room for size() values
+         */
+        template <typename T> void copyColumn(float Star::*member, T *column) const
+        {
+            const Star *stars = m_Stars.constData();
+            const int n = m_Stars.size();
+            for (int i = 0; i < n; i++)
+                column[i] = stars[i].*member;
+        }
+
+        /**
+         * @brief list gets the stars as a QList.  It is made the first time it is asked for after the catalog changed.
+         * @return The stars, in the same order.  The reference is good until the catalog is changed or destroyed.
+         */
+        const QList<Star> &list() const
+        {
+            // Several threads may read the same catalog, so the list is made under the catalog's lock.
+            QMutexLocker locker(&m_ListMutex);
+            if (!m_ListValid)
+            {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+                m_List = m_Stars;
+#else
+                m_List = m_Stars.toList();
+#endif
+                m_ListValid = true;
+            }
+            return m_List;
+        }
+
+    private:
+        void changed()
+        {
+            m_ListValid = false;
+        }
+
+        QVector<Star> m_Stars;
+        mutable QList<Star> m_List;     // The stars as a QList, see list()
+        mutable bool m_ListValid {false};
+        mutable QMutex m_ListMutex;     // Guards m_List and m_ListValid while list() makes the list
+};
+
+} // FITSImage
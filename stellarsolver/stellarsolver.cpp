@@ -7,12 +7,15 @@
 */
 #include <QApplication>
 #include <QSettings>
+#include <QTimer>
+#include <QtMath>
 #if defined(__APPLE__)
 #include <sys/sysctl.h>
 #elif defined(_WIN32)
+#define NOMINMAX
 #include "windows.h"
 #else //Linux
-#include <QProcess>
+#include <QFile>
 #endif
 #include "externalextractorsolver.h"
 
@@ -20,18 +23,31 @@
 #include "extractorsolver.h"
 
 #include "onlinesolver.h"
+#include "indexcache.h"
+#include "indexmanifest.h"
+#include "solutioncache.h"
+
+#include <limits>
 
 
 using namespace SSolver;
 
+namespace
+{
+// The number of StellarSolvers that exist, the solution cache is saved when the last one is deleted.
+QAtomicInt liveSolvers;
+}
+
 StellarSolver::StellarSolver(QObject *parent) : QObject(parent)
 {
+    liveSolvers.ref();
     registerMetaTypes();
 }
 
 StellarSolver::StellarSolver(const FITSImage::Statistic &imagestats, uint8_t const *imageBuffer,
                              QObject *parent) : QObject(parent)
 {
+    liveSolvers.ref();
     registerMetaTypes();
     loadNewImageBuffer(imagestats, imageBuffer);
 }
@@ -39,6 +55,7 @@ StellarSolver::StellarSolver(const FITSImage::Statistic &imagestats, uint8_t con
 StellarSolver::StellarSolver(ProcessType type, const FITSImage::Statistic &imagestats, const uint8_t *imageBuffer,
                              QObject *parent) : QObject(parent)
 {
+    liveSolvers.ref();
     registerMetaTypes();
     m_ProcessType = type;
     loadNewImageBuffer(imagestats, imageBuffer);
@@ -51,6 +68,9 @@ StellarSolver::~StellarSolver()
       disconnect(solver, &ExtractorSolver::finished, this, &StellarSolver::finishParallelSolve);
 
     abortAndWait();
+
+    if(!liveSolvers.deref())
+        SolutionCache::instance()->save();
 }
 
 void StellarSolver::registerMetaTypes()
@@ -113,7 +133,15 @@ ExtractorSolver* StellarSolver::createExtractorSolver()
     }
     else if((m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER) || (m_ProcessType != SOLVE
             && m_ExtractorType != EXTRACTOR_EXTERNAL))
-        solver = new InternalExtractorSolver(m_ProcessType, m_ExtractorType, m_SolverType, m_Statistics, m_ImageBuffer, this);
+    {
+        InternalExtractorSolver *internalSolver = new InternalExtractorSolver(m_ProcessType, m_ExtractorType, m_SolverType,
+                m_Statistics, m_ImageBuffer, this);
+        internalSolver->m_ExtractionContext = m_ExtractionContext;
+        internalSolver->m_UsePriorSolution = m_UsePriorSolution;
+        internalSolver->m_PriorSolution = m_PriorSolution;
+        internalSolver->m_IndexMemoryBudget = m_IndexMemoryBudget;
+        solver = internalSolver;
+    }
     else
     {
         ExternalExtractorSolver *extSolver = new ExternalExtractorSolver(m_ProcessType, m_ExtractorType, m_SolverType,
@@ -128,6 +156,7 @@ ExtractorSolver* StellarSolver::createExtractorSolver()
     if(useSubframe)
         solver->setUseSubframe(m_Subframe);
     solver->m_ColorChannel = m_ColorChannel;
+    solver->m_Deadline = m_Deadline;
     solver->m_LogToFile = m_LogToFile;
     solver->m_LogFileName = m_LogFileName;
     solver->m_AstrometryLogLevel = m_AstrometryLogLevel;
@@ -169,15 +198,15 @@ QStringList StellarSolver::getIndexFiles(const QStringList &directoryList, int i
     for(int i = 0; i < directoryList.count(); i++)
     {
         const QString &currentPath = directoryList[i];
-        QDir dir(currentPath);
-        QStringList dirIndexFiles;
-        if(dir.exists())
+        // The file names come from the folder's manifest, the folder is only listed again if it changed.
+        IndexManifest manifest(currentPath);
+        if(manifest.refreshIfStale())
         {
+            QStringList nameFilters;
             if(indexToUse < 0)
             {
                 // Find all fits files in the folder.
-                dir.setNameFilters(QStringList() << "*.fits" << "*.fit");
-                dirIndexFiles << dir.entryList();
+                nameFilters << "*.fits" << "*.fit";
             }
             else
             {
@@ -195,18 +224,78 @@ QStringList StellarSolver::getIndexFiles(const QStringList &directoryList, int i
                     name1 = "index-" + QString::number(indexToUse) + "*.fits";
                     name2 = "index-" + QString::number(indexToUse) + "*.fit";
                 }
-                dir.setNameFilters(QStringList() << name1 << name2);
-                dirIndexFiles << dir.entryList();
+                nameFilters << name1 << name2;
             }
-            for(int i = 0; i < dirIndexFiles.count(); i++)
+            const QString folder = QDir(currentPath).absolutePath();
+            for(const auto &entry : manifest.entries(nameFilters))
             {
-               indexFileList.append(dir.absolutePath() + QDir::separator() + dirIndexFiles.at(i));
+               indexFileList.append(folder + QDir::separator() + entry.fileName);
             }
         }
     }
     return indexFileList;
 }
 
+int StellarSolver::purgeIndexCache()
+{
+    return IndexCache::instance()->purgeUnused();
+}
+
+bool StellarSolver::updateIndexManifests(const QStringList &folders)
+{
+    bool success = true;
+    for(const auto &folder : folders)
+    {
+        IndexManifest manifest(folder);
+        if(!manifest.refresh())
+            success = false;
+    }
+    return success;
+}
+
+QFuture<int> StellarSolver::prewarmIndexes(double ra, double dec, double radius, double minwidth, double maxwidth)
+{
+    const QStringList folders = indexFolderPaths;
+    const QStringList files = m_IndexFilePaths;
+    index_residency_t residency;
+    residency.prefetch = TRUE;
+    residency.random_codes = TRUE;
+    residency.lock_tree_tops = static_cast<size_t>(std::max(params.indexTreeLockKB, 0)) * 1024;
+
+    // The solve only keeps as many indexes loaded as fit in the budget, so the prewarm doesn't load more than that either.
+    qint64 memoryBudget = 0;
+    if(params.inParallel && updateIndexMemoryBudget(folders))
+        memoryBudget = m_IndexMemoryBudget;
+
+    // The range of quad sizes the engine would look for, within the field widths the profile allows.
+    // The largest quads span the diagonal of the field.
+    minwidth = std::max(minwidth, params.minwidth);
+    maxwidth = std::min(maxwidth, params.maxwidth);
+    const double quadLow = DEFAULT_QSF_LO * minwidth * 3600.0;
+    const double quadHigh = DEFAULT_QSF_HI * maxwidth * 3600.0 * qSqrt(2.0);
+    return QtConcurrent::run([ = ]()
+    {
+        if(quadLow > quadHigh)
+            return 0;
+        return IndexCache::instance()->prewarm(folders, files, ra, dec, radius, quadLow, quadHigh, residency, memoryBudget);
+    });
+}
+
+int StellarSolver::getSolutionCacheHits()
+{
+    return SolutionCache::instance()->hits();
+}
+
+int StellarSolver::getSolutionCacheMisses()
+{
+    return SolutionCache::instance()->misses();
+}
+
+void StellarSolver::clearSolutionCache()
+{
+    SolutionCache::instance()->clear();
+}
+
 bool StellarSolver::extract(bool calculateHFR, QRect frame)
 {
     m_ProcessType = calculateHFR ? EXTRACT_WITH_HFR : EXTRACT;
@@ -236,6 +325,30 @@ bool StellarSolver::solve()
     return m_HasSolved;
 }
 
+bool StellarSolver::solveWithin(std::chrono::milliseconds budget)
+{
+    // A budget too long for the clock to represent has no deadline at all, rather than one that wrapped around.
+    budget = std::max(budget, std::chrono::milliseconds::zero());
+    const auto now = std::chrono::steady_clock::now();
+    if(budget < std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::time_point::max() - now))
+        m_Deadline = now + budget;
+    else
+        m_Deadline = std::chrono::steady_clock::time_point::max();
+
+    // The internal solver stops at the deadline by itself.  The timer aborts the star extraction and the other solvers,
+    // which only sets their cancel flags, so it doesn't wait for them here.
+    // QTimer only takes an int of milliseconds, about 24 days, so a longer budget is only kept by the internal solver.
+    QTimer deadlineTimer;
+    deadlineTimer.setSingleShot(true);
+    connect(&deadlineTimer, &QTimer::timeout, this, &StellarSolver::abort);
+    if(budget.count() <= std::numeric_limits<int>::max())
+        deadlineTimer.start(static_cast<int>(budget.count()));
+
+    const bool solved = solve();
+    m_Deadline = std::chrono::steady_clock::time_point::max();
+    return solved;
+}
+
 void StellarSolver::start()
 {
     if(checkParameters() == false)
@@ -268,8 +381,9 @@ void StellarSolver::start()
     }
 
     //These are the solvers that support parallelization, ASTAP and the online ones do not
-    if(params.multiAlgorithm != NOT_MULTI && m_ProcessType == SOLVE && (m_SolverType == SOLVER_STELLARSOLVER
-            || m_SolverType == SOLVER_LOCALASTROMETRY))
+    //MULTI_SHARED is run in threads inside of the one internal solver, so it does not need the child solvers.
+    if(params.multiAlgorithm != NOT_MULTI && params.multiAlgorithm != MULTI_SHARED && m_ProcessType == SOLVE
+            && (m_SolverType == SOLVER_STELLARSOLVER || m_SolverType == SOLVER_LOCALASTROMETRY))
     {
         //Note that it is good to do the Star Extraction before parallelization because it doesn't make sense to repeat this step in all the threads, especially since SEP is now also parallelized in StellarSolver.
         if(m_ExtractorType != EXTRACTOR_BUILTIN)
@@ -378,6 +492,13 @@ bool StellarSolver::checkParameters()
             m_ExtractorType = EXTRACTOR_INTERNAL;
         }
 
+        if(params.multiAlgorithm == MULTI_SHARED && m_SolverType != SOLVER_STELLARSOLVER)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("Only the internal solver can solve in shared threads.  Choosing the parallel algorithm automatically instead.");
+            params.multiAlgorithm = MULTI_AUTO;
+        }
+
         if(params.multiAlgorithm == MULTI_AUTO)
         {
             if(m_UseScale && m_UsePosition)
@@ -396,22 +517,11 @@ bool StellarSolver::checkParameters()
             params.keepNum = 300;
         }
 
-        if(params.inParallel)
+        if(params.inParallel && !updateIndexMemoryBudget(indexFolderPaths))
         {
-            if(enoughRAMisAvailableFor(indexFolderPaths))
-            {
-                if(m_SSLogLevel != LOG_OFF)
-                    emit logOutput("There should be enough RAM to load the indexes in parallel.");
-            }
-            else
-            {
-                if(m_SSLogLevel != LOG_OFF)
-                {
-                    emit logOutput("Not enough RAM is available on this system for loading the index files you have in parallel");
-                    emit logOutput("Disabling the inParallel option.");
-                }
-                params.inParallel = false;
-            }
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("Disabling the inParallel option.");
+            params.inParallel = false;
         }
     }
 
@@ -422,7 +532,8 @@ bool StellarSolver::checkParameters()
 //to attempt to efficiently use modern multi core computers to speed up the solve
 void StellarSolver::parallelSolve()
 {
-    if(params.multiAlgorithm == NOT_MULTI || !(m_SolverType == SOLVER_STELLARSOLVER || m_SolverType == SOLVER_LOCALASTROMETRY))
+    if(params.multiAlgorithm == NOT_MULTI || params.multiAlgorithm == MULTI_SHARED
+            || !(m_SolverType == SOLVER_STELLARSOLVER || m_SolverType == SOLVER_LOCALASTROMETRY))
         return;
     qDeleteAll(parallelSolvers);
     parallelSolvers.clear();
@@ -501,6 +612,13 @@ void StellarSolver::parallelSolve()
                 emit logOutput(QString("Child Solver # %1, Depth Low %2, Depth High %3").arg(parallelSolvers.count()).arg(i).arg(i + inc));
         }
     }
+    //The prior solution is the same for all of the child solvers, so only the first one needs to verify it.
+    for(int i = 1; i < parallelSolvers.count(); i++)
+    {
+        auto *internalSolver = dynamic_cast<InternalExtractorSolver *>(parallelSolvers.at(i));
+        if(internalSolver)
+            internalSolver->m_UsePriorSolution = false;
+    }
     for(auto &solver : parallelSolvers)
         solver->start();
 }
@@ -515,6 +633,8 @@ bool StellarSolver::parallelSolversAreRunning() const
 void StellarSolver::processFinished(int code)
 {
     numStars  = m_ExtractorSolver->getNumStarsFound();
+    if(m_ProcessType == SOLVE && m_SolverType == SOLVER_STELLARSOLVER)
+        recordSolutionCacheLookup(m_ExtractorSolver.data());
     if(code == 0)
     {
         if(m_ProcessType == SOLVE && m_ExtractorSolver->solvingDone())
@@ -522,7 +642,9 @@ void StellarSolver::processFinished(int code)
             solution = m_ExtractorSolver->getSolution();
             solutionIndexNumber = m_ExtractorSolver->getSolutionIndexNumber();
             solutionHealpix = m_ExtractorSolver->getSolutionHealpix();
-            m_SolverStars = m_ExtractorSolver->getStarList();
+            m_SolverStars = m_ExtractorSolver->getStarCatalog();
+            if(params.usePriorSolution)
+                setPriorSolution(solution);
             if(m_ExtractorSolver->hasWCSData())
             {
                 hasWCS = true;
@@ -535,7 +657,7 @@ void StellarSolver::processFinished(int code)
         }
         else if((m_ProcessType == EXTRACT || m_ProcessType == EXTRACT_WITH_HFR) && m_ExtractorSolver->extractionDone())
         {
-            m_ExtractorStars = m_ExtractorSolver->getStarList();
+            m_ExtractorStars = m_ExtractorSolver->getStarCatalog();
             background = m_ExtractorSolver->getBackground();
             m_CalculateHFR = m_ExtractorSolver->isCalculatingHFR();
             if(hasWCS)
@@ -552,6 +674,14 @@ void StellarSolver::processFinished(int code)
     emit finished();
 }
 
+//Each solve counts once, so for a parallel solve only the child solver that found the solution, or one that failed, is counted.
+void StellarSolver::recordSolutionCacheLookup(ExtractorSolver *solver)
+{
+    auto *internalSolver = static_cast<InternalExtractorSolver *>(solver);
+    if(internalSolver->checkedSolutionCache())
+        SolutionCache::instance()->recordLookup(internalSolver->solvedFromSolutionCache());
+}
+
 int StellarSolver::whichSolver(ExtractorSolver *solver)
 {
     for(int i = 0; i < parallelSolvers.count(); i++ )
@@ -596,7 +726,11 @@ void StellarSolver::finishParallelSolve(int success)
         solution = reportingSolver->getSolution();
         solutionIndexNumber = reportingSolver->getSolutionIndexNumber();
         solutionHealpix = reportingSolver->getSolutionHealpix();
-        m_SolverStars = reportingSolver->getStarList();
+        m_SolverStars = reportingSolver->getStarCatalog();
+        if(params.usePriorSolution)
+            setPriorSolution(solution);
+        if(m_SolverType == SOLVER_STELLARSOLVER)
+            recordSolutionCacheLookup(reportingSolver);
 
         if(reportingSolver->hasWCSData())
         {
@@ -625,6 +759,8 @@ void StellarSolver::finishParallelSolve(int success)
         if(!m_HasSolved){
             m_HasFailed = true;
             emitReady = true; //Since this was emitted earlier if it had been solved
+            if(m_SolverType == SOLVER_STELLARSOLVER && !parallelSolvers.isEmpty())
+                recordSolutionCacheLookup(parallelSolvers.first());
         }
         qDeleteAll(parallelSolvers);
         parallelSolvers.clear();
@@ -670,6 +806,20 @@ bool StellarSolver::pixelToWCS(const QPointF &pixelPoint, FITSImage::wcs_point &
     return false;
 }
 
+bool StellarSolver::wcsToPixel(const QVector<FITSImage::wcs_point> &skyPoints, QVector<QPointF> &pixelPoints)
+{
+    if(hasWCS)
+        return wcsData.wcsToPixel(skyPoints, pixelPoints);
+    return false;
+}
+
+bool StellarSolver::pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints)
+{
+    if(hasWCS)
+        return wcsData.pixelToWCS(pixelPoints, skyPoints);
+    return false;
+}
+
 //This is the abort method.  It works in different ways for the different solvers.
 void StellarSolver::abort()
 {
@@ -1014,7 +1164,7 @@ QStringList StellarSolver::getDefaultIndexFolderPaths()
     return indexFilePaths;
 }
 
-bool StellarSolver::appendStarsRAandDEC(QList<FITSImage::Star> &stars)
+bool StellarSolver::appendStarsRAandDEC(FITSImage::StarCatalog &stars)
 {
     if(hasWCS)
         return wcsData.appendStarsRAandDEC(stars);
@@ -1036,17 +1186,26 @@ bool StellarSolver::getAvailableRAM(double &availableRAM, double &totalRAM)
     availableRAM = RAMcheck;
     totalRAM = RAMcheck;
 #elif defined(Q_OS_LINUX)
-    QProcess p;
-    p.start("awk", QStringList() << "/MemFree/ { print $2 }" << "/proc/meminfo");
-    p.waitForFinished();
-    QString memory = p.readAllStandardOutput();
-    availableRAM = memory.toLong() * 1024.0; //It is in kB on this system
-
-    p.start("awk", QStringList() << "/MemTotal/ { print $2 }" << "/proc/meminfo");
-    p.waitForFinished();
-    memory = p.readAllStandardOutput();
-    totalRAM = memory.toLong() * 1024.0; //It is in kB on this system
-    p.close();
+    QFile meminfo("/proc/meminfo");
+    if(!meminfo.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    //MemAvailable also counts the file cache that can be dropped, older kernels only have MemFree
+    double memAvailable = -1, memFree = 0;
+    totalRAM = 0;
+    for(const QByteArray &line : meminfo.readAll().split('\n'))
+    {
+        const QList<QByteArray> fields = line.simplified().split(' ');
+        if(fields.count() < 2)
+            continue;
+        const double kB = fields[1].toDouble(); //It is in kB on this system
+        if(fields[0] == "MemTotal:")
+            totalRAM = kB * 1024.0;
+        else if(fields[0] == "MemFree:")
+            memFree = kB * 1024.0;
+        else if(fields[0] == "MemAvailable:")
+            memAvailable = kB * 1024.0;
+    }
+    availableRAM = memAvailable >= 0 ? memAvailable : memFree;
 #else
     MEMORYSTATUSEX memory_status;
     ZeroMemory(&memory_status, sizeof(MEMORYSTATUSEX));
@@ -1064,44 +1223,62 @@ bool StellarSolver::getAvailableRAM(double &availableRAM, double &totalRAM)
     return true;
 }
 
-//This should determine if enough RAM is available to load all the index files in parallel
-bool StellarSolver::enoughRAMisAvailableFor(const QStringList &indexFolders)
+//This works out how much of the index files can be loaded at the same time when they are searched in parallel
+bool StellarSolver::updateIndexMemoryBudget(const QStringList &indexFolders)
 {
     double totalSize = 0;
 
+    // The sizes come from the index manifests, so the folders are only listed again if they changed.
     foreach(const QString &folder, indexFolders)
     {
-        QDir dir(folder);
-        if(dir.exists())
+        IndexManifest manifest(folder);
+        if(manifest.refreshIfStale())
         {
-            dir.setNameFilters(QStringList() << "*.fits" << "*.fit");
-            QFileInfoList indexInfoList = dir.entryInfoList();
-            foreach(const QFileInfo &indexInfo, indexInfoList)
-                totalSize += indexInfo.size();
+            foreach(const IndexManifest::Entry &entry, manifest.entries(QStringList() << "*.fits" << "*.fit"))
+                totalSize += entry.size;
         }
 
     }
+    double budget = params.indexMemoryBudgetMB * 1024.0 * 1024.0;
     double availableRAM = 0;
     double totalRAM = 0;
     getAvailableRAM(availableRAM, totalRAM);
-    if(availableRAM == 0)
+    if(budget <= 0)
     {
-        if(m_SSLogLevel != LOG_OFF)
-            emit logOutput("Unable to determine system RAM for inParallel Option");
-        return false;
+        if(availableRAM == 0)
+        {
+            if(m_SSLogLevel != LOG_OFF)
+                emit logOutput("Unable to determine system RAM for inParallel Option");
+            return false;
+        }
+        budget = availableRAM;
     }
     double bytesInGB = 1024.0 * 1024.0 *
                        1024.0; // B -> KB -> MB -> GB , float to make sure it reports the answer with any decimals
     if(m_SSLogLevel != LOG_OFF)
     {
         emit logOutput(
-            QString("Evaluating Installed RAM for inParallel Option.  Total Size of Index files: %1 GB, Installed RAM: %2 GB, Free RAM: %3 GB").arg(
-                totalSize / bytesInGB).arg(totalRAM / bytesInGB).arg(availableRAM / bytesInGB));
+            QString("Evaluating Installed RAM for inParallel Option.  Total Size of Index files: %1 GB, Installed RAM: %2 GB, Free RAM: %3 GB, Index Budget: %4 GB").arg(
+                totalSize / bytesInGB).arg(totalRAM / bytesInGB).arg(availableRAM / bytesInGB).arg(budget / bytesInGB));
 #if defined(Q_OS_MACOS)
         emit logOutput("Note: Free RAM for now is reported as Installed RAM on MacOS until I figure out how to get available RAM");
 #endif
     }
-    return availableRAM > totalSize;
+    if(budget > totalSize)
+    {
+        m_IndexMemoryBudget = 0;
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("There should be enough RAM to load the indexes in parallel.");
+    }
+    else
+    {
+        m_IndexMemoryBudget = static_cast<qint64>(budget);
+        if(m_SSLogLevel != LOG_OFF)
+            emit logOutput("Not all of the index files fit in the budget, so the most useful ones for each solve are loaded in parallel and the rest are searched one at a time.");
+    }
+    // The indexes loaded by earlier solves stay in the cache, so they are held to the same budget.
+    IndexCache::instance()->setMemoryBudget(m_IndexMemoryBudget);
+    return true;
 }
 
 // Taken from: http://www1.phys.vt.edu/~jhs/phys3154/snr20040108.pdf
@@ -23,6 +23,10 @@
 #include <QVector>
 #include <QRect>
 #include <QPointer>
+#include <QSharedPointer>
+#include <QFuture>
+
+class ExtractionContext;
 
 using namespace SSolver;
 
@@ -106,12 +110,65 @@ class StellarSolver : public QObject
 
         /**
          * @brief getIndexFiles This lets you get a list of paths to index files to pass to astrometry instead of letting it automatically search.
+         * The files are taken from the index manifest of each folder, which is only refreshed if the folder has changed.
          * @param directoryList This is the list of directory names to search for index files
          * @param indexToUse If you know which index series should solve it, this lets you constrain the list to that index series.
          * @param healpixToUse If you further know which healpix to use, this lets you constrain to just that index file
          * @return The list of index files to use
          */
         static QStringList getIndexFiles(const QStringList &directoryList, int indexToUse = -1, int healpixToUse = -1);
+
+        /**
+         * @brief purgeIndexCache unloads the index files that the internal solver keeps loaded between solves.
+         * The index files are loaded once per process and shared by all solvers, so call this when no more solving is planned
+         * or the index folders are about to change.  Indexes that a solver is using right now are kept.
+         * @return The number of index files that were unloaded
+         */
+        static int purgeIndexCache();
+
+        /**
+         * @brief updateIndexManifests builds or refreshes the index manifests for the folders.
+         * A manifest keeps the metadata of the index files in a folder, so that the solver does not need to open every
+         * index file to find out which ones to use.  Only files that are new or have changed since the last update are opened.
+         * The solver refreshes the manifests itself, but calling this ahead of time, for instance after downloading index files,
+         * keeps that work out of the first solve.
+         * @param folders The index folders
+         * @return true if all of the folders could be read
+         */
+        static bool updateIndexManifests(const QStringList &folders);
+
+        /**
+         * @brief prewarmIndexes starts loading the index files that could solve a field at a position and scale in the background,
+         * so that they are already in memory when the image is solved.  Call it while the mount is still slewing, for instance.
+         * It uses the index folders and files, and the indexTreeLockKB, minwidth, maxwidth, inParallel and indexMemoryBudgetMB
+         * parameters, as they are when it is called.  Only the indexes that a solve would keep loaded are read.
+         * @param ra The Right Ascension in decimal degrees
+         * @param dec The Declination in decimal degrees
+         * @param radius The search radius in degrees
+         * @param minwidth The smallest expected field width in degrees
+         * @param maxwidth The largest expected field width in degrees
+         * @return A future with the number of index files that were warmed up
+         */
+        QFuture<int> prewarmIndexes(double ra, double dec, double radius, double minwidth, double maxwidth);
+
+        /**
+         * @brief getSolutionCacheHits gets the number of solves since the process started that were solved by verifying
+         * a solution from the solution cache, without a search.  See Parameters::useSolutionCache.
+         * @return The number of cache hits
+         */
+        static int getSolutionCacheHits();
+
+        /**
+         * @brief getSolutionCacheMisses gets the number of solves since the process started that looked in the solution cache,
+         * but had to search because the stars were not in it or the cached solution could not be verified.
+         * @return The number of cache misses
+         */
+        static int getSolutionCacheMisses();
+
+        /**
+         * @brief clearSolutionCache forgets all of the cached solutions, including the ones saved for later sessions
+         */
+        static void clearSolutionCache();
   
         /**
          * @brief getCommandString gets the processType as a string explaining the command StellarSolver is Running
@@ -213,6 +270,14 @@ class StellarSolver : public QObject
          */
         bool solve();
 
+        /**
+         * @brief solveWithin Plate Solves the image like solve(), but gives up once the time budget is spent.
+         * The internal solver checks the deadline as it searches, the other solvers are aborted when it passes.
+         * @param budget The wall-clock time the solve, including the star extraction, may take
+         * @return A boolean that reports whether it was successful, true means the image was solved in time.
+         */
+        bool solveWithin(std::chrono::milliseconds budget);
+
         /**
          * @brief start Starts a Star Extraction or Plate Solving proccess.  The process is performed asynchronously.  The calling program should then wait for the ready or finished signal.
          */
@@ -317,6 +382,26 @@ class StellarSolver : public QObject
             m_UsePosition = false;
         }
 
+        /**
+         * @brief setPriorSolution gives the internal solver the solution of an earlier frame to verify before it starts a blind search.
+         * This is fast when the new frame is the same field, or close to it with the search position set, even after a meridian flip.
+         * It is only used when the usePriorSolution parameter is set, and then the StellarSolver also remembers its own last solution this way.
+         * @param solution The earlier solution, with the pixel scale of the image that will be solved
+         */
+        void setPriorSolution(const FITSImage::Solution &solution)
+        {
+            m_PriorSolution = solution;
+            m_UsePriorSolution = true;
+        }
+
+        /**
+         * @brief clearPriorSolution turns off the verification of the prior solution, so the next solve is blind again
+         */
+        void clearPriorSolution()
+        {
+            m_UsePriorSolution = false;
+        }
+
         /**
          * @brief clearSearchScale turns off the usage of the Search Scale if it was set previously
          */
@@ -392,18 +477,36 @@ class StellarSolver : public QObject
         }
         /**
          * @brief getStarList gets the list of stars found during star extraction
-         * @return A QList full of stars and their properties
+         * @return A QList full of stars and their properties, made from getStarCatalog() when it changes
          */
         const QList<FITSImage::Star> &getStarList() const
+        {
+            return m_ExtractorStars.list();
+        }
+
+        /**
+         * @brief getStarCatalog gets the stars found during star extraction without copying them
+         * @return The stars and their properties
+         */
+        const FITSImage::StarCatalog &getStarCatalog() const
         {
             return m_ExtractorStars;
         }
 
         /**
          * @brief getStarListFromSolve gets the list of stars used to plate solve the image
-         * @return A QList full of stars and their properties
+         * @return A QList full of stars and their properties, made from getStarCatalogFromSolve() when it changes
          */
         const QList<FITSImage::Star> &getStarListFromSolve() const
+        {
+            return m_SolverStars.list();
+        }
+
+        /**
+         * @brief getStarCatalogFromSolve gets the stars used to plate solve the image without copying them
+         * @return The stars and their properties
+         */
+        const FITSImage::StarCatalog &getStarCatalogFromSolve() const
         {
             return m_SolverStars;
         }
@@ -549,6 +652,17 @@ class StellarSolver : public QObject
             m_ColorChannel = (FITSImage::ColorChannel) channel;
         };
 
+        /**
+         * @brief setExtractionContext lets the internal star extractor keep its scratch memory in the context between extractions.
+         * This is useful when extracting stars from a series of frames of the same size, such as when focusing or guiding.
+         * The same context can be given to several StellarSolvers.
+         * @param context The ExtractionContext to use, or a null pointer to allocate the memory for every extraction again
+         */
+        void setExtractionContext(const QSharedPointer<ExtractionContext> &context)
+        {
+            m_ExtractionContext = context;
+        };
+
         /**
          * @brief isRunning returns whether or not a process is currently running
          * @return true means it is running
@@ -585,6 +699,22 @@ class StellarSolver : public QObject
          */
         bool wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint);
 
+        /**
+         * @brief pixelToWCS converts many image X, Y Pixel coordinates to RA, DEC sky coordinates at once using the WCS data
+         * @param pixelPoints The X, Y coordinates in pixels
+         * @param skyPoints Gets the RA, DEC coordinates, in the same order
+         * @return A boolean to say whether it succeeded, true means it did
+         */
+        bool pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints);
+
+        /**
+         * @brief wcsToPixel converts many RA, DEC sky coordinates to image X, Y Pixel coordinates at once using the WCS data
+         * @param skyPoints The RA, DEC coordinates
+         * @param pixelPoints Gets the X, Y coordinates in pixels, in the same order
+         * @return A boolean to say whether it succeeded, true means it did
+         */
+        bool wcsToPixel(const QVector<FITSImage::wcs_point> &skyPoints, QVector<QPointF> &pixelPoints);
+
 
     public slots:
         /**
@@ -641,6 +771,12 @@ class StellarSolver : public QObject
         // By Default we should use green since most telescopes are best color corrected for Green
         int m_ColorChannel = FITSImage::GREEN;
 
+        // The scratch memory kept by the internal star extractor between extractions, if any
+        QSharedPointer<ExtractionContext> m_ExtractionContext;
+
+        // The time by which the current solve has to be done, only set during solveWithin
+        std::chrono::steady_clock::time_point m_Deadline = std::chrono::steady_clock::time_point::max();
+
         // The currently set parameters for StellarSolver
         Parameters params;
 
@@ -661,6 +797,13 @@ class StellarSolver : public QObject
         double m_SearchRA = HUGE_VAL;           // RA of field center for search, format: decimal degrees
         double m_SearchDE = HUGE_VAL;           // DEC of field center for search, format: decimal degrees
 
+        // The solution the internal solver verifies before a blind search with usePriorSolution, set by setPriorSolution or the last solve
+        bool m_UsePriorSolution = false;
+        FITSImage::Solution m_PriorSolution;
+
+        // The bytes of index files the solvers may keep loaded when searching in parallel, set by checkParameters, 0 for no limit
+        qint64 m_IndexMemoryBudget = 0;
+
     // StellarSolver Variables
 
         FITSImage::Statistic m_Statistics;                  // This is information about the image
@@ -673,8 +816,8 @@ class StellarSolver : public QObject
     // StellarSolver Results Information
 
         FITSImage::Background background;           // This is a report on the background levels found during star extraction
-        QList<FITSImage::Star> m_ExtractorStars;    // This is the list of stars that get extracted from the image
-        QList<FITSImage::Star> m_SolverStars;       // This is the list of stars that were extracted for the last successful solve
+        FITSImage::StarCatalog m_ExtractorStars;    // This is the list of stars that get extracted from the image
+        FITSImage::StarCatalog m_SolverStars;       // This is the list of stars that were extracted for the last successful solve
         int numStars = 0;                           // The number of stars found in the last operation
         FITSImage::Solution solution;               // This is the solution that comes back from the Solver
         short solutionIndexNumber = -1;             // This is the index number of the index used to solve the image.
@@ -711,6 +854,12 @@ class StellarSolver : public QObject
          */
         int whichSolver(ExtractorSolver *solver);
 
+        /**
+         * @brief recordSolutionCacheLookup counts a hit or a miss of the solution cache for a finished internal solver, if it used the cache
+         * @param solver is the InternalExtractorSolver that finished
+         */
+        void recordSolutionCacheLookup(ExtractorSolver *solver);
+
         /**
          * @brief snr gets the signal to noise ratio for a star with the specified background
          * @param background The specified background object which may have come from star extraction
@@ -736,7 +885,7 @@ class StellarSolver : public QObject
          * @param stars is the star list to process
          * @return true if it was successful
          */
-        bool appendStarsRAandDEC(QList<FITSImage::Star> &stars);
+        bool appendStarsRAandDEC(FITSImage::StarCatalog &stars);
 
         /**
          * @brief checkParameters checks the current Parameters before starting an operation to make sure they are sound.
@@ -759,11 +908,12 @@ class StellarSolver : public QObject
         bool getAvailableRAM(double &availableRAM, double &totalRAM);
 
         /**
-         * @brief enoughRAMisAvailableFor determines if there is enough RAM for the selected index files so that we don't try to load indexes inParallel unless it can handle it.
+         * @brief updateIndexMemoryBudget works out how many bytes of index files can be kept loaded when the indexes are searched inParallel.
+         * That is the indexMemoryBudgetMB parameter, or the available RAM if it is 0.  If all of the index files fit, there is no limit.
          * @param indexFolders is the list of index folders we will be searching for index files
-         * @return true if it is successful
+         * @return true if it is successful, false if there is no budget and the available RAM could not be found
          */
-        bool enoughRAMisAvailableFor(const QStringList &indexFolders);
+        bool updateIndexMemoryBudget(const QStringList &indexFolders);
 
     signals:
         /**
@@ -5,11 +5,6 @@
 #include <wcshdr.h>
 #include <wcsfix.h>
 
-//Astrometry.net includes
-extern "C" {
-#include "astrometry/starutil.h"
-}
-
 WCSData::WCSData()
 {
     hasWCS = false;
@@ -70,8 +65,8 @@ bool WCSData::wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoi
         double y;
         if(sip_radec2pixelxy(&wcs, skyPoint.ra, skyPoint.dec, &x, &y) != TRUE)
             return false;
-        pixelPoint.setX(x);
-        pixelPoint.setY(y);
+        pixelPoint.setX(x * d);
+        pixelPoint.setY(y * d);
         return true;
     }
     else
@@ -88,41 +83,154 @@ bool WCSData::wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoi
     }
 }
 
-bool WCSData::appendStarsRAandDEC(QList<FITSImage::Star> &stars)
+bool WCSData::pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints)
+{
+    const int n = pixelPoints.count();
+    QVector<double> x(n), y(n), ra(n), dec(n);
+    for(int i = 0; i < n; i++)
+    {
+        x[i] = pixelPoints[i].x();
+        y[i] = pixelPoints[i].y();
+    }
+    if(!pixelToWCS(x.constData(), y.constData(), n, ra.data(), dec.data()))
+        return false;
+    skyPoints.resize(n);
+    for(int i = 0; i < n; i++)
+    {
+        skyPoints[i].ra = ra[i];
+        skyPoints[i].dec = dec[i];
+    }
+    return true;
+}
+
+bool WCSData::wcsToPixel(const QVector<FITSImage::wcs_point> &skyPoints, QVector<QPointF> &pixelPoints)
+{
+    const int n = skyPoints.count();
+    QVector<double> ra(n), dec(n), x(n), y(n);
+    for(int i = 0; i < n; i++)
+    {
+        ra[i] = skyPoints[i].ra;
+        dec[i] = skyPoints[i].dec;
+    }
+    if(!wcsToPixel(ra.constData(), dec.constData(), n, x.data(), y.data()))
+        return false;
+    pixelPoints.resize(n);
+    for(int i = 0; i < n; i++)
+        pixelPoints[i] = QPointF(x[i], y[i]);
+    return true;
+}
+
+bool WCSData::pixelToWCS(const double *x, const double *y, int n, double *ra, double *dec)
 {
     if(!hasWCS)
         return false;
+    if(n == 0)
+        return true;
     if(internalWCS)
     {
-        for(auto &oneStar : stars)
+        if(d == 1)
+            sip_pixelxy2radecarrs(&wcs, x, y, n, ra, dec);
+        else
         {
-            double ra = HUGE_VAL;
-            double dec = HUGE_VAL;
-            sip_pixelxy2radec(&wcs, oneStar.x / d, oneStar.y / d, &ra, &dec);
-            char rastr[32], decstr[32];
-            ra2hmsstring(ra, rastr);
-            dec2dmsstring(dec, decstr);
-            oneStar.ra = ra;
-            oneStar.dec = dec;
+            // The solution is in the pixels of the downsampled image
+            QVector<double> xd(n), yd(n);
+            for(int i = 0; i < n; i++)
+            {
+                xd[i] = x[i] / d;
+                yd[i] = y[i] / d;
+            }
+            sip_pixelxy2radecarrs(&wcs, xd.constData(), yd.constData(), n, ra, dec);
         }
         return true;
     }
     else
     {
-        double imgcrd[2], phi = 0, pixcrd[2], theta = 0, world[2];
-        int stat[2];
-
-        for(auto &oneStar : stars)
+        // wcslib takes all of the points in one call, as interleaved coordinate pairs
+        QVector<double> pixcrd(2 * n), imgcrd(2 * n), world(2 * n), phi(n), theta(n);
+        QVector<int> stat(n);
+        for(int i = 0; i < n; i++)
         {
-            pixcrd[0] = oneStar.x;
-            pixcrd[1] = oneStar.y;
-            if ((wcsp2s(m_wcs, 1, 2, &pixcrd[0], &imgcrd[0], &phi, &theta, &world[0], &stat[0])) != 0)
-                return false;
-            oneStar.ra = world[0];
-            oneStar.dec = world[1];
+            pixcrd[2 * i] = x[i];
+            pixcrd[2 * i + 1] = y[i];
         }
+        if(wcsp2s(m_wcs, n, 2, pixcrd.constData(), imgcrd.data(), phi.data(), theta.data(), world.data(), stat.data()) != 0)
+            return false;
+        for(int i = 0; i < n; i++)
+        {
+            ra[i] = world[2 * i];
+            dec[i] = world[2 * i + 1];
+        }
+        return true;
+    }
+}
 
+bool WCSData::wcsToPixel(const double *ra, const double *dec, int n, double *x, double *y)
+{
+    if(!hasWCS)
+        return false;
+    if(n == 0)
         return true;
+    if(internalWCS)
+    {
+        QVector<anbool> ok(n);
+        sip_radec2pixelxyarrs(&wcs, ra, dec, n, x, y, ok.data());
+        // The solution is in the pixels of the downsampled image
+        if(d != 1)
+        {
+            for(int i = 0; i < n; i++)
+            {
+                x[i] *= d;
+                y[i] *= d;
+            }
+        }
+        return !ok.contains(FALSE);
     }
+    else
+    {
+        QVector<double> world(2 * n), imgcrd(2 * n), pixcrd(2 * n), phi(n), theta(n);
+        QVector<int> stat(n);
+        for(int i = 0; i < n; i++)
+        {
+            world[2 * i] = ra[i];
+            world[2 * i + 1] = dec[i];
+        }
+        if(wcss2p(m_wcs, n, 2, world.constData(), phi.data(), theta.data(), imgcrd.data(), pixcrd.data(), stat.data()) != 0)
+            return false;
+        for(int i = 0; i < n; i++)
+        {
+            x[i] = pixcrd[2 * i];
+            y[i] = pixcrd[2 * i + 1];
+        }
+        return true;
+    }
+}
+
+bool WCSData::appendStarsRAandDEC(FITSImage::StarCatalog &stars)
+{
+    const int n = stars.size();
+    QVector<double> x(n), y(n), ra(n), dec(n);
+    stars.copyColumn(&FITSImage::Star::x, x.data());
+    stars.copyColumn(&FITSImage::Star::y, y.data());
+    if(!pixelToWCS(x.constData(), y.constData(), n, ra.data(), dec.data()))
+        return false;
+    FITSImage::Star *star = stars.data();
+    for(int i = 0; i < n; i++)
+    {
+        star[i].ra = ra[i];
+        star[i].dec = dec[i];
+    }
+    return true;
 }
 
+bool WCSData::appendStarsRAandDEC(QList<FITSImage::Star> &stars)
+{
+    FITSImage::StarCatalog catalog(stars);
+    if(!appendStarsRAandDEC(catalog))
+        return false;
+    for(int i = 0; i < stars.size(); i++)
+    {
+        stars[i].ra = catalog.at(i).ra;
+        stars[i].dec = catalog.at(i).dec;
+    }
+    return true;
+}
@@ -4,6 +4,7 @@
 //Qt Includes
 #include <QPointF>
 #include <QList>
+#include <QVector>
 
 //Astrometry.net Includes
 extern "C" {
@@ -12,6 +13,7 @@ extern "C" {
 
 //Project Includes
 #include "structuredefinitions.h"
+#include "starcatalog.h"
 
 class WCSData
 {
@@ -38,15 +40,42 @@ public:
      */
     bool wcsToPixel(const FITSImage::wcs_point &skyPoint, QPointF &pixelPoint);
 
+    /**
+     * @brief pixelToWCS converts many image X, Y Pixel coordinates to RA, DEC sky coordinates at once, which is much faster than one at a time
+     * @param pixelPoints The X, Y coordinates in pixels
+     * @param skyPoints Gets the RA, DEC coordinates, in the same order
+     * @return A boolean to say whether it succeeded, true means it did
+     */
+    bool pixelToWCS(const QVector<QPointF> &pixelPoints, QVector<FITSImage::wcs_point> &skyPoints);
+
+    /**
+     * @brief wcsToPixel converts many RA, DEC sky coordinates to image X, Y Pixel coordinates at once, which is much faster than one at a time
+     * @param skyPoints The RA, DEC coordinates
+     * @param pixelPoints Gets the X, Y coordinates in pixels, in the same order
+     * @return A boolean to say whether it succeeded for all of the points, true means it did
+     */
+    bool wcsToPixel(const QVector<FITSImage::wcs_point> &skyPoints, QVector<QPointF> &pixelPoints);
+
     /**
      * @brief appendStarsRAandDEC attaches the RA and DEC information to a star list
      * @param stars is the star list to process
      * @return true if it was successful
      */
+    bool appendStarsRAandDEC(FITSImage::StarCatalog &stars);
+
+    /**
+     * @brief appendStarsRAandDEC attaches the RA and DEC information to a QList of stars
+     * @param stars is the star list to process
+     * @return true if it was successful
+     */
     bool appendStarsRAandDEC(QList<FITSImage::Star> &stars);
 
 private:
 
+    // These do the conversions on separate coordinate arrays of n points, for the batch methods and appendStarsRAandDEC
+    bool pixelToWCS(const double *x, const double *y, int n, double *ra, double *dec);
+    bool wcsToPixel(const double *ra, const double *dec, int n, double *x, double *y);
+
     bool hasWCS = false;
     int d = 1;  // This is to correct for any downsampling that took place in the solution.
 
@@ -0,0 +1,33 @@
+#include "solvertest.h"
+
+//Includes for this project
+#include "ssolverutils/fileio.h"
+
+int SolverTest::finish() const
+{
+    printf("+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++\n");
+    printf("Failed checks: %d\n", failures);
+    fflush( stdout );
+    return failures == 0 ? 0 : 1;
+}
+
+uint8_t *SolverTest::loadImageBuffer(FITSImage::Statistic &stats, const QString &fileName)
+{
+    fileio imageLoader;
+    if(!imageLoader.loadImage(fileName))
+    {
+        printf("Error in loading file");
+        exit(1);
+    }
+    stats = imageLoader.getStats();
+    return imageLoader.getImageBuffer();
+}
+
+bool SolverTest::check(bool condition, const char *what)
+{
+    printf("%s: %s\n", condition ? "PASS" : "FAIL", what);
+    fflush( stdout );
+    if(!condition)
+        failures++;
+    return condition;
+}
@@ -0,0 +1,53 @@
+#ifndef SOLVERTEST_H
+#define SOLVERTEST_H
+
+#include <stdio.h>
+#include <clocale>
+#include <QApplication>
+#include <QObject>
+#include <QStandardPaths>
+
+//Includes for this project
+#include "structuredefinitions.h"
+
+/**
+ * @brief The SolverTest class is the base of the test programs that count their failed checks.
+ * A test does its checks in its constructor, and its main() just returns runSolverTest<TheTest>(argc, argv).
+ */
+class SolverTest : public QObject
+{
+    public:
+        /**
+         * @brief finish prints the number of failed checks
+         * @return The exit code of the test program, 0 if every check passed
+         */
+        int finish() const;
+
+        /**
+         * @brief loadImageBuffer loads one of the test images, exiting if it can't be read
+         * @param stats The statistics of the loaded image
+         * @param fileName The image file, in the folder the test runs in
+         * @return The image buffer, to be deleted with delete[]
+         */
+        static uint8_t *loadImageBuffer(FITSImage::Statistic &stats, const QString &fileName);
+
+    protected:
+        bool check(bool condition, const char *what);
+
+        int failures {0};
+};
+
+template <typename Test>
+int runSolverTest(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+#if defined(__linux__)
+    setlocale(LC_NUMERIC, "C");
+#endif
+    //Keep the index manifests and the cached solutions of the tests out of the user's cache folder.
+    QStandardPaths::setTestModeEnabled(true);
+    Test test;
+    return test.finish();
+}
+
+#endif // SOLVERTEST_H
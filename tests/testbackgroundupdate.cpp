@@ -0,0 +1,153 @@
+#include "testbackgroundupdate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+//Includes for this project
+#include "sep/sep.h"
+
+using namespace SEP;
+
+TestBackgroundUpdate::TestBackgroundUpdate()
+{
+    makeImage();
+    testReuse();
+    testUpdate();
+}
+
+//A sloped, noisy background with some stars on it, the same every time the test runs.
+void TestBackgroundUpdate::makeImage()
+{
+    width = 640;
+    height = 480;
+    image.fill(0, width * height);
+    std::mt19937 random(1);
+    std::normal_distribution<float> noise(0, 5);
+    std::uniform_real_distribution<float> uniform(0, 1);
+    for(int i = 0; i < image.count(); i++)
+        image[i] = 100 + 0.01f * (i % width) + noise(random);
+    for(int star = 0; star < 150; star++)
+    {
+        const float cx = uniform(random) * width, cy = uniform(random) * height;
+        const float flux = 200 + uniform(random) * 5000, sigma = 1.2f + uniform(random);
+        for(int y = std::max(0, int(cy) - 10); y <= std::min(height - 1, int(cy) + 10); y++)
+            for(int x = std::max(0, int(cx) - 10); x <= std::min(width - 1, int(cx) + 10); x++)
+                image[y * width + x] += flux * std::exp(-((x - cx) * (x - cx) + (y - cy) * (y - cy)) / (2 * sigma * sigma));
+    }
+}
+
+//Measures the whole background of a frame, like the extractor does without an earlier frame.
+sep_bkg *TestBackgroundUpdate::measure(QVector<float> &frame)
+{
+    sep_image im = {};
+    im.data = frame.data();
+    im.dtype = SEP_TFLOAT;
+    im.w = im.raw_w = width;
+    im.h = im.raw_h = height;
+    im.gain = 1.0;
+    sep_bkg *bkg = nullptr;
+    if(sep_background(&im, 64, 64, 3, 3, 0.0, &bkg) != 0)
+        return nullptr;
+    return bkg;
+}
+
+//The backgrounds are compared where they are used, on every pixel of the image.
+bool TestBackgroundUpdate::sameBackground(sep_bkg *bkg1, sep_bkg *bkg2)
+{
+    if(!bkg1 || !bkg2)
+        return false;
+    QVector<float> line1(width), line2(width);
+    for(int y = 0; y < height; y++)
+    {
+        sep_bkg_line(bkg1, y, line1.data(), SEP_TFLOAT);
+        sep_bkg_line(bkg2, y, line2.data(), SEP_TFLOAT);
+        for(int x = 0; x < width; x++)
+            if(std::fabs(line1[x] - line2[x]) > 1e-3)
+                return false;
+        sep_bkg_rmsline(bkg1, y, line1.data(), SEP_TFLOAT);
+        sep_bkg_rmsline(bkg2, y, line2.data(), SEP_TFLOAT);
+        for(int x = 0; x < width; x++)
+            if(std::fabs(line1[x] - line2[x]) > 1e-3)
+                return false;
+    }
+    return true;
+}
+
+//Reusing a background of the same size should overwrite its maps, and give the same background as measuring it anew.
+bool TestBackgroundUpdate::testReuse()
+{
+    sep_bkg *fresh = measure(image);
+    sep_bkg *reused = measure(image);
+    const sep_bkg *before = reused;
+
+    sep_image im = {};
+    im.data = image.data();
+    im.dtype = SEP_TFLOAT;
+    im.w = im.raw_w = width;
+    im.h = im.raw_h = height;
+    im.gain = 1.0;
+    bool ok = check(sep_background_reuse(&im, 64, 64, 3, 3, 0.0, &reused) == 0, "A background of the same size is reused");
+    ok &= check(reused == before, "The reused background keeps its memory");
+    ok &= check(sameBackground(fresh, reused), "The reused background is the same as a new one");
+
+    ok &= check(sep_background_reuse(&im, 32, 32, 3, 3, 0.0, &reused) == 0 && reused && reused->bw == 32,
+                "A background with other tiles is made again");
+    sep_bkg_free(fresh);
+    sep_bkg_free(reused);
+    return ok;
+}
+
+//Updating a background should only measure the rows of tiles that changed, and agree with measuring the whole frame.
+bool TestBackgroundUpdate::testUpdate()
+{
+    sep_bkg *full = measure(image);
+    sep_bkg *updated = measure(image);
+    if(!check(full && updated, "The background of the frame is measured"))
+        return false;
+
+    sep_image im = {};
+    im.data = image.data();
+    im.dtype = SEP_TFLOAT;
+    im.w = im.raw_w = width;
+    im.h = im.raw_h = height;
+    im.gain = 1.0;
+    int changed = -1;
+    bool ok = check(sep_background_update(&im, 3, 3, 0.0, 1.0, &updated, &changed) == 0, "The background is updated");
+    ok &= check(changed == updated->ny, "The first update measures every row of tiles");
+    ok &= check(sameBackground(full, updated), "The first update gives the same background as measuring the frame");
+
+    changed = -1;
+    ok &= check(sep_background_update(&im, 3, 3, 0.0, 1.0, &updated, &changed) == 0, "The background is updated for the same frame");
+    ok &= check(changed == 0, "Nothing is measured again for the same frame");
+    ok &= check(sameBackground(full, updated), "The background of the same frame is unchanged");
+
+    //A band of brighter sky across the middle of the next frame.
+    QVector<float> next = image;
+    for(int y = 200; y < 300; y++)
+        for(int x = 0; x < width; x++)
+            next[y * width + x] += 50;
+    sep_bkg *nextFull = measure(next);
+    im.data = next.data();
+    changed = -1;
+    ok &= check(sep_background_update(&im, 3, 3, 0.0, 1.0, &updated, &changed) == 0, "The background is updated for the next frame");
+    ok &= check(changed > 0 && changed < updated->ny, "Only the rows of tiles that changed are measured again");
+    ok &= check(sameBackground(nextFull, updated), "The updated background is the same as measuring the next frame");
+
+    QVector<float> smaller(width * height / 4);
+    im.data = smaller.data();
+    im.w = im.raw_w = width / 2;
+    im.h = im.raw_h = height / 2;
+    ok &= check(sep_background_update(&im, 3, 3, 0.0, 1.0, &updated, &changed) != 0 && updated,
+                "A background is not updated for a frame of another size");
+
+    sep_bkg_free(full);
+    sep_bkg_free(nextFull);
+    sep_bkg_free(updated);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestBackgroundUpdate>(argc, argv);
+}
@@ -0,0 +1,27 @@
+#ifndef TESTBACKGROUNDUPDATE_H
+#define TESTBACKGROUNDUPDATE_H
+
+#include "solvertest.h"
+#include <QVector>
+
+namespace SEP
+{
+struct sep_bkg;
+}
+
+class TestBackgroundUpdate : public SolverTest
+{
+public:
+    TestBackgroundUpdate();
+    bool testReuse();
+    bool testUpdate();
+private:
+    bool sameBackground(SEP::sep_bkg *bkg1, SEP::sep_bkg *bkg2);
+    SEP::sep_bkg *measure(QVector<float> &frame);
+    void makeImage();
+    int width;
+    int height;
+    QVector<float> image;
+};
+
+#endif // TESTBACKGROUNDUPDATE_H
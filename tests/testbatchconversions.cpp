@@ -0,0 +1,76 @@
+#include "testbatchconversions.h"
+
+#include <cmath>
+
+TestBatchConversions::TestBatchConversions()
+{
+    FITSImage::Statistic stats;
+    uint8_t *imageBuffer = loadImageBuffer(stats, "pleiades.jpg");
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setProperty("ExtractorType", SSolver::EXTRACTOR_INTERNAL);
+    stellarSolver.setProperty("SolverType", SSolver::SOLVER_STELLARSOLVER);
+    stellarSolver.setProperty("ProcessType", SSolver::SOLVE);
+    stellarSolver.setParameterProfile(SSolver::Parameters::PARALLEL_SMALLSCALE);
+    stellarSolver.setIndexFolderPaths(QStringList() << "astrometry");
+
+    printf("Starting to solve. . .\n");
+    fflush( stdout );
+    if(check(stellarSolver.solve(), "The image solves"))
+        testBatchConversions(stellarSolver);
+
+    //The solution of a downsampled image is in its smaller pixels, but the conversions are in the pixels of the full image.
+    SSolver::Parameters params = stellarSolver.getCurrentParameters();
+    params.downsample = 2;
+    stellarSolver.setParameters(params);
+    printf("Starting to solve the image downsampled by 2. . .\n");
+    fflush( stdout );
+    if(check(stellarSolver.solve(), "The downsampled image solves"))
+        testBatchConversions(stellarSolver);
+    delete[] imageBuffer;
+}
+
+//The batch conversions should agree with the single point ones and with each other.
+bool TestBatchConversions::testBatchConversions(StellarSolver &stellarSolver)
+{
+    QVector<QPointF> pixelPoints;
+    for(int y = 0; y < 5; y++)
+        for(int x = 0; x < 5; x++)
+            pixelPoints.append(QPointF(x * 100.0 + 10, y * 80.0 + 10));
+
+    QVector<FITSImage::wcs_point> skyPoints;
+    bool ok = check(stellarSolver.pixelToWCS(pixelPoints, skyPoints), "The batch pixel to WCS conversion succeeds");
+    ok &= check(skyPoints.count() == pixelPoints.count(), "The batch pixel to WCS conversion converts every point");
+    if(skyPoints.count() != pixelPoints.count())
+        return false;
+
+    bool matchesSingle = true;
+    for(int i = 0; i < pixelPoints.count(); i++)
+    {
+        FITSImage::wcs_point skyPoint;
+        stellarSolver.pixelToWCS(pixelPoints.at(i), skyPoint);
+        matchesSingle &= std::fabs(skyPoint.ra - skyPoints.at(i).ra) < 1e-4 && std::fabs(skyPoint.dec - skyPoints.at(i).dec) < 1e-4;
+    }
+    ok &= check(matchesSingle, "The batch pixel to WCS conversion matches the single point one");
+
+    QVector<QPointF> roundTrip;
+    ok &= check(stellarSolver.wcsToPixel(skyPoints, roundTrip), "The batch WCS to pixel conversion succeeds");
+    ok &= check(roundTrip.count() == pixelPoints.count(), "The batch WCS to pixel conversion converts every point");
+    if(roundTrip.count() != pixelPoints.count())
+        return false;
+
+    bool returns = true;
+    for(int i = 0; i < pixelPoints.count(); i++)
+    {
+        QPointF pixelPoint;
+        stellarSolver.wcsToPixel(skyPoints.at(i), pixelPoint);
+        returns &= std::fabs(roundTrip.at(i).x() - pixelPoints.at(i).x()) < 0.5 && std::fabs(roundTrip.at(i).y() - pixelPoints.at(i).y()) < 0.5
+                   && std::fabs(roundTrip.at(i).x() - pixelPoint.x()) < 1e-3 && std::fabs(roundTrip.at(i).y() - pixelPoint.y()) < 1e-3;
+    }
+    ok &= check(returns, "The batch WCS to pixel conversion returns the original pixels");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestBatchConversions>(argc, argv);
+}
@@ -0,0 +1,17 @@
+#ifndef TESTBATCHCONVERSIONS_H
+#define TESTBATCHCONVERSIONS_H
+
+#include "solvertest.h"
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+
+class TestBatchConversions : public SolverTest
+{
+public:
+    TestBatchConversions();
+    bool testBatchConversions(StellarSolver &stellarSolver);
+};
+
+#endif // TESTBATCHCONVERSIONS_H
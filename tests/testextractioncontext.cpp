@@ -0,0 +1,77 @@
+#include "testextractioncontext.h"
+
+#include <algorithm>
+#include <cmath>
+
+//Includes for this project
+#include "extractioncontext.h"
+
+TestExtractionContext::TestExtractionContext()
+{
+    testReuse("pleiades.jpg", false);
+    testReuse("pleiades.jpg", true);
+    testReuse("randomsky.fits", true);
+}
+
+//The partitions can finish in any order, so the stars are compared by position.
+bool TestExtractionContext::sameStars(QList<FITSImage::Star> stars1, QList<FITSImage::Star> stars2)
+{
+    if(stars1.count() != stars2.count())
+        return false;
+    auto byPosition = [](const FITSImage::Star & s1, const FITSImage::Star & s2)
+    {
+        return s1.y < s2.y || (s1.y == s2.y && s1.x < s2.x);
+    };
+    std::sort(stars1.begin(), stars1.end(), byPosition);
+    std::sort(stars2.begin(), stars2.end(), byPosition);
+    for(int i = 0; i < stars1.count(); i++)
+    {
+        if(std::fabs(stars1.at(i).x - stars2.at(i).x) > 1e-3 || std::fabs(stars1.at(i).y - stars2.at(i).y) > 1e-3
+                || std::fabs(stars1.at(i).flux - stars2.at(i).flux) > 1e-3 * std::fabs(stars1.at(i).flux))
+            return false;
+    }
+    return true;
+}
+
+//Extracting frame after frame with the scratch memory kept in a context should find the same stars as extracting without it.
+bool TestExtractionContext::testReuse(const QString &fileName, bool partition)
+{
+    printf("Extracting %s with and without an extraction context, %s. . .\n", fileName.toUtf8().data(),
+           partition ? "partitioned" : "in one piece");
+    fflush( stdout );
+    FITSImage::Statistic stats;
+    uint8_t *imageBuffer = loadImageBuffer(stats, fileName);
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setProperty("ExtractorType", SSolver::EXTRACTOR_INTERNAL);
+    SSolver::Parameters params = stellarSolver.getCurrentParameters();
+    params.partition = partition;
+    stellarSolver.setParameters(params);
+
+    bool ok = check(stellarSolver.extract(), "The image is extracted without a context");
+    const QList<FITSImage::Star> stars = stellarSolver.getStarList();
+    ok &= check(!stars.isEmpty(), "Stars are found without a context");
+
+    QSharedPointer<ExtractionContext> context(new ExtractionContext());
+    stellarSolver.setExtractionContext(context);
+    ok &= check(stellarSolver.extract(), "The image is extracted with a new context");
+    ok &= check(sameStars(stars, stellarSolver.getStarList()), "A new context finds the same stars");
+    const int workspaces = context->workspaceCount();
+    ok &= check(workspaces > 0, "The context keeps the workspaces of the extraction");
+
+    ok &= check(stellarSolver.extract(), "The image is extracted again with the same context");
+    ok &= check(sameStars(stars, stellarSolver.getStarList()), "Reusing the context finds the same stars");
+    //How many partitions are extracted at the same time depends on the threads, so only one piece has a fixed count.
+    if(!partition)
+        ok &= check(workspaces == 1 && context->workspaceCount() == 1, "Reusing the context doesn't make more workspaces");
+
+    context->clear();
+    ok &= check(context->workspaceCount() == 0, "Clearing the context frees its workspaces");
+    stellarSolver.setExtractionContext(QSharedPointer<ExtractionContext>());
+    delete[] imageBuffer;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestExtractionContext>(argc, argv);
+}
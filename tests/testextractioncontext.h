@@ -0,0 +1,19 @@
+#ifndef TESTEXTRACTIONCONTEXT_H
+#define TESTEXTRACTIONCONTEXT_H
+
+#include "solvertest.h"
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+
+class TestExtractionContext : public SolverTest
+{
+public:
+    TestExtractionContext();
+    bool testReuse(const QString &fileName, bool partition);
+private:
+    static bool sameStars(QList<FITSImage::Star> stars1, QList<FITSImage::Star> stars2);
+};
+
+#endif // TESTEXTRACTIONCONTEXT_H
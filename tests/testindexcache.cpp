@@ -0,0 +1,87 @@
+#include "testindexcache.h"
+
+//Qt Includes
+#include <QDir>
+#include <QFileInfo>
+
+//Includes for this project
+#include "indexcache.h"
+
+TestIndexCache::TestIndexCache()
+{
+    testSharing();
+    testMemoryBudget();
+}
+
+//Acquired indexes should be shared and kept until they are released, and only unused ones should be purged.
+bool TestIndexCache::testSharing()
+{
+    IndexCache *cache = IndexCache::instance();
+    cache->purgeUnused();
+    bool ok = check(cache->loadedCount() == 0, "The index cache starts empty");
+
+    QList<index_t *> indexes = cache->acquireFolder("astrometry");
+    ok &= check(indexes.count() == 2, "The index cache acquires both index files in the folder");
+    ok &= check(cache->loadedCount() == 2, "The index cache holds both index files");
+    if(indexes.isEmpty())
+        return false;
+
+    index_t *again = cache->acquire(QDir("astrometry").absoluteFilePath(QFileInfo(indexes.first()->indexname).fileName()));
+    ok &= check(again == indexes.first(), "Acquiring an index file again shares the cached index");
+
+    index_residency_t residency = {};
+    ok &= check(IndexCache::loadIndex(indexes.first(), &residency, cache) == 0, "A cached index can be loaded");
+    ok &= check(cache->loadedBytes() > 0, "The loaded index is counted in the loaded bytes");
+    ok &= check(static_cast<qint64>(IndexCache::loadedBytesOf(cache)) == cache->loadedBytes(), "The engine sees the same loaded bytes");
+
+    cache->release(again);
+    ok &= check(cache->purgeUnused() == 0, "Indexes that are still acquired are not purged");
+    ok &= check(cache->loadedCount() == 2, "The acquired indexes stay in the cache");
+
+    for(index_t *index : indexes)
+        cache->release(index);
+    ok &= check(cache->loadedCount() == 2, "Released indexes stay in the cache until they are purged");
+    ok &= check(cache->purgeUnused() == 2, "Released indexes are purged");
+    ok &= check(cache->loadedCount() == 0 && cache->loadedBytes() == 0, "The purged cache is empty");
+    return ok;
+}
+
+//Indexes in use should stay loaded over the memory budget, and be unloaded once they are released.
+bool TestIndexCache::testMemoryBudget()
+{
+    IndexCache *cache = IndexCache::instance();
+    QList<index_t *> indexes = cache->acquireFolder("astrometry");
+    if(!check(indexes.count() == 2, "The index cache acquires both index files again"))
+        return false;
+
+    index_residency_t residency = {};
+    bool ok = true;
+    for(index_t *index : indexes)
+        ok &= check(IndexCache::loadIndex(index, &residency, cache) == 0, "An acquired index can be loaded");
+    const qint64 loaded = cache->loadedBytes();
+
+    cache->setMemoryBudget(1);
+    ok &= check(cache->loadedBytes() == loaded, "Indexes in use are not unloaded to fit the memory budget");
+    ok &= check(index_is_loaded(indexes.first()) && index_is_loaded(indexes.last()), "Indexes in use stay loaded");
+
+    for(index_t *index : indexes)
+        cache->release(index);
+    ok &= check(cache->loadedBytes() == 0, "Released indexes are unloaded to fit the memory budget");
+    ok &= check(cache->loadedCount() == 2, "Unloaded indexes keep their metadata in the cache");
+
+    indexes = cache->acquireFolder("astrometry");
+    ok &= check(indexes.count() == 2 && IndexCache::loadIndex(indexes.first(), &residency, cache) == 0,
+                "An unloaded index is loaded again when it is needed");
+    ok &= check(index_is_loaded(indexes.first()), "The index is loaded again");
+    for(index_t *index : indexes)
+        cache->release(index);
+
+    cache->setMemoryBudget(0);
+    ok &= check(cache->purgeUnused() == 2 && cache->loadedCount() == 0, "The cache is empty after the test");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestIndexCache>(argc, argv);
+}
@@ -0,0 +1,14 @@
+#ifndef TESTINDEXCACHE_H
+#define TESTINDEXCACHE_H
+
+#include "solvertest.h"
+
+class TestIndexCache : public SolverTest
+{
+public:
+    TestIndexCache();
+    bool testSharing();
+    bool testMemoryBudget();
+};
+
+#endif // TESTINDEXCACHE_H
@@ -0,0 +1,101 @@
+#include "testindexmanifest.h"
+
+//Qt Includes
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+
+//Includes for this project
+#include "stellarsolver.h"
+#include "indexmanifest.h"
+
+TestIndexManifest::TestIndexManifest()
+{
+    testManifest();
+    testIndexFiles();
+}
+
+//The manifest should list the index files, and reading it again for an unchanged folder should not save it again.
+bool TestIndexManifest::testManifest()
+{
+    IndexManifest manifest("astrometry");
+    if(!check(manifest.refresh(), "The index manifest reads the index folder"))
+        return false;
+    const QList<IndexManifest::Entry> entries = manifest.indexEntries();
+    bool ok = check(entries.count() == 2, "The index manifest finds both index files");
+    const QString savedPath = IndexManifest::manifestPath("astrometry");
+    if(!check(QFileInfo::exists(savedPath), "The index manifest is saved"))
+        return false;
+
+    //Backdating the saved manifest shows whether it is written again, without waiting for the clock to move on.
+    const QDateTime backdated = QDateTime::currentDateTimeUtc().addDays(-1);
+    {
+        QFile saved(savedPath);
+        ok &= check(saved.open(QIODevice::ReadWrite) && saved.setFileTime(backdated, QFileDevice::FileModificationTime),
+                    "The saved index manifest can be backdated");
+    }
+
+    IndexManifest reused("astrometry");
+    ok &= check(reused.refresh(), "The saved index manifest is read again");
+    ok &= check(reused.refreshIfStale(), "The saved index manifest is read again if it is not stale");
+    ok &= check(QFileInfo(savedPath).lastModified().toSecsSinceEpoch() == backdated.toSecsSinceEpoch(),
+                "An unchanged folder does not save the index manifest again");
+    const QList<IndexManifest::Entry> reusedEntries = reused.indexEntries();
+    bool same = reusedEntries.count() == entries.count();
+    for(int i = 0; same && i < entries.count(); i++)
+        same = reusedEntries.at(i).fileName == entries.at(i).fileName && reusedEntries.at(i).indexid == entries.at(i).indexid
+               && reusedEntries.at(i).healpix == entries.at(i).healpix && reusedEntries.at(i).scaleLower == entries.at(i).scaleLower
+               && reusedEntries.at(i).scaleUpper == entries.at(i).scaleUpper;
+    ok &= check(same, "The saved index manifest has the same entries");
+    return ok;
+}
+
+//getIndexFiles should pick the files by index and healpix from the manifest, and see files added to the folder.
+bool TestIndexManifest::testIndexFiles()
+{
+    QTemporaryDir folder;
+    if(!check(folder.isValid(), "A temporary index folder is made"))
+        return false;
+    //The files are only matched by name, so empty files will do.
+    const QStringList names = QStringList() << "index-4107.fits" << "index-4110-05.fits" << "index-4110-06.fit" << "notes.txt";
+    for(const auto &name : names)
+        QFile(QDir(folder.path()).filePath(name)).open(QIODevice::WriteOnly);
+
+    const QStringList folders = QStringList() << folder.path();
+    bool ok = check(StellarSolver::getIndexFiles(folders).count() == 3, "All of the fits files in the folder are found");
+    ok &= check(StellarSolver::getIndexFiles(folders, 4110).count() == 2, "The files of one index are found");
+    const QStringList healpix = StellarSolver::getIndexFiles(folders, 4110, 5);
+    ok &= check(healpix.count() == 1 && healpix.first().endsWith("index-4110-05.fits"), "The file of one index and healpix is found");
+    ok &= check(StellarSolver::getIndexFiles(folders, 4200).isEmpty(), "An index that is not in the folder is not found");
+
+    //A folder that didn't change is not listed again, so a new file is only seen if the folder's time shows it.
+    const QDateTime before = QFileInfo(folder.path()).lastModified();
+    QFile(QDir(folder.path()).filePath("index-4200.fits")).open(QIODevice::WriteOnly);
+    if(QFileInfo(folder.path()).lastModified() != before)
+        ok &= check(StellarSolver::getIndexFiles(folders, 4200).count() == 1, "A file added to the folder is found");
+    else
+        printf("SKIP: The file system did not change the folder's time for the new file\n");
+
+    //Overwriting a file in place doesn't change the folder, but its new size shows that its metadata must be read again.
+    {
+        QFile index("astrometry/index-4110.fits");
+        QFile replaced(QDir(folder.path()).filePath("index-4107.fits"));
+        ok &= check(index.open(QIODevice::ReadOnly) && replaced.open(QIODevice::WriteOnly | QIODevice::Truncate)
+                    && replaced.write(index.readAll()) == index.size(), "A file in the folder is overwritten with an index file");
+    }
+    IndexManifest manifest(folder.path());
+    ok &= check(manifest.refreshIfStale(), "The manifest of the folder is read again");
+    const QList<IndexManifest::Entry> replacedEntries = manifest.entries(QStringList() << "index-4107.fits");
+    ok &= check(replacedEntries.count() == 1 && replacedEntries.first().isIndex && replacedEntries.first().indexid == 4110,
+                "The manifest has the metadata of the overwritten file");
+
+    QFile::remove(IndexManifest::manifestPath(folder.path()));
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestIndexManifest>(argc, argv);
+}
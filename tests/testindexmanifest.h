@@ -0,0 +1,14 @@
+#ifndef TESTINDEXMANIFEST_H
+#define TESTINDEXMANIFEST_H
+
+#include "solvertest.h"
+
+class TestIndexManifest : public SolverTest
+{
+public:
+    TestIndexManifest();
+    bool testManifest();
+    bool testIndexFiles();
+};
+
+#endif // TESTINDEXMANIFEST_H
@@ -0,0 +1,138 @@
+#include "testparalleldeblend.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace SEP;
+
+TestParallelDeblend::TestParallelDeblend()
+{
+    makeImage();
+
+    Extract serialExtractor;
+    serial = extract(serialExtractor);
+    if(check(serial && serial->nobj > 100, "The image is extracted and deblended on one thread"))
+    {
+        //The workers share out the objects, so it must not matter how many there are, when they start or which runs first.
+        testDeblend("threads", 4, [](int workers, const std::function<void(int)> &work)
+        {
+            std::vector<std::thread> threads;
+            for(int worker = 1; worker < workers; worker++)
+                threads.emplace_back([&work, worker]()
+            {
+                work(worker);
+            });
+            work(0);
+            for(auto &thread : threads)
+                thread.join();
+        });
+        testDeblend("calling thread first", 3, [](int workers, const std::function<void(int)> &work)
+        {
+            for(int worker = 0; worker < workers; worker++)
+                work(worker);
+        });
+        testDeblend("calling thread last", 3, [](int workers, const std::function<void(int)> &work)
+        {
+            for(int worker = workers - 1; worker >= 0; worker--)
+                work(worker);
+        });
+    }
+    Extract::sep_catalog_free(serial);
+
+    //Another thread cancels the extraction through the flag, so it stops without a catalog.
+    Extract cancelledExtractor;
+    const std::atomic<bool> cancelled(true);
+    cancelledExtractor.sep_set_cancel_flag(&cancelled);
+    check(extract(cancelledExtractor) == nullptr, "A cancelled extraction stops without a catalog");
+}
+
+//A noisy field with a close pair in every few stars and some broad blobs, so that many objects need deblending.
+void TestParallelDeblend::makeImage()
+{
+    width = 800;
+    height = 600;
+    image.fill(0, width * height);
+    std::mt19937 random(3);
+    std::normal_distribution<float> noise(0, 5);
+    std::uniform_real_distribution<float> uniform(0, 1);
+    for(auto &pixel : image)
+        pixel = 100 + noise(random);
+    for(int star = 0; star < 300; star++)
+    {
+        const float flux = 200 + uniform(random) * 5000, sigma = star % 25 == 0 ? 6.0f : 1.2f + uniform(random);
+        const int radius = static_cast<int>(5 * sigma);
+        const float x0 = uniform(random) * width, y0 = uniform(random) * height;
+        const int parts = star % 3 == 0 ? 2 : 1;
+        for(int part = 0; part < parts; part++)
+        {
+            const float cx = x0 + part * 4.0f, cy = y0 + part * 3.0f;
+            for(int y = std::max(0, int(cy) - radius); y <= std::min(height - 1, int(cy) + radius); y++)
+                for(int x = std::max(0, int(cx) - radius); x <= std::min(width - 1, int(cx) + radius); x++)
+                    image[y * width + x] += flux * std::exp(-((x - cx) * (x - cx) + (y - cy) * (y - cy)) / (2 * sigma * sigma));
+        }
+    }
+}
+
+//Extracts with the settings StellarSolver uses for photometry, which deblend with 32 levels.
+sep_catalog *TestParallelDeblend::extract(Extract &extractor)
+{
+    sep_image im = {};
+    im.data = image.data();
+    im.dtype = SEP_TFLOAT;
+    im.w = im.raw_w = width;
+    im.h = im.raw_h = height;
+    im.gain = 1.0;
+    sep_bkg *bkg = nullptr;
+    if(sep_background(&im, 64, 64, 3, 3, 0.0, &bkg) != 0)
+        return nullptr;
+    im.back = bkg;
+
+    float conv[] = {1, 2, 1, 2, 4, 2, 1, 2, 1};
+    sep_catalog *catalog = nullptr;
+    const int status = extractor.sep_extract(&im, 2 * bkg->globalrms, SEP_THRESH_ABS, 5, conv, 3, 3, SEP_FILTER_CONV,
+                       32, 0.005, 1, 1.0, &catalog);
+    sep_bkg_free(bkg);
+    return status == 0 ? catalog : nullptr;
+}
+
+//Deblending in parallel must give the same objects in the same order, so everything is compared exactly.
+bool TestParallelDeblend::sameCatalog(const sep_catalog *catalog1, const sep_catalog *catalog2)
+{
+    if(!catalog1 || !catalog2 || catalog1->nobj != catalog2->nobj)
+        return false;
+    for(int i = 0; i < catalog1->nobj; i++)
+    {
+        if(catalog1->x[i] != catalog2->x[i] || catalog1->y[i] != catalog2->y[i] || catalog1->flux[i] != catalog2->flux[i]
+                || catalog1->a[i] != catalog2->a[i] || catalog1->b[i] != catalog2->b[i] || catalog1->flag[i] != catalog2->flag[i]
+                || catalog1->thresh[i] != catalog2->thresh[i] || catalog1->npix[i] != catalog2->npix[i])
+            return false;
+        if(!std::equal(catalog1->pix[i], catalog1->pix[i] + catalog1->npix[i], catalog2->pix[i]))
+            return false;
+    }
+    return true;
+}
+
+//Each way of running the workers is used twice with the same Extract, which keeps the deblending buffers in between.
+bool TestParallelDeblend::testDeblend(const char *name, int threads, Extract::parallelrunner runner)
+{
+    printf("Deblending with %d workers, %s\n", threads, name);
+    Extract extractor;
+    extractor.sep_set_deblend_threads(threads, runner);
+    bool ok = check(extractor.sep_get_deblend_threads() == threads, "The extractor deblends with the workers");
+    for(int run = 0; run < 2; run++)
+    {
+        sep_catalog *parallel = extract(extractor);
+        ok &= check(sameCatalog(serial, parallel), "The workers find the same objects in the same order as one thread");
+        Extract::sep_catalog_free(parallel);
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestParallelDeblend>(argc, argv);
+}
@@ -0,0 +1,26 @@
+#ifndef TESTPARALLELDEBLEND_H
+#define TESTPARALLELDEBLEND_H
+
+#include "solvertest.h"
+#include <QVector>
+
+//Includes for this project
+#include "sep/sep.h"
+#include "sep/extract.h"
+
+class TestParallelDeblend : public SolverTest
+{
+public:
+    TestParallelDeblend();
+    bool testDeblend(const char *name, int threads, SEP::Extract::parallelrunner runner);
+private:
+    SEP::sep_catalog *extract(SEP::Extract &extractor);
+    static bool sameCatalog(const SEP::sep_catalog *catalog1, const SEP::sep_catalog *catalog2);
+    void makeImage();
+    int width;
+    int height;
+    QVector<float> image;
+    SEP::sep_catalog *serial;
+};
+
+#endif // TESTPARALLELDEBLEND_H
@@ -0,0 +1,101 @@
+#include "testpriorsolution.h"
+
+#include <chrono>
+#include <cmath>
+
+TestPriorSolution::TestPriorSolution()
+{
+    FITSImage::Statistic stats;
+    uint8_t *imageBuffer = loadImageBuffer(stats, "pleiades.jpg");
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setProperty("ExtractorType", SSolver::EXTRACTOR_INTERNAL);
+    stellarSolver.setProperty("SolverType", SSolver::SOLVER_STELLARSOLVER);
+    stellarSolver.setProperty("ProcessType", SSolver::SOLVE);
+    stellarSolver.setParameterProfile(SSolver::Parameters::SINGLE_THREAD_SOLVING);
+    stellarSolver.setIndexFolderPaths(QStringList() << "astrometry");
+    //The solver only says that it verifies the prior solution in its log.
+    stellarSolver.setSSLogLevel(SSolver::LOG_NORMAL);
+    testPriorSolution(stellarSolver);
+    delete[] imageBuffer;
+}
+
+//Solves the image, and finds out from the log whether the solver verified a prior solution first.
+bool TestPriorSolution::solve(StellarSolver &stellarSolver, bool &triedPrior)
+{
+    triedPrior = false;
+    QMetaObject::Connection logConnection = connect(&stellarSolver, &StellarSolver::logOutput, this, [&triedPrior](QString text)
+    {
+        if(text.contains("near the prior solution"))
+            triedPrior = true;
+    });
+    //A blind search that can't solve gives up well within this, it only keeps a broken search from hanging the test.
+    const bool solved = stellarSolver.solveWithin(std::chrono::minutes(2));
+    disconnect(logConnection);
+    return solved;
+}
+
+//The solution from the prior should be tweaked to where the blind search puts the field.
+bool TestPriorSolution::sameSolution(const FITSImage::Solution &solution1, const FITSImage::Solution &solution2)
+{
+    const double tolerance = 0.5 * solution1.pixscale / 3600.0;
+    const double turn = std::remainder(solution1.orientation - solution2.orientation, 360.0);
+    return std::fabs(solution1.dec - solution2.dec) < tolerance
+           && std::fabs(std::remainder(solution1.ra - solution2.ra, 360.0)) * std::cos(solution1.dec / 180.0 * 3.14159265358979) < tolerance
+           && std::fabs(solution1.pixscale - solution2.pixscale) < 1e-3 * solution1.pixscale
+           && std::fabs(turn) < 0.1 && solution1.parity == solution2.parity;
+}
+
+//A solver with usePriorSolution should verify its last solution, or the one it is given, before searching blind.
+bool TestPriorSolution::testPriorSolution(StellarSolver &stellarSolver)
+{
+    SSolver::Parameters params = stellarSolver.getCurrentParameters();
+    params.usePriorSolution = true;
+    stellarSolver.setParameters(params);
+
+    bool triedPrior = false;
+    bool ok = check(solve(stellarSolver, triedPrior), "The image solves blind");
+    if(!ok)
+        return false;
+    ok &= check(!triedPrior, "There is no prior solution to verify for the first solve");
+    const FITSImage::Solution blind = stellarSolver.getSolution();
+
+    ok &= check(solve(stellarSolver, triedPrior), "The image solves again");
+    ok &= check(triedPrior, "The last solution is verified before the blind search");
+    ok &= check(sameSolution(blind, stellarSolver.getSolution()), "The last solution gives the same solution");
+
+    //Searching for the other parity can't find a match, so only verifying the prior can solve the image.
+    params.search_parity = blind.parity == FITSImage::POSITIVE ? 1 : 0;
+    stellarSolver.setParameters(params);
+    stellarSolver.clearPriorSolution();
+    ok &= check(!solve(stellarSolver, triedPrior), "A blind search for the other parity does not solve the image");
+    ok &= check(!triedPrior, "A cleared prior solution is not verified");
+
+    stellarSolver.setPriorSolution(blind);
+    ok &= check(solve(stellarSolver, triedPrior), "The image solves from the given prior solution alone");
+    ok &= check(triedPrior, "The given prior solution is verified");
+    ok &= check(sameSolution(blind, stellarSolver.getSolution()), "The given prior solution gives the same solution");
+
+    //A field that has drifted by a few arcminutes since the prior solution is still found from the prior alone.
+    FITSImage::Solution drifted = blind;
+    drifted.dec += 3.0 / 60.0;
+    drifted.ra = std::fmod(drifted.ra + 2.0 / 60.0 / std::cos(blind.dec / 180.0 * 3.14159265358979) + 360.0, 360.0);
+    stellarSolver.setPriorSolution(drifted);
+    ok &= check(solve(stellarSolver, triedPrior), "The image solves from a prior solution that is a few arcminutes off");
+    ok &= check(sameSolution(blind, stellarSolver.getSolution()), "The prior solution that is a few arcminutes off gives the same solution");
+
+    //A prior far from the field fails to verify, and the blind search still solves the image.
+    params.search_parity = 2;
+    stellarSolver.setParameters(params);
+    FITSImage::Solution wrong = blind;
+    wrong.ra = std::fmod(wrong.ra + 40, 360.0);
+    stellarSolver.setPriorSolution(wrong);
+    ok &= check(solve(stellarSolver, triedPrior), "The image solves with a prior far from the field");
+    ok &= check(triedPrior, "The prior far from the field is verified first");
+    ok &= check(sameSolution(blind, stellarSolver.getSolution()), "The blind search after a wrong prior gives the same solution");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestPriorSolution>(argc, argv);
+}
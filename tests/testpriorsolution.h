@@ -0,0 +1,20 @@
+#ifndef TESTPRIORSOLUTION_H
+#define TESTPRIORSOLUTION_H
+
+#include "solvertest.h"
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+
+class TestPriorSolution : public SolverTest
+{
+public:
+    TestPriorSolution();
+    bool testPriorSolution(StellarSolver &stellarSolver);
+private:
+    bool solve(StellarSolver &stellarSolver, bool &triedPrior);
+    static bool sameSolution(const FITSImage::Solution &solution1, const FITSImage::Solution &solution2);
+};
+
+#endif // TESTPRIORSOLUTION_H
@@ -0,0 +1,78 @@
+#include "testsharedsearch.h"
+
+#include <cmath>
+
+//Includes for this project
+#include "ssolverutils/fileio.h"
+
+TestSharedSearch::TestSharedSearch()
+{
+    testSharedSearch("pleiades.jpg");
+    testSharedSearch("randomsky.fits");
+}
+
+bool TestSharedSearch::solve(const QString &fileName, SSolver::MultiAlgo multiAlgorithm, FITSImage::Solution &solution)
+{
+    fileio imageLoader;
+    if(!imageLoader.loadImage(fileName))
+    {
+        printf("Error in loading file");
+        exit(1);
+    }
+    FITSImage::Statistic stats = imageLoader.getStats();
+    uint8_t *imageBuffer = imageLoader.getImageBuffer();
+
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setProperty("ExtractorType", SSolver::EXTRACTOR_INTERNAL);
+    stellarSolver.setProperty("SolverType", SSolver::SOLVER_STELLARSOLVER);
+    stellarSolver.setParameterProfile(SSolver::Parameters::SINGLE_THREAD_SOLVING);
+    SSolver::Parameters params = stellarSolver.getCurrentParameters();
+    params.multiAlgorithm = multiAlgorithm;
+    stellarSolver.setParameters(params);
+    stellarSolver.setIndexFolderPaths(QStringList() << "astrometry");
+    if(imageLoader.position_given)
+        stellarSolver.setSearchPositionRaDec(imageLoader.ra, imageLoader.dec);
+    if(imageLoader.scale_given)
+        stellarSolver.setSearchScale(imageLoader.scale_low, imageLoader.scale_high, imageLoader.scale_units);
+
+    printf("Starting to solve %s with the %s algorithm. . .\n", fileName.toUtf8().data(),
+           multiAlgorithm == SSolver::MULTI_SHARED ? "shared" : "single threaded");
+    fflush( stdout );
+    const bool solved = stellarSolver.solve();
+    if(solved)
+        solution = stellarSolver.getSolution();
+    delete[] imageBuffer;
+    return solved;
+}
+
+//Both searches verify their match against the same stars, so they should agree to a small part of a pixel.
+bool TestSharedSearch::sameSolution(const FITSImage::Solution &solution1, const FITSImage::Solution &solution2)
+{
+    const double tolerance = 0.2 * solution1.pixscale / 3600.0;
+    const double turn = std::remainder(solution1.orientation - solution2.orientation, 360.0);
+    return std::fabs(solution1.dec - solution2.dec) < tolerance
+           && std::fabs(std::remainder(solution1.ra - solution2.ra, 360.0)) * std::cos(solution1.dec / 180.0 * 3.14159265358979) < tolerance
+           && std::fabs(solution1.pixscale - solution2.pixscale) < 1e-3 * solution1.pixscale
+           && std::fabs(turn) < 0.05 && solution1.parity == solution2.parity;
+}
+
+//Searching the quads in threads that share one solver should find the same solution as searching them on one thread.
+bool TestSharedSearch::testSharedSearch(const QString &fileName)
+{
+    FITSImage::Solution single, shared;
+    bool ok = check(solve(fileName, SSolver::NOT_MULTI, single), "The image solves on one thread");
+    if(!ok)
+        return false;
+    //The threads take the work items in a different order every time, so the shared search is run a few times.
+    for(int run = 0; run < 3; run++)
+    {
+        const bool solved = check(solve(fileName, SSolver::MULTI_SHARED, shared), "The image solves with the shared search");
+        ok &= solved && check(sameSolution(single, shared), "The shared search finds the same solution");
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestSharedSearch>(argc, argv);
+}
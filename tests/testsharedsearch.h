@@ -0,0 +1,20 @@
+#ifndef TESTSHAREDSEARCH_H
+#define TESTSHAREDSEARCH_H
+
+#include "solvertest.h"
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+
+class TestSharedSearch : public SolverTest
+{
+public:
+    TestSharedSearch();
+    bool testSharedSearch(const QString &fileName);
+private:
+    bool solve(const QString &fileName, SSolver::MultiAlgo multiAlgorithm, FITSImage::Solution &solution);
+    static bool sameSolution(const FITSImage::Solution &solution1, const FITSImage::Solution &solution2);
+};
+
+#endif // TESTSHAREDSEARCH_H
@@ -0,0 +1,100 @@
+#include "testsimdfilter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
+//Includes for this project
+#include "stellarsolver.h"
+#include "sep/sep.h"
+#include "sep/extract.h"
+
+using namespace SEP;
+
+TestSimdFilter::TestSimdFilter()
+{
+    makeImage();
+
+    //The kernels StellarSolver makes have their own fast paths, and the image width is not a multiple of the vector width.
+    testFilter("default", StellarSolver::generateConvFilter(SSolver::CONV_DEFAULT, 2), false);
+    testFilter("gaussian", StellarSolver::generateConvFilter(SSolver::CONV_GAUSSIAN, 3.5), false);
+    testFilter("mexican hat", StellarSolver::generateConvFilter(SSolver::CONV_MEXICAN_HAT, 3.5), false);
+    testFilter("top hat", StellarSolver::generateConvFilter(SSolver::CONV_TOP_HAT, 3.5), false);
+    testFilter("ring", StellarSolver::generateConvFilter(SSolver::CONV_RING, 3.5), false);
+    testFilter("matched gaussian", StellarSolver::generateConvFilter(SSolver::CONV_GAUSSIAN, 3.5), true);
+    testFilter("matched ring", StellarSolver::generateConvFilter(SSolver::CONV_RING, 3.5), true);
+    sep_set_filter_simd(1);
+}
+
+//A noisy field of stars with a flat noise map, the same every time the test runs.
+void TestSimdFilter::makeImage()
+{
+    width = 517;
+    height = 389;
+    image.fill(0, width * height);
+    noise.fill(5, width * height);
+    std::mt19937 random(7);
+    std::normal_distribution<float> background(0, 5);
+    std::uniform_real_distribution<float> uniform(0, 1);
+    for(auto &pixel : image)
+        pixel = background(random);
+    for(int star = 0; star < 120; star++)
+    {
+        const float cx = uniform(random) * width, cy = uniform(random) * height;
+        const float flux = 100 + uniform(random) * 3000, sigma = 1 + uniform(random) * 1.5f;
+        for(int y = std::max(0, int(cy) - 12); y <= std::min(height - 1, int(cy) + 12); y++)
+            for(int x = std::max(0, int(cx) - 12); x <= std::min(width - 1, int(cx) + 12); x++)
+                image[y * width + x] += flux * std::exp(-((x - cx) * (x - cx) + (y - cy) * (y - cy)) / (2 * sigma * sigma));
+    }
+}
+
+//Extracting with the vector versions of the line filtering and with the plain loops should find the same objects.
+bool TestSimdFilter::testFilter(const char *name, const QVector<float> &filter, bool matched)
+{
+    QVector<float> conv = filter;
+    const int convSize = static_cast<int>(std::sqrt(conv.size()));
+    sep_catalog *catalogs[2] = {nullptr, nullptr};
+    int status[2];
+    for(int simd = 0; simd < 2; simd++)
+    {
+        sep_set_filter_simd(simd);
+        sep_image im = {};
+        im.data = image.data();
+        im.dtype = SEP_TFLOAT;
+        im.w = im.raw_w = width;
+        im.h = im.raw_h = height;
+        im.gain = 1.0;
+        if(matched)
+        {
+            im.noise = noise.data();
+            im.ndtype = SEP_TFLOAT;
+            im.noise_type = SEP_NOISE_STDDEV;
+        }
+        Extract extractor;
+        status[simd] = extractor.sep_extract(&im, matched ? 1.5 : 15, matched ? SEP_THRESH_REL : SEP_THRESH_ABS, 5,
+                                             conv.data(), convSize, convSize, matched ? SEP_FILTER_MATCHED : SEP_FILTER_CONV,
+                                             32, 0.005, 1, 1.0, &catalogs[simd]);
+    }
+
+    printf("Checking the %s filter\n", name);
+    bool ok = check(status[0] == 0 && status[1] == 0, "The image is extracted with and without the vector line filtering");
+    if(ok)
+    {
+        const sep_catalog *scalar = catalogs[0], *simd = catalogs[1];
+        ok &= check(scalar->nobj > 50 && scalar->nobj == simd->nobj, "Both find the same number of objects");
+        bool same = scalar->nobj == simd->nobj;
+        //The versions only differ by float rounding, which moves the filtered fluxes by far less than this.
+        for(int i = 0; same && i < scalar->nobj; i++)
+            same = std::fabs(scalar->x[i] - simd->x[i]) < 1e-3 && std::fabs(scalar->y[i] - simd->y[i]) < 1e-3
+                   && std::fabs(scalar->cflux[i] - simd->cflux[i]) <= 1e-4 * std::fabs(scalar->cflux[i]);
+        ok &= check(same, "Both find the objects in the same places with the same filtered fluxes");
+    }
+    Extract::sep_catalog_free(catalogs[0]);
+    Extract::sep_catalog_free(catalogs[1]);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestSimdFilter>(argc, argv);
+}
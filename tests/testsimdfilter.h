@@ -0,0 +1,20 @@
+#ifndef TESTSIMDFILTER_H
+#define TESTSIMDFILTER_H
+
+#include "solvertest.h"
+#include <QVector>
+
+class TestSimdFilter : public SolverTest
+{
+public:
+    TestSimdFilter();
+    bool testFilter(const char *name, const QVector<float> &filter, bool matched);
+private:
+    void makeImage();
+    int width;
+    int height;
+    QVector<float> image;
+    QVector<float> noise;
+};
+
+#endif // TESTSIMDFILTER_H
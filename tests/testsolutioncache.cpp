@@ -0,0 +1,147 @@
+#include "testsolutioncache.h"
+
+//Qt Includes
+#include <QFileInfo>
+
+#include <cmath>
+
+//Includes for this project
+#include "solutioncache.h"
+
+TestSolutionCache::TestSolutionCache()
+{
+    testSolutionCache();
+
+    FITSImage::Statistic stats;
+    uint8_t *imageBuffer = loadImageBuffer(stats, "pleiades.jpg");
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setProperty("ExtractorType", SSolver::EXTRACTOR_INTERNAL);
+    stellarSolver.setProperty("SolverType", SSolver::SOLVER_STELLARSOLVER);
+    stellarSolver.setProperty("ProcessType", SSolver::SOLVE);
+    stellarSolver.setParameterProfile(SSolver::Parameters::PARALLEL_SMALLSCALE);
+    stellarSolver.setIndexFolderPaths(QStringList() << "astrometry");
+    testSolutionCacheHit(stellarSolver);
+    delete[] imageBuffer;
+}
+
+//A field should miss before it is inserted, and then be found with its WCS moved to where the stars are now.
+bool TestSolutionCache::testSolutionCache()
+{
+    SolutionCache *cache = SolutionCache::instance();
+    cache->clear();
+
+    const int width = 1000, height = 800;
+    QList<FITSImage::Star> stars;
+    for(int i = 0; i < 10; i++)
+    {
+        FITSImage::Star star = {};
+        star.x = 100 + (i * 137) % 700;
+        star.y = 80 + (i * 211) % 600;
+        star.flux = 1000 - i * 50;
+        stars.append(star);
+    }
+    SolutionCache::Pose pose;
+    const QByteArray key = SolutionCache::fingerprint(FITSImage::StarCatalog(stars), width, height, &pose);
+    bool ok = check(!key.isEmpty(), "The stars have a fingerprint");
+
+    SolutionCache::Entry entry;
+    ok &= check(!cache->find(key, pose, entry), "A field that was never solved is not in the solution cache");
+
+    sip_t wcs = {};
+    wcs.wcstan.crval[0] = 56.75;
+    wcs.wcstan.crval[1] = 24.12;
+    wcs.wcstan.crpix[0] = 500;
+    wcs.wcstan.crpix[1] = 400;
+    wcs.wcstan.cd[0][0] = 0.001;
+    wcs.wcstan.cd[1][1] = 0.001;
+    wcs.wcstan.imagew = width;
+    wcs.wcstan.imageh = height;
+    wcs.a_order = wcs.b_order = 2;
+    cache->insert(key, pose, wcs, 4107, 0);
+
+    ok &= check(cache->find(key, pose, entry), "A solved field is found in the solution cache");
+    ok &= check(entry.indexid == 4107 && entry.wcs.wcstan.crval[0] == 56.75 && entry.wcs.wcstan.crpix[0] == 500
+                && entry.wcs.wcstan.crpix[1] == 400, "The cached solution is returned unchanged for the same stars");
+
+    //Moving the field changes where the stars are, but not the fingerprint, and the WCS should move with the stars.
+    QList<FITSImage::Star> moved = stars;
+    for(auto &star : moved)
+    {
+        star.x += 15;
+        star.y -= 7;
+    }
+    SolutionCache::Pose movedPose;
+    ok &= check(SolutionCache::fingerprint(FITSImage::StarCatalog(moved), width, height, &movedPose) == key,
+                "Moving the field keeps its fingerprint");
+    ok &= check(cache->find(key, movedPose, entry), "The moved field is found in the solution cache");
+    ok &= check(std::fabs(entry.wcs.wcstan.crpix[0] - 515) < 1e-3 && std::fabs(entry.wcs.wcstan.crpix[1] - 393) < 1e-3,
+                "The cached WCS is moved with the stars");
+    ok &= check(entry.wcs.a_order == 2, "A field that only moved keeps its SIP terms");
+
+    //Turning the field by a quarter turn should turn the WCS too, and drop the SIP terms that no longer fit it.
+    QList<FITSImage::Star> turned = stars;
+    for(auto &star : turned)
+    {
+        const float x = star.x;
+        star.x = 900 - star.y;
+        star.y = x;
+    }
+    SolutionCache::Pose turnedPose;
+    ok &= check(SolutionCache::fingerprint(FITSImage::StarCatalog(turned), width, height, &turnedPose) == key,
+                "Turning the field keeps its fingerprint");
+    ok &= check(cache->find(key, turnedPose, entry), "The turned field is found in the solution cache");
+    ok &= check(std::fabs(entry.wcs.wcstan.cd[0][0]) < 1e-9 && std::fabs(std::fabs(entry.wcs.wcstan.cd[0][1]) - 0.001) < 1e-9,
+                "The cached WCS is turned with the stars");
+    ok &= check(entry.wcs.a_order == 0 && entry.wcs.b_order == 0, "A turned field drops its SIP terms");
+
+    //Halving the distances between the stars, as with a lens of half the focal length, should double the sky each pixel covers.
+    QList<FITSImage::Star> scaled = stars;
+    for(auto &star : scaled)
+    {
+        star.x = 50 + star.x / 2;
+        star.y = 40 + star.y / 2;
+    }
+    SolutionCache::Pose scaledPose;
+    ok &= check(SolutionCache::fingerprint(FITSImage::StarCatalog(scaled), width, height, &scaledPose) == key,
+                "Scaling the field keeps its fingerprint");
+    ok &= check(cache->find(key, scaledPose, entry), "The scaled field is found in the solution cache");
+    ok &= check(std::fabs(entry.wcs.wcstan.crpix[0] - 300) < 1e-3 && std::fabs(entry.wcs.wcstan.crpix[1] - 240) < 1e-3,
+                "The cached WCS is moved with the scaled stars");
+    ok &= check(std::fabs(entry.wcs.wcstan.cd[0][0] - 0.002) < 1e-9 && std::fabs(entry.wcs.wcstan.cd[1][1] - 0.002) < 1e-9
+                && std::fabs(entry.wcs.wcstan.cd[0][1]) < 1e-9, "The cached WCS is scaled with the stars");
+    ok &= check(entry.wcs.a_order == 0 && entry.wcs.b_order == 0, "A scaled field drops its SIP terms");
+
+    ok &= check(cache->save() && QFileInfo::exists(SolutionCache::cachePath()), "The solution cache is saved to its file");
+    cache->clear();
+    ok &= check(!cache->find(key, pose, entry), "Clearing the solution cache forgets the field");
+    ok &= check(!QFileInfo::exists(SolutionCache::cachePath()), "Clearing the solution cache removes its file");
+    return ok;
+}
+
+//Solving the same image twice with the solution cache on should solve it from the cache the second time.
+bool TestSolutionCache::testSolutionCacheHit(StellarSolver &stellarSolver)
+{
+    SSolver::Parameters params = stellarSolver.getCurrentParameters();
+    params.useSolutionCache = true;
+    stellarSolver.setParameters(params);
+
+    printf("Starting to solve with the solution cache. . .\n");
+    fflush( stdout );
+    bool ok = check(stellarSolver.solve(), "The image solves with the solution cache on");
+    const int hits = StellarSolver::getSolutionCacheHits();
+    const FITSImage::Solution searched = stellarSolver.getSolution();
+    ok &= check(stellarSolver.solve(), "The image solves again with the solution cache on");
+    ok &= check(StellarSolver::getSolutionCacheHits() == hits + 1, "The second solve is solved from the solution cache");
+    const FITSImage::Solution cached = stellarSolver.getSolution();
+    const double tolerance = searched.pixscale / 3600.0;
+    ok &= check(std::fabs(cached.dec - searched.dec) < tolerance && std::fabs(std::remainder(cached.ra - searched.ra, 360.0)) < 2 * tolerance
+                && std::fabs(cached.pixscale - searched.pixscale) < 1e-3 * searched.pixscale && cached.parity == searched.parity,
+                "The cached solution is the one the search found");
+    StellarSolver::clearSolutionCache();
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestSolutionCache>(argc, argv);
+}
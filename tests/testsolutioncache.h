@@ -0,0 +1,18 @@
+#ifndef TESTSOLUTIONCACHE_H
+#define TESTSOLUTIONCACHE_H
+
+#include "solvertest.h"
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+
+class TestSolutionCache : public SolverTest
+{
+public:
+    TestSolutionCache();
+    bool testSolutionCache();
+    bool testSolutionCacheHit(StellarSolver &stellarSolver);
+};
+
+#endif // TESTSOLUTIONCACHE_H
@@ -0,0 +1,49 @@
+#include "testsolvewithin.h"
+
+#include <chrono>
+
+TestSolveWithin::TestSolveWithin()
+{
+    FITSImage::Statistic stats;
+    uint8_t *imageBuffer = loadImageBuffer(stats, "pleiades.jpg");
+    StellarSolver stellarSolver(stats, imageBuffer, nullptr);
+    stellarSolver.setProperty("ExtractorType", SSolver::EXTRACTOR_INTERNAL);
+    stellarSolver.setProperty("SolverType", SSolver::SOLVER_STELLARSOLVER);
+    stellarSolver.setProperty("ProcessType", SSolver::SOLVE);
+    stellarSolver.setParameterProfile(SSolver::Parameters::PARALLEL_SMALLSCALE);
+    stellarSolver.setIndexFolderPaths(QStringList() << "astrometry");
+    testSolveWithin(stellarSolver);
+    delete[] imageBuffer;
+}
+
+//A budget that is far too small should give up soon after it runs out, and a budget that can't be exceeded should solve.
+bool TestSolveWithin::testSolveWithin(StellarSolver &stellarSolver)
+{
+    using namespace std::chrono;
+    // The extraction and the solvers only stop between tiles, image lines and quads, so they get a little longer than the budget.
+    const milliseconds allowance(500);
+
+    printf("Starting to solve within 1 ms. . .\n");
+    fflush( stdout );
+    auto start = steady_clock::now();
+    bool ok = check(!stellarSolver.solveWithin(milliseconds(1)), "A solve with a 1 ms budget gives up");
+    ok &= check(steady_clock::now() - start < milliseconds(1) + allowance, "A solve with a 1 ms budget stops in time");
+    ok &= check(!stellarSolver.hasWCSData(), "A solve that gave up has no WCS data");
+
+    printf("Starting to solve within 100 ms. . .\n");
+    fflush( stdout );
+    start = steady_clock::now();
+    stellarSolver.solveWithin(milliseconds(100));
+    ok &= check(steady_clock::now() - start < milliseconds(100) + allowance, "A solve with a 100 ms budget stops in time");
+
+    printf("Starting to solve without a real time limit. . .\n");
+    fflush( stdout );
+    ok &= check(stellarSolver.solveWithin(milliseconds::max()), "A solve with the largest budget solves the image");
+    ok &= check(stellarSolver.hasWCSData(), "The solved image has WCS data");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    return runSolverTest<TestSolveWithin>(argc, argv);
+}
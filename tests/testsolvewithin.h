@@ -0,0 +1,17 @@
+#ifndef TESTSOLVEWITHIN_H
+#define TESTSOLVEWITHIN_H
+
+#include "solvertest.h"
+
+//Includes for this project
+#include "structuredefinitions.h"
+#include "stellarsolver.h"
+
+class TestSolveWithin : public SolverTest
+{
+public:
+    TestSolveWithin();
+    bool testSolveWithin(StellarSolver &stellarSolver);
+};
+
+#endif // TESTSOLVEWITHIN_H